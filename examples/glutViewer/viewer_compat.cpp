@@ -296,6 +296,7 @@ int g_level = 2;
 int g_exact = 0;
 int g_kernel = OpenSubdiv::OsdKernelDispatcher::kCPU;
 float g_moveScale = 1.0f;
+float g_approxError = 0.0f;
 
 GLuint g_indexBuffer;
 
@@ -513,6 +514,14 @@ const char *getKernelName(int kernel) {
         return "CustomGPU";
     else if (kernel == OpenSubdiv::OsdKernelDispatcher::kHYB)
         return "CustomHYB";
+    else if (kernel == OpenSubdiv::OsdKernelDispatcher::kHCPU)
+        return "HostHYB";
+    else if (kernel == OpenSubdiv::OsdKernelDispatcher::kMKL64)
+        return "MKL64";
+    else if (kernel == OpenSubdiv::OsdKernelDispatcher::kPCPU)
+        return "HostPanel";
+    else if (kernel == OpenSubdiv::OsdKernelDispatcher::kAUTO)
+        return "Auto";
     return "Unknown";
 }
 
@@ -655,6 +664,8 @@ createOsdMesh( const char * shape, int level, int kernel, Scheme scheme, int exa
     if (g_osdmesh) delete g_osdmesh;
     g_osdmesh = new OpenSubdiv::OsdMesh();
     g_osdmesh->Create(hmesh, level, kernel, exact);
+    if (not g_osdmesh->SetMaxApproximationError(g_approxError))
+        printf("Kernel %d can't approximate the subdivision matrix, keeping it exact\n", kernel);
     if (g_vertexBuffer) {
         delete g_vertexBuffer;
         g_vertexBuffer = NULL;
@@ -926,6 +937,27 @@ levelMenu(int l) {
 
     g_level = l;
 
+#if !REGRESSION
+    // the mesh keeps the tables and operators of the levels it went through,
+    // so only levels deeper than any shown so far cost a rebuild
+    int numVertices = g_osdmesh ? g_osdmesh->GetTotalVertices() : 0;
+    if (g_osdmesh and g_osdmesh->SetLevel(g_level)) {
+        if (g_osdmesh->GetTotalVertices() != numVertices) {
+            delete g_vertexBuffer;
+            g_vertexBuffer = NULL;
+        }
+
+        const std::vector<int> &indices = g_osdmesh->GetFarMesh()->GetFaceVertices(g_level);
+
+        g_numIndices = indices.size();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*g_numIndices, &(indices[0]), GL_STATIC_DRAW);
+
+        updateGeom();
+        return;
+    }
+#endif
+
     createOsdMesh( g_defaultShapes[g_currentShape].data, g_level, g_kernel, g_defaultShapes[ g_currentShape ].scheme, g_exact );
 }
 
@@ -960,7 +992,7 @@ keyboard(unsigned char key, int x, int y) {
         case 'l': exactMenu((g_exact+1)%2); break;
         case 'n': modelMenu(++g_currentShape); break;
         case 'p': modelMenu(--g_currentShape); break;
-	case 'r': g_reorder = (g_reorder+1)%2; levelMenu(g_level); break;
+	case 'r': g_reorder = (g_reorder+1)%2; modelMenu(g_currentShape); break;
         case 0x1b: g_drawHUD = (g_drawHUD+1)%2; break;
     }
 }
@@ -1126,6 +1158,8 @@ int main(int argc, char ** argv) {
             g_reorder = 1;
         else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--divide"))
             g_HybridSplitParam = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--approx"))
+            g_approxError = (float) atof(argv[++i]);
 #ifdef OPENSUBDIV_HAS_MKL
         else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--spy"))
             osdSpMVKernel_DumpSpy_FileName = argv[++i];
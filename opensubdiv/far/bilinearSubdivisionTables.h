@@ -79,12 +79,14 @@ template <class U> class FarBilinearSubdivisionTables : public FarSubdivisionTab
 public:
 
     /// Memory required to store the indexing tables
-    virtual int GetMemoryUsed() const;
+    virtual size_t GetMemoryUsed() const;
 
     /// Compute the positions of refined vertices using the specified kernels
-    virtual void Apply( int level, void * data=0 ) const;
-    virtual void PushToLimitSurface( int level, void * data=0 ) const;
-    virtual void PushLimitMatrix(int nverts, int offset) { /* no-op */ };
+    using FarSubdivisionTables<U>::Apply;
+    virtual void Apply( int level, FarDispatcher<U> * dispatch, void * data=0 ) const;
+    using FarSubdivisionTables<U>::PushToLimitSurface;
+    virtual void PushToLimitSurface( int level, FarDispatcher<U> * dispatch, void * data=0 );
+    virtual void PushLimitMatrix( int nverts, int offset, FarDispatcher<U> * dispatch ) { /* no-op */ };
 
     /// Face-vertices indexing table accessor
     FarTable<unsigned int> const & Get_F_IT( ) const { return _F_IT; }
@@ -98,6 +100,8 @@ public:
 
 private:
     template <class X, class Y> friend struct FarBilinearSubdivisionTablesFactory;
+    template <class X> friend class FarTopologyRefiner;
+    friend class FarMesh<U>;
     friend class FarDispatcher<U>;
 
     FarBilinearSubdivisionTables( FarMesh<U> * mesh, int maxlevel );
@@ -124,7 +128,7 @@ FarBilinearSubdivisionTables<U>::FarBilinearSubdivisionTables( FarMesh<U> * mesh
     _F_IT(maxlevel+1)
 { }
 
-template <class U> int
+template <class U> size_t
 FarBilinearSubdivisionTables<U>::GetMemoryUsed() const {
     return FarSubdivisionTables<U>::GetMemoryUsed()+
         _F_ITa.GetMemoryUsed()+
@@ -132,18 +136,17 @@ FarBilinearSubdivisionTables<U>::GetMemoryUsed() const {
 }
 
 template <class U> void
-FarBilinearSubdivisionTables<U>::PushToLimitSurface( int level, void * clientdata ) const {
+FarBilinearSubdivisionTables<U>::PushToLimitSurface( int level, FarDispatcher<U> * dispatch, void * clientdata ) {
     /* do nothing */
 }
 
 template <class U> void
-FarBilinearSubdivisionTables<U>::Apply( int level, void * clientdata ) const {
+FarBilinearSubdivisionTables<U>::Apply( int level, FarDispatcher<U> * dispatch, void * clientdata ) const {
 
     assert(this->_mesh and level>0);
 
     typename FarSubdivisionTables<U>::VertexKernelBatch const * batch = & (this->_batches[level-1]);
 
-    FarDispatcher<U> * dispatch = this->_mesh->GetDispatcher();
     assert(dispatch);
 
     int prevLevel = std::max(level-1,0);
@@ -110,8 +110,12 @@ FarBilinearSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fa
         int offset = 0;
         int * F_ITa = result->_F_ITa[level-1];
         unsigned int * F_IT = result->_F_IT[level-1];
-        batch->kernelF = (int)factory->_faceVertsList[level].size();
-        for (int i=0; i < batch->kernelF; ++i) {
+        int nfaceverts = (int)factory->_faceVertsList[level].size();
+        batch->kernelF = nfaceverts;
+
+        // the valences are scanned into offsets before the indices are filled
+#pragma omp parallel for
+        for (int i=0; i < nfaceverts; ++i) {
 
             HbrVertex<T> * v = factory->_faceVertsList[level][i];
             assert(v);
@@ -119,13 +123,21 @@ FarBilinearSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fa
             HbrFace<T> * f=v->GetParentFace();
             assert(f);
 
-            int valence = f->GetNumVertices();
+            F_ITa[2*i+1] = f->GetNumVertices();
+        }
 
+        for (int i=0; i < nfaceverts; ++i) {
             F_ITa[2*i+0] = offset;
-            F_ITa[2*i+1] = valence;
+            offset += F_ITa[2*i+1];
+        }
+
+#pragma omp parallel for
+        for (int i=0; i < nfaceverts; ++i) {
+
+            HbrFace<T> * f=factory->_faceVertsList[level][i]->GetParentFace();
 
-            for (int j=0; j<valence; ++j)
-                F_IT[offset++] = remap[f->GetVertex(j)->GetID()];
+            for (int j=0; j<F_ITa[2*i+1]; ++j)
+                F_IT[F_ITa[2*i+0]+j] = remap[f->GetVertex(j)->GetID()];
         }
         result->_F_ITa.SetMarker(level, &F_ITa[2*batch->kernelF]);
         result->_F_IT.SetMarker(level, &F_IT[offset]);
@@ -134,8 +146,10 @@ FarBilinearSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fa
 
         // "Average the end-points of the parent edge"
         int * E_IT = result->_E_IT[level-1];
-        batch->kernelE = (int)factory->_edgeVertsList[level].size();
-        for (int i=0; i < batch->kernelE; ++i) {
+        int nedgeverts = (int)factory->_edgeVertsList[level].size();
+        batch->kernelE = nedgeverts;
+#pragma omp parallel for
+        for (int i=0; i < nedgeverts; ++i) {
 
             HbrVertex<T> * v = factory->_edgeVertsList[level][i];
             assert(v);
@@ -152,11 +166,12 @@ FarBilinearSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fa
         // Vertex vertices
 
         // "Pass down the parent vertex"
-        offset = 0;
         int * V_ITa = result->_V_ITa[level-1];
+        int nverts = (int)factory->_vertVertsList[level].size();
         batch->kernelB.first = 0;
-        batch->kernelB.second = (int)factory->_vertVertsList[level].size();
-        for (int i=0; i < batch->kernelB.second; ++i) {
+        batch->kernelB.second = nverts;
+#pragma omp parallel for
+        for (int i=0; i < nverts; ++i) {
 
             HbrVertex<T> * v = factory->_vertVertsList[level][i],
                          * pv = v->GetParentVertex();
@@ -64,6 +64,8 @@
 
 #include "../version.h"
 
+#include "../hbr/catmark.h"
+
 #include "../far/subdivisionTables.h"
 
 namespace OpenSubdiv {
@@ -81,11 +83,12 @@ template <class U> class FarCatmarkSubdivisionTables : public FarSubdivisionTabl
 public:
 
     /// Memory required to store the indexing tables
-    virtual int GetMemoryUsed() const;
+    virtual size_t GetMemoryUsed() const;
 
     /// Compute the positions of refined vertices using the specified kernels
-    virtual void Apply( int level, void * data=0 ) const;
-    virtual void PushLimitMatrix(int nverts, int offset);
+    using FarSubdivisionTables<U>::Apply;
+    virtual void Apply( int level, FarDispatcher<U> * dispatch, void * data=0 ) const;
+    virtual void PushLimitMatrix( int nverts, int offset, FarDispatcher<U> * dispatch );
 
     /// Face-vertices indexing table accessor
     FarTable<unsigned int> const & Get_F_IT( ) const { return _F_IT; }
@@ -99,6 +102,8 @@ public:
 
 private:
     template <class X, class Y> friend struct FarCatmarkSubdivisionTablesFactory;
+    template <class X> friend class FarTopologyRefiner;
+    friend class FarMesh<U>;
     friend class FarDispatcher<U>;
 
     // Private constructor called by factory
@@ -132,7 +137,7 @@ FarCatmarkSubdivisionTables<U>::FarCatmarkSubdivisionTables( FarMesh<U> * mesh,
     _F_IT(maxlevel+1)
 { }
 
-template <class U> int
+template <class U> size_t
 FarCatmarkSubdivisionTables<U>::GetMemoryUsed() const {
     return FarSubdivisionTables<U>::GetMemoryUsed()+
         _F_ITa.GetMemoryUsed()+
@@ -140,13 +145,12 @@ FarCatmarkSubdivisionTables<U>::GetMemoryUsed() const {
 }
 
 template <class U> void
-FarCatmarkSubdivisionTables<U>::Apply( int level, void * clientdata ) const {
+FarCatmarkSubdivisionTables<U>::Apply( int level, FarDispatcher<U> * dispatch, void * clientdata ) const {
 
     assert(this->_mesh and level>0);
 
     typename FarSubdivisionTables<U>::VertexKernelBatch const * batch = & (this->_batches[level-1]);
 
-    FarDispatcher<U> * dispatch = this->_mesh->GetDispatcher();
     assert(dispatch);
 
     int prevLevel = std::max(level-1,0);
@@ -155,19 +159,27 @@ FarCatmarkSubdivisionTables<U>::Apply( int level, void * clientdata ) const {
     int jop = this->GetNumVertices(prevLevel);
     int iop = this->GetNumVertices(prevLevel) + batch->kernelF;
 
-    dispatch->SetSrcOffset(prevOffset);
-    dispatch->SetDstOffset(prevOffset);
+    // matrix dispatchers stage the face points and the vertices reading
+    // them in two matrices, unless they can substitute the face points
+    // into the edge and vertex stencils, which stages a single matrix
+    // of the previous level vertices
+    bool singleStage = dispatch->SupportsSingleStageLevels();
 
-    dispatch->StageMatrix(iop, jop);
-    {
-        dispatch->CopyNVerts(jop, prevOffset);
+    if (not singleStage) {
+        dispatch->SetSrcOffset(prevOffset);
+        dispatch->SetDstOffset(prevOffset);
 
-        if (batch->kernelF>0)
-            dispatch->ApplyCatmarkFaceVerticesKernel(this->_mesh, offset, level, 0, batch->kernelF, clientdata);
-    }
-    dispatch->PushMatrix();
+        dispatch->StageMatrix(iop, jop);
+        {
+            dispatch->CopyNVerts(jop, prevOffset);
+
+            if (batch->kernelF>0)
+                dispatch->ApplyCatmarkFaceVerticesKernel(this->_mesh, offset, level, 0, batch->kernelF, clientdata);
+        }
+        dispatch->PushMatrix();
 
-    jop = this->GetNumVertices(prevLevel) + batch->kernelF;
+        jop = this->GetNumVertices(prevLevel) + batch->kernelF;
+    }
     iop = this->GetNumVertices(level);
 
     dispatch->SetSrcOffset(prevOffset);
@@ -175,7 +187,10 @@ FarCatmarkSubdivisionTables<U>::Apply( int level, void * clientdata ) const {
 
     dispatch->StageMatrix(iop,jop);
     {
-        dispatch->CopyNVerts(batch->kernelF, offset);
+        if (not singleStage)
+            dispatch->CopyNVerts(batch->kernelF, offset);
+        else if (batch->kernelF>0)
+            dispatch->ApplyCatmarkFaceVerticesKernel(this->_mesh, offset, level, 0, batch->kernelF, clientdata);
 
         offset += this->GetNumFaceVertices(level);
         if (batch->kernelE>0)
@@ -353,10 +368,12 @@ FarCatmarkSubdivisionTables<U>::computeVertexPointsB( int offset, int level, int
 }
 
 template <class U> void
-FarCatmarkSubdivisionTables<U>::PushLimitMatrix( int nverts, int offset ) {
+FarCatmarkSubdivisionTables<U>::PushLimitMatrix( int nverts, int offset, FarDispatcher<U> * dispatch ) {
 
-    assert(this->_mesh);
-    FarDispatcher<U> * dispatch = this->_mesh->GetDispatcher();
+    assert(this->_mesh and dispatch);
+
+    // rules of the local refinements of the semi-sharp vertices
+    HbrCatmarkSubdivision<FarLimitStencilVertex> subdivision;
 
     dispatch->StageMatrix(nverts, nverts);
     {
@@ -364,34 +381,49 @@ FarCatmarkSubdivisionTables<U>::PushLimitMatrix( int nverts, int offset ) {
             /* Get Hbr handle */
             HbrVertex<U> *vertex = this->_mesh->GetHbrVertex(offset + vi);
 
-            // TODO handle models with boundaries
-            if (!vertex->OnBoundary()) {
+            // Semi-sharp features and darts are refined locally until they
+            // reach a stationary ring
+            if (not this->hasClosedFormLimit(vertex)) {
+                if (HbrCatmarkSubdivision<U> * catmark =
+                        dynamic_cast<HbrCatmarkSubdivision<U> *>(vertex->GetMesh()->GetSubdivision()))
+                    subdivision.SetTriangleSubdivisionMethod(
+                        (typename HbrCatmarkSubdivision<FarLimitStencilVertex>::TriangleSubdivision)
+                            catmark->GetTriangleSubdivisionMethod());
+                this->pushRefinedLimitStencil(dispatch, &subdivision, vertex, vi, offset);
+                continue;
+            }
+
+            // Creases and corners
+            if (this->pushSharpLimitStencil(dispatch, vertex, vertex->GetMask(false), vi, offset))
+                continue;
 
-                // Push to limit surface via stencil from Halstead '93.
-                int valence = vertex->GetValence();
-                double n = (double) valence;
-                double normalizer = n * (n + 5.0);
-                HbrHalfedge<U> *edge = vertex->GetIncidentEdge();
+            if (vertex->OnBoundary()) {
+                // Smooth boundaries (no boundary interpolation) have no
+                // limit - just copy location
+                dispatch->StageElem(vi, vi, 1.0f);
+                continue;
+            }
 
-                // Target point
-                dispatch->StageElem(vi, vi, n * n / normalizer);
+            // Push to limit surface via stencil from Halstead '93.
+            int valence = vertex->GetValence();
+            double n = (double) valence;
+            double normalizer = n * (n + 5.0);
+            HbrHalfedge<U> *edge = vertex->GetIncidentEdge();
 
-                // Points in neighborhood
-                for (int i = 0; i < valence; i++) {
-                    HbrVertex<U> *adjacent = edge->GetDestVertex(),
-                                 *opposite = edge->GetNext()->GetDestVertex();
-                    int adjacent_idx = this->_mesh->GetFarVertexID(adjacent) - offset,
-                        opposite_idx = this->_mesh->GetFarVertexID(opposite) - offset;
+            // Target point
+            dispatch->StageElem(vi, vi, n * n / normalizer);
 
-                    dispatch->StageElem(vi, adjacent_idx, 4.0 / normalizer );
-                    dispatch->StageElem(vi, opposite_idx, 1.0 / normalizer );
+            // Points in neighborhood
+            for (int i = 0; i < valence; i++) {
+                HbrVertex<U> *adjacent = edge->GetDestVertex(),
+                             *opposite = edge->GetNext()->GetDestVertex();
+                int adjacent_idx = this->_mesh->GetFarVertexID(adjacent) - offset,
+                    opposite_idx = this->_mesh->GetFarVertexID(opposite) - offset;
 
-                    edge = edge->GetOpposite()->GetNext();
-                }
+                dispatch->StageElem(vi, adjacent_idx, 4.0 / normalizer );
+                dispatch->StageElem(vi, opposite_idx, 1.0 / normalizer );
 
-            } else {
-                // No limit - just copy location
-                dispatch->StageElem(vi, vi, 1.0f);
+                edge = edge->GetOpposite()->GetNext();
             }
         }
     }
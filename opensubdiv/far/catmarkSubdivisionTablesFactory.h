@@ -113,8 +113,12 @@ FarCatmarkSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fac
         int offset = 0;
         int * F_ITa = result->_F_ITa[level-1];
         unsigned int * F_IT = result->_F_IT[level-1];
-        batch->kernelF = (int)factory->_faceVertsList[level].size();
-        for (int i=0; i < batch->kernelF; ++i) {
+        int nfaceverts = (int)factory->_faceVertsList[level].size();
+        batch->kernelF = nfaceverts;
+
+        // the valences are scanned into offsets before the indices are filled
+#pragma omp parallel for
+        for (int i=0; i < nfaceverts; ++i) {
 
             HbrVertex<T> * v = factory->_faceVertsList[level][i];
             assert(v);
@@ -122,13 +126,21 @@ FarCatmarkSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fac
             HbrFace<T> * f=v->GetParentFace();
             assert(f);
 
-            int valence = f->GetNumVertices();
+            F_ITa[2*i+1] = f->GetNumVertices();
+        }
 
+        for (int i=0; i < nfaceverts; ++i) {
             F_ITa[2*i+0] = offset;
-            F_ITa[2*i+1] = valence;
+            offset += F_ITa[2*i+1];
+        }
+
+#pragma omp parallel for
+        for (int i=0; i < nfaceverts; ++i) {
 
-            for (int j=0; j<valence; ++j)
-                F_IT[offset++] = remap[f->GetVertex(j)->GetID()];
+            HbrFace<T> * f=factory->_faceVertsList[level][i]->GetParentFace();
+
+            for (int j=0; j<F_ITa[2*i+1]; ++j)
+                F_IT[F_ITa[2*i+0]+j] = remap[f->GetVertex(j)->GetID()];
         }
         result->_F_ITa.SetMarker(level, &F_ITa[2*batch->kernelF]);
         result->_F_IT.SetMarker(level, &F_IT[offset]);
@@ -145,8 +157,10 @@ FarCatmarkSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fac
         // Adjust if edge has a crease or is on a boundary."
         int * E_IT = result->_E_IT[level-1];
         float * E_W = result->_E_W[level-1];
-        batch->kernelE = (int)factory->_edgeVertsList[level].size();
-        for (int i=0; i < batch->kernelE; ++i) {
+        int nedgeverts = (int)factory->_edgeVertsList[level].size();
+        batch->kernelE = nedgeverts;
+#pragma omp parallel for
+        for (int i=0; i < nedgeverts; ++i) {
 
             HbrVertex<T> * v = factory->_edgeVertsList[level][i];
             assert(v);
@@ -194,11 +208,53 @@ FarCatmarkSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fac
 
         batch->InitVertexKernels( (int)factory->_vertVertsList[level].size(), 0 );
 
-        offset = 0;
         int * V_ITa = result->_V_ITa[level-1];
         unsigned int * V_IT = result->_V_IT[level-1];
         float * V_W = result->_V_W[level-1];
         int nverts = (int)factory->_vertVertsList[level].size();
+
+        // First, count the indices gathered by the k_Smooth and k_Dart passes
+        // of each vertex, and rank the vertices into the kernel batches.
+        std::vector<int> ranks(nverts);
+#pragma omp parallel for
+        for (int i=0; i < nverts; ++i) {
+
+            HbrVertex<T> * pv = factory->_vertVertsList[level][i]->GetParentVertex();
+
+            int masks[2];
+            masks[0] = pv->GetMask(false);
+            masks[1] = pv->GetMask(true);
+
+            int npasses = (masks[0] != masks[1] and (
+                not (masks[0]==HbrVertex<T>::k_Smooth and
+                     masks[1]==HbrVertex<T>::k_Dart))) ? 2 : 1;
+
+            int count = 0;
+            for (int p=0; p<npasses; ++p)
+                if (masks[p]==HbrVertex<T>::k_Smooth or masks[p]==HbrVertex<T>::k_Dart) {
+                    HbrHalfedge<T> *e = pv->GetIncidentEdge(),
+                                   *start = e;
+                    while (e) {
+                        count += 2;
+                        e = e->GetPrev()->GetOpposite();
+                        if (e==start) break;
+                    }
+                }
+
+            V_ITa[5*i+0] = count;
+            ranks[i] = result->getMaskRanking(masks[0], masks[1]);
+        }
+
+        offset = 0;
+        for (int i=0; i < nverts; ++i) {
+            int count = V_ITa[5*i+0];
+            V_ITa[5*i+0] = offset;
+            offset += count;
+
+            batch->AddVertex( i, ranks[i] );
+        }
+
+#pragma omp parallel for
         for (int i=0; i < nverts; ++i) {
 
             HbrVertex<T> * v = factory->_vertVertsList[level][i],
@@ -229,9 +285,9 @@ FarCatmarkSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fac
                 npasses = 1;
             }
 
-            int rank = result->getMaskRanking(masks[0], masks[1]);
+            int rank = ranks[i],
+                offset = V_ITa[5*i+0];
 
-            V_ITa[5*i+0] = offset;
             V_ITa[5*i+1] = 0;
             V_ITa[5*i+2] = remap[ pv->GetID() ];
             V_ITa[5*i+3] = -1;
@@ -300,8 +356,6 @@ FarCatmarkSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * fac
                 V_W[i] = 0.0;
             else
                 V_W[i] = weights[0];
-
-            batch->AddVertex( i, rank );
         }
         result->_V_ITa.SetMarker(level, &V_ITa[5*nverts]);
         result->_V_IT.SetMarker(level, &V_IT[offset]);
@@ -87,6 +87,7 @@ template <class U> class FarDispatcher {
 
 protected:
     template <class X, class Y> friend class FarMeshFactory;
+    template <class X> friend class FarTopologyRefiner;
     friend class FarBilinearSubdivisionTables<U>;
     friend class FarCatmarkSubdivisionTables<U>;
     friend class FarLoopSubdivisionTables<U>;
@@ -124,6 +125,7 @@ protected:
 public:
     virtual void StageMatrix(int i, int j) { };
     virtual void StageElem(int i, int j, float value) { };
+    virtual void StageVaryingElem(int i, int j, float value) { };
     virtual void PushMatrix() { };
     virtual void FinalizeMatrix() { };
     virtual void ApplyMatrix(int offset) { };
@@ -131,8 +133,22 @@ public:
     void SetSrcOffset(int srcOffset) { this->srcOffset = srcOffset; };
     void SetDstOffset(int dstOffset) { this->dstOffset = dstOffset; };
     virtual int CopyNVerts(int nVerts, int index) { return 0; };
+    // true if references to rows of the staged matrix itself are resolved while staging,
+    // so that a Catmark level is staged as a single matrix (see FarCatmarkSubdivisionTables)
+    virtual bool SupportsSingleStageLevels() { return false; }
     virtual bool MatrixReady() { return false; }
     virtual void PrintReport() { }
+    // false if the kernel can't approximate and maxError > 0
+    virtual bool SetMaxApproximationError(float maxError) { return maxError <= 0.0f; }
+    virtual float GetApproximationError() const { return 0.0f; }
+    virtual long long GetApproximationSavings() const { return 0; }
+    virtual long long GetNumNonzeros() const { return 0; }
+    // false if the kernel can't output the levels of levelMask; the table
+    // kernels write every level anyway
+    virtual bool SetOutputLevels(int levelMask) { return true; }
+    virtual void MarkLevel(int level) { };
+    virtual int SelectLevel(int level) { return 1; }
+    virtual void EndLevel(int level) { };
 
     virtual int GetElemsPerVertex() const { return -1; }
     virtual int GetElemsPerVarying() const { return -1; }
@@ -0,0 +1,216 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#ifndef FAR_FVAR_TABLES_H
+#define FAR_FVAR_TABLES_H
+
+#include <assert.h>
+#include <vector>
+
+#include "../version.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+template <class U> class FarMesh;
+
+/// \brief Face-varying interpolation operators.
+///
+/// Face-varying data is not attached to vertices but to face corners, so it
+/// cannot ride along with the vertex subdivision tables : each datum is
+/// refined with its own boundary rules (see HbrMesh::SetFVarInterpolateBoundaryMethod)
+/// and may be discontinuous across face-varying sharp edges.
+///
+/// FarFVarTables stores, for each face-varying channel (an Hbr fvar "item"),
+/// a sparse operator that maps the face corners of the coarse mesh to the face
+/// corners of the faces at the maximum level of subdivision.
+///
+/// Coarse values are ordered by coarse face, then by corner, in the order the
+/// faces were added to the HbrMesh. Refined values follow the quads returned
+/// by FarMesh::GetFaceVertices(maxlevel), 4 corners per face. Each value holds
+/// GetTotalWidth() interleaved floats, with channel 'c' stored at offset
+/// GetChannelOffset(c).
+///
+template <class U> class FarFVarTables {
+public:
+    FarFVarTables( FarMesh<U> * mesh, int maxlevel );
+
+    /// Returns the number of face-varying channels
+    int GetNumChannels() const { return (int)_channels.size(); }
+
+    /// Returns the number of floats in channel 'channel'
+    int GetChannelWidth(int channel) const { return _channels[channel].width; }
+
+    /// Returns the offset of channel 'channel' within an interleaved value
+    int GetChannelOffset(int channel) const { return _channels[channel].offset; }
+
+    /// Returns the number of floats in an interleaved value
+    int GetTotalWidth() const { return _totalWidth; }
+
+    /// Returns the number of coarse face corners
+    int GetNumCoarseValues() const { return _numCoarseValues; }
+
+    /// Returns the number of face corners at the maximum level of subdivision
+    int GetNumRefinedValues() const { return _numRefinedValues; }
+
+    /// Returns the level of subdivision the operators refine to
+    int GetMaxLevel() const { return _maxlevel; }
+
+    /// Returns the row offsets of the operator of channel 'channel'
+    /// (GetNumRefinedValues()+1 entries, zero-based)
+    std::vector<int> const & GetRowOffsets(int channel) const { return _channels[channel].offsets; }
+
+    /// Returns the coarse face corner indices of the operator of channel 'channel'
+    std::vector<int> const & GetColumns(int channel) const { return _channels[channel].columns; }
+
+    /// Returns the weights of the operator of channel 'channel'
+    std::vector<float> const & GetWeights(int channel) const { return _channels[channel].weights; }
+
+    /// Refines all the channels of the interleaved face-varying data 'coarse'
+    /// (GetNumCoarseValues() values) into 'refined' (GetNumRefinedValues() values)
+    void Apply(float const * coarse, float * refined) const;
+
+    /// Refines a single channel of the interleaved face-varying data
+    void Apply(int channel, float const * coarse, float * refined) const;
+
+    /// Returns the amount of memory used by the operators
+    size_t GetMemoryUsed() const;
+
+private:
+    template <class X, class Y> friend struct FarFVarTablesFactory;
+    friend class FarMesh<U>;
+
+    // A CSR operator for one face-varying channel
+    struct Channel {
+        int width,
+            offset;
+
+        std::vector<int>   offsets;  // row offsets (one row per refined face corner)
+        std::vector<int>   columns;  // coarse face corner indices
+        std::vector<float> weights;
+    };
+
+    // mesh that owns this fvarTable
+    FarMesh<U> * _mesh;
+
+    int _maxlevel,
+        _totalWidth,
+        _numCoarseValues,
+        _numRefinedValues;
+
+    std::vector<Channel> _channels;
+};
+
+template <class U>
+FarFVarTables<U>::FarFVarTables( FarMesh<U> * mesh, int maxlevel ) :
+    _mesh(mesh),
+    _maxlevel(maxlevel),
+    _totalWidth(0),
+    _numCoarseValues(0),
+    _numRefinedValues(0)
+{ }
+
+template <class U> void
+FarFVarTables<U>::Apply(float const * coarse, float * refined) const {
+
+    for (int c=0; c<GetNumChannels(); ++c)
+        Apply(c, coarse, refined);
+}
+
+template <class U> void
+FarFVarTables<U>::Apply(int channel, float const * coarse, float * refined) const {
+
+    assert( coarse and refined and channel>=0 and channel<GetNumChannels() );
+
+    Channel const & ch = _channels[channel];
+
+    for (int i=0; i<_numRefinedValues; ++i) {
+
+        float * dst = refined + i*_totalWidth + ch.offset;
+
+        for (int k=0; k<ch.width; ++k)
+            dst[k] = 0.0f;
+
+        for (int j=ch.offsets[i]; j<ch.offsets[i+1]; ++j) {
+
+            float const * src = coarse + ch.columns[j]*_totalWidth + ch.offset;
+            float weight = ch.weights[j];
+
+            for (int k=0; k<ch.width; ++k)
+                dst[k] += weight * src[k];
+        }
+    }
+}
+
+template <class U> size_t
+FarFVarTables<U>::GetMemoryUsed() const {
+
+    size_t result = 0;
+    for (int c=0; c<GetNumChannels(); ++c) {
+        Channel const & ch = _channels[c];
+        result += ch.offsets.size()*sizeof(int) +
+                  ch.columns.size()*sizeof(int) +
+                  ch.weights.size()*sizeof(float);
+    }
+    return result;
+}
+
+} // end namespace OPENSUBDIV_VERSION
+using namespace OPENSUBDIV_VERSION;
+
+} // end namespace OpenSubdiv
+
+#endif /* FAR_FVAR_TABLES_H */
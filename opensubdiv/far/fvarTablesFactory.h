@@ -0,0 +1,574 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#ifndef FAR_FVAR_TABLES_FACTORY_H
+#define FAR_FVAR_TABLES_FACTORY_H
+
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "../version.h"
+
+#include "../hbr/mesh.h"
+
+#include "../far/fvarTables.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+template <class T, class U> class FarMeshFactory;
+
+/// \brief A specialized factory for FarFVarTables
+///
+/// The factory replays the face-varying rules of HbrCatmarkSubdivision<T>::transferFVarToChild
+/// (shared by the bilinear scheme) symbolically : instead of averaging data, each
+/// refined face corner accumulates the weights of the coarse face corners it
+/// depends on. Masks and face-varying sharpness are tracked per channel, so
+/// every channel gets its own operator.
+///
+/// Hbr stores the children corners across smooth face-varying data in their
+/// vertex, shared by all the faces around it, so the factory does as well :
+/// the sharp, dart and boundary rules overwrite the shared value, the smooth
+/// ones are only computed by the first face, in the order Hbr creates the
+/// children. Where the rule of a corner depends on its face, e.g. the boundary
+/// rule at a vertex with 3 semi-sharp creases and "edge only" face-varying
+/// interpolation, the refined data is that of the face refined last, like Hbr.
+///
+template <class T, class U> struct FarFVarTablesFactory {
+
+    /// Creates a FarFVarTables instance.
+    static FarFVarTables<U> * Create( FarMeshFactory<T,U> const * factory, FarMesh<U> * mesh, int maxlevel );
+
+private:
+
+    // Sparse combination of coarse face corners (index, weight)
+    typedef std::vector< std::pair<int, float> > Stencil;
+
+    // Dense scratch space used to sum stencils
+    class Accumulator {
+    public:
+        Accumulator(int size) : _values(size, 0.0f), _used(size, false) { }
+
+        void Add(Stencil const & stencil, float weight);
+
+        // Copies the sum into 'stencil' and clears the accumulator
+        void Flush(Stencil & stencil);
+
+    private:
+        std::vector<float> _values;
+        std::vector<bool>  _used;
+        std::vector<int>   _touched;
+    };
+
+    // Refinement state for one channel between 2 consecutive levels
+    struct Context {
+        HbrMesh<T> *               mesh;
+        int                        fvaritem;
+        std::vector<int> const *   faceBase;  // first corner of each face (by Hbr face ID)
+        std::vector<Stencil> const * parent;  // stencils of the parent level corners
+        std::vector<int> const *   childSlot; // storage of each child level corner
+        std::vector<Stencil> *     slots;     // stencils of the child level storage
+        std::vector<bool> *        written;   // storage already written by a face
+        Accumulator *              acc;
+        Stencil                    facePoint,
+                                   scratch;
+    };
+
+    // Returns the index of 'child' among the children of its parent
+    static int getChildIndex(HbrFace<T> * child);
+
+    // Orders faces by Hbr ID, which is their order of creation
+    static bool compareID(HbrFace<T> const * a, HbrFace<T> const * b) {
+        return a->GetID() < b->GetID();
+    }
+
+    // Stores the stencil of a child corner, unless the corner shares the
+    // storage of a vertex some other face already wrote with a smooth rule
+    static void storeCorner(Context & ctx, int slot, Stencil const & stencil, bool overwrite);
+
+    // Returns the stencil of the corner of 'face' at 'v'
+    static Stencil const & getCorner(Context const & ctx, HbrFace<T> * face, HbrVertex<T> * v);
+
+    // Returns the stencil of corner 'index' of 'face'
+    static Stencil const & getCorner(Context const & ctx, HbrFace<T> * face, int index) {
+        return (*ctx.parent)[(*ctx.faceBase)[face->GetID()]+index];
+    }
+
+    // Computes the stencils of child 'index' of 'face'
+    static void refineChild(Context & ctx, HbrFace<T> * face, int index);
+
+    // Face-varying vertex rule. Returns false for the smooth rule.
+    static bool vertexRule(Context & ctx, HbrFace<T> * face, int index, Stencil & result);
+
+    // Face-varying edge rule for the edge of 'face' starting at corner 'index'.
+    // Returns false for the smooth rule.
+    static bool edgeRule(Context & ctx, HbrFace<T> * face, int index, Stencil & result);
+};
+
+template <class T, class U> void
+FarFVarTablesFactory<T,U>::Accumulator::Add(Stencil const & stencil, float weight) {
+
+    for (int i=0; i<(int)stencil.size(); ++i) {
+        int index = stencil[i].first;
+        if (not _used[index]) {
+            _used[index] = true;
+            _touched.push_back(index);
+        }
+        _values[index] += weight * stencil[i].second;
+    }
+}
+
+template <class T, class U> void
+FarFVarTablesFactory<T,U>::Accumulator::Flush(Stencil & stencil) {
+
+    std::sort(_touched.begin(), _touched.end());
+
+    stencil.clear();
+    stencil.reserve(_touched.size());
+    for (int i=0; i<(int)_touched.size(); ++i) {
+        int index = _touched[i];
+        if (_values[index]!=0.0f)
+            stencil.push_back( std::make_pair(index, _values[index]) );
+        _values[index] = 0.0f;
+        _used[index] = false;
+    }
+    _touched.clear();
+}
+
+template <class T, class U> typename FarFVarTablesFactory<T,U>::Stencil const &
+FarFVarTablesFactory<T,U>::getCorner(Context const & ctx, HbrFace<T> * face, HbrVertex<T> * v) {
+
+    int j;
+    for (j=0; j<face->GetNumVertices(); ++j)
+        if (face->GetVertex(j)==v)
+            break;
+    assert( j!=face->GetNumVertices() );
+    return getCorner(ctx, face, j);
+}
+
+template <class T, class U> int
+FarFVarTablesFactory<T,U>::getChildIndex(HbrFace<T> * child) {
+
+    HbrFace<T> * parent = child->GetParent();
+    assert(parent);
+    int j;
+    for (j=0; j<parent->GetNumVertices(); ++j)
+        if (parent->GetChild(j)==child)
+            break;
+    assert( j!=parent->GetNumVertices() );
+    return j;
+}
+
+template <class T, class U> void
+FarFVarTablesFactory<T,U>::storeCorner(Context & ctx, int slot, Stencil const & stencil, bool overwrite) {
+
+    if (overwrite or not (*ctx.written)[slot]) {
+        (*ctx.slots)[slot] = stencil;
+        (*ctx.written)[slot] = true;
+    }
+}
+
+template <class T, class U> bool
+FarFVarTablesFactory<T,U>::vertexRule(Context & ctx, HbrFace<T> * face, int index, Stencil & result) {
+
+    typename HbrMesh<T>::InterpolateBoundaryMethod fvarinterp = ctx.mesh->GetFVarInterpolateBoundaryMethod();
+
+    HbrVertex<T> * v = face->GetVertex(index);
+    int fvaritem = ctx.fvaritem;
+    unsigned char fvarmask = v->GetFVarMask(fvaritem);
+
+    bool infcorner = false;
+    if (fvarinterp == HbrMesh<T>::k_InterpolateBoundaryEdgeAndCorner) {
+        if (fvarmask >= HbrVertex<T>::k_Corner) {
+            infcorner = true;
+        } else if (ctx.mesh->GetFVarPropagateCorners()) {
+            if (v->IsFVarCorner(fvaritem))
+                infcorner = true;
+        } else {
+            if (face->GetEdge(index)->GetFVarSharpness(fvaritem, true) and
+                face->GetEdge(index)->GetPrev()->GetFVarSharpness(fvaritem, true))
+                infcorner = true;
+        }
+    }
+
+    // Infinitely sharp vertex rule
+    if (fvarinterp == HbrMesh<T>::k_InterpolateBoundaryNone or
+        (fvarinterp == HbrMesh<T>::k_InterpolateBoundaryAlwaysSharp and fvarmask >= 1) or
+        v->GetSharpness() > HbrVertex<T>::k_Smooth or
+        infcorner) {
+
+        result = getCorner(ctx, face, index);
+        return true;
+    }
+
+    Accumulator & acc = *ctx.acc;
+
+    bool smooth = false;
+    if (fvarmask == 1) {
+        // Dart rule : boundary rule across the single face-varying sharp edge
+        acc.Add(getCorner(ctx, face, index), 0.75f);
+
+        HbrHalfedge<T> * start = v->GetIncidentEdge(), * edge = start;
+        while (edge) {
+            if (edge->GetFVarSharpness(fvaritem))
+                break;
+            HbrHalfedge<T> * next = v->GetNextEdge(edge);
+            if (next == start) {
+                assert(0);
+                break;
+            } else if (not next) {
+                assert(0);
+                edge = edge->GetPrev();
+                break;
+            }
+            edge = next;
+        }
+        HbrVertex<T> * w = edge->GetDestVertex();
+        acc.Add(getCorner(ctx, edge->GetLeftFace(), w), 0.125f);
+        acc.Add(getCorner(ctx, edge->GetRightFace(), w), 0.125f);
+
+    } else if (fvarmask != 0) {
+        // Boundary rule : 0.125 of the two adjacent face-varying boundary edges
+        acc.Add(getCorner(ctx, face, index), 0.75f);
+
+        // cycle counterclockwise around v for the first boundary edge
+        HbrFace<T> * bestface = face;
+        HbrHalfedge<T> * bestedge = face->GetEdge(index)->GetPrev();
+        HbrHalfedge<T> * starte = bestedge->GetOpposite();
+        HbrVertex<T> * w = 0;
+        if (not starte) {
+            w = face->GetEdge(index)->GetPrev()->GetOrgVertex();
+        } else {
+            HbrHalfedge<T> * e = starte, * next;
+            do {
+                if (e->GetFVarSharpness(fvaritem) or not e->GetLeftFace()) {
+                    bestface = e->GetRightFace();
+                    bestedge = e;
+                    break;
+                }
+                next = v->GetNextEdge(e);
+                if (not next) {
+                    bestface = e->GetLeftFace();
+                    w = e->GetPrev()->GetOrgVertex();
+                    break;
+                }
+                e = next;
+            } while (e and e != starte);
+        }
+        if (not w) w = bestedge->GetDestVertex();
+        acc.Add(getCorner(ctx, bestface, w), 0.125f);
+
+        // cycle clockwise around v for the other one
+        bestface = face;
+        bestedge = face->GetEdge(index);
+        starte = bestedge;
+        if (HbrHalfedge<T> * e = starte) {
+            do {
+                if (e->GetFVarSharpness(fvaritem) or not e->GetRightFace()) {
+                    bestface = e->GetLeftFace();
+                    bestedge = e;
+                    break;
+                }
+                e = v->GetPreviousEdge(e);
+            } while (e and e != starte);
+        }
+        w = bestedge->GetDestVertex();
+        acc.Add(getCorner(ctx, bestface, w), 0.125f);
+
+    } else {
+        // Smooth rule
+        smooth = true;
+        int valence = v->GetValence();
+        float invvalencesquared = 1.0f / (valence * valence);
+
+        acc.Add(getCorner(ctx, face, index), invvalencesquared * valence * (valence - 2));
+
+        HbrHalfedge<T> * start = v->GetIncidentEdge(), * edge = start;
+        while (edge) {
+            HbrFace<T> * g = edge->GetLeftFace();
+            int n = g->GetNumVertices();
+            float weight = invvalencesquared / n;
+            for (int j=0; j<n; ++j) {
+                acc.Add(getCorner(ctx, g, j), weight);
+                if (g->GetEdge(j)->GetOrgVertex() == v)
+                    acc.Add(getCorner(ctx, g, (j+1)%n), invvalencesquared);
+            }
+            edge = v->GetNextEdge(edge);
+            if (edge == start) break;
+        }
+    }
+    acc.Flush(result);
+    return not smooth;
+}
+
+template <class T, class U> bool
+FarFVarTablesFactory<T,U>::edgeRule(Context & ctx, HbrFace<T> * face, int index, Stencil & result) {
+
+    int nv = face->GetNumVertices();
+    HbrHalfedge<T> * edge = face->GetEdge(index);
+
+    Accumulator & acc = *ctx.acc;
+
+    bool sharp = ctx.mesh->GetFVarInterpolateBoundaryMethod() == HbrMesh<T>::k_InterpolateBoundaryNone or
+                 edge->GetFVarSharpness(ctx.fvaritem) or edge->IsBoundary();
+    if (sharp) {
+
+        // Sharp edge rule
+        acc.Add(getCorner(ctx, face, index), 0.5f);
+        acc.Add(getCorner(ctx, face, (index+1)%nv), 0.5f);
+    } else {
+        // Smooth edge rule
+        acc.Add(getCorner(ctx, face, index), 0.25f);
+        acc.Add(getCorner(ctx, face, (index+1)%nv), 0.25f);
+        acc.Add(ctx.facePoint, 0.25f);
+
+        HbrFace<T> * oppFace = edge->GetRightFace();
+        float weight = 0.25f / oppFace->GetNumVertices();
+        for (int j=0; j<oppFace->GetNumVertices(); ++j)
+            acc.Add(getCorner(ctx, oppFace, j), weight);
+    }
+    acc.Flush(result);
+    return sharp;
+}
+
+template <class T, class U> void
+FarFVarTablesFactory<T,U>::refineChild(Context & ctx, HbrFace<T> * face, int index) {
+
+    int nv = face->GetNumVertices();
+    bool extraordinary = (nv != 4);
+
+    HbrFace<T> * child = face->GetChild(index);
+    assert(child);
+
+    int const * slots = &(*ctx.childSlot)[(*ctx.faceBase)[child->GetID()]];
+
+    storeCorner(ctx, slots[extraordinary ? 2 : (index+2)%4], ctx.facePoint, false);
+
+    bool overwrite = vertexRule(ctx, face, index, ctx.scratch);
+    storeCorner(ctx, slots[extraordinary ? 0 : index], ctx.scratch, overwrite);
+
+    overwrite = edgeRule(ctx, face, index, ctx.scratch);
+    storeCorner(ctx, slots[extraordinary ? 1 : (index+1)%4], ctx.scratch, overwrite);
+
+    overwrite = edgeRule(ctx, face, (index+nv-1)%nv, ctx.scratch);
+    storeCorner(ctx, slots[extraordinary ? 3 : (index+3)%4], ctx.scratch, overwrite);
+}
+
+template <class T, class U> FarFVarTables<U> *
+FarFVarTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * factory, FarMesh<U> * mesh, int maxlevel ) {
+
+    assert( factory and mesh );
+
+    HbrMesh<T> * hmesh = factory->_hbrMesh;
+
+    std::vector<std::vector< HbrFace<T> *> > const & facesList = factory->_facesList;
+
+    FarFVarTables<U> * result = new FarFVarTables<U>(mesh, maxlevel);
+
+    // Number the face corners of every level (face IDs are unique across levels)
+    int maxFaceID = 0;
+    for (int l=0; l<=maxlevel; ++l)
+        for (int i=0; i<(int)facesList[l].size(); ++i)
+            maxFaceID = std::max(maxFaceID, facesList[l][i]->GetID());
+
+    std::vector<int> faceBase(maxFaceID+1, -1);
+    std::vector<int> numCorners(maxlevel+1, 0);
+    for (int l=0; l<=maxlevel; ++l) {
+        for (int i=0; i<(int)facesList[l].size(); ++i) {
+            HbrFace<T> * f = facesList[l][i];
+            faceBase[f->GetID()] = numCorners[l];
+            numCorners[l] += f->GetNumVertices();
+        }
+    }
+
+    // Children are refined in the order Hbr creates them, and their corners
+    // stored like Hbr does : in the vertex, unless the parent vertex or edge
+    // has discontinuous data, or in a storage of their own
+    std::vector< std::vector<HbrFace<T> *> > children(maxlevel);
+    std::vector< std::vector<int> > childSlots(maxlevel);
+    std::vector<int> numSlots(maxlevel, 0);
+    for (int l=0; l<maxlevel; ++l) {
+
+        children[l] = facesList[l+1];
+        std::sort(children[l].begin(), children[l].end(), compareID);
+
+        int maxVertexID = 0;
+        for (int i=0; i<(int)children[l].size(); ++i)
+            for (int j=0; j<4; ++j)
+                maxVertexID = std::max(maxVertexID, children[l][i]->GetVertex(j)->GetID());
+
+        std::vector<int> vertexSlot(maxVertexID+1, -1);
+        childSlots[l].assign(numCorners[l+1], -1);
+
+        for (int i=0; i<(int)children[l].size(); ++i) {
+
+            HbrFace<T> * child = children[l][i],
+                       * face = child->GetParent();
+            int index = getChildIndex(child),
+                nv = face->GetNumVertices();
+            bool extraordinary = (nv != 4);
+
+            bool shared[4];
+            shared[extraordinary ? 0 : index] = face->GetVertex(index)->IsFVarAllSmooth();
+            shared[extraordinary ? 1 : (index+1)%4] = not face->GetEdge(index)->IsFVarInfiniteSharpAnywhere();
+            shared[extraordinary ? 2 : (index+2)%4] = true;
+            shared[extraordinary ? 3 : (index+3)%4] = not face->GetEdge((index+nv-1)%nv)->IsFVarInfiniteSharpAnywhere();
+
+            int * slots = &childSlots[l][faceBase[child->GetID()]];
+            for (int j=0; j<4; ++j) {
+                if (shared[j]) {
+                    int & slot = vertexSlot[child->GetVertex(j)->GetID()];
+                    if (slot<0)
+                        slot = numSlots[l]++;
+                    slots[j] = slot;
+                } else
+                    slots[j] = numSlots[l]++;
+            }
+        }
+    }
+
+    result->_totalWidth = hmesh->GetTotalFVarWidth();
+    result->_numCoarseValues = numCorners[0];
+    result->_numRefinedValues = numCorners[maxlevel];
+
+    int fvarcount = hmesh->GetFVarCount();
+    result->_channels.resize(fvarcount);
+
+    Accumulator acc(numCorners[0]);
+
+    std::vector<Stencil> parent, child, slots;
+    std::vector<bool> written;
+
+    for (int fvaritem=0, offset=0; fvaritem<fvarcount; ++fvaritem) {
+
+        typename FarFVarTables<U>::Channel & ch = result->_channels[fvaritem];
+        ch.width = hmesh->GetFVarWidths()[fvaritem];
+        ch.offset = offset;
+        offset += ch.width;
+
+        // coarse face corners map onto themselves
+        parent.assign(numCorners[0], Stencil());
+        for (int i=0; i<numCorners[0]; ++i)
+            parent[i].push_back( std::make_pair(i, 1.0f) );
+
+        Context ctx;
+        ctx.mesh = hmesh;
+        ctx.fvaritem = fvaritem;
+        ctx.faceBase = &faceBase;
+        ctx.acc = &acc;
+        ctx.slots = &slots;
+        ctx.written = &written;
+
+        for (int l=0; l<maxlevel; ++l) {
+
+            slots.assign(numSlots[l], Stencil());
+            written.assign(numSlots[l], false);
+
+            ctx.parent = &parent;
+            ctx.childSlot = &childSlots[l];
+
+            HbrFace<T> * last = 0;
+            for (int i=0; i<(int)children[l].size(); ++i) {
+
+                HbrFace<T> * f = children[l][i]->GetParent();
+                int nv = f->GetNumVertices();
+
+                // Face rule : the face point is smooth and shared by all the children
+                if (f != last) {
+                    for (int j=0; j<nv; ++j)
+                        acc.Add(getCorner(ctx, f, j), 1.0f/nv);
+                    acc.Flush(ctx.facePoint);
+                    last = f;
+                }
+
+                refineChild(ctx, f, getChildIndex(children[l][i]));
+            }
+
+            child.resize(numCorners[l+1]);
+            for (int i=0; i<numCorners[l+1]; ++i)
+                child[i] = slots[childSlots[l][i]];
+            std::swap(parent, child);
+        }
+
+        // Serialize the stencils of the last level into a CSR operator
+        int nnz = 0;
+        for (int i=0; i<(int)parent.size(); ++i)
+            nnz += (int)parent[i].size();
+
+        ch.offsets.resize(parent.size()+1);
+        ch.columns.reserve(nnz);
+        ch.weights.reserve(nnz);
+
+        ch.offsets[0] = 0;
+        for (int i=0; i<(int)parent.size(); ++i) {
+            for (int j=0; j<(int)parent[i].size(); ++j) {
+                ch.columns.push_back(parent[i][j].first);
+                ch.weights.push_back(parent[i][j].second);
+            }
+            ch.offsets[i+1] = (int)ch.columns.size();
+        }
+    }
+    return result;
+}
+
+} // end namespace OPENSUBDIV_VERSION
+using namespace OPENSUBDIV_VERSION;
+
+} // end namespace OpenSubdiv
+
+#endif /* FAR_FVAR_TABLES_FACTORY_H */
@@ -63,6 +63,8 @@
 
 #include "../version.h"
 
+#include "../hbr/loop.h"
+
 #include "../far/subdivisionTables.h"
 
 namespace OpenSubdiv {
@@ -81,11 +83,14 @@ template <class U> class FarLoopSubdivisionTables : public FarSubdivisionTables<
 public:
 
     /// Compute the positions of refined vertices using the specified kernels
-    virtual void Apply( int level, void * data=0 ) const;
-    virtual void PushLimitMatrix(int nverts, int offset);
+    using FarSubdivisionTables<U>::Apply;
+    virtual void Apply( int level, FarDispatcher<U> * dispatch, void * data=0 ) const;
+    virtual void PushLimitMatrix( int nverts, int offset, FarDispatcher<U> * dispatch );
 
 private:
     template <class X, class Y> friend struct FarLoopSubdivisionTablesFactory;
+    template <class X> friend class FarTopologyRefiner;
+    friend class FarMesh<U>;
     friend class FarDispatcher<U>;
 
     FarLoopSubdivisionTables( FarMesh<U> * mesh, int maxlevel );
@@ -108,13 +113,12 @@ FarLoopSubdivisionTables<U>::FarLoopSubdivisionTables( FarMesh<U> * mesh, int ma
 { }
 
 template <class U> void
-FarLoopSubdivisionTables<U>::Apply( int level, void * clientdata ) const
+FarLoopSubdivisionTables<U>::Apply( int level, FarDispatcher<U> * dispatch, void * clientdata ) const
 {
     assert(this->_mesh and level>0);
 
     typename FarSubdivisionTables<U>::VertexKernelBatch const * batch = & (this->_batches[level-1]);
 
-    FarDispatcher<U> * dispatch = this->_mesh->GetDispatcher();
     assert(dispatch);
 
     int prevLevel = std::max(level-1,0);
@@ -273,10 +277,12 @@ FarLoopSubdivisionTables<U>::computeVertexPointsB( int offset, int level, int st
 #define COEFF_A(n) (5.0 / 8.0 - pow( 3.0 + 2.0 * cos(2.0 * M_PI / n), 2.0) / 64.0)
 
 template <class U> void
-FarLoopSubdivisionTables<U>::PushLimitMatrix( int nverts, int offset ) {
+FarLoopSubdivisionTables<U>::PushLimitMatrix( int nverts, int offset, FarDispatcher<U> * dispatch ) {
 
-    assert(this->_mesh);
-    FarDispatcher<U> * dispatch = this->_mesh->GetDispatcher();
+    assert(this->_mesh and dispatch);
+
+    // rules of the local refinements of the semi-sharp vertices
+    HbrLoopSubdivision<FarLimitStencilVertex> subdivision;
 
     dispatch->StageMatrix(nverts, nverts);
     {
@@ -284,32 +290,42 @@ FarLoopSubdivisionTables<U>::PushLimitMatrix( int nverts, int offset ) {
             /* Get Hbr handle */
             HbrVertex<U> *vertex = this->_mesh->GetHbrVertex(offset + vi);
 
-            // TODO handle models with boundaries
-            if (!vertex->OnBoundary()) {
+            // Semi-sharp features and darts are refined locally until they
+            // reach a stationary ring
+            if (not this->hasClosedFormLimit(vertex)) {
+                this->pushRefinedLimitStencil(dispatch, &subdivision, vertex, vi, offset);
+                continue;
+            }
+
+            // Creases and corners
+            if (this->pushSharpLimitStencil(dispatch, vertex, vertex->GetMask(false), vi, offset))
+                continue;
 
-                // Push to limit surface via stencil from Hoppe '94.
-                int valence = vertex->GetValence();
-                double n = (double) valence;
-                HbrHalfedge<U> *edge = vertex->GetIncidentEdge();
+            if (vertex->OnBoundary()) {
+                // Smooth boundaries (no boundary interpolation) have no
+                // limit - just copy location
+                dispatch->StageElem(vi, vi, 1.0f);
+                continue;
+            }
 
-                double omega_n = 3.0 * n / (8.0 * COEFF_A(n));
-                double normalizer = omega_n + n;
+            // Push to limit surface via stencil from Hoppe '94.
+            int valence = vertex->GetValence();
+            double n = (double) valence;
+            HbrHalfedge<U> *edge = vertex->GetIncidentEdge();
 
-                // Target point
-                dispatch->StageElem(vi, vi, omega_n / normalizer);
+            double omega_n = 3.0 * n / (8.0 * COEFF_A(n));
+            double normalizer = omega_n + n;
 
-                // Points in neighborhood
-                for (int i = 0; i < valence; i++) {
-                    HbrVertex<U> *adjacent = edge->GetDestVertex();
-                    int adjacent_idx = this->_mesh->GetFarVertexID(adjacent) - offset;
-                    dispatch->StageElem(vi, adjacent_idx, 1.0 / normalizer );
+            // Target point
+            dispatch->StageElem(vi, vi, omega_n / normalizer);
 
-                    edge = edge->GetOpposite()->GetNext();
-                }
+            // Points in neighborhood
+            for (int i = 0; i < valence; i++) {
+                HbrVertex<U> *adjacent = edge->GetDestVertex();
+                int adjacent_idx = this->_mesh->GetFarVertexID(adjacent) - offset;
+                dispatch->StageElem(vi, adjacent_idx, 1.0 / normalizer );
 
-            } else {
-                // No limit - just copy location
-                dispatch->StageElem(vi, vi, 1.0f);
+                edge = edge->GetOpposite()->GetNext();
             }
         }
     }
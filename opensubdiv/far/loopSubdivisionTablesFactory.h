@@ -108,8 +108,10 @@ FarLoopSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * factor
         // Edge vertices
         int * E_IT = result->_E_IT[level-1];
         float * E_W = result->_E_W[level-1];
-        batch->kernelE = (int)factory->_edgeVertsList[level].size();
-        for (int i=0; i < batch->kernelE; ++i) {
+        int nedgeverts = (int)factory->_edgeVertsList[level].size();
+        batch->kernelE = nedgeverts;
+#pragma omp parallel for
+        for (int i=0; i < nedgeverts; ++i) {
 
             HbrVertex<T> * v = factory->_edgeVertsList[level][i];
             assert(v);
@@ -145,11 +147,53 @@ FarLoopSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * factor
 
         batch->InitVertexKernels( (int)factory->_vertVertsList[level].size(), 0 );
 
-        int offset = 0;
         int * V_ITa = result->_V_ITa[level-1];
         unsigned int * V_IT = result->_V_IT[level-1];
         float * V_W = result->_V_W[level-1];
         int nverts = (int)factory->_vertVertsList[level].size();
+
+        // First, count the indices gathered by the k_Smooth and k_Dart passes
+        // of each vertex, and rank the vertices into the kernel batches.
+        std::vector<int> ranks(nverts);
+#pragma omp parallel for
+        for (int i=0; i < nverts; ++i) {
+
+            HbrVertex<T> * pv = factory->_vertVertsList[level][i]->GetParentVertex();
+
+            int masks[2];
+            masks[0] = pv->GetMask(false);
+            masks[1] = pv->GetMask(true);
+
+            int npasses = (masks[0] != masks[1] and (
+                not (masks[0]==HbrVertex<T>::k_Smooth and
+                     masks[1]==HbrVertex<T>::k_Dart))) ? 2 : 1;
+
+            int count = 0;
+            for (int p=0; p<npasses; ++p)
+                if (masks[p]==HbrVertex<T>::k_Smooth or masks[p]==HbrVertex<T>::k_Dart) {
+                    HbrHalfedge<T> *e = pv->GetIncidentEdge(),
+                                   *start = e;
+                    while (e) {
+                        ++count;
+                        e = e->GetPrev()->GetOpposite();
+                        if (e==start) break;
+                    }
+                }
+
+            V_ITa[5*i+0] = count;
+            ranks[i] = result->getMaskRanking(masks[0], masks[1]);
+        }
+
+        int offset = 0;
+        for (int i=0; i < nverts; ++i) {
+            int count = V_ITa[5*i+0];
+            V_ITa[5*i+0] = offset;
+            offset += count;
+
+            batch->AddVertex( i, ranks[i] );
+        }
+
+#pragma omp parallel for
         for (int i=0; i < nverts; ++i) {
 
             HbrVertex<T> * v = factory->_vertVertsList[level][i],
@@ -180,9 +224,9 @@ FarLoopSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * factor
                 npasses = 1;
             }
 
-            int rank = result->getMaskRanking(masks[0], masks[1]);
+            int rank = ranks[i],
+                offset = V_ITa[5*i+0];
 
-            V_ITa[5*i+0] = offset;
             V_ITa[5*i+1] = 0;
             V_ITa[5*i+2] = remap[ pv->GetID() ];
             V_ITa[5*i+3] = -1;
@@ -248,8 +292,6 @@ FarLoopSubdivisionTablesFactory<T,U>::Create( FarMeshFactory<T,U> const * factor
                 V_W[i] = 0.0;
             else
                 V_W[i] = weights[0];
-
-            batch->AddVertex( i, rank );
         }
         result->_V_ITa.SetMarker(level, &V_ITa[5*nverts]);
         result->_V_IT.SetMarker(level, &V_IT[offset]);
@@ -58,6 +58,8 @@
 #define FAR_MESH_H
 
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include <iostream>
 
@@ -71,7 +73,11 @@
 #include "../hbr/loop.h"
 
 #include "../far/subdivisionTables.h"
+#include "../far/bilinearSubdivisionTables.h"
+#include "../far/catmarkSubdivisionTables.h"
+#include "../far/loopSubdivisionTables.h"
 #include "../far/vertexEditTables.h"
+#include "../far/fvarTables.h"
 
 namespace OpenSubdiv {
 namespace OPENSUBDIV_VERSION {
@@ -97,6 +103,10 @@ public:
     /// Returns the compute dispatcher
     FarDispatcher<U> * GetDispatcher() { return _dispatcher; }
 
+    /// Replaces the compute dispatcher (the tables don't depend on it). The
+    /// mesh doesn't own the dispatcher.
+    void SetDispatcher(FarDispatcher<U> * dispatch) { _dispatcher = dispatch; }
+
     enum PatchType {
         k_BilinearTriangles,
         k_BilinearQuads,
@@ -121,6 +131,11 @@ public:
     /// Returns vertex edit tables
     FarVertexEditTables<U> const * GetVertexEdit() const { return _vertexEditTables; }
 
+    /// Returns face-varying tables : null if the mesh has no face-varying data,
+    /// and for Loop meshes, whose face-varying rules are not serialized (their
+    /// data is only refined by Hbr)
+    FarFVarTables<U> const * GetFVarTables() const { return _fvarTables; }
+
     /// Returns the number of coarse vertices held at the beginning of the vertex
     /// buffer.
     int GetNumCoarseVertices() const;
@@ -129,18 +144,44 @@ public:
     int GetNumVertices() const { return (int)(_vertices.size()); }
 
     /// Apply the subdivision tables to compute the positions of the vertices up
-    /// to 'level'
+    /// to 'level', or of all the levels if 'level' is negative. The vertices
+    /// are pushed to the limit surface if 'exact' is 1, which needs the HbrMesh
+    /// : meshes read or built without one can't be evaluated exactly.
     void Subdivide(int level=-1, int exact=0);
 
+    /// Stages and finalizes the matrix refining up to 'level' with dispatch rather
+    /// than the mesh dispatcher, e.g. on a worker thread while the mesh dispatcher
+    /// keeps refining with the tables. Hierarchical edits and the limit surface
+    /// are left out.
+    void BuildMatrix(FarDispatcher<U> * dispatch, int level);
+
+    /// Gives up the ownership of the HbrMesh, so that it can be refined further
+    /// by another FarMeshFactory once this mesh is deleted.
+    HbrMesh<U> * ReleaseHbrMesh();
+
+    /// Writes the subdivision, vertex edit and face-varying tables, face vertices
+    /// and ptex coordinates of the mesh to file (see Read). Returns false on I/O
+    /// errors.
+    bool Write(FILE * file) const;
+
+    /// Creates a mesh from size bytes written by Write. The tables are used in
+    /// place (the face-varying operators are copied) : data (e.g. a file mapped
+    /// with MAP_PRIVATE) must be 8-byte aligned and outlive the mesh. The mesh
+    /// has no HbrMesh. Returns NULL if the data was written by another version
+    /// or on a machine of different endianness, or if it is truncated.
+    static FarMesh<U> * Read(void * data, size_t size, FarDispatcher<U> * dispatch=0);
+
 private:
 
     // Note : the vertex classes are renamed <X,Y> so as not to shadow the
     // declaration of the templated vertex class U.
     template <class X, class Y> friend class FarMeshFactory;
+    template <class X> friend class FarTopologyRefiner;
 
     FarMesh(HbrMesh<U> * _hbrMesh, const std::vector<int>& remap, const std::vector<int>& unmap) :
         _subdivisionTables(0),
         _vertexEditTables(0),
+        _fvarTables(0),
         _dispatcher(0),
         _hbrMesh(_hbrMesh),
         _unmapTable(unmap),
@@ -151,12 +192,54 @@ private:
     FarMesh(FarMesh<U> const &);
     FarMesh<U> & operator = (FarMesh<U> const &);
 
+    // Serialization : a header followed by blocks of a 64-bit count and the
+    // elements, each padded to 8 bytes so that they can be used in place.
+    enum {
+        k_SerialMagic     = 0x4641524d, // "FARM"
+        k_SerialVersion   = 2,
+        k_SerialByteOrder = 0x01020304
+    };
+
+    enum SerialScheme {
+        k_SerialBilinear,
+        k_SerialCatmark,
+        k_SerialLoop
+    };
+
+    struct SerialHeader {
+        unsigned int magic,
+                     version,
+                     byteOrder;
+        int          scheme,
+                     maxlevel,
+                     patchtype,
+                     numCoarseVertices,
+                     numVertices,
+                     numEditBatches,
+                     numFVarChannels;   // -1 without face-varying tables
+    };
+
+    template <class T> static bool writeBlock(FILE * file, T const * data, long long count);
+
+    template <class T> static bool writeBlock(FILE * file, std::vector<T> const & vec) {
+        return writeBlock(file, vec.empty() ? (T const *)0 : &vec[0], (long long)vec.size());
+    }
+
+    template <class T> static T * readBlock(char * data, size_t size, size_t * pos, long long * count);
+
+    template <class T> static bool writeTable(FILE * file, FarTable<T> const & table);
+
+    template <class T> static bool readTable(char * data, size_t size, size_t * pos, FarTable<T> & table);
+
     // subdivision method used in this mesh
     FarSubdivisionTables<U> * _subdivisionTables;
 
     // hierarchical vertex edit tables
     FarVertexEditTables<U> * _vertexEditTables;
 
+    // face-varying interpolation operators
+    FarFVarTables<U> * _fvarTables;
+
     // customizable compute dispatcher class
     FarDispatcher<U> * _dispatcher;
 
@@ -193,6 +276,8 @@ FarMesh<U>::GetFarVertexID( HbrVertex<U> *v ) {
 
 template <class U> HbrVertex<U> *
 FarMesh<U>::GetHbrVertex( int i ) {
+    if (not _hbrMesh)
+        return 0;
     assert( (0 <= i) and (i < _unmapTable.size()) );
     return _hbrMesh->GetVertex( _unmapTable[i] );
 }
@@ -202,9 +287,338 @@ FarMesh<U>::~FarMesh()
 {
     delete _subdivisionTables;
     delete _vertexEditTables;
+    delete _fvarTables;
     delete _hbrMesh;
 }
 
+template <class U> HbrMesh<U> *
+FarMesh<U>::ReleaseHbrMesh() {
+    HbrMesh<U> * hbrMesh = _hbrMesh;
+    _hbrMesh = 0;
+    return hbrMesh;
+}
+
+template <class U> template <class T> bool
+FarMesh<U>::writeBlock(FILE * file, T const * data, long long count) {
+
+    static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    size_t padSize = (8 - (count * sizeof(T)) % 8) % 8;
+
+    return fwrite(&count, sizeof(long long), 1, file) == 1 and
+           (count == 0 or fwrite(data, sizeof(T), (size_t)count, file) == (size_t)count) and
+           fwrite(padding, 1, padSize, file) == padSize;
+}
+
+template <class U> template <class T> T *
+FarMesh<U>::readBlock(char * data, size_t size, size_t * pos, long long * count) {
+
+    if (*pos + sizeof(long long) > size)
+        return 0;
+    *count = *(long long *)(data + *pos);
+    *pos += sizeof(long long);
+
+    if (*count < 0 or (size - *pos) / sizeof(T) < (unsigned long long)*count)
+        return 0;
+
+    T * result = (T *)(data + *pos);
+    *pos += (size_t)((*count * sizeof(T) + 7) / 8 * 8);
+    return *pos <= size ? result : 0;
+}
+
+// The markers of the tables are stored as offsets to their first element (-1
+// for unset markers)
+template <class U> template <class T> bool
+FarMesh<U>::writeTable(FILE * file, FarTable<T> const & table) {
+
+    std::vector<long long> markers(table.GetNumMarkers(), -1);
+    for (int i=0; i<(int)markers.size(); ++i)
+        if (table[i])
+            markers[i] = table[i] - table[0];
+
+    return writeBlock(file, markers) and
+           writeBlock(file, table[0], (long long)(table.GetMemoryUsed() / sizeof(T)));
+}
+
+template <class U> template <class T> bool
+FarMesh<U>::readTable(char * data, size_t size, size_t * pos, FarTable<T> & table) {
+
+    long long nmarkers, nelements;
+
+    long long * markers = readBlock<long long>(data, size, pos, &nmarkers);
+    if (not markers or nmarkers < 1 or nmarkers > 64)
+        return false;
+
+    T * elements = readBlock<T>(data, size, pos, &nelements);
+    if (not elements)
+        return false;
+
+    table.SetMaxLevel((int)nmarkers);
+    table.Attach(elements, (size_t)nelements);
+    for (int i=0; i<(int)nmarkers; ++i) {
+        if (markers[i] > nelements)
+            return false;
+        table.SetMarker(i, markers[i] < 0 ? 0 : elements + markers[i]);
+    }
+    return true;
+}
+
+template <class U> bool
+FarMesh<U>::Write(FILE * file) const {
+
+    SerialHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = k_SerialMagic;
+    header.version = k_SerialVersion;
+    header.byteOrder = k_SerialByteOrder;
+
+    FarSubdivisionTables<U> const * tables = _subdivisionTables;
+
+    FarBilinearSubdivisionTables<U> const * bilinear =
+        dynamic_cast<FarBilinearSubdivisionTables<U> const *>(tables);
+    FarCatmarkSubdivisionTables<U> const * catmark =
+        dynamic_cast<FarCatmarkSubdivisionTables<U> const *>(tables);
+
+    if (bilinear)
+        header.scheme = k_SerialBilinear;
+    else if (catmark)
+        header.scheme = k_SerialCatmark;
+    else if (dynamic_cast<FarLoopSubdivisionTables<U> const *>(tables))
+        header.scheme = k_SerialLoop;
+    else
+        return false;
+
+    header.maxlevel = tables->GetMaxLevel()-1;
+    header.patchtype = _patchtype;
+    header.numCoarseVertices = _numCoarseVertices;
+    header.numVertices = (int)_vertices.size();
+    header.numEditBatches = _vertexEditTables ? _vertexEditTables->GetNumBatches() : -1;
+    header.numFVarChannels = _fvarTables ? _fvarTables->GetNumChannels() : -1;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return false;
+
+    bool success = writeBlock(file, _remapTable) and
+                   writeBlock(file, _unmapTable);
+
+    for (int i=0; success and i<=header.maxlevel; ++i)
+        success = writeBlock(file, _faceverts[i]) and
+                  writeBlock(file, _ptexcoordinates[i]);
+
+    // kernel batches as 8 ints each
+    std::vector<int> batches;
+    for (int i=0; i<(int)tables->_batches.size(); ++i) {
+        typename FarSubdivisionTables<U>::VertexKernelBatch const & batch = tables->_batches[i];
+        int values[8] = { batch.kernelF, batch.kernelE,
+                          batch.kernelB.first, batch.kernelB.second,
+                          batch.kernelA1.first, batch.kernelA1.second,
+                          batch.kernelA2.first, batch.kernelA2.second };
+        batches.insert(batches.end(), values, values+8);
+    }
+
+    success = success and
+              writeBlock(file, batches) and
+              writeBlock(file, tables->_vertsOffsets) and
+              writeTable(file, tables->_E_IT) and
+              writeTable(file, tables->_E_W) and
+              writeTable(file, tables->_V_ITa) and
+              writeTable(file, tables->_V_IT) and
+              writeTable(file, tables->_V_W);
+
+    if (bilinear)
+        success = success and writeTable(file, bilinear->_F_ITa) and writeTable(file, bilinear->_F_IT);
+    else if (catmark)
+        success = success and writeTable(file, catmark->_F_ITa) and writeTable(file, catmark->_F_IT);
+
+    for (int i=0; success and i<header.numEditBatches; ++i) {
+        typename FarVertexEditTables<U>::VertexEditBatch const & batch = _vertexEditTables->_batches[i];
+        int values[4] = { batch._primvarIndex, batch._primvarWidth, batch._op, 0 };
+        success = writeBlock(file, values, 4) and
+                  writeTable(file, batch._vertIndices) and
+                  writeTable(file, batch._edits);
+    }
+
+    // face-varying operators as 4 ints, then the layout (2 ints) and the CSR
+    // vectors of each channel
+    if (success and _fvarTables) {
+        FarFVarTables<U> const * fvar = _fvarTables;
+        int values[4] = { fvar->_maxlevel, fvar->_totalWidth,
+                          fvar->_numCoarseValues, fvar->_numRefinedValues };
+        success = writeBlock(file, values, 4);
+
+        for (int i=0; success and i<header.numFVarChannels; ++i) {
+            typename FarFVarTables<U>::Channel const & channel = fvar->_channels[i];
+            int layout[2] = { channel.width, channel.offset };
+            success = writeBlock(file, layout, 2) and
+                      writeBlock(file, channel.offsets) and
+                      writeBlock(file, channel.columns) and
+                      writeBlock(file, channel.weights);
+        }
+    }
+    return success;
+}
+
+template <class U> FarMesh<U> *
+FarMesh<U>::Read(void * data, size_t size, FarDispatcher<U> * dispatch) {
+
+    assert(((size_t)data % 8) == 0);
+
+    char * bytes = (char *)data;
+
+    SerialHeader const * header = (SerialHeader const *)bytes;
+    if (size < sizeof(SerialHeader) or
+        header->magic != k_SerialMagic or
+        header->version != k_SerialVersion or
+        header->byteOrder != k_SerialByteOrder or
+        header->maxlevel < 1)
+        return 0;
+
+    size_t pos = sizeof(SerialHeader);
+    long long nremap, nunmap;
+
+    int * remap = readBlock<int>(bytes, size, &pos, &nremap);
+    int * unmap = remap ? readBlock<int>(bytes, size, &pos, &nunmap) : 0;
+    if (not unmap)
+        return 0;
+
+    FarMesh<U> * result = new FarMesh<U>(0, std::vector<int>(remap, remap+nremap),
+                                            std::vector<int>(unmap, unmap+nunmap));
+
+    if (dispatch)
+        result->_dispatcher = dispatch;
+    else
+        result->_dispatcher = & FarDispatcher<U>::_DefaultDispatcher;
+
+    result->_patchtype = (PatchType)header->patchtype;
+    result->_numCoarseVertices = header->numCoarseVertices;
+    result->_vertices.resize(header->numVertices);
+
+    int maxlevel = header->maxlevel;
+    bool success = true;
+
+    result->_faceverts.resize(maxlevel+1);
+    result->_ptexcoordinates.resize(maxlevel+1);
+    for (int i=0; success and i<=maxlevel; ++i) {
+        long long count;
+        int * faceverts = readBlock<int>(bytes, size, &pos, &count);
+        if (faceverts)
+            result->_faceverts[i].assign(faceverts, faceverts+count);
+        int * ptex = faceverts ? readBlock<int>(bytes, size, &pos, &count) : 0;
+        if (ptex)
+            result->_ptexcoordinates[i].assign(ptex, ptex+count);
+        success = ptex != 0;
+    }
+
+    FarSubdivisionTables<U> * tables = 0;
+    FarBilinearSubdivisionTables<U> * bilinear = 0;
+    FarCatmarkSubdivisionTables<U> * catmark = 0;
+    switch (header->scheme) {
+        case k_SerialBilinear : tables = bilinear = new FarBilinearSubdivisionTables<U>(result, maxlevel); break;
+        case k_SerialCatmark  : tables = catmark = new FarCatmarkSubdivisionTables<U>(result, maxlevel); break;
+        case k_SerialLoop     : tables = new FarLoopSubdivisionTables<U>(result, maxlevel); break;
+        default : success = false;
+    }
+    result->_subdivisionTables = tables;
+
+    if (success) {
+        long long nbatches, noffsets;
+        int * batches = readBlock<int>(bytes, size, &pos, &nbatches);
+        int * offsets = batches ? readBlock<int>(bytes, size, &pos, &noffsets) : 0;
+
+        success = offsets and nbatches == 8*maxlevel and noffsets == maxlevel+1;
+
+        for (int i=0; success and i<maxlevel; ++i) {
+            typename FarSubdivisionTables<U>::VertexKernelBatch & batch = tables->_batches[i];
+            int const * values = batches + 8*i;
+            batch.kernelF = values[0];
+            batch.kernelE = values[1];
+            batch.kernelB = std::make_pair(values[2], values[3]);
+            batch.kernelA1 = std::make_pair(values[4], values[5]);
+            batch.kernelA2 = std::make_pair(values[6], values[7]);
+        }
+        if (success)
+            tables->_vertsOffsets.assign(offsets, offsets+noffsets);
+    }
+
+    success = success and
+              readTable(bytes, size, &pos, tables->_E_IT) and
+              readTable(bytes, size, &pos, tables->_E_W) and
+              readTable(bytes, size, &pos, tables->_V_ITa) and
+              readTable(bytes, size, &pos, tables->_V_IT) and
+              readTable(bytes, size, &pos, tables->_V_W);
+
+    if (bilinear)
+        success = success and
+                  readTable(bytes, size, &pos, bilinear->_F_ITa) and
+                  readTable(bytes, size, &pos, bilinear->_F_IT);
+    else if (catmark)
+        success = success and
+                  readTable(bytes, size, &pos, catmark->_F_ITa) and
+                  readTable(bytes, size, &pos, catmark->_F_IT);
+
+    if (success and header->numEditBatches >= 0) {
+        FarVertexEditTables<U> * edits = new FarVertexEditTables<U>(result, maxlevel);
+        result->_vertexEditTables = edits;
+
+        for (int i=0; success and i<header->numEditBatches; ++i) {
+            long long count;
+            int * values = readBlock<int>(bytes, size, &pos, &count);
+            if (not values or count != 4) {
+                success = false;
+                break;
+            }
+            edits->_batches.push_back(typename FarVertexEditTables<U>::VertexEditBatch(
+                values[0], values[1], (FarVertexEdit::Operation)values[2]));
+
+            typename FarVertexEditTables<U>::VertexEditBatch & batch = edits->_batches.back();
+            success = readTable(bytes, size, &pos, batch._vertIndices) and
+                      readTable(bytes, size, &pos, batch._edits);
+        }
+    }
+
+    if (success and header->numFVarChannels >= 0) {
+        long long count;
+        int * values = readBlock<int>(bytes, size, &pos, &count);
+        success = values and count == 4;
+
+        if (success) {
+            FarFVarTables<U> * fvar = new FarFVarTables<U>(result, values[0]);
+            result->_fvarTables = fvar;
+
+            fvar->_totalWidth = values[1];
+            fvar->_numCoarseValues = values[2];
+            fvar->_numRefinedValues = values[3];
+            fvar->_channels.resize(header->numFVarChannels);
+
+            for (int i=0; success and i<header->numFVarChannels; ++i) {
+                typename FarFVarTables<U>::Channel & channel = fvar->_channels[i];
+
+                long long noffsets, ncolumns, nweights;
+                int * layout = readBlock<int>(bytes, size, &pos, &count);
+                int * offsets = (layout and count == 2) ? readBlock<int>(bytes, size, &pos, &noffsets) : 0;
+                int * columns = offsets ? readBlock<int>(bytes, size, &pos, &ncolumns) : 0;
+                float * weights = columns ? readBlock<float>(bytes, size, &pos, &nweights) : 0;
+
+                success = weights and noffsets == fvar->_numRefinedValues+1 and nweights == ncolumns;
+                if (success) {
+                    channel.width = layout[0];
+                    channel.offset = layout[1];
+                    channel.offsets.assign(offsets, offsets+noffsets);
+                    channel.columns.assign(columns, columns+ncolumns);
+                    channel.weights.assign(weights, weights+nweights);
+                }
+            }
+        }
+    }
+
+    if (not success) {
+        delete result;
+        return 0;
+    }
+    return result;
+}
+
 template <class U> int
 FarMesh<U>::GetNumCoarseVertices() const {
     return _numCoarseVertices;
@@ -227,18 +641,35 @@ FarMesh<U>::GetPtexCoordinates(int level) const {
 template <class U> void
 FarMesh<U>::Subdivide(int level, int exact) {
 
+    // by default, refine every level of the tables
+    if (level < 0)
+        level = _subdivisionTables->GetMaxLevel();
+
+    // dispatchers caching the operators of each level resume from the
+    // deepest one they hold
+    int firstLevel = _dispatcher->SelectLevel(level-1);
+
     if (not _dispatcher->MatrixReady()) {
 
-        for (int i=1; i<level; ++i) {
+        for (int i=firstLevel; i<level; ++i) {
             _subdivisionTables->Apply(i);
 
             // edits only work for table-driven strategy, not spmv
             if (_vertexEditTables)
                 _vertexEditTables->Apply(i, _dispatcher);
+
+            // intermediate levels can be stacked into the matrix
+            if (i < level-1)
+                _dispatcher->MarkLevel(i);
+
+            _dispatcher->EndLevel(i);
         }
 
-        if (exact == 1 && _dispatcher->SupportsExactEvaluation())
-            _subdivisionTables->PushToLimitSurface(level-1); //XXX level-1?
+        if (exact == 1 && _dispatcher->SupportsExactEvaluation()) {
+            // exact evaluation walks the HbrMesh
+            assert(_hbrMesh);
+            _subdivisionTables->PushToLimitSurface(level-1, _dispatcher); //XXX level-1?
+        }
 
         _dispatcher->FinalizeMatrix();
     }
@@ -247,6 +678,26 @@ FarMesh<U>::Subdivide(int level, int exact) {
     _dispatcher->ApplyMatrix(offset);
 }
 
+template <class U> void
+FarMesh<U>::BuildMatrix(FarDispatcher<U> * dispatch, int level) {
+
+    int firstLevel = dispatch->SelectLevel(level-1);
+
+    if (dispatch->MatrixReady())
+        return;
+
+    for (int i=firstLevel; i<level; ++i) {
+        _subdivisionTables->Apply(i, dispatch);
+
+        if (i < level-1)
+            dispatch->MarkLevel(i);
+
+        dispatch->EndLevel(i);
+    }
+
+    dispatch->FinalizeMatrix();
+}
+
 } // end namespace OPENSUBDIV_VERSION
 using namespace OPENSUBDIV_VERSION;
 
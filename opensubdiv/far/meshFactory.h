@@ -57,7 +57,9 @@
 #ifndef FAR_MESH_FACTORY_H
 #define FAR_MESH_FACTORY_H
 
+#include <algorithm>
 #include <typeinfo>
+#include <vector>
 
 #include "../version.h"
 
@@ -72,6 +74,7 @@
 #include "../far/catmarkSubdivisionTablesFactory.h"
 #include "../far/loopSubdivisionTablesFactory.h"
 #include "../far/vertexEditTablesFactory.h"
+#include "../far/fvarTablesFactory.h"
 
 namespace OpenSubdiv {
 namespace OPENSUBDIV_VERSION {
@@ -138,6 +141,7 @@ private:
     friend struct FarCatmarkSubdivisionTablesFactory<T,U>;
     friend struct FarLoopSubdivisionTablesFactory<T,U>;
     friend struct FarVertexEditTablesFactory<T,U>;
+    friend struct FarFVarTablesFactory<T,U>;
 
     // Non-copyable, so these are not implemented:
     FarMeshFactory( FarMeshFactory const & );
@@ -153,7 +157,15 @@ private:
 
     void copyTopology( std::vector<int> & vec, int level );
 
-    static  bool compareVertices( HbrVertex<T> const *x, HbrVertex<T> const *y );
+    // The vertices and faces are processed in parallel in blocks of consecutive
+    // IDs : counting each block separately and scanning the counts keeps the
+    // lists in ID order.
+    enum { k_BlockSize = 4096 };
+
+    // Number of combinations of masks (see FarSubdivisionTables<U>::getMaskRanking)
+    enum { k_NumRanks = 10 };
+
+    static void sortVertices( std::vector<HbrVertex<T> *> & vertices );
 
     static void refine( HbrMesh<T> * mesh, int maxlevel );
 
@@ -226,25 +238,61 @@ FarMeshFactory<T,U>::refine( HbrMesh<T> * mesh, int maxlevel ) {
 
 }
 
-// Compare the weight masks of 2 vertices using the following ordering table.
+// Sorts the vertices based on the weight masks of their parent with the
+// following ordering table.
 //
 // Assuming 2 computer kernels :
 //  - A handles the k_Crease and K_Corner rules
 //  - B handles the K_Smooth and K_Dart rules
 // The vertices should be sorted so as to minimize the number execution calls of
 // these kernels to match the 2 pass interpolation scheme used in Hbr.
-template <class T, class U> bool
-FarMeshFactory<T,U>::compareVertices( HbrVertex<T> const * x, HbrVertex<T> const * y ) {
+//
+// There are only k_NumRanks mask combinations : the vertices are counting sorted,
+// which keeps the vertices of a given rank in ID order.
+template <class T, class U> void
+FarMeshFactory<T,U>::sortVertices( std::vector<HbrVertex<T> *> & vertices ) {
+
+    int nverts = (int)vertices.size(),
+        nblocks = (nverts+k_BlockSize-1)/k_BlockSize;
+
+    std::vector<unsigned char> ranks(nverts);
+    std::vector<int> offsets(nblocks*k_NumRanks, 0);
+
+#pragma omp parallel for
+    for (int b=0; b<nblocks; ++b) {
+        int end = std::min(nverts, (b+1)*k_BlockSize);
+        for (int i=b*k_BlockSize; i<end; ++i) {
+
+            // Masks of the parent vertex decide for the current vertex.
+            HbrVertex<T> * pv = vertices[i]->GetParentVertex();
+
+            int rank = FarSubdivisionTables<U>::getMaskRanking(pv->GetMask(false), pv->GetMask(true));
+            assert( rank < k_NumRanks );
+
+            ranks[i] = (unsigned char)rank;
+            offsets[b*k_NumRanks+rank]++;
+        }
+    }
+
+    // the vertices of a rank are placed block after block
+    for (int r=0, offset=0; r<k_NumRanks; ++r)
+        for (int b=0; b<nblocks; ++b) {
+            int count = offsets[b*k_NumRanks+r];
+            offsets[b*k_NumRanks+r] = offset;
+            offset += count;
+        }
 
-    // Masks of the parent vertex decide for the current vertex.
-    HbrVertex<T> * px=x->GetParentVertex(),
-                 * py=y->GetParentVertex();
+    std::vector<HbrVertex<T> *> sorted(nverts);
 
-    assert( (FarSubdivisionTables<U>::getMaskRanking(px->GetMask(false), px->GetMask(true) )!=0xFF) and
-            (FarSubdivisionTables<U>::getMaskRanking(py->GetMask(false), py->GetMask(true) )!=0xFF) );
+#pragma omp parallel for
+    for (int b=0; b<nblocks; ++b) {
+        int * blockOffsets = &offsets[b*k_NumRanks],
+              end = std::min(nverts, (b+1)*k_BlockSize);
+        for (int i=b*k_BlockSize; i<end; ++i)
+            sorted[ blockOffsets[ranks[i]]++ ] = vertices[i];
+    }
 
-    return FarSubdivisionTables<U>::getMaskRanking(px->GetMask(false), px->GetMask(true) ) <
-           FarSubdivisionTables<U>::getMaskRanking(py->GetMask(false), py->GetMask(true) );
+    vertices.swap(sorted);
 }
 
 // Assumption : the order of the vertices in the HbrMesh could be set in any
@@ -271,124 +319,198 @@ FarMeshFactory<T,U>::FarMeshFactory( HbrMesh<T> * mesh, int maxlevel ) :
     int numVertices = mesh->GetNumVertices();
     int numFaces = mesh->GetNumFaces();
 
-    std::vector<int> faceCounts(maxlevel+1,0),
-                     edgeCounts(maxlevel+1,0),
-                     vertCounts(maxlevel+1,0);
+    int nlevels = maxlevel+1,
+        nblocks = (numVertices+k_BlockSize-1)/k_BlockSize;
+
+    // counters of each block for each depth
+    std::vector<int> faceCounts(nblocks*nlevels,0),
+                     edgeCounts(nblocks*nlevels,0),
+                     vertCounts(nblocks*nlevels,0),
+                     listSizes(nblocks*nlevels,0),
+                     maxvertids(nblocks,-1);
 
     // First pass (vertices) : count the vertices of each type for each depth
-    // up to maxlevel (values are dependent on topology).
-    int maxvertid=-1;
-    for (int i=0; i<numVertices; ++i) {
+    // up to maxlevel (values are dependent on topology). The masks of the
+    // vertices are cached here, so that the next passes only read them.
+#pragma omp parallel for
+    for (int b=0; b<nblocks; ++b) {
+
+        int * faceCount = &faceCounts[b*nlevels],
+            * edgeCount = &edgeCounts[b*nlevels],
+            * vertCount = &vertCounts[b*nlevels],
+            * listSize = &listSizes[b*nlevels],
+              end = std::min(numVertices, (b+1)*k_BlockSize);
+
+        for (int i=b*k_BlockSize; i<end; ++i) {
+
+            HbrVertex<T> * v = mesh->GetVertex(i);
+            assert(v);
+
+            int depth = v->GetFace()->GetDepth();
 
-        HbrVertex<T> * v = mesh->GetVertex(i);
-        assert(v);
+            if (depth>maxlevel)
+                continue;
 
-        int depth = v->GetFace()->GetDepth();
+            if (depth<maxlevel)
+                v->GetMask(false);
 
-        if (depth>maxlevel)
-            continue;
+            if (depth==0 )
+                vertCount[depth]++;
 
-        if (depth==0 )
-            vertCounts[depth]++;
+            if (v->GetID()>maxvertids[b])
+                maxvertids[b] = v->GetID();
 
-        if (v->GetID()>maxvertid)
-            maxvertid = v->GetID();
+            if (not v->OnBoundary())
+                listSize[depth] += v->GetValence();
+            else if (v->GetValence()!=2)
+                listSize[depth] ++;
 
-        if (not v->OnBoundary())
-            _vertVertsListSize[depth] += v->GetValence();
-        else if (v->GetValence()!=2)
-            _vertVertsListSize[depth] ++;
+            if (v->GetParentFace())
+                faceCount[depth]++;
+            else if (v->GetParentEdge())
+                edgeCount[depth]++;
+            else if (v->GetParentVertex())
+                vertCount[depth]++;
+        }
+    }
 
-        if (v->GetParentFace())
-            faceCounts[depth]++;
-        else if (v->GetParentEdge())
-            edgeCounts[depth]++;
-        else if (v->GetParentVertex())
-            vertCounts[depth]++;
+    // Scan the counters : each block starts after the vertices of the previous
+    // blocks in the lists
+    std::vector<int> faceTotals(nlevels,0),
+                     edgeTotals(nlevels,0),
+                     vertTotals(nlevels,0);
+    int maxvertid=-1;
+    for (int b=0; b<nblocks; ++b) {
+        for (int l=0; l<nlevels; ++l) {
+            int k = b*nlevels+l,
+                faceCount = faceCounts[k],
+                edgeCount = edgeCounts[k],
+                vertCount = vertCounts[k];
+
+            faceCounts[k] = faceTotals[l];
+            edgeCounts[k] = edgeTotals[l];
+            vertCounts[k] = vertTotals[l];
+
+            faceTotals[l] += faceCount;
+            edgeTotals[l] += edgeCount;
+            vertTotals[l] += vertCount;
+
+            _vertVertsListSize[l] += listSizes[k];
+        }
+        maxvertid = std::max(maxvertid, maxvertids[b]);
     }
 
     // Per-level offset to the first vertex of each type in the global vertex map
-    _vertVertsList[0].reserve( vertCounts[0] );
+    _vertVertsList[0].resize( vertTotals[0] );
     for (int l=1; l<(maxlevel+1); ++l) {
-        _faceVertIdx[l]= _vertVertIdx[l-1]+vertCounts[l-1];
-        _edgeVertIdx[l]= _faceVertIdx[l]+faceCounts[l];
-        _vertVertIdx[l]= _edgeVertIdx[l]+edgeCounts[l];
+        _faceVertIdx[l]= _vertVertIdx[l-1]+vertTotals[l-1];
+        _edgeVertIdx[l]= _faceVertIdx[l]+faceTotals[l];
+        _vertVertIdx[l]= _edgeVertIdx[l]+edgeTotals[l];
 
-        _faceVertsList[l].reserve( faceCounts[l] );
-        _edgeVertsList[l].reserve( edgeCounts[l] );
-        _vertVertsList[l].reserve( vertCounts[l] );
+        _faceVertsList[l].resize( faceTotals[l] );
+        _edgeVertsList[l].resize( edgeTotals[l] );
+        _vertVertsList[l].resize( vertTotals[l] );
     }
 
-    // reset counters
-    faceCounts.assign(maxlevel+1,0);
-    edgeCounts.assign(maxlevel+1,0);
-
     _remapTable.resize( maxvertid+1, -1);
     _unmapTable.resize( maxvertid+1, -1);
 
     // Second pass (vertices) : calculate the starting indices of the sub-tables
     // (face, edge, verts...) and populate the remapping table.
-    for (int i=0; i<numVertices; ++i) {
-
-        HbrVertex<T> * v = mesh->GetVertex(i);
-        assert(v);
-
-        int depth = v->GetFace()->GetDepth();
-
-        if (depth>maxlevel)
-            continue;
-
-        assert( _remapTable[ v->GetID() ] = -1 );
-
-        if (depth==0) {
-            _vertVertsList[ depth ].push_back( v );
-            _remapTable[ v->GetID() ] = v->GetID();
-        } else if (v->GetParentFace()) {
-            _remapTable[ v->GetID() ]=_faceVertIdx[depth]+faceCounts[depth]++;
-            _faceVertsList[ depth ].push_back( v );
-        } else if (v->GetParentEdge()) {
-            _remapTable[ v->GetID() ]=_edgeVertIdx[depth]+edgeCounts[depth]++;
-            _edgeVertsList[ depth ].push_back( v );
-        } else if (v->GetParentVertex()) {
-            // vertices need to be sorted separately based on compute kernel :
-            // the remapping step is done just after this
-            _vertVertsList[ depth ].push_back( v );
+#pragma omp parallel for
+    for (int b=0; b<nblocks; ++b) {
+
+        int * faceOffset = &faceCounts[b*nlevels],
+            * edgeOffset = &edgeCounts[b*nlevels],
+            * vertOffset = &vertCounts[b*nlevels],
+              end = std::min(numVertices, (b+1)*k_BlockSize);
+
+        for (int i=b*k_BlockSize; i<end; ++i) {
+
+            HbrVertex<T> * v = mesh->GetVertex(i);
+            assert(v);
+
+            int depth = v->GetFace()->GetDepth();
+
+            if (depth>maxlevel)
+                continue;
+
+            assert( _remapTable[ v->GetID() ] = -1 );
+
+            if (depth==0) {
+                _vertVertsList[ depth ][ vertOffset[depth]++ ] = v;
+                _remapTable[ v->GetID() ] = v->GetID();
+            } else if (v->GetParentFace()) {
+                _remapTable[ v->GetID() ]=_faceVertIdx[depth]+faceOffset[depth];
+                _faceVertsList[ depth ][ faceOffset[depth]++ ] = v;
+            } else if (v->GetParentEdge()) {
+                _remapTable[ v->GetID() ]=_edgeVertIdx[depth]+edgeOffset[depth];
+                _edgeVertsList[ depth ][ edgeOffset[depth]++ ] = v;
+            } else if (v->GetParentVertex()) {
+                // vertices need to be sorted separately based on compute kernel :
+                // the remapping step is done just after this
+                _vertVertsList[ depth ][ vertOffset[depth]++ ] = v;
+            }
         }
     }
 
     // Sort the the vertices that are the child of a vertex based on their weight
     // mask. The masks combinations are ordered so as to minimize the compute
     // kernel switching.
-    for (size_t i=1; i<_vertVertsList.size(); ++i)
-        std::sort(_vertVertsList[i].begin(), _vertVertsList[i].end(),compareVertices);
+    for (int l=1; l<(maxlevel+1); ++l) {
+
+        sortVertices(_vertVertsList[l]);
 
-    // These vertices still need a remapped index
-    for (int l=1; l<(maxlevel+1); ++l)
-        for (size_t i=0; i<_vertVertsList[l].size(); ++i)
-            _remapTable[ _vertVertsList[l][i]->GetID() ]=_vertVertIdx[l]+(int)i;
+        // These vertices still need a remapped index
+        int nverts = (int)_vertVertsList[l].size();
+#pragma omp parallel for
+        for (int i=0; i<nverts; ++i)
+            _remapTable[ _vertVertsList[l][i]->GetID() ]=_vertVertIdx[l]+i;
+    }
 
     // Populate the far->hbr vertex mapping
-    for (int i=0; i < _remapTable.size(); i++)
+    int nremap = (int)_remapTable.size();
+#pragma omp parallel for
+    for (int i=0; i<nremap; i++)
         _unmapTable[ _remapTable[i] ] = i;
 
-    // Third pass (faces) : populate the face lists.
-    int fsize=0;
-    for (int i=0; i<numFaces; ++i) {
-        HbrFace<T> * f = mesh->GetFace(i);
-        assert(f);
-        if (f->GetDepth()==0)
-            fsize += mesh->GetSubdivision()->GetFaceChildrenCount( f->GetNumVertices() );
+    // Third pass (faces) : populate the face lists, with the same block
+    // counting as the vertices.
+    int nfaceblocks = (numFaces+k_BlockSize-1)/k_BlockSize;
+
+    std::vector<int> faceOffsets(nfaceblocks*nlevels,0);
+
+#pragma omp parallel for
+    for (int b=0; b<nfaceblocks; ++b) {
+        int end = std::min(numFaces, (b+1)*k_BlockSize);
+        for (int i=b*k_BlockSize; i<end; ++i) {
+            HbrFace<T> * f = mesh->GetFace(i);
+            assert(f);
+            if (f->GetDepth()<=maxlevel)
+                faceOffsets[b*nlevels+f->GetDepth()]++;
+        }
     }
 
-    _facesList[0].reserve(mesh->GetNumCoarseFaces());
-    _facesList[1].reserve(fsize);
-    for (int l=2; l<=maxlevel; ++l)
-        _facesList[l].reserve( _facesList[l-1].capacity()*4 );
+    std::vector<int> numFacesPerLevel(nlevels,0);
+    for (int b=0; b<nfaceblocks; ++b)
+        for (int l=0; l<nlevels; ++l) {
+            int count = faceOffsets[b*nlevels+l];
+            faceOffsets[b*nlevels+l] = numFacesPerLevel[l];
+            numFacesPerLevel[l] += count;
+        }
+
+    for (int l=0; l<=maxlevel; ++l)
+        _facesList[l].resize( numFacesPerLevel[l] );
 
-    for (int i=0; i<numFaces; ++i) {
-        HbrFace<T> * f = mesh->GetFace(i);
-        if (f->GetDepth()<=maxlevel)
-            _facesList[ f->GetDepth() ].push_back(f);
+#pragma omp parallel for
+    for (int b=0; b<nfaceblocks; ++b) {
+        int * offsets = &faceOffsets[b*nlevels],
+              end = std::min(numFaces, (b+1)*k_BlockSize);
+        for (int i=b*k_BlockSize; i<end; ++i) {
+            HbrFace<T> * f = mesh->GetFace(i);
+            if (f->GetDepth()<=maxlevel)
+                _facesList[ f->GetDepth() ][ offsets[f->GetDepth()]++ ] = f;
+        }
     }
 
     _numFaces = GetNumFacesTotal(maxlevel);
@@ -425,9 +547,12 @@ FarMeshFactory<T,U>::copyTopology( std::vector<int> & vec, int level ) {
 
     assert(nv>0);
 
-    vec.resize( nv * _facesList[level].size(), -1 );
+    int nfaces = (int)_facesList[level].size();
+
+    vec.resize( nv * nfaces, -1 );
 
-    for (int i=0; i<(int)_facesList[level].size(); ++i) {
+#pragma omp parallel for
+    for (int i=0; i<nfaces; ++i) {
         HbrFace<T> * f = _facesList[level][i];
         assert( f and f->GetNumVertices()==nv);
         for (int j=0; j<f->GetNumVertices(); ++j)
@@ -452,9 +577,12 @@ FarMeshFactory<T,U>::generatePtexCoordinates( std::vector<int> & vec, int level
 
     if (_facesList[level][0]->GetPtexIndex() == -1) return;
 
-    vec.resize( _facesList[level].size()*2, -1 );
+    int nfaces = (int)_facesList[level].size();
+
+    vec.resize( nfaces*2, -1 );
 
-    for (int i=0; i<(int)_facesList[level].size(); ++i) {
+#pragma omp parallel for
+    for (int i=0; i<nfaces; ++i) {
 
         HbrFace<T> const * f = _facesList[level][i];
         assert(f);
@@ -525,7 +653,9 @@ FarMeshFactory<T,U>::Create( FarDispatcher<U> * dispatch ) {
     // XXXX : we should figure out a test to make sure that the vertex
     //        class is not an empty placeholder (ex. non-interleaved data)
     result->_vertices.resize( _numVertices );
-    for (int i=0; i<result->GetNumCoarseVertices(); ++i)
+    int ncoarse = result->GetNumCoarseVertices();
+#pragma omp parallel for
+    for (int i=0; i<ncoarse; ++i)
         copyVertex(result->_vertices[i], _hbrMesh->GetVertex(i)->GetData());
 
     // Populate topology (face verts indices)
@@ -547,9 +677,16 @@ FarMeshFactory<T,U>::Create( FarDispatcher<U> * dispatch ) {
         assert(result->_vertexEditTables);
     }
 
+    // Create FVarTables if necessary (the Loop face-varying rules are not
+    // serialized yet)
+    if (_hbrMesh->GetTotalFVarWidth() > 0 and not isLoop(_hbrMesh)) {
+        result->_fvarTables = FarFVarTablesFactory<T,U>::Create( this, result, _maxlevel );
+        assert(result->_fvarTables);
+    }
+
 #if BENCHMARKING
         // report mem usage by subd tables
-        printf(" tablemem=%d", result->_subdivisionTables->GetMemoryUsed());
+        printf(" tablemem=%lu", (unsigned long) result->_subdivisionTables->GetMemoryUsed());
 #endif
 
     return result;
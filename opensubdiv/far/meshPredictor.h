@@ -0,0 +1,381 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#ifndef FAR_MESH_PREDICTOR_H
+#define FAR_MESH_PREDICTOR_H
+
+#include <typeinfo>
+#include <algorithm>
+#include <vector>
+
+#include "../version.h"
+
+#include "../hbr/mesh.h"
+#include "../hbr/bilinear.h"
+#include "../hbr/catmark.h"
+#include "../hbr/loop.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+/// \brief Coarse topology statistics, from which FarMeshPredictor predicts the
+/// refined meshes.
+struct FarTopologyStatistics {
+
+    enum Scheme {
+        k_Bilinear,
+        k_Catmark,
+        k_Loop
+    };
+
+    FarTopologyStatistics() : scheme(k_Catmark), numVertices(0), numEdges(0), numFaces(0),
+        numBoundaryEdges(0), numCreasedEdges(0), numCreaseVertices(0), numCornerVertices(0) { }
+
+    Scheme scheme;
+
+    int numVertices,
+        numEdges,
+        numFaces;
+
+    int numBoundaryEdges,
+        numCreasedEdges,    // sharp or boundary edges
+        numCreaseVertices,  // vertices on creases or boundaries
+        numCornerVertices;
+
+    std::vector<int> valences,          // number of vertices of each valence
+                     boundaryValences,  // number of boundary vertices of each valence
+                     faceSizes;         // number of faces of each size
+};
+
+/// \brief Predicted size and build cost of a level of subdivision.
+struct FarLevelPrediction {
+
+    int numVertices,        // vertices of the level
+        numTotalVertices;   // vertices of the levels 0 to this one, as in the vertex buffers
+
+    size_t tableBytes;      // subdivision tables refining up to this level
+
+    long long nonzeros;     // matrix from the coarse vertices to the vertices of the level
+    size_t matrixBytes;     // in CSR format
+
+    double tableTime,       // seconds to refine the HbrMesh and build the tables
+           matrixTime;      // seconds to stage and compose the matrix
+};
+
+/// \brief Predicts the vertex counts, table and matrix sizes and build times of
+/// the levels of subdivision of a coarse mesh, without refining it.
+///
+/// The vertex counts and table sizes follow from the refinement rules of the
+/// scheme, and match the meshes FarMeshFactory builds from manifold coarse
+/// meshes (HbrMesh splits non-manifold vertices). The matrix rows hold about the stencil of the coarse vertices at the
+/// first level, and grow with every level towards the support of the limit
+/// surface of a coarse face. The build times scale rates that can be calibrated
+/// from a build of a similar mesh.
+
+template <class T> class FarMeshPredictor {
+
+public:
+
+    /// Gathers the statistics of a coarse HbrMesh that wasn't refined yet
+    FarMeshPredictor(HbrMesh<T> * mesh);
+
+    /// Predicts from statistics gathered by the caller
+    FarMeshPredictor(FarTopologyStatistics const & statistics);
+
+    FarTopologyStatistics const & GetStatistics() const { return _statistics; }
+
+    /// Sets the seconds spent per refined vertex to refine the HbrMesh and build
+    /// the tables, and per nonzero of each composed matrix to build the matrix
+    void SetRates(double secondsPerVertex, double secondsPerNonzero) {
+        _secondsPerVertex = secondsPerVertex;
+        _secondsPerNonzero = secondsPerNonzero;
+    }
+
+    /// Predicts the levels 1 to maxLevel, for matrices with row offsets of
+    /// offsetSize bytes
+    void Predict(int maxLevel, std::vector<FarLevelPrediction> & predictions,
+                 int offsetSize=sizeof(int)) const;
+
+    /// Returns the highest level up to maxLevel whose tables, and matrix if
+    /// withMatrix is set, fit in budget bytes, or 0 if none does
+    int GetMaxLevel(int maxLevel, size_t budget, bool withMatrix,
+                    int offsetSize=sizeof(int)) const;
+
+private:
+
+    FarTopologyStatistics _statistics;
+
+    double _secondsPerVertex,
+           _secondsPerNonzero;
+};
+
+template <class T>
+FarMeshPredictor<T>::FarMeshPredictor(FarTopologyStatistics const & statistics) :
+    _statistics(statistics), _secondsPerVertex(2.0e-6), _secondsPerNonzero(4.0e-7) { }
+
+template <class T>
+FarMeshPredictor<T>::FarMeshPredictor(HbrMesh<T> * mesh) :
+    _secondsPerVertex(2.0e-6), _secondsPerNonzero(4.0e-7) {
+
+    FarTopologyStatistics & s = _statistics;
+
+    if (typeid(*(mesh->GetSubdivision()))==typeid(HbrLoopSubdivision<T>))
+        s.scheme = FarTopologyStatistics::k_Loop;
+    else if (typeid(*(mesh->GetSubdivision()))==typeid(HbrBilinearSubdivision<T>))
+        s.scheme = FarTopologyStatistics::k_Bilinear;
+
+    int nfaces = mesh->GetNumFaces();
+    for (int i=0; i<nfaces; ++i) {
+        HbrFace<T> * f = mesh->GetFace(i);
+        if (not f)
+            continue;
+
+        int n = f->GetNumVertices();
+        if (n >= (int)s.faceSizes.size())
+            s.faceSizes.resize(n+1, 0);
+        ++s.faceSizes[n];
+        ++s.numFaces;
+
+        // interior edges are counted from one of their halfedges
+        for (int j=0; j<n; ++j) {
+            HbrHalfedge<T> * e = f->GetEdge(j);
+            if (e->IsBoundary()) {
+                ++s.numEdges;
+                ++s.numBoundaryEdges;
+                ++s.numCreasedEdges;
+            } else if (e < e->GetOpposite()) {
+                ++s.numEdges;
+                if (e->IsSharp(true))
+                    ++s.numCreasedEdges;
+            }
+        }
+    }
+
+    int nvertices = mesh->GetNumVertices();
+    for (int i=0; i<nvertices; ++i) {
+        HbrVertex<T> * v = mesh->GetVertex(i);
+        if (not v or not v->IsConnected())
+            continue;
+
+        int valence = v->GetValence();
+        if (valence >= (int)s.valences.size())
+            s.valences.resize(valence+1, 0);
+        ++s.valences[valence];
+        ++s.numVertices;
+
+        if (v->OnBoundary()) {
+            if (valence >= (int)s.boundaryValences.size())
+                s.boundaryValences.resize(valence+1, 0);
+            ++s.boundaryValences[valence];
+        }
+
+        unsigned char mask = v->GetMask(false);
+        if (mask == HbrVertex<T>::k_Corner)
+            ++s.numCornerVertices;
+        else if (mask == HbrVertex<T>::k_Crease or v->OnBoundary())
+            ++s.numCreaseVertices;
+    }
+}
+
+template <class T> void
+FarMeshPredictor<T>::Predict(int maxLevel, std::vector<FarLevelPrediction> & predictions,
+                             int offsetSize) const {
+
+    FarTopologyStatistics const & s = _statistics;
+
+    predictions.clear();
+    if (s.numVertices == 0 or s.numFaces == 0)
+        return;
+
+    // sums of the face sizes and valences, and of their squares
+    double sides = 0.0, sides2 = 0.0, valences2 = 0.0;
+    for (int n=0; n<(int)s.faceSizes.size(); ++n) {
+        sides += (double)n * s.faceSizes[n];
+        sides2 += (double)n * n * s.faceSizes[n];
+    }
+    for (int n=0; n<(int)s.valences.size(); ++n)
+        valences2 += (double)n * n * s.valences[n];
+
+    double V = s.numVertices,
+           E = s.numEdges,
+           F = s.numFaces,
+           smoothEdges = std::max(E - s.numCreasedEdges, 0.0),
+           smoothVertices = std::max(V - s.numCreaseVertices - s.numCornerVertices, 0.0) / V;
+
+    // nonzeroes of the first level: the stencils of the face, edge and vertex
+    // vertices (smooth, creased and corners), and the support of the limit
+    // surface of an average coarse face, from the valences of its corners
+    double nonzeros1 = 0.0, support = 0.0;
+    switch (s.scheme) {
+        case FarTopologyStatistics::k_Catmark:
+            nonzeros1 = sides +
+                        smoothEdges * (2.0*sides2/sides - 2.0) + 2.0 * s.numCreasedEdges +
+                        smoothVertices * (V + 2.0*E + sides2 - 3.0*sides) +
+                        3.0 * s.numCreaseVertices + s.numCornerVertices;
+            support = 2.0*valences2/F - 16.0;
+            break;
+        case FarTopologyStatistics::k_Loop:
+            nonzeros1 = smoothEdges * 4.0 + 2.0 * s.numCreasedEdges +
+                        smoothVertices * (V + 2.0*E) +
+                        3.0 * s.numCreaseVertices + s.numCornerVertices;
+            support = valences2/F - 6.0;
+            break;
+        case FarTopologyStatistics::k_Bilinear:
+            nonzeros1 = sides + 2.0*E + V;
+            support = sides/F;
+            break;
+    }
+
+    // a vertex of the first level depends on its stencil of coarse vertices, and the
+    // vertices of every further level on more of them, up to the support of their
+    // coarse face, which creases cut short
+    double rows1 = s.scheme == FarTopologyStatistics::k_Loop ? V + E : V + E + F,
+           stencil1 = nonzeros1 / rows1,
+           limit = std::max(stencil1 + std::max(support - stencil1, 0.0) * smoothEdges / E, sides / F),
+           gap = 2.0 * (limit - stencil1);
+
+    // the tables index the neighbors of the vertices of every level up to the
+    // finest, as FarMeshFactory counts them : all of them around an interior
+    // vertex, a single one for the boundary vertices of valence other than 2.
+    // The children of the boundary vertices keep their valence, the children of
+    // the boundary edges have a valence of 3 (4 with Loop).
+    double boundaryValences = 0.0, boundaryNeighbors = 0.0;
+    for (int n=0; n<(int)s.boundaryValences.size(); ++n) {
+        boundaryValences += (double)n * s.boundaryValences[n];
+        if (n != 2)
+            boundaryNeighbors += s.boundaryValences[n];
+    }
+    double edgeValence = s.scheme == FarTopologyStatistics::k_Loop ? 4.0 : 3.0;
+
+    // the tables also index the coarse vertices
+    double v = V, e = E, f = F, b = s.numBoundaryEdges,
+           total = V, nonzeros = 0.0, entries = 0.0,
+           neighbors = 2.0*E - boundaryValences + boundaryNeighbors;
+    switch (s.scheme) {
+        case FarTopologyStatistics::k_Catmark: entries = 6.0*V + 2.0*neighbors; break;
+        case FarTopologyStatistics::k_Loop: entries = 6.0*V + neighbors; break;
+        case FarTopologyStatistics::k_Bilinear: entries = V; break;
+    }
+
+    for (int level=1; level<=maxLevel; ++level) {
+
+        boundaryValences += edgeValence * b;
+        boundaryNeighbors += b;
+        b = 2.0*b;
+
+        // tables refining the parent level
+        if (s.scheme == FarTopologyStatistics::k_Loop) {
+            double edges = 2.0*e + 3.0*f;
+            neighbors = 2.0*edges - boundaryValences + boundaryNeighbors;
+            entries += 6.0*e + 6.0*v + neighbors;
+            v = v + e;
+            e = edges;
+            f = 4.0*f;
+        } else {
+            double edges = 2.0*e + sides;
+            neighbors = 2.0*edges - boundaryValences + boundaryNeighbors;
+            if (s.scheme == FarTopologyStatistics::k_Catmark)
+                entries += 2.0*f + sides + 6.0*e + 6.0*v + 2.0*neighbors;
+            else
+                entries += 2.0*f + sides + 2.0*e + v;
+            v = v + e + f;
+            e = edges;
+            f = sides;
+            sides = 4.0*f;
+        }
+        total += v;
+        gap *= 0.5;
+
+        double stencil = std::min(limit - gap, V);
+
+        FarLevelPrediction p;
+        p.numVertices = (int)v;
+        p.numTotalVertices = (int)total;
+        p.tableBytes = (size_t)(entries * sizeof(int));
+        p.nonzeros = (long long)(v * stencil);
+        p.matrixBytes = (size_t)p.nonzeros * (sizeof(int)+sizeof(float)) + (size_t)(v+1) * offsetSize;
+
+        nonzeros += (double)p.nonzeros;
+        p.tableTime = _secondsPerVertex * (total - V);
+        p.matrixTime = _secondsPerNonzero * nonzeros;
+
+        predictions.push_back(p);
+    }
+}
+
+template <class T> int
+FarMeshPredictor<T>::GetMaxLevel(int maxLevel, size_t budget, bool withMatrix, int offsetSize) const {
+
+    std::vector<FarLevelPrediction> predictions;
+    Predict(maxLevel, predictions, offsetSize);
+
+    int result = 0;
+    for (int i=0; i<(int)predictions.size(); ++i) {
+        size_t bytes = predictions[i].tableBytes;
+        if (withMatrix)
+            bytes += predictions[i].matrixBytes;
+        if (bytes <= budget)
+            result = i+1;
+    }
+    return result;
+}
+
+} // end namespace OPENSUBDIV_VERSION
+using namespace OPENSUBDIV_VERSION;
+
+} // end namespace OpenSubdiv
+
+#endif /* FAR_MESH_PREDICTOR_H */
@@ -57,11 +57,15 @@
 #ifndef FAR_SUBDIVISION_TABLES_H
 #define FAR_SUBDIVISION_TABLES_H
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <map>
 #include <utility>
 #include <vector>
 
 #include "../version.h"
+#include "../hbr/mesh.h"
 #include "../far/table.h"
 
 namespace OpenSubdiv {
@@ -70,6 +74,42 @@ namespace OPENSUBDIV_VERSION {
 template <class U> class FarMesh;
 template <class U> class FarDispatcher;
 
+/// \brief Vertex data of the local refinements of limit stencils.
+///
+/// Holds the weights of the vertices of the level pushed to the limit, by
+/// index in that level, so that refining a copy of the neighborhood of a
+/// vertex with Hbr yields the stencils of the refined vertices.
+class FarLimitStencilVertex {
+public:
+    FarLimitStencilVertex() { }
+
+    FarLimitStencilVertex( int /* index */ ) { }
+
+    FarLimitStencilVertex( FarLimitStencilVertex const & src ) : _weights(src._weights) { }
+
+    /// Sets the stencil of the vertex of the given index
+    void SetIndex( int index ) { _weights.clear(); _weights[index] = 1.0f; }
+
+    /// Weights of the stencil, by vertex index
+    std::map<int, float> const & GetWeights() const { return _weights; }
+
+    void AddWithWeight( FarLimitStencilVertex const & src, float weight, void * =0 ) {
+        for (std::map<int, float>::const_iterator it=src._weights.begin(); it!=src._weights.end(); ++it)
+            _weights[it->first] += weight * it->second;
+    }
+
+    void AddVaryingWithWeight( FarLimitStencilVertex const &, float, void * =0 ) { }
+
+    void Clear( void * =0 ) { _weights.clear(); }
+
+    void ApplyVertexEdit( HbrVertexEdit<FarLimitStencilVertex> const & ) { }
+
+    void ApplyMovingVertexEdit( HbrMovingVertexEdit<FarLimitStencilVertex> const & ) { }
+
+private:
+    std::map<int, float> _weights;
+};
+
 /// \brief FarSubdivisionTables are a serialized topological data representation.
 ///
 /// Subdivision tables store the indexing tables required in order to compute
@@ -106,12 +146,24 @@ public:
     int GetMaxLevel() const { return (int)(_vertsOffsets.size()); }
 
     /// Memory required to store the indexing tables
-    virtual int GetMemoryUsed() const;
+    virtual size_t GetMemoryUsed() const;
 
     /// Compute the positions of refined vertices using the specified kernels
-    virtual void Apply( int level, void * clientdata=0 ) const=0;
-    virtual void PushToLimitSurface( int level, void * clientdata=0 );
-    virtual void PushLimitMatrix(int nverts, int offset) = 0;
+    void Apply( int level, void * clientdata=0 ) const;
+
+    /// Same as Apply, with the kernels of dispatch rather than the ones of the
+    /// mesh dispatcher, e.g. to stage a matrix on another thread
+    virtual void Apply( int level, FarDispatcher<U> * dispatch, void * clientdata=0 ) const=0;
+
+    /// Stages the matrix projecting the vertices of a level onto the limit
+    /// surface, with the mesh dispatcher
+    void PushToLimitSurface( int level, void * clientdata=0 );
+
+    /// Same as PushToLimitSurface, with dispatch rather than the mesh dispatcher
+    virtual void PushToLimitSurface( int level, FarDispatcher<U> * dispatch, void * clientdata=0 );
+
+    /// Stages the limit matrix of the nverts vertices starting at offset
+    virtual void PushLimitMatrix( int nverts, int offset, FarDispatcher<U> * dispatch ) = 0;
 
     /// Pointer back to the mesh owning the table
     FarMesh<U> * GetMesh() { return _mesh; }
@@ -155,6 +207,7 @@ public:
 
 public:
     template <class X, class Y> friend class FarMeshFactory;
+    friend class FarMesh<U>;
 
     FarSubdivisionTables<U>( FarMesh<U> * mesh, int maxlevel );
 
@@ -204,6 +257,41 @@ public:
     std::vector<VertexKernelBatch> & getKernelBatches() const { return _batches; }
 
 protected:
+    // True if 'vertex' or one of its edges has a semi-sharp crease, which
+    // decays in the levels below
+    template <class T> static bool isSemiSharp( HbrVertex<T> * vertex );
+
+    // True if the limit of 'vertex' has a closed-form stencil : its features
+    // are smooth or infinitely sharp, and it is not a dart
+    static bool hasClosedFormLimit( HbrVertex<U> * vertex );
+
+    // Stages the limit stencil of the k_Crease and k_Corner rules for row 'vi'
+    // of the limit matrix. Infinitely sharp creases are uniform cubic B-splines
+    // along the two sharp edges for both Catmark and Loop, so their limit is
+    // (a + 4v + b)/6. Returns false if 'mask' is k_Smooth or k_Dart : those
+    // limit stencils are scheme specific.
+    bool pushSharpLimitStencil( FarDispatcher<U> * dispatch, HbrVertex<U> * vertex, int mask, int vi, int offset );
+
+    // Stages the limit stencil of a vertex without closed-form stencil for row
+    // 'vi' of the limit matrix. A copy of the neighborhood of the vertex is
+    // refined with 'subdivision' until its semi-sharp features have decayed,
+    // then the limit is the left eigenvector of eigenvalue 1 of the matrix
+    // refining its ring of vertices, which is the same at every level below.
+    void pushRefinedLimitStencil( FarDispatcher<U> * dispatch, HbrSubdivision<FarLimitStencilVertex> * subdivision,
+                                  HbrVertex<U> * vertex, int vi, int offset );
+
+    // Copies the faces around 'vertex', and their sharpness, into an empty
+    // patch. Returns the copy of 'vertex', and the vertex copied as each vertex
+    // of the patch in 'sources'.
+    template <class T> static HbrVertex<FarLimitStencilVertex> * copyNeighborhood( HbrVertex<T> * vertex,
+        HbrMesh<FarLimitStencilVertex> * patch, std::vector<HbrVertex<T> *> & sources );
+
+    // Computes the weights of the limit of 'vertex' by vertex of its ring, if
+    // the ring is refined into a ring of the same layout. Returns false
+    // otherwise, e.g. if some faces are not quads yet on a Catmark mesh.
+    static bool getRingLimit( HbrVertex<FarLimitStencilVertex> * vertex,
+        std::vector<HbrVertex<FarLimitStencilVertex> *> & ring, std::vector<double> & limit );
+
     // mesh that owns this subdivisionTable
     FarMesh<U> * _mesh;
 
@@ -262,6 +350,11 @@ FarSubdivisionTables<U>::getMaskRanking( unsigned char mask0, unsigned char mask
     return masks[mask0][mask1];
 }
 
+template <class U> void
+FarSubdivisionTables<U>::Apply( int level, void * clientdata ) const {
+    Apply(level, _mesh->GetDispatcher(), clientdata);
+}
+
 template <class U> int
 FarSubdivisionTables<U>::GetFirstVertexOffset( int level ) const {
     assert(level>=0 and level<=(int)_vertsOffsets.size());
@@ -302,7 +395,7 @@ FarSubdivisionTables<U>::GetNumVertices( int level ) const {
                GetNumVertexVertices(level);
 }
 
-template <class U> int
+template <class U> size_t
 FarSubdivisionTables<U>::GetMemoryUsed() const {
     return _E_IT.GetMemoryUsed()+
            _E_W.GetMemoryUsed()+
@@ -311,14 +404,295 @@ FarSubdivisionTables<U>::GetMemoryUsed() const {
            _V_W.GetMemoryUsed();
 }
 
+template <class U> template <class T> bool
+FarSubdivisionTables<U>::isSemiSharp( HbrVertex<T> * vertex ) {
+
+    float sharpness = vertex->GetSharpness();
+    if (sharpness > HbrVertex<T>::k_Smooth and sharpness < HbrVertex<T>::k_InfinitelySharp)
+        return true;
+
+    // walk the ring the same way as HbrVertex<T>::GetMask
+    HbrHalfedge<T> * start = vertex->GetIncidentEdge(), * edge = start;
+    while (edge) {
+        HbrHalfedge<T> * next = vertex->GetNextEdge(edge);
+        for (int k=0; k<(next ? 1 : 2); ++k) {
+            // on a boundary, the last edge of the ring ends at 'vertex'
+            sharpness = (k==0 ? edge : edge->GetPrev())->GetSharpness();
+            if (sharpness > HbrHalfedge<T>::k_Smooth and sharpness < HbrHalfedge<T>::k_InfinitelySharp)
+                return true;
+        }
+        if (next==start)
+            break;
+        edge = next;
+    }
+    return false;
+}
+
+template <class U> bool
+FarSubdivisionTables<U>::hasClosedFormLimit( HbrVertex<U> * vertex ) {
+
+    // smooth boundaries (no boundary interpolation) have no limit
+    if (vertex->OnBoundary() and
+        vertex->GetMesh()->GetInterpolateBoundaryMethod()==HbrMesh<U>::k_InterpolateBoundaryNone)
+        return true;
+
+    // the sharp edge of a dart changes the refinement of its ring, which the
+    // smooth limit stencil ignores
+    return not isSemiSharp(vertex) and vertex->GetMask(false)!=HbrVertex<U>::k_Dart;
+}
+
+template <class U> bool
+FarSubdivisionTables<U>::pushSharpLimitStencil( FarDispatcher<U> * dispatch, HbrVertex<U> * vertex, int mask, int vi, int offset ) {
+
+    switch (mask) {
+        case HbrVertex<U>::k_Crease : {
+            // gather the (hopefully only two) sharp edges, walking the ring
+            // the same way as HbrVertex<T>::ApplyOperatorSurroundingEdges
+            std::vector<HbrHalfedge<U> *> ring;
+            HbrHalfedge<U> * start = vertex->GetIncidentEdge(), * edge = start, * nextedge;
+            while (edge) {
+                ring.push_back(edge);
+                nextedge = vertex->GetNextEdge(edge);
+                if (nextedge == start) {
+                    break;
+                } else if (not nextedge) {
+                    ring.push_back(edge->GetPrev());
+                    break;
+                }
+                edge = nextedge;
+            }
+
+            HbrVertex<U> * neighbors[2] = { 0, 0 };
+            int count = 0;
+            for (int k=0; k<(int)ring.size() and count<2; ++k) {
+                if (ring[k]->IsSharp(false)) {
+                    HbrVertex<U> * a = ring[k]->GetDestVertex();
+                    if (a == vertex)
+                        a = ring[k]->GetOrgVertex();
+                    neighbors[count++] = a;
+                }
+            }
+            if (count < 2) {
+                // degenerate crease : keep the control point
+                dispatch->StageElem(vi, vi, 1.0f);
+                break;
+            }
+
+            dispatch->StageElem(vi, vi, 4.0f / 6.0f);
+            for (int k=0; k<2; ++k)
+                dispatch->StageElem(vi, this->_mesh->GetFarVertexID(neighbors[k]) - offset, 1.0f / 6.0f);
+            break;
+        }
+        case HbrVertex<U>::k_Corner :
+            // corners interpolate their control point
+            dispatch->StageElem(vi, vi, 1.0f);
+            break;
+
+        default :
+            return false;
+    }
+    return true;
+}
+
+template <class U> template <class T> HbrVertex<FarLimitStencilVertex> *
+FarSubdivisionTables<U>::copyNeighborhood( HbrVertex<T> * vertex,
+    HbrMesh<FarLimitStencilVertex> * patch, std::vector<HbrVertex<T> *> & sources ) {
+
+    std::vector<HbrFace<T> *> faces;
+    HbrHalfedge<T> * start = vertex->GetIncidentEdge(), * edge = start;
+    while (edge) {
+        faces.push_back(edge->GetLeftFace());
+        edge = vertex->GetNextEdge(edge);
+        if (edge==start)
+            break;
+    }
+
+    std::map<HbrVertex<T> *, int> ids;
+    for (int i=0; i<(int)faces.size(); ++i) {
+        int nv = faces[i]->GetNumVertices();
+        std::vector<int> corners(nv);
+        for (int j=0; j<nv; ++j) {
+            HbrVertex<T> * corner = faces[i]->GetVertex(j);
+            typename std::map<HbrVertex<T> *, int>::iterator it = ids.find(corner);
+            if (it==ids.end()) {
+                it = ids.insert(std::make_pair(corner, (int)sources.size())).first;
+                sources.push_back(corner);
+                patch->NewVertex(it->second, FarLimitStencilVertex())->SetSharpness(corner->GetSharpness());
+            }
+            corners[j] = it->second;
+        }
+        patch->NewFace(nv, &corners[0], 0);
+    }
+
+    for (int i=0; i<(int)faces.size(); ++i)
+        for (int j=0; j<faces[i]->GetNumVertices(); ++j)
+            patch->GetFace(i)->GetEdge(j)->SetSharpness(faces[i]->GetEdge(j)->GetSharpness());
+
+    patch->SetInterpolateBoundaryMethod(
+        (typename HbrMesh<FarLimitStencilVertex>::InterpolateBoundaryMethod)
+            vertex->GetMesh()->GetInterpolateBoundaryMethod());
+    patch->Finish();
+
+    return patch->GetVertex(ids[vertex]);
+}
+
+template <class U> bool
+FarSubdivisionTables<U>::getRingLimit( HbrVertex<FarLimitStencilVertex> * vertex,
+    std::vector<HbrVertex<FarLimitStencilVertex> *> & ring, std::vector<double> & limit ) {
+
+    typedef FarLimitStencilVertex V;
+
+    // refine a copy of the ring whose vertices are their own stencils : the
+    // stencils of the refined ring are the rows of the refinement matrix
+    HbrMesh<V> patch(vertex->GetMesh()->GetSubdivision());
+    HbrVertex<V> * center = copyNeighborhood(vertex, &patch, ring);
+
+    int n = (int)ring.size();
+    for (int i=0; i<n; ++i)
+        patch.GetVertex(i)->GetData().SetIndex(i);
+
+    center->Refine();
+    HbrVertex<V> * child = center->Subdivide();
+
+    // each vertex of the refined ring stands for its parent, or for the vertex
+    // across its parent face (see FarCatmarkSubdivisionTables), in the ring
+    std::vector<HbrVertex<V> *> children;
+    std::vector<HbrFace<V> *> faces;
+    HbrHalfedge<V> * start = child->GetIncidentEdge(), * edge = start;
+    while (edge) {
+        faces.push_back(edge->GetLeftFace());
+        edge = child->GetNextEdge(edge);
+        if (edge==start)
+            break;
+    }
+    for (int i=0; i<(int)faces.size(); ++i)
+        for (int j=0; j<faces[i]->GetNumVertices(); ++j)
+            if (std::find(children.begin(), children.end(), faces[i]->GetVertex(j))==children.end())
+                children.push_back(faces[i]->GetVertex(j));
+
+    if ((int)children.size()!=n)
+        return false;
+
+    std::vector<double> S(n*n, 0.0);
+    std::vector<bool> found(n, false);
+    for (int i=0; i<n; ++i) {
+        HbrVertex<V> * parent = 0;
+        if (children[i]==child) {
+            parent = center;
+        } else if (HbrHalfedge<V> * pe = children[i]->GetParentEdge()) {
+            parent = pe->GetOrgVertex()==center ? pe->GetDestVertex() : pe->GetOrgVertex();
+        } else if (HbrFace<V> * pf = children[i]->GetParentFace()) {
+            if (pf->GetNumVertices()!=4)
+                return false;
+            for (int j=0; j<4; ++j)
+                if (pf->GetVertex(j)==center)
+                    parent = pf->GetVertex((j+2)%4);
+        }
+        if (not parent or found[parent->GetID()])
+            return false;
+        found[parent->GetID()] = true;
+
+        std::map<int, float> const & weights = children[i]->GetData().GetWeights();
+        for (std::map<int, float>::const_iterator it=weights.begin(); it!=weights.end(); ++it)
+            S[parent->GetID()*n + it->first] = it->second;
+    }
+
+    // solve l (S - I) = 0 with sum(l) = 1, replacing the last equation by
+    // the normalization
+    std::vector<double> A(n*(n+1), 0.0);
+    for (int q=0; q<n-1; ++q) {
+        for (int p=0; p<n; ++p)
+            A[q*(n+1)+p] = S[p*n+q] - (p==q ? 1.0 : 0.0);
+    }
+    for (int p=0; p<n; ++p)
+        A[(n-1)*(n+1)+p] = 1.0;
+    A[(n-1)*(n+1)+n] = 1.0;
+
+    for (int c=0; c<n; ++c) {
+        int pivot = c;
+        for (int r=c+1; r<n; ++r)
+            if (fabs(A[r*(n+1)+c]) > fabs(A[pivot*(n+1)+c]))
+                pivot = r;
+        if (fabs(A[pivot*(n+1)+c]) < 1e-12)
+            return false;
+        for (int k=0; k<=n; ++k)
+            std::swap(A[c*(n+1)+k], A[pivot*(n+1)+k]);
+        for (int r=0; r<n; ++r) {
+            if (r==c)
+                continue;
+            double f = A[r*(n+1)+c] / A[c*(n+1)+c];
+            for (int k=c; k<=n; ++k)
+                A[r*(n+1)+k] -= f * A[c*(n+1)+k];
+        }
+    }
+
+    limit.resize(n);
+    for (int p=0; p<n; ++p)
+        limit[p] = A[p*(n+1)+n] / A[p*(n+1)+p];
+    return true;
+}
+
+template <class U> void
+FarSubdivisionTables<U>::pushRefinedLimitStencil( FarDispatcher<U> * dispatch,
+    HbrSubdivision<FarLimitStencilVertex> * subdivision, HbrVertex<U> * vertex, int vi, int offset ) {
+
+    typedef FarLimitStencilVertex V;
+
+    // sharpness decays by one per level, and is infinite from 10 on
+    static const int maxLevels = HbrVertex<U>::k_InfinitelySharp + 2;
+
+    subdivision->SetCreaseSubdivisionMethod((typename HbrSubdivision<V>::CreaseSubdivision)
+        vertex->GetMesh()->GetSubdivision()->GetCreaseSubdivisionMethod());
+
+    HbrMesh<V> patch(subdivision);
+    std::vector<HbrVertex<U> *> sources;
+    HbrVertex<V> * center = copyNeighborhood(vertex, &patch, sources);
+
+    for (int i=0; i<(int)sources.size(); ++i)
+        patch.GetVertex(i)->GetData().SetIndex(this->_mesh->GetFarVertexID(sources[i]) - offset);
+
+    std::map<int, float> weights;
+    for (int level=0; level<=maxLevels; ++level) {
+
+        std::vector<HbrVertex<V> *> ring;
+        std::vector<double> limit;
+        if (not isSemiSharp(center) and getRingLimit(center, ring, limit)) {
+            // the copy of the ring points at the vertices of the patch
+            for (int i=0; i<(int)ring.size(); ++i) {
+                std::map<int, float> const & w = ring[i]->GetData().GetWeights();
+                for (std::map<int, float>::const_iterator it=w.begin(); it!=w.end(); ++it)
+                    weights[it->first] += (float)(limit[i] * it->second);
+            }
+            break;
+        }
+
+        if (level==maxLevels) {
+            // no stationary ring was reached : keep the deepest vertex
+            weights = center->GetData().GetWeights();
+            break;
+        }
+
+        center->Refine();
+        center = center->Subdivide();
+    }
+
+    for (std::map<int, float>::const_iterator it=weights.begin(); it!=weights.end(); ++it)
+        dispatch->StageElem(vi, it->first, it->second);
+}
+
 template <class U> void
 FarSubdivisionTables<U>::PushToLimitSurface( int level, void * clientdata ) {
+    PushToLimitSurface(level, _mesh->GetDispatcher(), clientdata);
+}
+
+template <class U> void
+FarSubdivisionTables<U>::PushToLimitSurface( int level, FarDispatcher<U> * dispatch, void * clientdata ) {
 
     int nverts = this->GetNumVertices( level );
     int offset = this->GetFirstVertexOffset( level );
 
     /* Build and push projection matrix */
-    this->PushLimitMatrix(nverts, offset);
+    this->PushLimitMatrix(nverts, offset, dispatch);
 }
 
 template <class U>
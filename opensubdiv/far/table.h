@@ -75,21 +75,28 @@ namespace OPENSUBDIV_VERSION {
 template <typename Type> class FarTable {
     std::vector<Type>   _data;     // table data
     std::vector<Type *> _markers;  // pointers to the first datum at each level
+    size_t              _size;     // number of elements (in _data, or attached)
 public:
 
-    FarTable() { }
+    FarTable() : _size(0) { }
 
-    FarTable(int maxlevel) : _markers(maxlevel) { }
+    FarTable(int maxlevel) : _markers(maxlevel), _size(0) { }
 
     /// Reset max level and clear data
     void SetMaxLevel(int maxlevel) {
         _data.clear();
         _markers.resize(maxlevel);
+        _size = 0;
+    }
+
+    /// Returns the number of markers (levels) of the table
+    int GetNumMarkers() const {
+        return (int)_markers.size();
     }
 
     /// Returns the memory required to store the data in this table.
-    int GetMemoryUsed() const {
-        return (int)_data.size() * sizeof(Type);
+    size_t GetMemoryUsed() const {
+        return _size * sizeof(Type);
     }
 
     /// Returns the number of elements in level "level"
@@ -107,9 +114,19 @@ public:
     /// Resize the table to size (also resets markers)
     void Resize(int size) {
         _data.resize(size);
+        _size = _data.size();
         _markers[0] = &_data[0];
     }
 
+    /// Points the table at size elements stored elsewhere (e.g. in a mapped
+    /// file), which must outlive the table. Resets the first marker, the others
+    /// have to be set with SetMarker.
+    void Attach(Type * data, size_t size) {
+        _data.clear();
+        _size = size;
+        _markers[0] = data;
+    }
+
     /// Returns a pointer to the data at the beginning of level "level" of
     /// subdivision
     Type * operator[](int level) {
@@ -0,0 +1,1439 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#ifndef FAR_TOPOLOGY_REFINER_H
+#define FAR_TOPOLOGY_REFINER_H
+
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+#include "../version.h"
+
+#include "../far/mesh.h"
+#include "../far/dispatcher.h"
+#include "../far/bilinearSubdivisionTables.h"
+#include "../far/catmarkSubdivisionTables.h"
+#include "../far/loopSubdivisionTables.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+/// \brief Coarse topology of a mesh as flat arrays, from which FarTopologyRefiner
+/// builds a FarMesh without an HbrMesh.
+///
+/// Creases, corners and boundaries have the semantics of the "crease", "corner"
+/// and "interpolateboundary" tags applied to an HbrMesh. Holes, hierarchical
+/// edits, face-varying data and the Chaikin crease rule are not supported.
+struct FarTopologyDescriptor {
+
+    enum Scheme {
+        k_Bilinear,
+        k_Catmark,
+        k_Loop
+    };
+
+    // same values as HbrMesh<T>::InterpolateBoundaryMethod
+    enum InterpolateBoundary {
+        k_InterpolateBoundaryNone,
+        k_InterpolateBoundaryEdgeOnly,
+        k_InterpolateBoundaryEdgeAndCorner
+    };
+
+    // same values as HbrCatmarkSubdivision<T>::TriangleSubdivision
+    enum TriangleSubdivision {
+        k_TriangleNormal,
+        k_TriangleOld,
+        k_TriangleNew
+    };
+
+    FarTopologyDescriptor() : scheme(k_Catmark), interpolateBoundary(k_InterpolateBoundaryNone),
+        triangleSubdivision(k_TriangleNormal), numVertices(0) { }
+
+    Scheme scheme;
+
+    InterpolateBoundary interpolateBoundary;
+
+    TriangleSubdivision triangleSubdivision; // Catmark only
+
+    int numVertices;
+
+    std::vector<int> numVertsPerFace,   // number of vertices of each face
+                     vertIndices;       // vertices of each face, counter-clockwise
+
+    std::vector<int> creaseIndices;     // pairs of vertices of the creased edges
+    std::vector<float> creaseSharpness; // one per edge, or one for all of them
+
+    std::vector<int> cornerIndices;     // sharp vertices
+    std::vector<float> cornerSharpness; // one per vertex, or one for all of them
+};
+
+/// \brief Instantiates a FarMesh from a FarTopologyDescriptor.
+///
+/// FarTopologyRefiner replays the uniform refinement of an HbrMesh on compact
+/// per-level arrays : the vertices of each level are created in the order of
+/// the HbrMesh vertex IDs, so that the subdivision tables, face vertices, ptex
+/// coordinates and remapping tables are identical to the ones FarMeshFactory
+/// builds from an HbrMesh of the same topology (with ptex indices assigned in
+/// face order, n for the non-quads of Catmark and Bilinear meshes, 1 for the
+/// other faces).
+///
+/// The FarMesh has no HbrMesh : it can't be pushed to the limit surface, and
+/// the coarse vertices are left for the client to fill.
+///
+/// Non-manifold topology is rejected : HbrMesh splits the vertices where the
+/// faces form several fans, which would number the vertices differently.
+
+template <class U> class FarTopologyRefiner {
+
+public:
+
+    // Refines the topology up to maxlevel. Once the FarMesh has been created,
+    // the refiner can be deleted safely.
+    FarTopologyRefiner(FarTopologyDescriptor const & descriptor, int maxlevel);
+
+    /// Create a table-based mesh representation. Returns NULL if the coarse
+    /// mesh has non-manifold edges or vertices, or vertices without faces.
+    FarMesh<U> * Create( FarDispatcher<U> * dispatch=0 );
+
+    /// Returns false if the coarse mesh can't be refined (see Create)
+    bool IsManifold() const { return _manifold; }
+
+    /// Maximum level of subidivision supported by this refiner
+    int GetMaxLevel() const { return _maxlevel; }
+
+    /// Total number of vertices up to maxlevel
+    int GetNumVertices() const { return _numVertices; }
+
+    /// Returns the mapping between the HbrVertex IDs of an HbrMesh of the same
+    /// topology and the Far vertices indices
+    std::vector<int> const & GetRemappingTable( ) const { return _remapTable; }
+    std::vector<int> const & GetUnmappingTable( ) const { return _unmapTable; }
+
+private:
+
+    // Non-copyable, so these are not implemented:
+    FarTopologyRefiner( FarTopologyRefiner const & );
+    FarTopologyRefiner<U> & operator=(FarTopologyRefiner<U> const &);
+
+    enum VertexType {
+        k_Coarse,
+        k_FaceChild,
+        k_EdgeChild,
+        k_VertexChild
+    };
+
+    // Topology of a level of subdivision. The halfedges are stored face by face:
+    // the halfedge i of a face starts at its vertex i.
+    struct Level {
+
+        Level() : firstVertexID(0) { }
+
+        int GetNumFaces() const { return (int)faceParents.size(); }
+
+        int GetNumVertices() const { return (int)vertParents.size(); }
+
+        int GetNumFaceVertices(int face) const { return faceOffsets[face+1]-faceOffsets[face]; }
+
+        int GetNext(int edge) const {
+            int first = faceOffsets[edgeFaces[edge]];
+            return first + (edge-first+1) % GetNumFaceVertices(edgeFaces[edge]);
+        }
+
+        int GetPrev(int edge) const {
+            int first = faceOffsets[edgeFaces[edge]],
+                nv = GetNumFaceVertices(edgeFaces[edge]);
+            return first + (edge-first+nv-1) % nv;
+        }
+
+        int GetDestVertex(int edge) const { return edgeVerts[GetNext(edge)]; }
+
+        // next halfedge counter-clockwise around the origin vertex (-1 past a boundary)
+        int GetNextEdge(int edge) const { return edgeOpposites[GetPrev(edge)]; }
+
+        int firstVertexID;              // HbrVertex ID of the first vertex
+
+        std::vector<int> faceOffsets,   // first halfedge of each face, and the end
+                         faceParents,
+                         faceChildIndices,
+                         facePtex,
+                         faceChildren;  // child vertex of each face
+
+        std::vector<int> edgeVerts,     // origin vertex of each halfedge
+                         edgeFaces,
+                         edgeOpposites, // -1 on boundaries
+                         edgeChildren;  // child vertex, held by the halfedge that created it
+
+        std::vector<float> edgeSharpness;
+
+        std::vector<int> vertParents,   // parent face, halfedge or vertex
+                         vertEdges,     // incident halfedge, as in HbrVertex
+                         vertChildren;
+
+        std::vector<unsigned char> vertTypes,
+                                   vertMasks[2];
+
+        std::vector<float> vertSharpness;
+    };
+
+    struct compareRanks {
+        compareRanks(std::vector<unsigned char> const & ranks) : _ranks(&ranks) { }
+
+        bool operator() (int x, int y) const { return (*_ranks)[x] < (*_ranks)[y]; }
+
+        std::vector<unsigned char> const * _ranks;
+    };
+
+    static float subdivideSharpness( float sharpness );
+
+    static bool isSharp( float sharpness, bool next ) {
+        return next ? (sharpness > 0.0f) : (sharpness >= 1.0f);
+    }
+
+    static int findEdge( Level const & level, int org, int dest );
+
+    static bool finalizeTopology( Level & level );
+
+    static unsigned char getMask( Level const & level, int vertex, bool next );
+
+    static float getFractionalMask( Level const & level, int vertex );
+
+    static void getCreaseEdges( Level const & level, int vertex, bool next, int eidx[2] );
+
+    void initializeCoarseLevel( FarTopologyDescriptor const & descriptor );
+
+    int newVertex( int level, VertexType type, int parent );
+
+    int subdivideFace( int level, int face );
+
+    int subdivideEdge( int level, int edge );
+
+    int subdivideVertex( int level, int vertex );
+
+    void refineFace( int level, int face );
+
+    void refineTriangle( int level, int face );
+
+    void refineLevel( int level );
+
+    void addFace( Level & level, int nverts, int const * verts, float const * sharpness,
+                  int parent, int childIndex, int ptex );
+
+    void numberVertices();
+
+    int getFarID( int level, int vertex ) const {
+        return _remapTable[ _levels[level].firstVertexID + vertex ];
+    }
+
+    static int sumList( std::vector<std::vector<int> > const & list, int level );
+
+    int getNumFacesTotal( int level ) const;
+
+    int getNumAdjacentVertVerticesTotal( int level ) const;
+
+    FarCatmarkSubdivisionTables<U> * createCatmarkTables( FarMesh<U> * mesh );
+
+    FarLoopSubdivisionTables<U> * createLoopTables( FarMesh<U> * mesh );
+
+    FarBilinearSubdivisionTables<U> * createBilinearTables( FarMesh<U> * mesh );
+
+    void copyTopology( std::vector<int> & vec, int level );
+
+    void generatePtexCoordinates( std::vector<int> & vec, int level );
+
+private:
+    FarTopologyDescriptor::Scheme _scheme;
+
+    FarTopologyDescriptor::TriangleSubdivision _triangleSubdivision;
+
+    int _maxlevel,
+        _numVertices;
+
+    bool _manifold;
+
+    std::vector<Level> _levels;
+
+    // per-level offsets to the first vertex of each type (face,edge,vert)
+    std::vector<int> _faceVertIdx,
+                     _edgeVertIdx,
+                     _vertVertIdx;
+
+    // number of indices required for the vertex iteration table at each level
+    std::vector<int> _vertVertsListSize;
+
+    // remapping tables between the HbrVertex IDs and the order of the vertices
+    // in the tables
+    std::vector<int> _remapTable,
+                     _unmapTable;
+
+    // vertices of each level sorted by type, as in FarMeshFactory
+    std::vector<std::vector<int> > _faceVertsList,
+                                   _edgeVertsList,
+                                   _vertVertsList;
+};
+
+template <class U>
+FarTopologyRefiner<U>::FarTopologyRefiner( FarTopologyDescriptor const & descriptor, int maxlevel ) :
+    _scheme(descriptor.scheme),
+    _triangleSubdivision(descriptor.triangleSubdivision),
+    _maxlevel(maxlevel),
+    _numVertices(0),
+    _manifold(true),
+    _levels(maxlevel+1),
+    _faceVertIdx(maxlevel+1,0),
+    _edgeVertIdx(maxlevel+1,0),
+    _vertVertIdx(maxlevel+1,0),
+    _vertVertsListSize(maxlevel+1,0),
+    _faceVertsList(maxlevel+1),
+    _edgeVertsList(maxlevel+1),
+    _vertVertsList(maxlevel+1)
+{
+    initializeCoarseLevel(descriptor);
+
+    if (not _manifold)
+        return;
+
+    for (int l=0; l<maxlevel; ++l)
+        refineLevel(l);
+
+    numberVertices();
+}
+
+template <class U> float
+FarTopologyRefiner<U>::subdivideSharpness( float sharpness ) {
+
+    // see HbrSubdivision<T>::SubdivideCreaseWeight (k_CreaseNormal)
+    if (sharpness >= HbrHalfedge<U>::k_InfinitelySharp)
+        return HbrHalfedge<U>::k_InfinitelySharp;
+    if (sharpness > HbrHalfedge<U>::k_Smooth)
+        return std::max((float)HbrHalfedge<U>::k_Smooth, sharpness - 1.0f);
+    return HbrHalfedge<U>::k_Smooth;
+}
+
+template <class U> int
+FarTopologyRefiner<U>::findEdge( Level const & level, int org, int dest ) {
+
+    int start = level.vertEdges[org], edge = start;
+    while (edge>=0) {
+        if (level.GetDestVertex(edge)==dest)
+            return edge;
+        edge = level.GetNextEdge(edge);
+        if (edge==start)
+            break;
+    }
+    return -1;
+}
+
+// Links the opposite halfedges and picks the incident halfedge of each vertex
+// the way HbrVertex<T>::AddIncidentEdge does : the boundary halfedge if there
+// is one, the halfedge of the first face around the vertex otherwise. Returns
+// false if an edge or a vertex is non-manifold, or if a vertex has no face.
+template <class U> bool
+FarTopologyRefiner<U>::finalizeTopology( Level & level ) {
+
+    int nverts = level.GetNumVertices(),
+        nedges = (int)level.edgeVerts.size();
+
+    // outgoing halfedges of each vertex, in face order
+    std::vector<int> offsets(nverts+1, 0), outgoing(nedges);
+    for (int i=0; i<nedges; ++i)
+        ++offsets[level.edgeVerts[i]+1];
+    for (int i=0; i<nverts; ++i)
+        offsets[i+1] += offsets[i];
+    std::vector<int> counts(offsets.begin(), offsets.end()-1);
+    for (int i=0; i<nedges; ++i)
+        outgoing[counts[level.edgeVerts[i]]++] = i;
+
+    // edges must be shared by at most 2 faces, with opposite orientations
+    level.edgeOpposites.assign(nedges, -1);
+    for (int i=0; i<nedges; ++i) {
+        int org = level.edgeVerts[i],
+            dest = level.GetDestVertex(i);
+        for (int j=offsets[org]; j<offsets[org+1]; ++j)
+            if (outgoing[j]!=i and level.GetDestVertex(outgoing[j])==dest)
+                return false;
+        for (int j=offsets[dest]; j<offsets[dest+1]; ++j)
+            if (level.GetDestVertex(outgoing[j])==org) {
+                if (level.edgeOpposites[i]>=0)
+                    return false;
+                level.edgeOpposites[i] = outgoing[j];
+            }
+    }
+
+    level.vertEdges.assign(nverts, -1);
+    for (int i=0; i<nverts; ++i) {
+        if (offsets[i+1]==offsets[i])
+            return false;
+        for (int j=offsets[i]; j<offsets[i+1]; ++j) {
+            int edge = outgoing[j];
+            if (level.vertEdges[i]<0)
+                level.vertEdges[i] = edge;
+            if (level.edgeOpposites[edge]<0) {
+                level.vertEdges[i] = edge;
+                break;
+            }
+        }
+
+        // the faces around the vertex must form a single fan
+        int start = level.vertEdges[i], edge = start, valence = 0;
+        do {
+            ++valence;
+            edge = level.GetNextEdge(edge);
+        } while (edge>=0 and edge!=start);
+
+        if (valence!=offsets[i+1]-offsets[i])
+            return false;
+    }
+
+    level.vertMasks[0].resize(nverts);
+    level.vertMasks[1].resize(nverts);
+    return true;
+}
+
+// see HbrVertex<T>::GetMask
+template <class U> unsigned char
+FarTopologyRefiner<U>::getMask( Level const & level, int vertex, bool next ) {
+
+    unsigned char mask = 0;
+
+    if (isSharp(level.vertSharpness[vertex], next))
+        mask += HbrVertex<U>::k_Corner;
+
+    int start = level.vertEdges[vertex], edge = start;
+    while (edge>=0) {
+        if (isSharp(level.edgeSharpness[edge], next) and mask < HbrVertex<U>::k_Corner)
+            ++mask;
+
+        int nextedge = level.GetNextEdge(edge);
+        if (nextedge==start) {
+            break;
+        } else if (nextedge<0) {
+            // Special case for the last edge in a cycle.
+            int prev = level.GetPrev(edge);
+            if (isSharp(level.edgeSharpness[prev], next) and mask < HbrVertex<U>::k_Corner)
+                ++mask;
+            break;
+        } else
+            edge = nextedge;
+    }
+    return mask;
+}
+
+// see HbrVertex<T>::GetFractionalMask
+template <class U> float
+FarTopologyRefiner<U>::getFractionalMask( Level const & level, int vertex ) {
+
+    float mask = 0, n = 0;
+
+    float sharpness = level.vertSharpness[vertex];
+    if (sharpness > HbrVertex<U>::k_Smooth and sharpness < HbrVertex<U>::k_Dart) {
+        mask += sharpness; ++n;
+    }
+
+    int start = level.vertEdges[vertex], edge = start;
+    while (edge>=0) {
+        float esharp = level.edgeSharpness[edge];
+        if (esharp > HbrHalfedge<U>::k_Smooth and esharp < HbrHalfedge<U>::k_Sharp) {
+            mask += esharp; ++n;
+        }
+        int nextedge = level.GetNextEdge(edge);
+        if (nextedge==start) {
+            break;
+        } else if (nextedge<0) {
+            // Special case for the last edge in a cycle.
+            esharp = level.edgeSharpness[level.GetPrev(edge)];
+            if (esharp > HbrHalfedge<U>::k_Smooth and esharp < HbrHalfedge<U>::k_Sharp) {
+                mask += esharp; ++n;
+            }
+            break;
+        } else
+            edge = nextedge;
+    }
+    assert (n > 0.0f and mask < n);
+    return (mask / n);
+}
+
+// Gathers the other end of the first 2 sharp edges around the vertex, in the
+// order of HbrVertex<T>::ApplyOperatorSurroundingEdges
+template <class U> void
+FarTopologyRefiner<U>::getCreaseEdges( Level const & level, int vertex, bool next, int eidx[2] ) {
+
+    int count = 0;
+    eidx[0] = eidx[1] = -1;
+
+    int start = level.vertEdges[vertex], edge = start;
+    while (edge>=0 and count<2) {
+        if (isSharp(level.edgeSharpness[edge], next))
+            eidx[count++] = level.GetDestVertex(edge);
+
+        int nextedge = level.GetNextEdge(edge);
+        if (nextedge==start) {
+            break;
+        } else if (nextedge<0) {
+            int prev = level.GetPrev(edge);
+            if (isSharp(level.edgeSharpness[prev], next) and count<2)
+                eidx[count++] = level.edgeVerts[prev];
+            break;
+        } else
+            edge = nextedge;
+    }
+}
+
+template <class U> void
+FarTopologyRefiner<U>::initializeCoarseLevel( FarTopologyDescriptor const & descriptor ) {
+
+    Level & coarse = _levels[0];
+
+    int nverts = descriptor.numVertices;
+
+    coarse.firstVertexID = 0;
+    coarse.vertParents.assign(nverts, -1);
+    coarse.vertTypes.assign(nverts, k_Coarse);
+    coarse.vertSharpness.assign(nverts, 0.0f);
+    _numVertices = nverts;
+
+    int nfaces = (int)descriptor.numVertsPerFace.size();
+
+    coarse.faceOffsets.reserve(nfaces+1);
+    coarse.faceOffsets.push_back(0);
+    coarse.edgeVerts.reserve(descriptor.vertIndices.size());
+
+    // ptex indices are assigned the way the regression shapes do
+    int const * fv = &descriptor.vertIndices[0];
+    for (int i=0, ptex=0; i<nfaces; ++i) {
+
+        int nv = descriptor.numVertsPerFace[i];
+        assert(nv>2 and (_scheme!=FarTopologyDescriptor::k_Loop or nv==3));
+
+        std::vector<float> sharpness(nv, 0.0f);
+        addFace(coarse, nv, fv, &sharpness[0], -1, -1, ptex);
+
+        if (_scheme!=FarTopologyDescriptor::k_Loop and nv!=4)
+            ptex += nv;
+        else
+            ++ptex;
+
+        fv += nv;
+    }
+
+    if (not finalizeTopology(coarse)) {
+        _manifold = false;
+        return;
+    }
+
+    // "crease" and "corner" tags
+    int ncreases = (int)descriptor.creaseIndices.size()/2,
+        nsharpness = (int)descriptor.creaseSharpness.size();
+    for (int i=0; i<ncreases; ++i) {
+        int v = descriptor.creaseIndices[2*i],
+            w = descriptor.creaseIndices[2*i+1];
+
+        int edge = findEdge(coarse, v, w);
+        if (edge<0)
+            edge = findEdge(coarse, w, v);
+        if (edge<0)
+            continue;
+
+        float sharpness = std::max(0.0f, nsharpness>1 ? descriptor.creaseSharpness[i] :
+                                                        descriptor.creaseSharpness[0]);
+        coarse.edgeSharpness[edge] = sharpness;
+        if (coarse.edgeOpposites[edge]>=0)
+            coarse.edgeSharpness[coarse.edgeOpposites[edge]] = sharpness;
+    }
+
+    int ncorners = (int)descriptor.cornerIndices.size();
+    nsharpness = (int)descriptor.cornerSharpness.size();
+    for (int i=0; i<ncorners; ++i) {
+        int v = descriptor.cornerIndices[i];
+        if (v<0 or v>=nverts)
+            continue;
+        coarse.vertSharpness[v] = std::max(0.0f, nsharpness>1 ? descriptor.cornerSharpness[i] :
+                                                                descriptor.cornerSharpness[0]);
+    }
+
+    // see HbrMesh<T>::Finish
+    if (descriptor.interpolateBoundary!=FarTopologyDescriptor::k_InterpolateBoundaryNone) {
+        for (int i=0; i<(int)coarse.edgeVerts.size(); ++i)
+            if (coarse.edgeOpposites[i]<0)
+                coarse.edgeSharpness[i] = HbrHalfedge<U>::k_InfinitelySharp;
+    }
+
+    if (descriptor.interpolateBoundary==FarTopologyDescriptor::k_InterpolateBoundaryEdgeAndCorner) {
+        for (int i=0; i<nverts; ++i) {
+            int edge = coarse.vertEdges[i];
+            // boundary vertices of valence 2 are incident to a single face
+            if (coarse.edgeOpposites[edge]<0 and coarse.GetNextEdge(edge)<0)
+                coarse.vertSharpness[i] = HbrVertex<U>::k_InfinitelySharp;
+        }
+    }
+
+    for (int i=0; i<nverts; ++i) {
+        coarse.vertMasks[0][i] = getMask(coarse, i, false);
+        coarse.vertMasks[1][i] = getMask(coarse, i, true);
+    }
+}
+
+template <class U> void
+FarTopologyRefiner<U>::addFace( Level & level, int nverts, int const * verts, float const * sharpness,
+                                int parent, int childIndex, int ptex ) {
+
+    int face = level.GetNumFaces();
+    for (int i=0; i<nverts; ++i) {
+        level.edgeVerts.push_back(verts[i]);
+        level.edgeFaces.push_back(face);
+        level.edgeSharpness.push_back(sharpness[i]);
+    }
+    level.faceOffsets.push_back((int)level.edgeVerts.size());
+    level.faceParents.push_back(parent);
+    level.faceChildIndices.push_back(childIndex);
+    level.facePtex.push_back(ptex);
+}
+
+template <class U> int
+FarTopologyRefiner<U>::newVertex( int level, VertexType type, int parent ) {
+
+    Level & child = _levels[level+1];
+
+    int vertex = child.GetNumVertices();
+    if (vertex==0)
+        child.firstVertexID = _numVertices;
+    assert(child.firstVertexID+vertex==_numVertices);
+    ++_numVertices;
+
+    child.vertParents.push_back(parent);
+    child.vertTypes.push_back((unsigned char)type);
+    child.vertSharpness.push_back(0.0f);
+    return vertex;
+}
+
+template <class U> int
+FarTopologyRefiner<U>::subdivideFace( int level, int face ) {
+
+    Level & parent = _levels[level];
+    if (parent.faceChildren[face]<0)
+        parent.faceChildren[face] = newVertex(level, k_FaceChild, face);
+    return parent.faceChildren[face];
+}
+
+// see HbrHalfedge<T>::Subdivide and HbrCatmarkSubdivision<T>::Subdivide
+template <class U> int
+FarTopologyRefiner<U>::subdivideEdge( int level, int edge ) {
+
+    Level & parent = _levels[level];
+
+    int opposite = parent.edgeOpposites[edge];
+    if (parent.edgeChildren[edge]>=0)
+        return parent.edgeChildren[edge];
+    if (opposite>=0 and parent.edgeChildren[opposite]>=0)
+        return parent.edgeChildren[opposite];
+
+    int vertex = newVertex(level, k_EdgeChild, edge);
+    parent.edgeChildren[edge] = vertex;
+
+    // the Catmark edge rule creates the vertices of the faces on either side,
+    // left face first, using the halfedge of the face with the smallest path
+    if (_scheme==FarTopologyDescriptor::k_Catmark and opposite>=0 and
+        parent.edgeSharpness[edge] <= 1.0f) {
+
+        int e = parent.edgeFaces[opposite] < parent.edgeFaces[edge] ? opposite : edge;
+        subdivideFace(level, parent.edgeFaces[e]);
+        subdivideFace(level, parent.edgeFaces[parent.edgeOpposites[e]]);
+    }
+    return vertex;
+}
+
+// see HbrVertex<T>::Subdivide and HbrCatmarkSubdivision<T>::Subdivide
+template <class U> int
+FarTopologyRefiner<U>::subdivideVertex( int level, int vertex ) {
+
+    Level & parent = _levels[level];
+    if (parent.vertChildren[vertex]>=0)
+        return parent.vertChildren[vertex];
+
+    int child = newVertex(level, k_VertexChild, vertex);
+    parent.vertChildren[vertex] = child;
+
+    float sharpness = parent.vertSharpness[vertex];
+    if (sharpness >= HbrVertex<U>::k_InfinitelySharp)
+        sharpness = HbrVertex<U>::k_InfinitelySharp;
+    else if (sharpness > HbrVertex<U>::k_Smooth)
+        sharpness = std::max((float)HbrVertex<U>::k_Smooth, sharpness - 1.0f);
+    else
+        sharpness = HbrVertex<U>::k_Smooth;
+    _levels[level+1].vertSharpness[child] = sharpness;
+
+    // the Catmark smooth and dart rules create the vertices of the faces around
+    // the vertex
+    if (_scheme==FarTopologyDescriptor::k_Catmark and
+        (parent.vertMasks[0][vertex] <= HbrVertex<U>::k_Dart or
+         parent.vertMasks[1][vertex] <= HbrVertex<U>::k_Dart)) {
+
+        int start = parent.vertEdges[vertex], edge = start;
+        while (edge>=0) {
+            subdivideFace(level, parent.edgeFaces[edge]);
+            edge = parent.GetNextEdge(edge);
+            if (edge==start)
+                break;
+        }
+    }
+    return child;
+}
+
+// see HbrCatmarkSubdivision<T>::Refine and HbrBilinearSubdivision<T>::Refine
+template <class U> void
+FarTopologyRefiner<U>::refineFace( int level, int face ) {
+
+    int first = _levels[level].faceOffsets[face],
+        nv = _levels[level].GetNumFaceVertices(face);
+
+    for (int i=0; i<nv; ++i) {
+
+        int edge = first + i,
+            prevedge = first + (i+nv-1) % nv;
+
+        // The funny indexing on vertices is done only for non-extraordinary
+        // faces in order to correctly preserve parametric space
+        int corner = (nv==4) ? i : 0, verts[4];
+        verts[corner] = subdivideVertex(level, _levels[level].edgeVerts[edge]);
+        verts[(corner+1)%4] = subdivideEdge(level, edge);
+        verts[(corner+2)%4] = subdivideFace(level, face);
+        verts[(corner+3)%4] = subdivideEdge(level, prevedge);
+
+        // Hand down edge sharpnesses
+        float sharpness[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        sharpness[corner] = subdivideSharpness(_levels[level].edgeSharpness[edge]);
+        sharpness[(corner+3)%4] = subdivideSharpness(_levels[level].edgeSharpness[prevedge]);
+
+        int ptex = _levels[level].facePtex[face];
+        if (nv!=4 and ptex!=-1)
+            ptex += i;
+
+        addFace(_levels[level+1], 4, verts, sharpness, face, i, ptex);
+    }
+}
+
+// see HbrLoopSubdivision<T>::Refine
+template <class U> void
+FarTopologyRefiner<U>::refineTriangle( int level, int face ) {
+
+    int first = _levels[level].faceOffsets[face],
+        ptex = _levels[level].facePtex[face];
+
+    assert(_levels[level].GetNumFaceVertices(face)==3);
+
+    for (int i=0; i<3; ++i) {
+
+        int edge = first + i,
+            prevedge = first + (i+2) % 3;
+
+        int verts[3];
+        verts[i] = subdivideVertex(level, _levels[level].edgeVerts[edge]);
+        verts[(i+1)%3] = subdivideEdge(level, edge);
+        verts[(i+2)%3] = subdivideEdge(level, prevedge);
+
+        float sharpness[3] = { 0.0f, 0.0f, 0.0f };
+        sharpness[i] = subdivideSharpness(_levels[level].edgeSharpness[edge]);
+        sharpness[(i+2)%3] = subdivideSharpness(_levels[level].edgeSharpness[prevedge]);
+
+        addFace(_levels[level+1], 3, verts, sharpness, face, i, ptex);
+    }
+
+    // middle face
+    int verts[3];
+    verts[0] = subdivideEdge(level, first+1);
+    verts[1] = subdivideEdge(level, first+2);
+    verts[2] = subdivideEdge(level, first);
+
+    float sharpness[3] = { 0.0f, 0.0f, 0.0f };
+    addFace(_levels[level+1], 3, verts, sharpness, face, 3, ptex);
+}
+
+template <class U> void
+FarTopologyRefiner<U>::refineLevel( int level ) {
+
+    Level & parent = _levels[level],
+          & child = _levels[level+1];
+
+    int nfaces = parent.GetNumFaces();
+
+    parent.faceChildren.assign(nfaces, -1);
+    parent.edgeChildren.assign(parent.edgeVerts.size(), -1);
+    parent.vertChildren.assign(parent.GetNumVertices(), -1);
+
+    int nchildren = _scheme==FarTopologyDescriptor::k_Loop ? 4*nfaces : (int)parent.edgeVerts.size();
+    child.faceOffsets.reserve(nchildren+1);
+    child.faceOffsets.push_back(0);
+    child.edgeVerts.reserve(nchildren*4);
+
+    // faces are refined in the order of their IDs, as in FarMeshFactory
+    for (int i=0; i<nfaces; ++i)
+        if (_scheme==FarTopologyDescriptor::k_Loop)
+            refineTriangle(level, i);
+        else
+            refineFace(level, i);
+
+    // refining manifold faces can't create non-manifold ones
+    _manifold = finalizeTopology(child);
+    assert(_manifold);
+
+    for (int i=0; i<child.GetNumVertices(); ++i) {
+        child.vertMasks[0][i] = getMask(child, i, false);
+        child.vertMasks[1][i] = getMask(child, i, true);
+    }
+}
+
+// Numbers the vertices the way the FarMeshFactory constructor does
+template <class U> void
+FarTopologyRefiner<U>::numberVertices() {
+
+    _remapTable.resize(_numVertices, -1);
+    _unmapTable.resize(_numVertices, -1);
+
+    for (int l=0; l<=_maxlevel; ++l) {
+
+        Level const & level = _levels[l];
+
+        for (int i=0; i<level.GetNumVertices(); ++i) {
+
+            int start = level.vertEdges[i], edge = start, valence = 0;
+            do {
+                ++valence;
+                edge = level.GetNextEdge(edge);
+            } while (edge>=0 and edge!=start);
+
+            if (edge==start)
+                _vertVertsListSize[l] += valence;
+            else if (valence+1!=2)
+                _vertVertsListSize[l]++;
+
+            switch (level.vertTypes[i]) {
+                case k_FaceChild   : _faceVertsList[l].push_back(i); break;
+                case k_EdgeChild   : _edgeVertsList[l].push_back(i); break;
+                case k_Coarse      :
+                case k_VertexChild : _vertVertsList[l].push_back(i); break;
+            }
+        }
+
+        if (l==0) {
+            for (int i=0; i<level.GetNumVertices(); ++i)
+                _remapTable[i] = i;
+            continue;
+        }
+
+        // Sort the vertices that are the child of a vertex based on the weight
+        // mask of their parent, keeping the id order within a rank as
+        // FarMeshFactory does
+        Level const & parent = _levels[l-1];
+
+        std::vector<unsigned char> ranks(level.GetNumVertices(), 0xFF);
+        for (int i=0; i<(int)_vertVertsList[l].size(); ++i) {
+            int v = _vertVertsList[l][i],
+                pv = level.vertParents[v];
+            ranks[v] = (unsigned char)FarSubdivisionTables<U>::getMaskRanking(
+                parent.vertMasks[0][pv], parent.vertMasks[1][pv]);
+            assert(ranks[v]!=0xFF);
+        }
+        std::stable_sort(_vertVertsList[l].begin(), _vertVertsList[l].end(), compareRanks(ranks));
+
+        _faceVertIdx[l] = _vertVertIdx[l-1] + (int)_vertVertsList[l-1].size();
+        _edgeVertIdx[l] = _faceVertIdx[l] + (int)_faceVertsList[l].size();
+        _vertVertIdx[l] = _edgeVertIdx[l] + (int)_edgeVertsList[l].size();
+
+        for (int i=0; i<(int)_faceVertsList[l].size(); ++i)
+            _remapTable[ level.firstVertexID + _faceVertsList[l][i] ] = _faceVertIdx[l] + i;
+        for (int i=0; i<(int)_edgeVertsList[l].size(); ++i)
+            _remapTable[ level.firstVertexID + _edgeVertsList[l][i] ] = _edgeVertIdx[l] + i;
+        for (int i=0; i<(int)_vertVertsList[l].size(); ++i)
+            _remapTable[ level.firstVertexID + _vertVertsList[l][i] ] = _vertVertIdx[l] + i;
+    }
+
+    for (int i=0; i<(int)_remapTable.size(); ++i)
+        _unmapTable[ _remapTable[i] ] = i;
+}
+
+template <class U> int
+FarTopologyRefiner<U>::sumList( std::vector<std::vector<int> > const & list, int level ) {
+
+    level = std::min(level, (int)list.size()-1);
+    int total = 0;
+    for (int i=0; i<=level; ++i)
+        total += (int)list[i].size();
+    return total;
+}
+
+template <class U> int
+FarTopologyRefiner<U>::getNumFacesTotal( int level ) const {
+
+    level = std::min(level, _maxlevel);
+    int total = 0;
+    for (int i=0; i<=level; ++i)
+        total += _levels[i].GetNumFaces();
+    return total;
+}
+
+template <class U> int
+FarTopologyRefiner<U>::getNumAdjacentVertVerticesTotal( int level ) const {
+
+    level = std::min(level, _maxlevel);
+    int total = 0;
+    for (int i=0; i<=level; ++i)
+        total += _vertVertsListSize[i];
+    return total;
+}
+
+// see FarCatmarkSubdivisionTablesFactory<T,U>::Create
+template <class U> FarCatmarkSubdivisionTables<U> *
+FarTopologyRefiner<U>::createCatmarkTables( FarMesh<U> * mesh ) {
+
+    FarCatmarkSubdivisionTables<U> * result = new FarCatmarkSubdivisionTables<U>(mesh, _maxlevel);
+
+    // Allocate memory for the indexing tables
+    result->_F_ITa.Resize(sumList(_faceVertsList, _maxlevel)*2);
+    result->_F_IT.Resize(getNumFacesTotal(_maxlevel) - getNumFacesTotal(0));
+
+    result->_E_IT.Resize(sumList(_edgeVertsList, _maxlevel)*4);
+    result->_E_W.Resize(sumList(_edgeVertsList, _maxlevel)*2);
+
+    result->_V_ITa.Resize(sumList(_vertVertsList, _maxlevel)*5);
+    result->_V_IT.Resize(getNumAdjacentVertVerticesTotal(_maxlevel)*2);
+    result->_V_W.Resize(sumList(_vertVertsList, _maxlevel));
+
+    for (int level=1; level<=_maxlevel; ++level) {
+
+        Level const & parent = _levels[level-1],
+                    & child = _levels[level];
+
+        // pointer to the first vertex corresponding to this level
+        result->_vertsOffsets[level] = _vertVertIdx[level-1] + (int)_vertVertsList[level-1].size();
+
+        typename FarSubdivisionTables<U>::VertexKernelBatch * batch = & (result->_batches[level-1]);
+
+        // Face vertices
+        int offset = 0;
+        int * F_ITa = result->_F_ITa[level-1];
+        unsigned int * F_IT = result->_F_IT[level-1];
+        batch->kernelF = (int)_faceVertsList[level].size();
+        for (int i=0; i < batch->kernelF; ++i) {
+
+            int f = child.vertParents[ _faceVertsList[level][i] ],
+                valence = parent.GetNumFaceVertices(f);
+
+            F_ITa[2*i+0] = offset;
+            F_ITa[2*i+1] = valence;
+
+            for (int j=0; j<valence; ++j)
+                F_IT[offset++] = getFarID(level-1, parent.edgeVerts[parent.faceOffsets[f]+j]);
+        }
+        result->_F_ITa.SetMarker(level, &F_ITa[2*batch->kernelF]);
+        result->_F_IT.SetMarker(level, &F_IT[offset]);
+
+        // Edge vertices
+        int * E_IT = result->_E_IT[level-1];
+        float * E_W = result->_E_W[level-1];
+        batch->kernelE = (int)_edgeVertsList[level].size();
+        for (int i=0; i < batch->kernelE; ++i) {
+
+            int e = child.vertParents[ _edgeVertsList[level][i] ],
+                opposite = parent.edgeOpposites[e];
+
+            float esharp = parent.edgeSharpness[e];
+
+            E_IT[4*i+0] = getFarID(level-1, parent.edgeVerts[e]);
+            E_IT[4*i+1] = getFarID(level-1, parent.GetDestVertex(e));
+
+            float faceWeight=0.5f, vertWeight=0.5f;
+
+            if (opposite>=0 and esharp <= 1.0f) {
+
+                int lf = parent.edgeFaces[e],
+                    rf = parent.edgeFaces[opposite];
+
+                float leftWeight = (_triangleSubdivision==FarTopologyDescriptor::k_TriangleNew and
+                                    parent.GetNumFaceVertices(lf)==3) ? HBR_SMOOTH_TRI_EDGE_WEIGHT : 0.25f;
+                float rightWeight = (_triangleSubdivision==FarTopologyDescriptor::k_TriangleNew and
+                                     parent.GetNumFaceVertices(rf)==3) ? HBR_SMOOTH_TRI_EDGE_WEIGHT : 0.25f;
+
+                faceWeight = 0.5f * (leftWeight + rightWeight);
+                vertWeight = 0.5f * (1.0f - 2.0f * faceWeight);
+
+                faceWeight *= (1.0f - esharp);
+
+                vertWeight = 0.5f * esharp + (1.0f - esharp) * vertWeight;
+
+                E_IT[4*i+2] = getFarID(level, parent.faceChildren[lf]);
+                E_IT[4*i+3] = getFarID(level, parent.faceChildren[rf]);
+            } else {
+                E_IT[4*i+2] = -1;
+                E_IT[4*i+3] = -1;
+            }
+            E_W[2*i+0] = vertWeight;
+            E_W[2*i+1] = faceWeight;
+        }
+        result->_E_IT.SetMarker(level, &E_IT[4*batch->kernelE]);
+        result->_E_W.SetMarker(level, &E_W[2*batch->kernelE]);
+
+        // Vertex vertices
+        int nverts = (int)_vertVertsList[level].size();
+        batch->InitVertexKernels( nverts, 0 );
+
+        offset = 0;
+        int * V_ITa = result->_V_ITa[level-1];
+        unsigned int * V_IT = result->_V_IT[level-1];
+        float * V_W = result->_V_W[level-1];
+        for (int i=0; i < nverts; ++i) {
+
+            int pv = child.vertParents[ _vertVertsList[level][i] ];
+
+            int masks[2], npasses;
+            float weights[2];
+            masks[0] = parent.vertMasks[0][pv];
+            masks[1] = parent.vertMasks[1][pv];
+
+            // k_Smooth to k_Dart transitions apply the same kernel twice : they
+            // are combined into a single pass
+            if (masks[0] != masks[1] and (
+                not (masks[0]==HbrVertex<U>::k_Smooth and
+                     masks[1]==HbrVertex<U>::k_Dart))) {
+                weights[1] = getFractionalMask(parent, pv);
+                weights[0] = 1.0f - weights[1];
+                npasses = 2;
+            } else {
+                weights[0] = 1.0f;
+                weights[1] = 0.0f;
+                npasses = 1;
+            }
+
+            int rank = result->getMaskRanking(masks[0], masks[1]);
+
+            V_ITa[5*i+0] = offset;
+            V_ITa[5*i+1] = 0;
+            V_ITa[5*i+2] = getFarID(level-1, pv);
+            V_ITa[5*i+3] = -1;
+            V_ITa[5*i+4] = -1;
+
+            for (int p=0; p<npasses; ++p)
+                switch (masks[p]) {
+                    case HbrVertex<U>::k_Smooth :
+                    case HbrVertex<U>::k_Dart : {
+                        int start = parent.vertEdges[pv], e = start;
+                        while (e>=0) {
+                            V_ITa[5*i+1]++;
+
+                            V_IT[offset++] = getFarID(level-1, parent.GetDestVertex(e));
+
+                            V_IT[offset++] = getFarID(level, parent.faceChildren[parent.edgeFaces[e]]);
+
+                            e = parent.GetNextEdge(e);
+
+                            if (e==start) break;
+                        }
+                        break;
+                    }
+                    case HbrVertex<U>::k_Crease : {
+                        int eidx[2];
+                        getCreaseEdges(parent, pv, p==1, eidx);
+
+                        assert(V_ITa[5*i+3]==-1 and V_ITa[5*i+4]==-1);
+                        assert(eidx[0]!=-1 and eidx[1]!=-1);
+                        V_ITa[5*i+3] = getFarID(level-1, eidx[0]);
+                        V_ITa[5*i+4] = getFarID(level-1, eidx[1]);
+                        break;
+                    }
+                    case HbrVertex<U>::k_Corner :
+                        // k_Crease / k_Corner pass combination : see the
+                        // Catmark tables factory
+                        if (V_ITa[5*i+1]==0)
+                            V_ITa[5*i+1] = -1;
+
+                    default : break;
+                }
+
+            if (rank>7)
+                V_W[i] = 0.0;
+            else
+                V_W[i] = weights[0];
+
+            batch->AddVertex( i, rank );
+        }
+        result->_V_ITa.SetMarker(level, &V_ITa[5*nverts]);
+        result->_V_IT.SetMarker(level, &V_IT[offset]);
+        result->_V_W.SetMarker(level, &V_W[nverts]);
+
+        batch->kernelB.second++;
+        batch->kernelA1.second++;
+        batch->kernelA2.second++;
+    }
+    return result;
+}
+
+// see FarLoopSubdivisionTablesFactory<T,U>::Create
+template <class U> FarLoopSubdivisionTables<U> *
+FarTopologyRefiner<U>::createLoopTables( FarMesh<U> * mesh ) {
+
+    FarLoopSubdivisionTables<U> * result = new FarLoopSubdivisionTables<U>(mesh, _maxlevel);
+
+    // Allocate memory for the indexing tables
+    result->_E_IT.Resize(sumList(_edgeVertsList, _maxlevel)*4);
+    result->_E_W.Resize(sumList(_edgeVertsList, _maxlevel)*2);
+
+    result->_V_ITa.Resize(sumList(_vertVertsList, _maxlevel)*5);
+    result->_V_IT.Resize(getNumAdjacentVertVerticesTotal(_maxlevel));
+    result->_V_W.Resize(sumList(_vertVertsList, _maxlevel));
+
+    for (int level=1; level<=_maxlevel; ++level) {
+
+        Level const & parent = _levels[level-1],
+                    & child = _levels[level];
+
+        // pointer to the first vertex corresponding to this level
+        result->_vertsOffsets[level] = _vertVertIdx[level-1] + (int)_vertVertsList[level-1].size();
+
+        typename FarSubdivisionTables<U>::VertexKernelBatch * batch = & (result->_batches[level-1]);
+
+        // Edge vertices
+        int * E_IT = result->_E_IT[level-1];
+        float * E_W = result->_E_W[level-1];
+        batch->kernelE = (int)_edgeVertsList[level].size();
+        for (int i=0; i < batch->kernelE; ++i) {
+
+            int e = child.vertParents[ _edgeVertsList[level][i] ],
+                opposite = parent.edgeOpposites[e];
+
+            float esharp = parent.edgeSharpness[e],
+                  endPtWeight = 0.5f,
+                  oppPtWeight = 0.5f;
+
+            E_IT[4*i+0]= getFarID(level-1, parent.edgeVerts[e]);
+            E_IT[4*i+1]= getFarID(level-1, parent.GetDestVertex(e));
+
+            if (opposite>=0 and esharp <= 1.0f) {
+                endPtWeight = 0.375f + esharp * (0.5f - 0.375f);
+                oppPtWeight = 0.125f * (1 - esharp);
+
+                E_IT[4*i+2]= getFarID(level-1, parent.GetDestVertex(parent.GetNext(e)));
+                E_IT[4*i+3]= getFarID(level-1, parent.GetDestVertex(parent.GetNext(opposite)));
+            } else {
+                E_IT[4*i+2]= -1;
+                E_IT[4*i+3]= -1;
+            }
+            E_W[2*i+0] = endPtWeight;
+            E_W[2*i+1] = oppPtWeight;
+        }
+        result->_E_IT.SetMarker(level, &E_IT[4*batch->kernelE]);
+        result->_E_W.SetMarker(level, &E_W[2*batch->kernelE]);
+
+        // Vertex vertices
+        int nverts = (int)_vertVertsList[level].size();
+        batch->InitVertexKernels( nverts, 0 );
+
+        int offset = 0;
+        int * V_ITa = result->_V_ITa[level-1];
+        unsigned int * V_IT = result->_V_IT[level-1];
+        float * V_W = result->_V_W[level-1];
+        for (int i=0; i < nverts; ++i) {
+
+            int pv = child.vertParents[ _vertVertsList[level][i] ];
+
+            int masks[2], npasses;
+            float weights[2];
+            masks[0] = parent.vertMasks[0][pv];
+            masks[1] = parent.vertMasks[1][pv];
+
+            if (masks[0] != masks[1] and (
+                not (masks[0]==HbrVertex<U>::k_Smooth and
+                     masks[1]==HbrVertex<U>::k_Dart))) {
+                weights[1] = getFractionalMask(parent, pv);
+                weights[0] = 1.0f - weights[1];
+                npasses = 2;
+            } else {
+                weights[0] = 1.0f;
+                weights[1] = 0.0f;
+                npasses = 1;
+            }
+
+            int rank = result->getMaskRanking(masks[0], masks[1]);
+
+            V_ITa[5*i+0] = offset;
+            V_ITa[5*i+1] = 0;
+            V_ITa[5*i+2] = getFarID(level-1, pv);
+            V_ITa[5*i+3] = -1;
+            V_ITa[5*i+4] = -1;
+
+            for (int p=0; p<npasses; ++p)
+                switch (masks[p]) {
+                    case HbrVertex<U>::k_Smooth :
+                    case HbrVertex<U>::k_Dart : {
+                        int start = parent.vertEdges[pv], e = start;
+                        while (e>=0) {
+                            V_ITa[5*i+1]++;
+
+                            V_IT[offset++] = getFarID(level-1, parent.GetDestVertex(e));
+
+                            e = parent.GetNextEdge(e);
+
+                            if (e==start) break;
+                        }
+                        break;
+                    }
+                    case HbrVertex<U>::k_Crease : {
+                        int eidx[2];
+                        getCreaseEdges(parent, pv, p==1, eidx);
+
+                        assert(V_ITa[5*i+3]==-1 and V_ITa[5*i+4]==-1);
+                        assert(eidx[0]!=-1 and eidx[1]!=-1);
+                        V_ITa[5*i+3] = getFarID(level-1, eidx[0]);
+                        V_ITa[5*i+4] = getFarID(level-1, eidx[1]);
+                        break;
+                    }
+                    case HbrVertex<U>::k_Corner :
+                        if (V_ITa[5*i+1]==0)
+                            V_ITa[5*i+1] = -1;
+
+                    default : break;
+                }
+
+            if (rank>7)
+                V_W[i] = 0.0;
+            else
+                V_W[i] = weights[0];
+
+            batch->AddVertex( i, rank );
+        }
+        result->_V_ITa.SetMarker(level, &V_ITa[5*nverts]);
+        result->_V_IT.SetMarker(level, &V_IT[offset]);
+        result->_V_W.SetMarker(level, &V_W[nverts]);
+
+        batch->kernelB.second++;
+        batch->kernelA1.second++;
+        batch->kernelA2.second++;
+    }
+    return result;
+}
+
+// see FarBilinearSubdivisionTablesFactory<T,U>::Create
+template <class U> FarBilinearSubdivisionTables<U> *
+FarTopologyRefiner<U>::createBilinearTables( FarMesh<U> * mesh ) {
+
+    FarBilinearSubdivisionTables<U> * result = new FarBilinearSubdivisionTables<U>(mesh, _maxlevel);
+
+    // Allocate memory for the indexing tables
+    result->_F_ITa.Resize(sumList(_faceVertsList, _maxlevel)*2);
+    result->_F_IT.Resize(getNumFacesTotal(_maxlevel) - getNumFacesTotal(0));
+
+    result->_E_IT.Resize(sumList(_edgeVertsList, _maxlevel)*2);
+
+    result->_V_ITa.Resize(sumList(_vertVertsList, _maxlevel));
+
+    for (int level=1; level<=_maxlevel; ++level) {
+
+        Level const & parent = _levels[level-1],
+                    & child = _levels[level];
+
+        // pointer to the first vertex corresponding to this level
+        result->_vertsOffsets[level] = _vertVertIdx[level-1] + (int)_vertVertsList[level-1].size();
+
+        typename FarSubdivisionTables<U>::VertexKernelBatch * batch = & (result->_batches[level-1]);
+
+        // Face vertices
+        int offset = 0;
+        int * F_ITa = result->_F_ITa[level-1];
+        unsigned int * F_IT = result->_F_IT[level-1];
+        batch->kernelF = (int)_faceVertsList[level].size();
+        for (int i=0; i < batch->kernelF; ++i) {
+
+            int f = child.vertParents[ _faceVertsList[level][i] ],
+                valence = parent.GetNumFaceVertices(f);
+
+            F_ITa[2*i+0] = offset;
+            F_ITa[2*i+1] = valence;
+
+            for (int j=0; j<valence; ++j)
+                F_IT[offset++] = getFarID(level-1, parent.edgeVerts[parent.faceOffsets[f]+j]);
+        }
+        result->_F_ITa.SetMarker(level, &F_ITa[2*batch->kernelF]);
+        result->_F_IT.SetMarker(level, &F_IT[offset]);
+
+        // Edge vertices
+        int * E_IT = result->_E_IT[level-1];
+        batch->kernelE = (int)_edgeVertsList[level].size();
+        for (int i=0; i < batch->kernelE; ++i) {
+
+            int e = child.vertParents[ _edgeVertsList[level][i] ];
+
+            E_IT[2*i+0] = getFarID(level-1, parent.edgeVerts[e]);
+            E_IT[2*i+1] = getFarID(level-1, parent.GetDestVertex(e));
+        }
+        result->_E_IT.SetMarker(level, &E_IT[2*batch->kernelE]);
+
+        // Vertex vertices
+        int * V_ITa = result->_V_ITa[level-1];
+        batch->kernelB.first = 0;
+        batch->kernelB.second = (int)_vertVertsList[level].size();
+        for (int i=0; i < batch->kernelB.second; ++i)
+            V_ITa[i] = getFarID(level-1, child.vertParents[ _vertVertsList[level][i] ]);
+
+        result->_V_ITa.SetMarker(level, &V_ITa[batch->kernelB.second]);
+    }
+    return result;
+}
+
+template <class U> void
+FarTopologyRefiner<U>::copyTopology( std::vector<int> & vec, int level ) {
+
+    Level const & faces = _levels[level];
+
+    int nv = _scheme==FarTopologyDescriptor::k_Loop ? 3 : 4;
+
+    vec.resize( nv * faces.GetNumFaces(), -1 );
+
+    for (int i=0; i<faces.GetNumFaces(); ++i) {
+        assert( faces.GetNumFaceVertices(i)==nv );
+        for (int j=0; j<nv; ++j)
+            vec[nv*i+j] = getFarID(level, faces.edgeVerts[faces.faceOffsets[i]+j]);
+    }
+}
+
+// see FarMeshFactory<T,U>::generatePtexCoordinates
+template <class U> void
+FarTopologyRefiner<U>::generatePtexCoordinates( std::vector<int> & vec, int level ) {
+
+    vec.resize( _levels[level].GetNumFaces()*2, -1 );
+
+    for (int i=0; i<_levels[level].GetNumFaces(); ++i) {
+
+        short u,v;
+        unsigned short ofs = 1, depth;
+        bool quad = true;
+
+        // track upwards towards coarse face, accumulating u,v indices
+        int f = i, l = level,
+            p = _levels[l].faceParents[f];
+        for ( u=v=depth=0;  p!=-1; depth++ ) {
+
+            if ( _levels[l-1].GetNumFaceVertices(p) != 4 ) {
+                quad = false;
+                break;
+            }
+
+            switch ( _levels[l].faceChildIndices[f] ) {
+              case 0 :                     break;
+              case 1 : { u+=ofs;         } break;
+              case 2 : { u+=ofs; v+=ofs; } break;
+              case 3 : {         v+=ofs; } break;
+            }
+            ofs = ofs << 1;
+            f = p;
+            --l;
+            p = _levels[l].faceParents[f];
+        }
+
+        vec[2*i] = quad ? _levels[l].facePtex[f] : -_levels[l].facePtex[f];
+        vec[2*i+1] = (int)u << 16;
+        vec[2*i+1] += v;
+    }
+}
+
+template <class U> FarMesh<U> *
+FarTopologyRefiner<U>::Create( FarDispatcher<U> * dispatch ) {
+
+    if (_maxlevel<1 or not _manifold)
+        return 0;
+
+    FarMesh<U> * result = new FarMesh<U>(0, GetRemappingTable(), GetUnmappingTable());
+
+    if (dispatch)
+        result->_dispatcher = dispatch;
+    else
+        result->_dispatcher = & FarDispatcher<U>::_DefaultDispatcher;
+
+    switch (_scheme) {
+        case FarTopologyDescriptor::k_Bilinear :
+            result->_subdivisionTables = createBilinearTables(result); break;
+        case FarTopologyDescriptor::k_Catmark :
+            result->_subdivisionTables = createCatmarkTables(result); break;
+        case FarTopologyDescriptor::k_Loop :
+            result->_subdivisionTables = createLoopTables(result); break;
+    }
+    assert(result->_subdivisionTables);
+
+    result->_numCoarseVertices = (int)_vertVertsList[0].size();
+
+    result->_vertices.resize( _numVertices );
+
+    result->_patchtype = FarMesh<U>::k_BilinearQuads;
+
+    result->_faceverts.resize(_maxlevel+1);
+    for (int l=1; l<=_maxlevel; ++l)
+        copyTopology(result->_faceverts[l], l);
+
+    result->_ptexcoordinates.resize(_maxlevel+1);
+    for (int l=1; l<=_maxlevel; ++l)
+        generatePtexCoordinates(result->_ptexcoordinates[l], l);
+
+#if BENCHMARKING
+        // report mem usage by subd tables
+        printf(" tablemem=%lu", (unsigned long) result->_subdivisionTables->GetMemoryUsed());
+#endif
+
+    return result;
+}
+
+} // end namespace OPENSUBDIV_VERSION
+using namespace OPENSUBDIV_VERSION;
+
+} // end namespace OpenSubdiv
+
+#endif /* FAR_TOPOLOGY_REFINER_H */
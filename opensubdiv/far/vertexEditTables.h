@@ -155,6 +155,7 @@ public:
     private:
         template <class X, class Y> friend struct FarVertexEditTablesFactory;
         friend class FarDispatcher<U>;
+        friend class FarMesh<U>;
 
         FarTable<unsigned int>    _vertIndices;  // absolute vertex index array for edits
         FarTable<float>           _edits;        // edit values array
@@ -171,6 +172,7 @@ public:
 private:
     template <class X, class Y> friend struct FarVertexEditTablesFactory;
     friend class FarDispatcher<U>;
+    friend class FarMesh<U>;
 
     // Compute-kernel that applies the edits
     void computeVertexEdits(int level, void *clientdata) const;
@@ -139,7 +139,7 @@ OsdClKernelDispatcher::DeviceTable::~DeviceTable() {
 }
 
 void
-OsdClKernelDispatcher::DeviceTable::Copy(cl_context context, int size, const void *table) {
+OsdClKernelDispatcher::DeviceTable::Copy(cl_context context, size_t size, const void *table) {
 
     if (size > 0) {
         cl_int ciErrNum;
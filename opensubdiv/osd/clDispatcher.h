@@ -205,7 +205,7 @@ protected:
         DeviceTable() : devicePtr(NULL) {}
         ~DeviceTable();
 
-        void Copy(cl_context context, int size, const void *ptr);
+        void Copy(cl_context context, size_t size, const void *ptr);
 
         cl_mem devicePtr;
     };
@@ -77,7 +77,7 @@ OsdCpuKernelDispatcher::Table::~Table() {
 }
 
 void
-OsdCpuKernelDispatcher::Table::Copy( int size, const void *table ) {
+OsdCpuKernelDispatcher::Table::Copy( size_t size, const void *table ) {
 
     if (size > 0) {
         if (ptr)
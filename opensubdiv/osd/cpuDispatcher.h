@@ -126,7 +126,7 @@ protected:
 
        ~Table();
 
-        void Copy(int size, const void *ptr);
+        void Copy(size_t size, const void *ptr);
 
         void *ptr;
     };
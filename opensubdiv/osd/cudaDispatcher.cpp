@@ -128,7 +128,7 @@ OsdCudaKernelDispatcher::DeviceTable::~DeviceTable() {
 }
 
 void
-OsdCudaKernelDispatcher::DeviceTable::Copy(int size, const void *ptr) {
+OsdCudaKernelDispatcher::DeviceTable::Copy(size_t size, const void *ptr) {
 
     if (devicePtr)
         cudaFree(devicePtr);
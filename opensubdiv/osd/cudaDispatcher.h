@@ -151,7 +151,7 @@ protected:
         DeviceTable() : devicePtr(NULL) {}
        ~DeviceTable();
 
-        void Copy(int size, const void *ptr);
+        void Copy(size_t size, const void *ptr);
 
         void *devicePtr;
     };
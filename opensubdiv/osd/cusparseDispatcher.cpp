@@ -121,7 +121,7 @@ CudaCsrMatrix::CudaCsrMatrix(const CudaCooMatrix* StagedOp, int nve) :
     cudaStreamCreate(&computeStream);
 }
 
-int
+size_t
 CudaCsrMatrix::NumBytes() {
     if (ell_k != 0)
         return m*ell_k*(sizeof(float)+sizeof(int)) + coo_nnz*(2*sizeof(int) + sizeof(float));
@@ -317,6 +317,8 @@ OsdCusparseKernelDispatcher::~OsdCusparseKernelDispatcher() {
 
 void
 OsdCusparseKernelDispatcher::FinalizeMatrix() {
+    this->ComposeMatrix();
+
     if (logical)
         SubdivOp->ellize();
 
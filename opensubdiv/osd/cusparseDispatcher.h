@@ -52,7 +52,7 @@ public:
     void spmv(float* d_out, float* d_in);
     void logical_spmv(float* d_out, float* d_in, float *h_in);
     virtual CudaCsrMatrix* gemm(CudaCsrMatrix* rhs);
-    virtual int NumBytes();
+    virtual size_t NumBytes();
     void ellize();
     void dump(std::string ofilename);
 
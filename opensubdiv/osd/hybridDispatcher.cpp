@@ -98,7 +98,7 @@ HybridCsrMatrix::HybridCsrMatrix(const HybridCooMatrix* StagedOp, int nve) :
     free(h_vals);
 }
 
-int
+size_t
 HybridCsrMatrix::NumBytes() {
     if (ell_k != 0)
         return m*ell_k*(sizeof(float)+sizeof(int)) +
@@ -334,6 +334,7 @@ OsdHybridKernelDispatcher::~OsdHybridKernelDispatcher() {
 
 void
 OsdHybridKernelDispatcher::FinalizeMatrix() {
+    this->ComposeMatrix();
     SubdivOp->ellize();
     this->super::FinalizeMatrix();
 }
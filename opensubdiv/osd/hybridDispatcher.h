@@ -31,7 +31,7 @@ public:
     void spmv(float* d_out, float* d_in);
     void logical_spmv(float* d_out, float* d_in, float *h_in);
     virtual HybridCsrMatrix* gemm(HybridCsrMatrix* rhs);
-    virtual int NumBytes();
+    virtual size_t NumBytes();
     void ellize();
     void dump(std::string ofilename);
 
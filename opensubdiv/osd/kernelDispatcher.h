@@ -87,6 +87,10 @@ public:
                       kCCPU= 7,
                       kCGPU= 8,
                       kHYB= 9,
+                      kHCPU= 10,
+                      kMKL64= 11,
+                      kPCPU= 12,
+                      kAUTO= 13,
                       kMAX };
 
 
@@ -119,6 +123,9 @@ public:
             _tableOffsets[tableIndex][i] = (int)(table[i] - table[0]);
     }
 
+    // lets UpdateTable take the tables of a mesh refined to another level
+    void SetMaxLevel(int maxLevel) { _maxLevel = maxLevel; }
+
     static OsdKernelDispatcher *CreateKernelDispatcher( int levels, int kernel ) {
         return Factory::GetInstance().Create( levels, kernel );
     }
@@ -149,6 +156,19 @@ public:
     virtual void ApplyM(int offset) { };
     virtual int SupportsExactEvaluation() { return 0; }
 
+    // lets matrix kernels map the finalized matrices of this topology from shared memory,
+    // and if publish is set, build and publish them for the other processes of the node
+    virtual void SetSharedOperators(unsigned long long key, std::vector<unsigned int> const & signature,
+                                    bool publish) { };
+
+    // lets matrix kernels keep the finalized matrices in the file at path, and stream them
+    // from there. A file already holding the matrices of signature is used as it is.
+    virtual void SetOperatorFile(const char *path, std::vector<unsigned int> const & signature) { };
+
+    // lets matrix kernels refine only numElements elements of each vertex, starting at
+    // firstElement. Kernels that can't refine a subset refine every element.
+    virtual void SetElementRange(int firstElement, int numElements) { };
+
     virtual int GetElemsPerVertex() const { return -2; }
     virtual int GetElemsPerVarying() const { return -2; }
 
@@ -178,6 +198,9 @@ protected:
         }
 
         bool HasKernelType(KernelType kernel) const {
+            // kAUTO is resolved by OsdMesh, and starts on a table kernel
+            if (kernel == kAUTO)
+                return HasKernelType(kCPU) or HasKernelType(kOPENMP);
             if (kernel >= (int)_kernelCreators.size()) {
                 return false;
             }
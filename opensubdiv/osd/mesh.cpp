@@ -55,7 +55,12 @@
 //     a particular purpose and non-infringement.
 //
 
+#include <math.h>
 #include <string.h>
+#include <algorithm>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #include "../version.h"
 #include "../examples/common/stopwatch.h"
@@ -69,6 +74,7 @@
 
 #include "../far/mesh.h"
 #include "../far/meshFactory.h"
+#include "../far/meshPredictor.h"
 
 #include "../osd/mesh.h"
 #include "../osd/local.h"
@@ -76,66 +82,239 @@
 #include "../osd/cpuDispatcher.h"
 #include "../osd/elementArrayBuffer.h"
 #include "../osd/ptexCoordinatesTextureBuffer.h"
+#include "../osd/topologyRegistry.h"
 
 namespace OpenSubdiv {
 namespace OPENSUBDIV_VERSION {
 
-OsdMesh::OsdMesh() : _farMesh(NULL), _dispatcher(NULL) { }
+// the table kernel standing in for a matrix kernel
+static int
+tableKernel() {
+
+    return OsdKernelDispatcher::HasKernelType(OsdKernelDispatcher::kOPENMP) ?
+        OsdKernelDispatcher::kOPENMP : OsdKernelDispatcher::kCPU;
+}
+
+// matrix kernels refining the OsdCpuVertexBuffers of the table kernels
+static bool
+isHostMatrixKernel(int kernel) {
+
+    switch (kernel) {
+        case OsdKernelDispatcher::kMKL:
+        case OsdKernelDispatcher::kCCPU:
+        case OsdKernelDispatcher::kHCPU:
+        case OsdKernelDispatcher::kMKL64:
+        case OsdKernelDispatcher::kPCPU:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// a coarse sized copy of buffer for dispatcher, with the coarse primvars if they are on the host
+static OsdVertexBuffer *
+copyCoarseVertices(OsdKernelDispatcher *dispatcher, OsdVertexBuffer *buffer, int numCoarse) {
+
+    if (not buffer)
+        return NULL;
+
+    OsdVertexBuffer * copy = dispatcher->InitializeVertexBuffer(buffer->GetNumElements(), numCoarse);
+    if (float * data = buffer->GetCpuBuffer())
+        copy->UpdateData(data, numCoarse);
+    return copy;
+}
+
+// a subdivision matrix built on a worker thread, while the mesh refines with a table
+// kernel. The worker only reads the Far tables, and refines its own copy of the coarse
+// primvars (which the approximation looks at), so it shares nothing else with the mesh.
+// Without threads the matrix is built right away.
+struct OsdMatrixBuild {
+
+    OsdMatrixBuild(OsdKernelDispatcher *dispatcher, int kernel, FarMesh<OsdVertex> *farMesh,
+                   int level, OsdVertexBuffer *vertex, OsdVertexBuffer *varying) :
+        dispatcher(dispatcher), kernel(kernel), farMesh(farMesh), level(level), done(false) {
+
+        int numCoarse = farMesh->GetNumCoarseVertices();
+        this->vertex = copyCoarseVertices(dispatcher, vertex, numCoarse);
+        this->varying = copyCoarseVertices(dispatcher, varying, numCoarse);
+
+#ifndef _WIN32
+        pthread_mutex_init(&mutex, NULL);
+        running = (pthread_create(&thread, NULL, Run, this) == 0);
+        if (running)
+            return;
+#endif
+        Run(this);
+    }
+
+    // waits for the worker; the dispatcher is deleted unless it was taken
+    ~OsdMatrixBuild() {
+
+        Wait();
+#ifndef _WIN32
+        pthread_mutex_destroy(&mutex);
+#endif
+        delete vertex;
+        delete varying;
+        delete dispatcher;
+    }
+
+    bool IsDone() {
+
+#ifndef _WIN32
+        pthread_mutex_lock(&mutex);
+        bool isDone = done;
+        pthread_mutex_unlock(&mutex);
+        return isDone;
+#else
+        return done;
+#endif
+    }
+
+    void Wait() {
+
+#ifndef _WIN32
+        if (running)
+            pthread_join(thread, NULL);
+        running = false;
+#endif
+    }
+
+    static void * Run(void *data) {
+
+        OsdMatrixBuild * build = (OsdMatrixBuild *)data;
+
+        build->dispatcher->BindVertexBuffer(build->vertex, build->varying);
+        build->dispatcher->OnKernelLaunch();
+
+        build->farMesh->BuildMatrix(build->dispatcher, build->level);
+
+        build->dispatcher->OnKernelFinish();
+        build->dispatcher->UnbindVertexBuffer();
+
+#ifndef _WIN32
+        pthread_mutex_lock(&build->mutex);
+        build->done = true;
+        pthread_mutex_unlock(&build->mutex);
+#else
+        build->done = true;
+#endif
+        return NULL;
+    }
+
+    OsdKernelDispatcher * dispatcher;
+    int kernel;
+
+    FarMesh<OsdVertex> * farMesh;
+    int level;
+
+    OsdVertexBuffer * vertex,
+                    * varying;
+
+    bool done;
+#ifndef _WIN32
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    bool running;
+#endif
+};
+
+OsdMesh::OsdMesh() : _farMesh(NULL), _dispatcher(NULL), _kernel(-1), _matrixKernel(-1),
+    _expectedFrames(0), _numFrames(0), _timeBudget(0.0), _elapsed(0.0), _bestFrame(0.0),
+    _autoKernel(false), _backgroundBuild(false), _statistics(NULL), _build(NULL),
+    _maxApproximationError(0.0f), _outputLevels(0), _topology(NULL), _blendShapeBuffer(NULL) { }
 
 OsdMesh::~OsdMesh() {
 
-    if(_dispatcher)
-        delete _dispatcher;
+    release();
+}
 
-    if(_farMesh)
-        delete _farMesh;
+void
+OsdMesh::release() {
+
+    // the worker reads the Far tables
+    delete _build;
+    _build = NULL;
+
+    if (_topology) {
+        OsdTopologyRegistry::GetInstance().Release(_topology);
+    } else {
+        if(_dispatcher)
+            delete _dispatcher;
+
+        if(_farMesh)
+            delete _farMesh;
+    }
+
+    delete _statistics;
+
+    _topology = NULL;
+    _dispatcher = NULL;
+    _farMesh = NULL;
+    _statistics = NULL;
 }
 
 void
-OsdMesh::createTables( FarSubdivisionTables<OsdVertex> const * tables ) {
+OsdMesh::createTables( OsdKernelDispatcher * dispatcher, FarSubdivisionTables<OsdVertex> const * tables ) {
 
-    _dispatcher->UpdateTable(OsdKernelDispatcher::E_IT,  tables->Get_E_IT());
-    _dispatcher->UpdateTable(OsdKernelDispatcher::V_IT,  tables->Get_V_IT());
-    _dispatcher->UpdateTable(OsdKernelDispatcher::V_ITa, tables->Get_V_ITa());
-    _dispatcher->UpdateTable(OsdKernelDispatcher::E_W,   tables->Get_E_W());
-    _dispatcher->UpdateTable(OsdKernelDispatcher::V_W,   tables->Get_V_W());
+    dispatcher->UpdateTable(OsdKernelDispatcher::E_IT,  tables->Get_E_IT());
+    dispatcher->UpdateTable(OsdKernelDispatcher::V_IT,  tables->Get_V_IT());
+    dispatcher->UpdateTable(OsdKernelDispatcher::V_ITa, tables->Get_V_ITa());
+    dispatcher->UpdateTable(OsdKernelDispatcher::E_W,   tables->Get_E_W());
+    dispatcher->UpdateTable(OsdKernelDispatcher::V_W,   tables->Get_V_W());
 
     if ( const FarCatmarkSubdivisionTables<OsdVertex> * cctable =
        dynamic_cast<const FarCatmarkSubdivisionTables<OsdVertex>*>(tables) ) {
         // catmark
-        _dispatcher->UpdateTable(OsdKernelDispatcher::F_IT, cctable->Get_F_IT());
-        _dispatcher->UpdateTable(OsdKernelDispatcher::F_ITa, cctable->Get_F_ITa());
+        dispatcher->UpdateTable(OsdKernelDispatcher::F_IT, cctable->Get_F_IT());
+        dispatcher->UpdateTable(OsdKernelDispatcher::F_ITa, cctable->Get_F_ITa());
     } else if ( const FarBilinearSubdivisionTables<OsdVertex> * btable =
        dynamic_cast<const FarBilinearSubdivisionTables<OsdVertex>*>(tables) ) {
         // bilinear
-        _dispatcher->UpdateTable(OsdKernelDispatcher::F_IT, btable->Get_F_IT());
-        _dispatcher->UpdateTable(OsdKernelDispatcher::F_ITa, btable->Get_F_ITa());
+        dispatcher->UpdateTable(OsdKernelDispatcher::F_IT, btable->Get_F_IT());
+        dispatcher->UpdateTable(OsdKernelDispatcher::F_ITa, btable->Get_F_ITa());
     } else {
         // XXX for glsl shader...
-        _dispatcher->CopyTable(OsdKernelDispatcher::F_IT, 0, NULL);
-        _dispatcher->CopyTable(OsdKernelDispatcher::F_ITa, 0, NULL);
+        dispatcher->CopyTable(OsdKernelDispatcher::F_IT, 0, NULL);
+        dispatcher->CopyTable(OsdKernelDispatcher::F_ITa, 0, NULL);
     }
 }
 
 void
-OsdMesh::createEditTables( FarVertexEditTables<OsdVertex> const *editTables ) {
+OsdMesh::createEditTables( OsdKernelDispatcher * dispatcher, FarVertexEditTables<OsdVertex> const *editTables ) {
 
     int numEditBatches = editTables->GetNumBatches();
 
-    _dispatcher->AllocateEditTables(numEditBatches);
+    dispatcher->AllocateEditTables(numEditBatches);
 
     for (int i=0; i<numEditBatches; ++i) {
         const FarVertexEditTables<OsdVertex>::VertexEditBatch & edit = editTables->GetBatch(i);
-        _dispatcher->UpdateEditTable(i, edit.GetVertexIndices(), edit.GetValues(),
-                                     edit.GetOperation(), edit.GetPrimvarIndex(), edit.GetPrimvarWidth());
+        dispatcher->UpdateEditTable(i, edit.GetVertexIndices(), edit.GetValues(),
+                                    edit.GetOperation(), edit.GetPrimvarIndex(), edit.GetPrimvarWidth());
     }
 }
 
 bool
 OsdMesh::Create(OsdHbrMesh *hbrMesh, int level, int kernel, int exact, std::vector<int> * remap) {
 
-    if (_dispatcher)
-        delete _dispatcher;
+    release();
+
+    _matrixKernel = -1;
+    _autoKernel = (kernel == OsdKernelDispatcher::kAUTO);
+    _backgroundBuild = false;
+    if (kernel == OsdKernelDispatcher::kAUTO) {
+        if (OsdKernelDispatcher::HasKernelType(OsdKernelDispatcher::kMKL))
+            _matrixKernel = OsdKernelDispatcher::kMKL;
+
+        kernel = tableKernel();
+
+        // the table kernels can't push the vertices to the limit surface
+        if (exact and _matrixKernel >= 0) {
+            kernel = _matrixKernel;
+            _matrixKernel = -1;
+        }
+    }
+
     _dispatcher = OsdKernelDispatcher::CreateKernelDispatcher(level, kernel);
 
     if (not _dispatcher) {
@@ -143,8 +322,18 @@ OsdMesh::Create(OsdHbrMesh *hbrMesh, int level, int kernel, int exact, std::vect
         return false;
     }
 
+    _kernel = kernel;
     _level = level;
     _exact = exact;
+    _numFrames = 0;
+    _elapsed = 0.0;
+    _bestFrame = 0.0;
+    _maxApproximationError = 0.0f;
+    _outputLevels = 0;
+
+    // the auto kernel predicts the matrix from the coarse mesh, before it is refined
+    if (_autoKernel and _matrixKernel >= 0)
+        _statistics = new FarTopologyStatistics(FarMeshPredictor<OsdVertex>(hbrMesh).GetStatistics());
 
     // create Far mesh
     OSD_DEBUG("Create MeshFactory\n");
@@ -156,11 +345,15 @@ OsdMesh::Create(OsdHbrMesh *hbrMesh, int level, int kernel, int exact, std::vect
     OSD_DEBUG("PREP: NumCoarseVertex = %d\n", _farMesh->GetNumCoarseVertices());
     OSD_DEBUG("PREP: NumVertex = %d\n", _farMesh->GetNumVertices());
 
-    createTables( _farMesh->GetSubdivision() );
+    createTables( _dispatcher, _farMesh->GetSubdivision() );
 
     FarVertexEditTables<OsdVertex> const *editTables = _farMesh->GetVertexEdit();
-    if (editTables)
-        createEditTables( editTables );
+    if (editTables) {
+        createEditTables( _dispatcher, editTables );
+
+        // the matrix kernels don't apply hierarchical edits
+        _matrixKernel = -1;
+    }
 
     // copy the remapping table if the client needs to remap vertex indices from
     // Osd to Hbr for comparison / regression purposes.
@@ -170,6 +363,212 @@ OsdMesh::Create(OsdHbrMesh *hbrMesh, int level, int kernel, int exact, std::vect
     return true;
 }
 
+bool
+OsdMesh::SetLevel(int level) {
+
+    // the tables of shared meshes are refined to the level they were registered with
+    if (_topology or not _farMesh or level < 1)
+        return false;
+
+    // the matrix being built refines the current level
+    finishBuild(true);
+
+    if (level > _farMesh->GetSubdivision()->GetMaxLevel()-1) {
+
+        // the coarser levels keep their vertex numbering, so the dispatcher
+        // and the operators it cached stay valid
+        OsdHbrMesh * hbrMesh = _farMesh->ReleaseHbrMesh();
+        delete _farMesh;
+
+        _dispatcher->SetMaxLevel(level);
+
+        FarMeshFactory<OsdVertex> meshFactory(hbrMesh, level);
+
+        _farMesh = meshFactory.Create(_dispatcher);
+
+        OSD_DEBUG("PREP: NumVertex = %d\n", _farMesh->GetNumVertices());
+
+        createTables( _dispatcher, _farMesh->GetSubdivision() );
+
+        FarVertexEditTables<OsdVertex> const *editTables = _farMesh->GetVertexEdit();
+        if (editTables)
+            createEditTables( _dispatcher, editTables );
+    }
+
+    _level = level;
+
+    if (not _operatorFile.empty())
+        StreamOperators(_operatorFile.c_str());
+
+    // refined for the previous level
+    _refinedBase.clear();
+    for (int i=0; i<(int)_blendShapes.size(); ++i) {
+        _blendShapes[i].vertices.clear();
+        _blendShapes[i].deltas.clear();
+    }
+    _blendVertexOffsets.clear();
+    _blendShapeBuffer = NULL;
+    _skinVertexOffsets.clear();
+    _skinVertexBones.clear();
+    _skinContributions.clear();
+
+    return true;
+}
+
+bool
+OsdMesh::CreateShared(OsdHbrMesh *hbrMesh, int level, int kernel, int exact) {
+
+    // the meshes of a topology share their dispatcher, and amortize the matrix
+    // over all of them: kAUTO goes straight to the matrix kernel
+    if (kernel == OsdKernelDispatcher::kAUTO and
+        OsdKernelDispatcher::HasKernelType(OsdKernelDispatcher::kMKL))
+        kernel = OsdKernelDispatcher::kMKL;
+
+    std::vector<unsigned int> signature;
+    if (not OsdTopologyRegistry::GetSignature(hbrMesh, level, kernel, exact, signature))
+        return Create(hbrMesh, level, kernel, exact);
+
+    OsdTopologyRegistry & registry = OsdTopologyRegistry::GetInstance();
+
+    if (OsdTopology * topology = registry.Acquire(signature)) {
+        release();
+
+        _topology = topology;
+        _farMesh = topology->farMesh;
+        _dispatcher = topology->dispatcher;
+        _kernel = kernel;
+        _matrixKernel = -1;
+        _autoKernel = false;
+        _backgroundBuild = false;
+        _level = level;
+        _exact = exact;
+
+        // the shared FarMesh already owns an identical HbrMesh
+        delete hbrMesh;
+        return true;
+    }
+
+    if (not Create(hbrMesh, level, kernel, exact))
+        return false;
+
+    _topology = registry.Insert(signature, _farMesh, _dispatcher, level, exact);
+    return true;
+}
+
+void
+OsdMesh::Predict(OsdHbrMesh *hbrMesh, int maxLevel, int kernel,
+                 std::vector<FarLevelPrediction> & predictions) {
+
+    FarMeshPredictor<OsdVertex> predictor(hbrMesh);
+
+    predictor.Predict(maxLevel, predictions,
+        kernel == OsdKernelDispatcher::kMKL64 ? sizeof(long long) : sizeof(int));
+
+    switch (kernel) {
+        case OsdKernelDispatcher::kCPU:
+        case OsdKernelDispatcher::kOPENMP:
+        case OsdKernelDispatcher::kCUDA:
+        case OsdKernelDispatcher::kGLSL:
+        case OsdKernelDispatcher::kCL:
+            for (int i=0; i<(int)predictions.size(); ++i) {
+                predictions[i].nonzeros = 0;
+                predictions[i].matrixBytes = 0;
+                predictions[i].matrixTime = 0.0;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool
+OsdMesh::ShareOperators(bool publish) {
+
+    if (not _topology)
+        return false;
+
+    _dispatcher->SetSharedOperators(_topology->hash, _topology->signature, publish);
+    return true;
+}
+
+bool
+OsdMesh::StreamOperators(const char *path) {
+
+    std::vector<unsigned int> signature;
+    if (not _farMesh or not getOperatorSignature(signature))
+        return false;
+
+    _operatorFile = path;
+    _dispatcher->SetOperatorFile(path, signature);
+    return true;
+}
+
+bool
+OsdMesh::getOperatorSignature(std::vector<unsigned int> & signature) {
+
+    // meshes read back from a file have no HbrMesh to describe
+    HbrVertex<OsdVertex> * v = _farMesh->GetHbrVertex(0);
+    if (not v)
+        return false;
+
+    // the signature tells the matrices of other meshes or levels apart; they don't
+    // depend on the matrix kernel, but do on the approximation and the stacked levels
+    if (not OsdTopologyRegistry::GetSignature(v->GetMesh(), _level, OsdKernelDispatcher::kMKL,
+                                              _exact, signature))
+        return false;
+
+    unsigned int toleranceBits;
+    memcpy(&toleranceBits, &_maxApproximationError, sizeof(toleranceBits));
+    signature.push_back(toleranceBits);
+    signature.push_back(_outputLevels);
+    return true;
+}
+
+void
+OsdMesh::updateOperatorFile() {
+
+    std::vector<unsigned int> signature;
+    if (not _operatorFile.empty() and getOperatorSignature(signature))
+        _dispatcher->SetOperatorFile(_operatorFile.c_str(), signature);
+}
+
+bool
+OsdMesh::SetBackgroundBuild(bool background) {
+
+    if (not background) {
+        _backgroundBuild = false;
+
+        // a plain matrix mesh stops standing in with the tables
+        finishBuild(true);
+        if (_matrixKernel >= 0 and not _autoKernel)
+            moveToMatrixKernel(NULL, NULL);
+        return true;
+    }
+
+    // the table kernels can't push the vertices to the limit surface, and the matrix
+    // kernels don't apply hierarchical edits, so neither can stand in for the other
+    if (_topology or _exact or not _farMesh or _farMesh->GetVertexEdit())
+        return false;
+
+    if (_autoKernel) {
+        // already moved to the matrix kernel, or there is none
+        if (_matrixKernel < 0 and not _build)
+            return false;
+    } else if (_matrixKernel < 0) {
+        // the vertex buffers of the caller are refined by both kernels
+        if (not isHostMatrixKernel(_kernel))
+            return false;
+
+        int kernel = _kernel;
+        if (not switchKernel(tableKernel()))
+            return false;
+        _matrixKernel = kernel;
+    }
+
+    _backgroundBuild = true;
+    return true;
+}
+
 OsdVertexBuffer *
 OsdMesh::InitializeVertexBuffer(int numElements) {
 
@@ -178,6 +577,12 @@ OsdMesh::InitializeVertexBuffer(int numElements) {
     return _dispatcher->InitializeVertexBuffer(numElements, GetTotalVertices());
 }
 
+OsdVertexBuffer *
+OsdMesh::InitializeInstanceBuffer(int numElements, int numInstances) {
+
+    return InitializeVertexBuffer(numElements * numInstances);
+}
+
 OsdElementArrayBuffer *
 OsdMesh::CreateElementArrayBuffer(int level) {
 
@@ -197,6 +602,23 @@ OsdMesh::CreatePtexCoordinatesTextureBuffer(int level) {
 double
 OsdMesh::Subdivide(OsdVertexBuffer *vertex, OsdVertexBuffer *varying) {
 
+    // the table kernel refines the first frames while the matrix is built
+    if (_build)
+        finishBuild(false);
+    else if (_matrixKernel >= 0 and not _autoKernel)
+        moveToMatrixKernel(vertex, varying);
+
+    double elapsed = runKernels(vertex, varying);
+
+    if (_matrixKernel >= 0 and _autoKernel)
+        updateAutoKernel(elapsed, vertex, varying);
+
+    return elapsed;
+}
+
+double
+OsdMesh::runKernels(OsdVertexBuffer *vertex, OsdVertexBuffer *varying) {
+
     _dispatcher->BindVertexBuffer(vertex, varying);
 
     Stopwatch s;
@@ -215,6 +637,545 @@ OsdMesh::Subdivide(OsdVertexBuffer *vertex, OsdVertexBuffer *varying) {
     return s.GetElapsed();
 }
 
+bool
+OsdMesh::SetMaxApproximationError(float maxError) {
+
+    // the dispatcher of a shared mesh builds the matrix of every mesh of its topology
+    if (_topology)
+        return false;
+
+    // an auto kernel approximates once it moves to the matrix
+    bool deferred = _autoKernel and _matrixKernel >= 0 and maxError > 0.0f;
+
+    if (not _dispatcher->SetMaxApproximationError(maxError) and not deferred)
+        return false;
+
+    _maxApproximationError = maxError;
+    updateOperatorFile();
+    return true;
+}
+
+bool
+OsdMesh::SetOutputLevels(int levelMask) {
+
+    if (_topology)
+        return false;
+
+    if (not _dispatcher->SetOutputLevels(levelMask))
+        return false;
+
+    _outputLevels = levelMask;
+    updateOperatorFile();
+    return true;
+}
+
+// cost of a nonzero of the subdivision matrix, relative to a stencil entry of the
+// table kernels: per frame, and to stage, compose and convert it once. Measured
+// against the CPU table kernel on the regression shapes (cubes, tent and
+// icosahedron at levels 3 to 5, bigguy and venus at levels 2 and 3), a nonzero
+// costs 0.6 to 1.0 entry per frame, and 20 to 110 entries to build, the larger
+// matrices costing more.
+static const double kMatrixFrameCost = 0.75,
+                    kMatrixBuildCost = 60.0;
+
+void
+OsdMesh::updateAutoKernel(double elapsed, OsdVertexBuffer *vertex, OsdVertexBuffer *varying) {
+
+    ++_numFrames;
+    _elapsed += elapsed;
+    if (_numFrames == 1 or elapsed < _bestFrame)
+        _bestFrame = elapsed;
+
+    // frames left to evaluate on whichever kernel
+    bool bounded = _expectedFrames > 0 or _timeBudget > 0.0;
+    double remaining = 0.0;
+    if (_expectedFrames > 0)
+        remaining = _expectedFrames - _numFrames;
+    else if (_timeBudget > 0.0)
+        remaining = (_timeBudget - _elapsed) / std::max(_bestFrame, 1e-9);
+
+    if (bounded and remaining < 1.0)
+        return;
+
+    // the tables refining up to the current level hold about an index and a weight
+    // per stencil entry, and the matrix the rows of the levels it outputs
+    std::vector<FarLevelPrediction> predictions;
+    FarMeshPredictor<OsdVertex>(*_statistics).Predict(_level, predictions);
+
+    if ((int)predictions.size() < _level)
+        return;
+
+    double entries = std::max(0.5 * predictions[_level-1].tableBytes / sizeof(int), 1.0),
+           nonzeros = 0.0;
+    for (int level=1; level<=_level; ++level) {
+        if (level == _level or ((_outputLevels >> level) & 1))
+            nonzeros += (double)predictions[level-1].nonzeros;
+    }
+
+    double entryCost = _bestFrame / entries,
+           matrixFrame = kMatrixFrameCost * entryCost * nonzeros,
+           matrixBuild = kMatrixBuildCost * entryCost * nonzeros;
+
+    OSD_DEBUG("Auto : table frame %g, predicted matrix frame %g and build %g, %g frames left\n",
+              _bestFrame, matrixFrame, matrixBuild, remaining);
+
+    // a matrix built in the background costs no frames, as long as the table kernel
+    // doesn't run out of frames before it is built
+    bool payoff;
+    if (_backgroundBuild)
+        payoff = matrixFrame < _bestFrame and (not bounded or remaining * _bestFrame > matrixBuild);
+    else
+        payoff = bounded ? remaining * (_bestFrame - matrixFrame) > matrixBuild :
+            matrixFrame < _bestFrame;
+
+    if (payoff)
+        moveToMatrixKernel(vertex, varying);
+}
+
+OsdKernelDispatcher *
+OsdMesh::createDispatcher(int kernel) {
+
+    OsdKernelDispatcher * dispatcher =
+        OsdKernelDispatcher::CreateKernelDispatcher(_farMesh->GetSubdivision()->GetMaxLevel()-1, kernel);
+
+    if (not dispatcher)
+        return NULL;
+
+    createTables( dispatcher, _farMesh->GetSubdivision() );
+
+    FarVertexEditTables<OsdVertex> const *editTables = _farMesh->GetVertexEdit();
+    if (editTables)
+        createEditTables( dispatcher, editTables );
+
+    if (_maxApproximationError > 0.0f)
+        dispatcher->SetMaxApproximationError(_maxApproximationError);
+    if (_outputLevels)
+        dispatcher->SetOutputLevels(_outputLevels);
+
+    std::vector<unsigned int> signature;
+    if (not _operatorFile.empty() and getOperatorSignature(signature))
+        dispatcher->SetOperatorFile(_operatorFile.c_str(), signature);
+
+    return dispatcher;
+}
+
+bool
+OsdMesh::switchKernel(int kernel) {
+
+    OsdKernelDispatcher * dispatcher = createDispatcher(kernel);
+
+    if (not dispatcher)
+        return false;
+
+    delete _dispatcher;
+    _dispatcher = dispatcher;
+    _farMesh->SetDispatcher(dispatcher);
+    _kernel = kernel;
+
+    return true;
+}
+
+void
+OsdMesh::moveToMatrixKernel(OsdVertexBuffer *vertex, OsdVertexBuffer *varying) {
+
+    int kernel = _matrixKernel;
+    _matrixKernel = -1;
+
+    if (not _backgroundBuild or not vertex) {
+        if (not switchKernel(kernel))
+            OSD_ERROR("Unknown kernel %d\n", kernel);
+        return;
+    }
+
+    OsdKernelDispatcher * dispatcher = createDispatcher(kernel);
+
+    if (not dispatcher) {
+        OSD_ERROR("Unknown kernel %d\n", kernel);
+        return;
+    }
+
+    OSD_DEBUG("Building the matrix of kernel %d in the background\n", kernel);
+
+    _build = new OsdMatrixBuild(dispatcher, kernel, _farMesh, _level+1, vertex, varying);
+}
+
+void
+OsdMesh::finishBuild(bool wait) {
+
+    if (not _build or (not wait and not _build->IsDone()))
+        return;
+
+    _build->Wait();
+
+    delete _dispatcher;
+    _dispatcher = _build->dispatcher;
+    _farMesh->SetDispatcher(_dispatcher);
+    _kernel = _build->kernel;
+
+    // the mesh owns the dispatcher now
+    _build->dispatcher = NULL;
+    delete _build;
+    _build = NULL;
+}
+
+int
+OsdMesh::AddBlendShape(int numElements, int numVertices, const int *vertices, const float *deltas) {
+
+    BlendShape shape;
+    shape.numElements = numElements;
+    shape.coarseVertices.assign(vertices, vertices + numVertices);
+    shape.coarseDeltas.assign(deltas, deltas + numVertices*numElements);
+
+    _blendShapes.push_back(shape);
+    return (int)_blendShapes.size()-1;
+}
+
+bool
+OsdMesh::refine(OsdVertexBuffer *buffer, std::vector<float> & data) {
+
+    int numVertices = GetTotalVertices();
+
+    buffer->UpdateData(&data[0], numVertices);
+
+    // not a frame : kAUTO and the background build only account for Subdivide()
+    runKernels(buffer, NULL);
+    Synchronize();
+
+    if (float * cpuBuffer = buffer->GetCpuBuffer()) {
+        memcpy(&data[0], cpuBuffer, data.size()*sizeof(float));
+    } else if (OsdGpuVertexBuffer * gpuBuffer = dynamic_cast<OsdGpuVertexBuffer *>(buffer)) {
+        gpuBuffer->GetBufferData(&data[0], 0, numVertices);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool
+OsdMesh::PrepareBlendShapes(const float *coarseBase, int numElements) {
+
+    // hierarchical edits add constant offsets, which would leak into the deltas
+    if (!_farMesh or _farMesh->GetVertexEdit())
+        return false;
+
+    int numCoarse = GetNumCoarseVertices(),
+        numVertices = GetTotalVertices();
+
+    OsdVertexBuffer * buffer = InitializeVertexBuffer(numElements);
+    if (!buffer)
+        return false;
+
+    // the parts of the buffer the kernel doesn't write keep a zero delta
+    _refinedBase.assign(numVertices*numElements, 0.0f);
+    memcpy(&_refinedBase[0], coarseBase, numCoarse*numElements*sizeof(float));
+
+    bool success = refine(buffer, _refinedBase);
+
+    std::vector<float> data;
+    for (int i=0; i<(int)_blendShapes.size() and success; ++i) {
+        BlendShape & shape = _blendShapes[i];
+        if (shape.numElements != numElements) {
+            OSD_ERROR("Blendshape %d has %d elements instead of %d\n", i, shape.numElements, numElements);
+            success = false;
+            break;
+        }
+
+        data.assign(numVertices*numElements, 0.0f);
+        for (int j=0; j<(int)shape.coarseVertices.size(); ++j)
+            memcpy(&data[shape.coarseVertices[j]*numElements],
+                   &shape.coarseDeltas[j*numElements], numElements*sizeof(float));
+
+        success = refine(buffer, data);
+
+        // subdivision is local, so most refined deltas are exactly zero
+        shape.vertices.clear();
+        shape.deltas.clear();
+        for (int v=0; v<numVertices and success; ++v) {
+            const float * delta = &data[v*numElements];
+            bool nonzero = false;
+            for (int k=0; k<numElements; ++k)
+                nonzero |= (delta[k] != 0.0f);
+            if (nonzero) {
+                shape.vertices.push_back(v);
+                shape.deltas.insert(shape.deltas.end(), delta, delta+numElements);
+            }
+        }
+    }
+
+    delete buffer;
+
+    _blendShapeBuffer = NULL;
+    _blendVertexOffsets.clear();
+
+    if (!success) {
+        _refinedBase.clear();
+        return false;
+    }
+
+    // the blendshapes reaching each refined vertex, in blendshape order
+    _blendVertexOffsets.assign(numVertices+1, 0);
+    for (int i=0; i<(int)_blendShapes.size(); ++i)
+        for (int j=0; j<(int)_blendShapes[i].vertices.size(); ++j)
+            ++_blendVertexOffsets[_blendShapes[i].vertices[j]+1];
+    for (int v=0; v<numVertices; ++v)
+        _blendVertexOffsets[v+1] += _blendVertexOffsets[v];
+
+    std::vector<int> next(_blendVertexOffsets.begin(), _blendVertexOffsets.end()-1);
+    _blendVertexShapes.resize(_blendVertexOffsets[numVertices]);
+    _blendVertexDeltas.resize(_blendVertexOffsets[numVertices]);
+    for (int i=0; i<(int)_blendShapes.size(); ++i) {
+        for (int j=0; j<(int)_blendShapes[i].vertices.size(); ++j) {
+            int dst = next[_blendShapes[i].vertices[j]]++;
+            _blendVertexShapes[dst] = i;
+            _blendVertexDeltas[dst] = j*numElements;
+        }
+    }
+
+    _blendDirtyMarks.assign(numVertices, 0);
+    _blendDirtyVertices.clear();
+    return true;
+}
+
+double
+OsdMesh::ApplyBlendShapes(OsdVertexBuffer *vertex, const float *weights) {
+
+    int numElements = vertex->GetNumElements();
+
+    if (_refinedBase.empty() or (int)_refinedBase.size() != numElements*GetTotalVertices())
+        return 0.0;
+
+    int numShapes = (int)_blendShapes.size();
+
+    Stopwatch s;
+    s.Start();
+    if (vertex != _blendShapeBuffer) {
+        _blendShapeResult = _refinedBase;
+
+        for (int i=0; i<numShapes; ++i) {
+            BlendShape const & shape = _blendShapes[i];
+            float w = weights[i];
+            if (w == 0.0f)
+                continue;
+            for (int j=0; j<(int)shape.vertices.size(); ++j) {
+                float * dst = &_blendShapeResult[shape.vertices[j]*numElements];
+                const float * delta = &shape.deltas[j*numElements];
+                for (int k=0; k<numElements; ++k)
+                    dst[k] += w * delta[k];
+            }
+        }
+
+        vertex->UpdateData(&_blendShapeResult[0], GetTotalVertices());
+
+        _blendShapeBuffer = vertex;
+        _blendShapeWeights.assign(weights, weights + numShapes);
+    } else {
+        // the vertices reached by a blendshape whose weight changed are summed
+        // again from the base, in the same order, so that no error builds up
+        for (int i=0; i<numShapes; ++i) {
+            if (weights[i] == _blendShapeWeights[i])
+                continue;
+            _blendShapeWeights[i] = weights[i];
+
+            std::vector<int> const & vertices = _blendShapes[i].vertices;
+            for (int j=0; j<(int)vertices.size(); ++j) {
+                if (not _blendDirtyMarks[vertices[j]]) {
+                    _blendDirtyMarks[vertices[j]] = 1;
+                    _blendDirtyVertices.push_back(vertices[j]);
+                }
+            }
+        }
+
+        float * buffer = vertex->GetCpuBuffer();
+        for (int d=0; d<(int)_blendDirtyVertices.size(); ++d) {
+            int v = _blendDirtyVertices[d];
+            float * dst = &_blendShapeResult[v*numElements];
+            memcpy(dst, &_refinedBase[v*numElements], numElements*sizeof(float));
+
+            for (int j=_blendVertexOffsets[v]; j<_blendVertexOffsets[v+1]; ++j) {
+                float w = weights[_blendVertexShapes[j]];
+                if (w == 0.0f)
+                    continue;
+                const float * delta = &_blendShapes[_blendVertexShapes[j]].deltas[_blendVertexDeltas[j]];
+                for (int k=0; k<numElements; ++k)
+                    dst[k] += w * delta[k];
+            }
+
+            if (buffer)
+                memcpy(buffer + v*numElements, dst, numElements*sizeof(float));
+            _blendDirtyMarks[v] = 0;
+        }
+
+        // device buffers are uploaded whole
+        if (not buffer and not _blendDirtyVertices.empty())
+            vertex->UpdateData(&_blendShapeResult[0], GetTotalVertices());
+        _blendDirtyVertices.clear();
+    }
+    s.Stop();
+
+    return s.GetElapsed();
+}
+
+// bones refined together, 4 elements each
+static const int kSkinningBonesPerPass = 16;
+
+bool
+OsdMesh::PrepareSkinning(int numBones, const float *restPositions,
+                         const int *offsets, const int *bones, const float *weights, bool force) {
+
+    if (!_farMesh or _farMesh->GetVertexEdit())
+        return false;
+
+    int numCoarse = GetNumCoarseVertices(),
+        numVertices = GetTotalVertices();
+
+    _skinRestPositions.assign(restPositions, restPositions + numCoarse*3);
+    _skinOffsets.assign(offsets, offsets + numCoarse+1);
+    _skinBones.assign(bones, bones + offsets[numCoarse]);
+    _skinWeights.assign(weights, weights + offsets[numCoarse]);
+
+    _skinVertexOffsets.clear();
+    _skinVertexBones.clear();
+    _skinContributions.clear();
+
+    // refine w_b * (x,y,z,1) for a batch of bones at a time, and collect the
+    // (vertex, bone) pairs with a nonzero contribution
+    std::vector<int> pairVertices, pairBones;
+    std::vector<float> pairContributions, data;
+
+    for (int firstBone=0; firstBone<numBones; firstBone+=kSkinningBonesPerPass) {
+        int nbones = std::min(kSkinningBonesPerPass, numBones-firstBone),
+            width = 4*nbones;
+
+        OsdVertexBuffer * buffer = InitializeVertexBuffer(width);
+        if (!buffer)
+            return false;
+
+        data.assign(numVertices*width, 0.0f);
+        for (int v=0; v<numCoarse; ++v) {
+            for (int j=offsets[v]; j<offsets[v+1]; ++j) {
+                int b = bones[j]-firstBone;
+                if (b < 0 or b >= nbones)
+                    continue;
+                float * dst = &data[v*width + 4*b];
+                dst[0] += weights[j] * restPositions[3*v+0];
+                dst[1] += weights[j] * restPositions[3*v+1];
+                dst[2] += weights[j] * restPositions[3*v+2];
+                dst[3] += weights[j];
+            }
+        }
+
+        bool success = refine(buffer, data);
+        delete buffer;
+        if (!success)
+            return false;
+
+        for (int v=0; v<numVertices; ++v) {
+            for (int b=0; b<nbones; ++b) {
+                const float * c = &data[v*width + 4*b];
+                if (c[0] == 0.0f and c[1] == 0.0f and c[2] == 0.0f and c[3] == 0.0f)
+                    continue;
+                pairVertices.push_back(v);
+                pairBones.push_back(firstBone+b);
+                pairContributions.insert(pairContributions.end(), c, c+4);
+            }
+        }
+    }
+
+    // per frame, the precomputation costs a 3x4 transform per pair, while the
+    // alternative skins the coarse vertices and runs the operator on positions
+    double skinCost = 24.0 * (double)_skinBones.size(),
+           subdivCost = 6.0 * (double)_dispatcher->GetNumNonzeros(),
+           precomputedCost = 24.0 * (double)pairVertices.size();
+
+    // table kernels have no matrix: count their table entries instead
+    if (subdivCost == 0.0)
+        subdivCost = 6.0 * (double)_farMesh->GetSubdivision()->GetMemoryUsed() / sizeof(int);
+
+    OSD_DEBUG("Skinning : precomputed %g, skin then subdivide %g\n",
+              precomputedCost, skinCost+subdivCost);
+
+    if (!force and precomputedCost >= skinCost+subdivCost)
+        return false;
+
+    // sort the pairs by vertex
+    _skinVertexOffsets.assign(numVertices+1, 0);
+    for (int i=0; i<(int)pairVertices.size(); ++i)
+        ++_skinVertexOffsets[pairVertices[i]+1];
+    for (int v=0; v<numVertices; ++v)
+        _skinVertexOffsets[v+1] += _skinVertexOffsets[v];
+
+    std::vector<int> next(_skinVertexOffsets.begin(), _skinVertexOffsets.end()-1);
+    _skinVertexBones.resize(pairVertices.size());
+    _skinContributions.resize(pairContributions.size());
+    for (int i=0; i<(int)pairVertices.size(); ++i) {
+        int dst = next[pairVertices[i]]++;
+        _skinVertexBones[dst] = pairBones[i];
+        memcpy(&_skinContributions[4*dst], &pairContributions[4*i], 4*sizeof(float));
+    }
+    return true;
+}
+
+double
+OsdMesh::Skin(OsdVertexBuffer *vertex, const float *boneMatrices) {
+
+    if (_skinOffsets.empty())
+        return 0.0;
+
+    int numElements = vertex->GetNumElements(),
+        numVertices = GetTotalVertices();
+
+    Stopwatch s;
+    s.Start();
+    {
+        _skinResult.assign(numVertices*numElements, 0.0f);
+
+        if (IsSkinningPrecomputed()) {
+#pragma omp parallel for
+            for (int v=0; v<numVertices; ++v) {
+                float * dst = &_skinResult[v*numElements];
+                for (int j=_skinVertexOffsets[v]; j<_skinVertexOffsets[v+1]; ++j) {
+                    const float * T = &boneMatrices[12*_skinVertexBones[j]],
+                                * c = &_skinContributions[4*j];
+                    dst[0] += T[0]*c[0] + T[1]*c[1] + T[2] *c[2] + T[3] *c[3];
+                    dst[1] += T[4]*c[0] + T[5]*c[1] + T[6] *c[2] + T[7] *c[3];
+                    dst[2] += T[8]*c[0] + T[9]*c[1] + T[10]*c[2] + T[11]*c[3];
+                }
+            }
+            vertex->UpdateData(&_skinResult[0], numVertices);
+        } else {
+            int numCoarse = GetNumCoarseVertices();
+            for (int v=0; v<numCoarse; ++v) {
+                float * dst = &_skinResult[v*numElements];
+                const float * x = &_skinRestPositions[3*v];
+                for (int j=_skinOffsets[v]; j<_skinOffsets[v+1]; ++j) {
+                    const float * T = &boneMatrices[12*_skinBones[j]];
+                    float w = _skinWeights[j];
+                    dst[0] += w * (T[0]*x[0] + T[1]*x[1] + T[2] *x[2] + T[3]);
+                    dst[1] += w * (T[4]*x[0] + T[5]*x[1] + T[6] *x[2] + T[7]);
+                    dst[2] += w * (T[8]*x[0] + T[9]*x[1] + T[10]*x[2] + T[11]);
+                }
+            }
+            vertex->UpdateData(&_skinResult[0], numVertices);
+            Subdivide(vertex);
+        }
+    }
+    s.Stop();
+
+    return s.GetElapsed();
+}
+
+double
+OsdMesh::Subdivide(OsdVertexBuffer *vertex, int firstElement, int numElements) {
+
+    _dispatcher->SetElementRange(firstElement, numElements);
+
+    double elapsed = Subdivide(vertex);
+
+    _dispatcher->SetElementRange(0, 0);
+
+    return elapsed;
+}
+
 double
 OsdMesh::Synchronize() {
 
@@ -78,9 +78,13 @@ typedef HbrFace<OsdVertex>     OsdHbrFace;
 typedef HbrHalfedge<OsdVertex> OsdHbrHalfedge;
 
 template <class U> class FarMesh;
+struct FarLevelPrediction;
+struct FarTopologyStatistics;
 
 class OsdKernelDispatcher;
 class OsdElementArrayBuffer;
+struct OsdTopology;
+struct OsdMatrixBuild;
 class OsdPtexCoordinatesTextureBuffer;
 
 class OsdMesh {
@@ -92,18 +96,73 @@ public:
 
     // Given a valid HbrMesh, create an OsdMesh
     //   - capable of densely refining up to 'level'
-    //   - subdivision kernel one of (kCPU, kOPENMP, kCUDA, kGLSL, kCL, kMKL, kCLSPMV, kCUSPARSE)
+    //   - subdivision kernel one of (kCPU, kOPENMP, kCUDA, kGLSL, kCL, kMKL, kCLSPMV, kCUSPARSE),
+    //     or kAUTO, which starts on a table kernel and switches to the matrix kernel
+    //     once its build cost is predicted to pay off (see SetExpectedFrames)
     //   - optional "remapping" vector that connects Osd and Hbr vertex indices
     //     (for regression)
     bool Create(OsdHbrMesh *hbrMesh, int level, int kernel, int exact, std::vector<int> * remap=0);
 
+    // Same as Create, but shares the Far tables and the kernel dispatcher (and
+    // with them the subdivision matrix) with every other OsdMesh created from
+    // an identical topology. The OsdMesh takes ownership of hbrMesh, which is
+    // deleted right away if a matching topology already exists.
+    bool CreateShared(OsdHbrMesh *hbrMesh, int level, int kernel, int exact);
+
+    // predicts the vertex counts, table and matrix sizes and build times of the levels 1
+    // to maxLevel of the coarse hbrMesh for kernel, without refining it, e.g. to pick the
+    // highest level that fits a memory budget. The matrix fields are zero for the table
+    // kernels.
+    static void Predict(OsdHbrMesh *hbrMesh, int maxLevel, int kernel,
+                        std::vector<FarLevelPrediction> & predictions);
+
+    // true if the tables are shared with other meshes
+    bool IsShared() const { return _topology != NULL; }
+
     FarMesh<OsdVertex> *GetFarMesh() { return _farMesh; }
 
     int GetLevel() const { return _level; }
 
+    // the kernel Subdivide() currently runs, which changes for meshes created with kAUTO
+    int GetKernel() const { return _kernel; }
+
+    // for meshes created with kAUTO, the number of frames the caller is going to evaluate,
+    // or the time in seconds it is going to spend evaluating them. The matrix kernel has a
+    // large time to first frame but faster frames: the mesh switches to it when building
+    // the matrix and running the remaining frames is predicted to take less time than
+    // running them on the table kernel. Without either, the frames are assumed to go on
+    // indefinitely.
+    void SetExpectedFrames(int numFrames) { _expectedFrames = numFrames; }
+
+    void SetTimeBudget(double seconds) { _timeBudget = seconds; }
+
+    // lets meshes created with a host matrix kernel (kMKL, kCCPU, kHCPU, kMKL64, kPCPU),
+    // or with kAUTO, build the matrix on a worker thread. Subdivide() refines with a table
+    // kernel until the matrix is ready and then swaps to it, so the first frames don't
+    // wait for the build; kAUTO then only needs the matrix frames to be faster. Must be
+    // called before the first Subdivide(). Returns false for shared meshes, exact
+    // evaluation and hierarchical edits, which the table kernels can't stand in for.
+    bool SetBackgroundBuild(bool background);
+
+    // true while Subdivide() runs a table kernel for a matrix built in the background
+    bool IsBuildPending() const { return _build != NULL; }
+
+    // switches the level Subdivide() refines to. Levels up to the deepest one created so
+    // far reuse their tables, and the per-level operators cached by matrix kernels, so
+    // going back to one of them costs no rebuild. A deeper level refines the retained
+    // HbrMesh further and recreates the Far tables (vertex buffers must be reinitialized),
+    // but matrix kernels only multiply in the new levels. Drops the blendshape and
+    // skinning precomputations. Returns false for meshes created with CreateShared().
+    bool SetLevel(int level);
+
     // creates and initializes vertex buffer. Must call Creates() before calling this function.
     OsdVertexBuffer * InitializeVertexBuffer(int numElements);
 
+    // creates a vertex buffer holding numInstances copies of the primvars, interleaved
+    // per vertex, so that a batch of instances is refined by a single Subdivide().
+    // Must call Creates() before calling this function.
+    OsdVertexBuffer * InitializeInstanceBuffer(int numElements, int numInstances);
+
     // creates element indices buffer for given level. Must call Creates() before calling this function.
     OsdElementArrayBuffer * CreateElementArrayBuffer(int level);
 
@@ -113,6 +172,11 @@ public:
     // for non-interleaved vertex data, returns time in seconds for execution
     double Subdivide(OsdVertexBuffer *vertex, OsdVertexBuffer *varying = NULL);
 
+    // refines only numElements interleaved elements of each vertex, starting at firstElement,
+    // e.g. the positions when the other primvars are static. Matrix kernels leave the other
+    // elements untouched, the others (and the first Subdivide) refine every element.
+    double Subdivide(OsdVertexBuffer *vertex, int firstElement, int numElements);
+
 /*
     // for interleaved vertex data ?
     template <class T> void Subdivide(T *vertex) { }
@@ -122,13 +186,116 @@ public:
 
     int GetTotalVertices() const { return _farMesh->GetNumVertices(); }
 
+    // lets matrix kernels drop small weights from the subdivision matrix, as long as
+    // no vertex moves by more than maxError. Must be called before the first Subdivide().
+    // The bound holds for poses within the radius of the coarse vertices of that first
+    // Subdivide() : deforming cages may exceed it. Returns false if the kernel (or the
+    // matrix kernel an auto kernel moves to) can't approximate, and for meshes created
+    // with CreateShared(), whose matrix is shared with the other meshes of the topology.
+    bool SetMaxApproximationError(float maxError);
+
+    // positional error bound achieved by the approximation, and the number of nonzeroes it saved
+    float GetApproximationError() const { return _dispatcher->GetApproximationError(); }
+
+    long long GetApproximationSavings() const { return _dispatcher->GetApproximationSavings(); }
+
+    // lets matrix kernels also write the levels set in levelMask (bit l for level l) in the
+    // same pass as the finest level. Must be called before the first Subdivide(). Returns
+    // false if the kernel can't stack levels, and for meshes created with CreateShared().
+    bool SetOutputLevels(int levelMask);
+
+    // lets matrix kernels map the subdivision matrix of a mesh created with CreateShared()
+    // from POSIX shared memory, where another process of the node published it. With
+    // publish set, the matrix is built and published if nobody did yet. Must be called
+    // before the first Subdivide(). Returns false if the mesh is not shared.
+    bool ShareOperators(bool publish);
+
+    // lets matrix kernels stream the subdivision matrix from the file at path, for meshes
+    // whose matrix doesn't fit in memory. The file is written by the first Subdivide(),
+    // unless it already holds the matrix of this mesh, e.g. from a previous run. Must be
+    // called before the first Subdivide(). Returns false for meshes with hierarchical edits.
+    bool StreamOperators(const char *path);
+
+    // registers a blendshape, given as deltas of numElements floats on a few coarse vertices,
+    // and returns its index. numElements must match the vertex buffer passed to Subdivide().
+    int AddBlendShape(int numElements, int numVertices, const int *vertices, const float *deltas);
+
+    // refines the coarse base primvars and every registered blendshape once through the
+    // subdivision operator, and keeps the refined deltas sparsely. Returns false for meshes
+    // with hierarchical edits, which are not linear in the coarse vertices.
+    bool PrepareBlendShapes(const float *coarseBase, int numElements);
+
+    // writes the refined base plus the refined deltas weighted by weights (one per blendshape)
+    // into vertex, without running the subdivision operator. The first call on a buffer writes
+    // every vertex, and the next ones only the vertices of the blendshapes whose weight changed,
+    // so the buffer must not be written by anything else in between (see InvalidateBlendShapes).
+    // Device buffers are still uploaded whole. Returns the time in seconds.
+    double ApplyBlendShapes(OsdVertexBuffer *vertex, const float *weights);
+
+    // makes the next ApplyBlendShapes() write every vertex, e.g. after the buffer was refined
+    void InvalidateBlendShapes() { _blendShapeBuffer = NULL; }
+
+    int GetNumBlendShapes() const { return (int)_blendShapes.size(); }
+
+    // registers a linear blend skinning rig: the rest positions (xyz) of the coarse vertices,
+    // and for coarse vertex v the bone influences [offsets[v], offsets[v+1]) of bones and
+    // weights. Refined vertices are affine in the bone transforms, so the refined rest pose
+    // contribution of every bone is precomputed, and kept sparsely over the bones reaching
+    // each refined vertex. The precomputation is kept if evaluating the refined vertices
+    // straight from the bones is predicted to be cheaper than skinning the coarse vertices
+    // and subdividing them, or if force is set. Returns whether it is kept.
+    bool PrepareSkinning(int numBones, const float *restPositions,
+                         const int *offsets, const int *bones, const float *weights,
+                         bool force=false);
+
+    // poses the refined vertices with numBones 3x4 row-major affine boneMatrices. Positions
+    // go to the first 3 elements of vertex, and the other elements are set to zero.
+    // Returns the time in seconds.
+    double Skin(OsdVertexBuffer *vertex, const float *boneMatrices);
+
+    bool IsSkinningPrecomputed() const { return not _skinVertexOffsets.empty(); }
+
     int GetNumCoarseVertices() const { return _farMesh->GetNumCoarseVertices(); }
 
 protected:
 
-    void createTables( FarSubdivisionTables<OsdVertex> const * tables );
+    void createTables( OsdKernelDispatcher * dispatcher, FarSubdivisionTables<OsdVertex> const * tables );
+
+    void createEditTables( OsdKernelDispatcher * dispatcher, FarVertexEditTables<OsdVertex> const * editTables );
+
+    // drops the tables, or the reference to the shared ones
+    void release();
 
-    void createEditTables( FarVertexEditTables<OsdVertex> const * editTables );
+    // runs the kernels of the current dispatcher once, and returns the time in seconds
+    double runKernels(OsdVertexBuffer *vertex, OsdVertexBuffer *varying);
+
+    // runs the subdivision operator on data, a full vertex buffer worth of primvars, outside
+    // of the frames Subdivide() accounts for
+    bool refine(OsdVertexBuffer *buffer, std::vector<float> & data);
+
+    // for kAUTO meshes still on the table kernel, accounts for a frame that took
+    // elapsed seconds, and moves to the matrix kernel if it pays off
+    void updateAutoKernel(double elapsed, OsdVertexBuffer *vertex, OsdVertexBuffer *varying);
+
+    // signature of the matrices of this mesh in an operator file
+    bool getOperatorSignature(std::vector<unsigned int> & signature);
+
+    // passes the operator file on with the signature of the current matrix settings
+    void updateOperatorFile();
+
+    // creates a dispatcher for kernel holding the Far tables and the matrix settings
+    OsdKernelDispatcher * createDispatcher(int kernel);
+
+    // moves the Far tables to a new dispatcher for kernel
+    bool switchKernel(int kernel);
+
+    // moves to _matrixKernel, building the matrix on a worker thread for the primvars
+    // layout of vertex and varying if the build runs in the background
+    void moveToMatrixKernel(OsdVertexBuffer *vertex, OsdVertexBuffer *varying);
+
+    // swaps in the matrix built in the background once it is ready, or right away
+    // waiting for it if wait is set
+    void finishBuild(bool wait);
 
     FarMesh<OsdVertex> *_farMesh;
 
@@ -137,6 +304,73 @@ protected:
 
     OsdKernelDispatcher * _dispatcher;
 
+    int _kernel;
+
+    // kAUTO and background build state: the matrix kernel to move to (-1 once moved,
+    // or if there is none), the caller's expectations and the table frames run so far
+    int _matrixKernel,
+        _expectedFrames,
+        _numFrames;
+    double _timeBudget,
+           _elapsed,
+           _bestFrame;
+    bool _autoKernel,
+         _backgroundBuild;
+
+    // coarse topology of a kAUTO mesh, from which its matrix is predicted
+    FarTopologyStatistics * _statistics;
+
+    // matrix being built on a worker thread, if any
+    OsdMatrixBuild * _build;
+
+    // settings forwarded to the matrix kernel when switching to it
+    float _maxApproximationError;
+    int _outputLevels;
+
+    // registry entry owning _farMesh and _dispatcher if they are shared
+    OsdTopology * _topology;
+
+    // file the subdivision matrix is streamed from, if any
+    std::string _operatorFile;
+
+    struct BlendShape {
+        int numElements;
+        std::vector<int>   coarseVertices,  // as registered
+                           vertices;        // refined, with a nonzero delta
+        std::vector<float> coarseDeltas,
+                           deltas;
+    };
+
+    std::vector<BlendShape> _blendShapes;
+    std::vector<float> _refinedBase,
+                       _blendShapeResult;
+
+    // the blendshapes reaching refined vertex v are [_blendVertexOffsets[v], _blendVertexOffsets[v+1])
+    // of _blendVertexShapes, with their delta at _blendVertexDeltas in the blendshape
+    std::vector<int>   _blendVertexOffsets,
+                       _blendVertexShapes,
+                       _blendVertexDeltas;
+
+    // buffer holding _blendShapeResult for _blendShapeWeights, if any
+    OsdVertexBuffer *  _blendShapeBuffer;
+    std::vector<float> _blendShapeWeights;
+
+    // vertices to write by the next ApplyBlendShapes()
+    std::vector<char>  _blendDirtyMarks;
+    std::vector<int>   _blendDirtyVertices;
+
+    // coarse skinning rig
+    std::vector<float> _skinRestPositions,
+                       _skinWeights;
+    std::vector<int>   _skinOffsets,
+                       _skinBones;
+
+    // refined rest pose contribution (x,y,z,w) of each bone reaching a refined vertex
+    std::vector<int>   _skinVertexOffsets,
+                       _skinVertexBones;
+    std::vector<float> _skinContributions,
+                       _skinResult;
+
     // mbd: for connectivity queries during limit surface eval
     OpenSubdiv::OsdHbrMesh * _hbrMesh;
 };
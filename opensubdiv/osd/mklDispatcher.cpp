@@ -1,6 +1,23 @@
 #include "../version.h"
 #include "../osd/mklDispatcher.h"
 #include "../osd/mklKernel.h"
+#ifndef _WIN32
+#include "../osd/sharedOperators.h"
+#include <sys/mman.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    #include <omp.h>
+#endif
 
 char* osdSpMVKernel_DumpSpy_FileName = NULL;
 Stopwatch g_matrixTimer;
@@ -36,23 +53,42 @@ CpuCooMatrix::gemm(CpuCsrMatrix* rhs) {
     return answer;
 }
 
-CpuCsrMatrix::CpuCsrMatrix(int m, int n, int nnz, int nve) :
-    CsrMatrix(m, n, nnz, nve) {
-    rows = (int*) malloc((m+1) * sizeof(int));
-    cols = (int*) malloc(nnz * sizeof(int));
-    vals = (float*) malloc(nnz * sizeof(float));
+template <class Offset>
+CpuCsrMatrixT<Offset>::CpuCsrMatrixT(int m, int n, Offset nnz, int nve) :
+    super(m, n, nnz, nve), ownsArrays(true) {
+    rows = (Offset*) malloc((size_t) (m+1) * sizeof(Offset));
+    cols = (int*) malloc((size_t) nnz * sizeof(int));
+    vals = (float*) malloc((size_t) nnz * sizeof(float));
     rows[m] = nnz+1;
 }
 
-CpuCsrMatrix::CpuCsrMatrix(const CpuCooMatrix* StagedOp, int nve) :
-    CsrMatrix(StagedOp, nve) {
+template <class Offset>
+CpuCsrMatrixT<Offset>::CpuCsrMatrixT(int m, int n, Offset nnz, int nve, Offset* rows, int* cols, float* vals) :
+    super(m, n, nnz, nve), rows(rows), cols(cols), vals(vals), ownsArrays(false)
+{ }
+
+// MKL converts into 32-bit row offsets, which are widened afterwards
+static int*
+conversionRows(int* rows, int m, std::vector<int> & buffer) {
+    return rows;
+}
+
+static int*
+conversionRows(long long* rows, int m, std::vector<int> & buffer) {
+    buffer.resize(m+1);
+    return &buffer[0];
+}
+
+template <class Offset>
+CpuCsrMatrixT<Offset>::CpuCsrMatrixT(const CpuCooMatrix* StagedOp, int nve) :
+    super(StagedOp, nve), ownsArrays(true) {
 
     m = StagedOp->m;
     n = StagedOp->n;
     int numnz = StagedOp->nnz;
-    rows = (int*) malloc((m+1) * sizeof(int));
-    cols = (int*) malloc(numnz * sizeof(int));
-    vals = (float*) malloc(numnz * sizeof(float));
+    rows = (Offset*) malloc((size_t) (m+1) * sizeof(Offset));
+    cols = (int*) malloc((size_t) numnz * sizeof(int));
+    vals = (float*) malloc((size_t) numnz * sizeof(float));
 
     int job[] = {
         2, // job(1)=2 (coo->csr with sorting)
@@ -68,123 +104,1049 @@ CpuCsrMatrix::CpuCsrMatrix(const CpuCooMatrix* StagedOp, int nve) :
     int* colind = (int*) &StagedOp->cols[0];
     int info;
 
+    // a single staged matrix always fits 32-bit offsets
+    std::vector<int> buffer;
+    int* csrRows = conversionRows(rows, m, buffer);
+
     g_matrixTimer.Start();
     {
-        mkl_scsrcoo(job, &m, vals, cols, rows, &numnz, acoo, rowind, colind, &info);
+        mkl_scsrcoo(job, &m, vals, cols, csrRows, &numnz, acoo, rowind, colind, &info);
     }
     g_matrixTimer.Stop();
 
     assert(info == 0);
 
+    if (not buffer.empty())
+        std::copy(buffer.begin(), buffer.end(), rows);
+
     nnz = rows[m]-1;
 }
 
-void
-CpuCsrMatrix::logical_spmv(float* __restrict__  d_out, float* __restrict__ d_in, float *h_in) {
+// the logical kernel takes 32-bit offsets only
+static bool
+logicalSpMV(int m, int* rows, int* cols, float* vals, float* d_out, float* d_in) {
     LogicalSpMV_csr1_cpu(m, rows, cols, vals, d_in, d_out);
+    return true;
 }
 
+// never asked for by OsdMklWideKernelDispatcher, see convertedMatrix
+static bool
+logicalSpMV(int m, long long* rows, int* cols, float* vals, float* d_out, float* d_in) {
+    return false;
+}
+
+template <class Offset>
 void
-CpuCsrMatrix::spmv(float* d_out, float* d_in) {
+CpuCsrMatrixT<Offset>::logical_spmv(float* __restrict__  d_out, float* __restrict__ d_in, float *h_in) {
+    if (not logicalSpMV(m, rows, cols, vals, d_out, d_in))
+        spmv(d_out, d_in);
+}
+
+template <class Offset>
+void
+CpuCsrMatrixT<Offset>::spmv(float* d_out, float* d_in) {
+    spmm(d_out, d_in, nve);
+}
+
+template <class Offset>
+bool
+CpuCsrMatrixT<Offset>::spmm(float* d_out, float* d_in, int nrhs) {
+    return spmm_strided(d_out, d_in, nrhs, nrhs);
+}
+
+template <class Offset>
+bool
+CpuCsrMatrixT<Offset>::spmm_strided(float* d_out, float* d_in, int ld, int width) {
+    spmm_rows(0, m, d_out, d_in, ld, width);
+    return true;
+}
+
+static void
+multiplyRows(int n, int begin, int end, int* rows, int* cols, float* vals,
+             float* d_out, float* d_in, int ld, int width) {
     char *mkl_transa = (char*) "N";
-    int mkl_m = m,
-        mkl_n = nve,
+    int mkl_m = end-begin,
+        mkl_n = width,
         mkl_k = n;
     float mkl_alpha = 1.0f;
     char *mkl_matdesrca = (char*) "G__C__";
-    float *mkl_val = vals;
-    int *mkl_indx = cols,
-        *mkl_pntrb = rows,
-        *mkl_pntre = rows+1;
+    // MKL takes the row offsets relative to pntrb[0], so the
+    // elements start at the first one of the block
+    float *mkl_val = vals + rows[begin];
+    int *mkl_indx = cols + rows[begin],
+        *mkl_pntrb = rows+begin,
+        *mkl_pntre = rows+begin+1;
     float *mkl_b = d_in;
-    int mkl_ldb = nve;
+    int mkl_ldb = ld;
     float mkl_beta = 0.0f;
-    float *mkl_c = d_out;
-    int mkl_ldc = nve;
+    float *mkl_c = d_out + (size_t) begin*ld;
+    int mkl_ldc = ld;
 
     mkl_scsrmm(mkl_transa, &mkl_m, &mkl_n, &mkl_k, &mkl_alpha,
             mkl_matdesrca, mkl_val, mkl_indx, mkl_pntrb, mkl_pntre,
             mkl_b, &mkl_ldb, &mkl_beta, mkl_c, &mkl_ldc);
 }
 
-CpuCsrMatrix*
-CpuCsrMatrix::gemm(CpuCsrMatrix* rhs) {
+// 64-bit offsets are out of reach of MKL's LP64 interface
+static void
+multiplyRows(int n, int begin, int end, long long* rows, int* cols, float* vals,
+             float* d_out, float* d_in, int ld, int width) {
+    SpMM_csr0_wide_cpu(begin, end, rows, cols, vals, ld, width, d_in, d_out);
+}
+
+template <class Offset>
+void
+CpuCsrMatrixT<Offset>::spmm_rows(int begin, int end, float* d_out, float* d_in, int ld, int width) {
+    multiplyRows(n, begin, end, rows, cols, vals, d_out, d_in, ld, width);
+}
 
-    Stopwatch s;
+/*
+ * Accumulates one row of a sparse product. Narrow products use a
+ * dense array indexed by column, wide ones an open-addressing hash
+ * table sized from the upper bound on the row length. Each thread
+ * owns one accumulator, so no synchronization is needed.
+ */
+class CsrRowAccumulator {
+public:
+    CsrRowAccumulator(int ncols, int maxRowNnz) : _mask(0) {
+        int size = 1;
+        while (size < 2*maxRowNnz)
+            size <<= 1;
 
-    CpuCsrMatrix* A = this;
-    CpuCsrMatrix* B = rhs;
+        _dense = (ncols <= 4*size);
+        if (_dense) {
+            _keys.resize(ncols, -1);
+            _vals.resize(ncols, 0.0f);
+        } else {
+            _keys.resize(size, -1);
+            _vals.resize(size, 0.0f);
+            _mask = size-1;
+        }
+        _slots.reserve(maxRowNnz);
+    }
+
+    void Accumulate(int col, float val) {
+        int slot = find(col);
+        if (_keys[slot] < 0) {
+            _keys[slot] = col;
+            _vals[slot] = val;
+            _slots.push_back(slot);
+        } else {
+            _vals[slot] += val;
+        }
+    }
+
+    /* symbolic pass : registers the column, without value */
+    void Mark(int col) {
+        int slot = find(col);
+        if (_keys[slot] < 0) {
+            _keys[slot] = col;
+            _slots.push_back(slot);
+        }
+    }
+
+    int Size() const {
+        return (int) _slots.size();
+    }
+
+    /* writes the row with one-based, sorted columns and resets */
+    void Flush(int *cols, float *vals) {
+        std::sort(_slots.begin(), _slots.end(), KeyLess(&_keys[0]));
+        for (int i = 0; i < (int) _slots.size(); i++) {
+            cols[i] = _keys[_slots[i]]+1;
+            vals[i] = _vals[_slots[i]];
+        }
+        Clear();
+    }
+
+    /* slots are released directly, a lookup would stop at the
+     * first slot already released on its probe sequence */
+    void Clear() {
+        for (int i = 0; i < (int) _slots.size(); i++)
+            _keys[_slots[i]] = -1;
+        _slots.clear();
+    }
+
+private:
+    struct KeyLess {
+        const int* keys;
+        KeyLess(const int* keys) : keys(keys) { }
+        bool operator()(int a, int b) const { return keys[a] < keys[b]; }
+    };
+
+    int find(int col) const {
+        if (_dense)
+            return col;
+        int slot = (int) (((unsigned int) col * 2654435761u) & _mask);
+        while (_keys[slot] >= 0 and _keys[slot] != col)
+            slot = (slot+1) & _mask;
+        return slot;
+    }
+
+    bool _dense;
+    int _mask;
+    std::vector<int> _keys;
+    std::vector<float> _vals;
+    std::vector<int> _slots;
+};
+
+template <class Offset>
+static inline void
+accumulateRow(const CpuCsrMatrixT<Offset>* A, const CpuCsrMatrixT<Offset>* B, int row, CsrRowAccumulator & acc) {
+    for (Offset p = A->rows[row]-1; p < A->rows[row+1]-1; p++) {
+        int k = A->cols[p]-1;
+        float a = A->vals[p];
+        for (Offset q = B->rows[k]-1; q < B->rows[k+1]-1; q++)
+            acc.Accumulate(B->cols[q]-1, a * B->vals[q]);
+    }
+}
+
+template <class Offset>
+static inline void
+markRow(const CpuCsrMatrixT<Offset>* A, const CpuCsrMatrixT<Offset>* B, int row, CsrRowAccumulator & acc) {
+    for (Offset p = A->rows[row]-1; p < A->rows[row+1]-1; p++) {
+        int k = A->cols[p]-1;
+        for (Offset q = B->rows[k]-1; q < B->rows[k+1]-1; q++)
+            acc.Mark(B->cols[q]-1);
+    }
+}
+
+// products of concurrent teams (see composeChain) overlap, and are timed
+// by their caller
+static inline bool
+timedProduct() {
+#ifdef OPENSUBDIV_HAS_OPENMP
+    return not omp_in_parallel();
+#else
+    return true;
+#endif
+}
+
+template <class Offset>
+CpuCsrMatrixT<Offset>*
+CpuCsrMatrixT<Offset>::gemm(CpuCsrMatrixT* rhs) {
+
+    CpuCsrMatrixT* A = this;
+    CpuCsrMatrixT* B = rhs;
     assert(A->n == B->m);
 
-    int request = 1; // count nonzeroes
-    int sort = 7; // don't reorder nonzeroes
-    int info = 0; // output info flag
+    int m = A->m;
+    Offset* c_rows = (Offset*) malloc((size_t) (m+1) * sizeof(Offset));
 
-    int c_rows[A->m+1];
-    int c_nnz;
+    bool timed = timedProduct();
+    if (timed)
+        g_matrixTimer.Start();
 
-    /* count nonzeroes in C */
-    g_matrixTimer.Start();
+    /* upper bound on the length of each row of C */
+#pragma omp parallel for
+    for (int i = 0; i < m; i++) {
+        Offset bound = 0;
+        for (Offset p = A->rows[i]-1; p < A->rows[i+1]-1; p++) {
+            int k = A->cols[p]-1;
+            bound += B->rows[k+1] - B->rows[k];
+        }
+        c_rows[i+1] = bound;
+    }
+
+    Offset maxBound = 0;
+    for (int i = 0; i < m; i++)
+        maxBound = std::max(maxBound, c_rows[i+1]);
+    int maxRowNnz = (int) std::min(maxBound, (Offset) B->n);
+
+    /* count nonzeroes in C, from the column pattern only */
+#pragma omp parallel
     {
-        mkl_scsrmultcsr((char*)"N", &request, &sort,
-                &A->m, &A->n, &B->n,
-                A->vals, A->cols, A->rows,
-                B->vals, B->cols, B->rows,
-                NULL, NULL, &c_rows[0],
-                &c_nnz, &info);
+        CsrRowAccumulator acc(B->n, maxRowNnz);
+#pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < m; i++) {
+            markRow(A, B, i, acc);
+            c_rows[i+1] = acc.Size();
+            acc.Clear();
+        }
     }
-    g_matrixTimer.Stop();
 
-    if (info != 0) {
-        printf("Error: info returned %d\n", info);
-        assert(info == 0);
+    c_rows[0] = 1;
+    for (int i = 0; i < m; i++)
+        c_rows[i+1] += c_rows[i];
+    Offset c_nnz = c_rows[m]-1;
+
+    if (timed)
+        g_matrixTimer.Stop();
+
+    CpuCsrMatrixT* C = new CpuCsrMatrixT(m, B->n, c_nnz, B->nve);
+    free(C->rows);
+    C->rows = c_rows;
+
+    /* do multiplication */
+    if (timed)
+        g_matrixTimer.Start();
+#pragma omp parallel
+    {
+        CsrRowAccumulator acc(B->n, maxRowNnz);
+#pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < m; i++) {
+            accumulateRow(A, B, i, acc);
+            acc.Flush(&C->cols[c_rows[i]-1], &C->vals[c_rows[i]-1]);
+        }
     }
+    if (timed)
+        g_matrixTimer.Stop();
 
-    c_nnz = c_rows[A->m]-1;
-    CpuCsrMatrix* C = new CpuCsrMatrix(A->m, B->n, c_nnz, B->nve);
-    memcpy(&C->rows[0], &c_rows[0], (A->m+1)*sizeof(int));
+    return C;
+}
 
-    /* do multiplication  */
-    request = 2;
-    g_matrixTimer.Start();
+struct AbsLess {
+    const float* vals;
+    AbsLess(const float* vals) : vals(vals) { }
+    template <class Offset>
+    bool operator()(Offset a, Offset b) const { return fabsf(vals[a]) < fabsf(vals[b]); }
+};
+
+template <class Offset>
+Offset
+CpuCsrMatrixT<Offset>::truncate(float tolerance, float* achieved) {
+
+    std::vector<float> rowError(m, 0.0f);
+
+    /* pick the entries to drop, smallest magnitude first, and mark
+     * them with a zero column index (the matrix is one-based) */
+#pragma omp parallel
     {
-        mkl_scsrmultcsr((char*)"N", &request, &sort,
-                &A->m, &A->n, &B->n,
-                A->vals, A->cols, A->rows,
-                B->vals, B->cols, B->rows,
-                C->vals, C->cols, C->rows,
-                &c_nnz, &info);
+        std::vector<Offset> order;
+#pragma omp for schedule(dynamic, 256)
+        for (int r = 0; r < m; r++) {
+            Offset begin = rows[r]-1, end = rows[r+1]-1;
+            if (end-begin < 2)
+                continue;
+
+            double sum = 0.0, abssum = 0.0;
+            order.clear();
+            for (Offset p = begin; p < end; p++) {
+                sum += vals[p];
+                abssum += fabsf(vals[p]);
+                order.push_back(p);
+            }
+            std::sort(order.begin(), order.end(), AbsLess(vals));
+
+            /* dropping D and scaling the kept weights K by 1/s, where
+             * s is their sum, changes the row by
+             * sum_D |w| + |1-s|/s * sum_K |w| */
+            double dropped = 0.0, droppedsum = 0.0, error = 0.0;
+            int ndropped = 0;
+            for (int i = 0; i < (int) order.size()-1; i++) {
+                float w = vals[order[i]];
+                double s = sum - (droppedsum + w),
+                       d = dropped + fabsf(w);
+                if (s <= 0.0)
+                    break;
+                double e = d + fabs(1.0-s)/s * (abssum - d);
+                if (e > tolerance)
+                    break;
+                dropped = d;
+                droppedsum += w;
+                error = e;
+                ndropped++;
+            }
+            if (ndropped == 0)
+                continue;
+
+            float scale = (float) (1.0 / (sum - droppedsum));
+            for (int i = 0; i < ndropped; i++)
+                cols[order[i]] = 0;
+            for (Offset p = begin; p < end; p++)
+                vals[p] *= scale;
+            rowError[r] = (float) error;
+        }
     }
-    g_matrixTimer.Stop();
 
-    if (info != 0) {
-        printf("Error: info returned %d\n", info);
-        assert(info == 0);
+    /* compact the remaining entries in place */
+    Offset out = 0;
+    *achieved = 0.0f;
+    for (int r = 0; r < m; r++) {
+        Offset begin = rows[r]-1, end = rows[r+1]-1;
+        rows[r] = out+1;
+        for (Offset p = begin; p < end; p++) {
+            if (cols[p] == 0)
+                continue;
+            cols[out] = cols[p];
+            vals[out] = vals[p];
+            out++;
+        }
+        *achieved = std::max(*achieved, rowError[r]);
     }
+    rows[m] = out+1;
 
-    return C;
+    Offset saved = nnz - out;
+    nnz = out;
+    cols = (int*) realloc(cols, (size_t) std::max(nnz, (Offset) 1) * sizeof(int));
+    vals = (float*) realloc(vals, (size_t) std::max(nnz, (Offset) 1) * sizeof(float));
+    return saved;
+}
+
+template <class Offset>
+static void
+makeZeroBased(CpuCsrMatrixT<Offset>* A) {
+    for (int i = 0; i < A->m+1; i++)
+        A->rows[i] -= 1;
+    for (Offset i = 0; i < A->nnz; i++)
+        A->cols[i] -= 1;
+}
+
+#ifndef _WIN32
+template <class Offset>
+static OsdSharedOperators::Matrix
+sharedMatrix(CpuCsrMatrixT<Offset>* A) {
+    OsdSharedOperators::Matrix B;
+    B.m = A->m;
+    B.n = A->n;
+    B.nnz = A->nnz;
+    B.nve = A->nve;
+    B.offsetSize = sizeof(Offset);
+    B.rows = A->rows;
+    B.cols = A->cols;
+    B.vals = A->vals;
+    return B;
+}
+
+template <class Offset>
+static CpuCsrMatrixT<Offset>*
+sharedMatrixView(OsdSharedOperators::Matrix const & B) {
+    return new CpuCsrMatrixT<Offset>(B.m, B.n, (Offset) B.nnz, B.nve, (Offset*) B.rows, B.cols, B.vals);
+}
+#endif
+
+// the hybrid and panel formats are built for 32-bit offsets
+static CpuCsrMatrix*
+convertedMatrix(CpuCsrMatrix* A, bool hybrid, bool panels) {
+    if (hybrid)
+        return new CpuHybridCsrMatrix(A);
+    if (panels)
+        return new CpuPanelCsrMatrix(A);
+    return NULL;
 }
 
+// never asked for by OsdMklWideKernelDispatcher, which only does the plain product
+static CpuWideCsrMatrix*
+convertedMatrix(CpuWideCsrMatrix* A, bool hybrid, bool panels) {
+    return NULL;
+}
+
+template <class Offset>
 void
-OsdMklKernelDispatcher::FinalizeMatrix() {
+OsdMklKernelDispatcherT<Offset>::FinalizeMatrix() {
     this->super::FinalizeMatrix();
 
-    for (int i = 0; i < SubdivOp->m+1; i++)
-        SubdivOp->rows[i] -= 1;
-    for (int i = 0; i < SubdivOp->nnz; i++)
-        SubdivOp->cols[i] -= 1;
+    makeZeroBased(SubdivOp);
+    if (VaryingOp != NULL)
+        makeZeroBased(VaryingOp);
+
+#ifndef _WIN32
+    // replace the private matrices with read-only views of the published ones.
+    // Both layouts place the rows at a single offset, which levels output with
+    // gaps in between don't have
+    OsdSharedOperators* shared = (sharedKey != 0 and sharedPublish and not hasOutputGaps()) ?
+                                 OsdSharedOperators::GetInstance() : NULL;
+    if (shared) {
+        OsdSharedOperators::Matrix vertex = sharedMatrix(SubdivOp),
+                                   varying = VaryingOp ? sharedMatrix(VaryingOp) : vertex;
+        if (shared->Publish(sharedKey, sharedSignature, getStackOffset(),
+                            &vertex, VaryingOp ? &varying : NULL)) {
+            delete SubdivOp;
+            SubdivOp = sharedMatrixView<Offset>(vertex);
+            if (VaryingOp != NULL) {
+                delete VaryingOp;
+                VaryingOp = sharedMatrixView<Offset>(varying);
+            }
+            attachedKey = sharedKey;
+        }
+    }
+
+    // replace the private matrices with views of the file they are written to
+    if (not operatorFile.empty() and attachedKey == 0 and not hasOutputGaps()) {
+        OsdSharedOperators::Matrix vertex = sharedMatrix(SubdivOp),
+                                   varying = VaryingOp ? sharedMatrix(VaryingOp) : vertex;
+        Matrix *A = SubdivOp,
+               *B = VaryingOp;
+        if (OsdSharedOperators::WriteFile(operatorFile.c_str(), operatorSignature, getStackOffset(),
+                                          &vertex, VaryingOp ? &varying : NULL)) {
+            SubdivOp = VaryingOp = NULL;
+            if (mapOperatorFile()) {
+                delete A;
+                delete B;
+            } else {
+                SubdivOp = A;
+                VaryingOp = B;
+            }
+        }
+    }
+#endif
+
+    convertMatrices();
+}
+
+template <class Offset>
+void
+OsdMklKernelDispatcherT<Offset>::convertMatrices() {
+    // streamed matrices are kept out of memory
+    if (not (hybrid or panels) or not operatorFile.empty())
+        return;
+
+    Matrix* A = SubdivOp;
+    if (Matrix* H = convertedMatrix(A, hybrid, panels)) {
+        SubdivOp = H;
+        delete A;
+    }
+
+    if (VaryingOp != NULL) {
+        A = VaryingOp;
+        if (Matrix* H = convertedMatrix(A, hybrid, panels)) {
+            VaryingOp = H;
+            delete A;
+        }
+    }
+}
+
+/*
+ * Looks for matrices published by another process before building
+ * them, so that the first Subdivide() skips the staging entirely.
+ */
+template <class Offset>
+bool
+OsdMklKernelDispatcherT<Offset>::MatrixReady() {
+    if (SubdivOp == NULL and sharedKey != 0 and not sharedLookedUp)
+        attachSharedOperators();
+    if (SubdivOp == NULL and not operatorFile.empty() and not operatorFileLookedUp) {
+        // build the matrix and write the file if it holds another one
+        mapOperatorFile();
+        operatorFileLookedUp = true;
+    }
+    return this->super::MatrixReady();
+}
+
+/*
+ * Maps the matrices of the operator file, which are streamed from
+ * storage by each product.
+ */
+template <class Offset>
+bool
+OsdMklKernelDispatcherT<Offset>::mapOperatorFile() {
+#ifndef _WIN32
+    OsdSharedOperators::Matrix matrices[2][2];
+    void* mappings[2] = { NULL, NULL };
+    size_t sizes[2];
+    int offset;
+
+    // each matrix owns a mapping of the whole file, and points into it
+    for (int i = 0; i < 2; i++) {
+        mappings[i] = OsdSharedOperators::MapFile(operatorFile.c_str(), operatorSignature, sizeof(Offset),
+                                                  &offset, &matrices[i][0], &matrices[i][1], &sizes[i]);
+        if (mappings[i] == NULL) {
+            if (i == 1)
+                munmap(mappings[0], sizes[0]);
+            return false;
+        }
+    }
+
+    OsdSharedOperators::Matrix const & A = matrices[0][0],
+                                     & B = matrices[1][1];
+    SubdivOp = new CpuMappedCsrMatrix<Offset>(mappings[0], sizes[0],
+            A.m, A.n, (Offset) A.nnz, A.nve, (Offset*) A.rows, A.cols, A.vals);
+    if (B.nnz >= 0)
+        VaryingOp = new CpuMappedCsrMatrix<Offset>(mappings[1], sizes[1],
+                B.m, B.n, (Offset) B.nnz, B.nve, (Offset*) B.rows, B.cols, B.vals);
+    else
+        munmap(mappings[1], sizes[1]);
+    setStackOffset(offset);
+    return true;
+#else
+    return false;
+#endif
 }
 
+template <class Offset>
 void
-CpuCsrMatrix::dump(std::string ofilename) {
+OsdMklKernelDispatcherT<Offset>::attachSharedOperators() {
+#ifndef _WIN32
+    OsdSharedOperators* shared = OsdSharedOperators::GetInstance();
+    OsdSharedOperators::Matrix vertex, varying;
+    int offset;
+    if (shared and shared->Attach(sharedKey, sharedSignature, sizeof(Offset), &offset, &vertex, &varying)) {
+        SubdivOp = sharedMatrixView<Offset>(vertex);
+        if (varying.nnz >= 0)
+            VaryingOp = sharedMatrixView<Offset>(varying);
+        setStackOffset(offset);
+        attachedKey = sharedKey;
+        convertMatrices();
+    }
+#endif
+    // only look once, and build the matrix if nothing was published
+    sharedLookedUp = true;
+}
+
+template <class Offset>
+void
+OsdMklKernelDispatcherT<Offset>::SetSharedOperators(unsigned long long key,
+                                                    std::vector<unsigned int> const & signature, bool publish) {
+    sharedKey = key;
+    sharedSignature = signature;
+    sharedPublish = publish;
+    sharedLookedUp = false;
+}
+
+template <class Offset>
+bool
+OsdMklKernelDispatcherT<Offset>::SupportsApproximation() {
+    return true;
+}
+
+template <class Offset>
+bool
+OsdMklKernelDispatcherT<Offset>::SupportsConcurrentProducts() {
+    return true;
+}
+
+template <class Offset>
+bool
+OsdMklKernelDispatcherT<Offset>::SupportsLevelCache() {
+    // the operators of each level would be kept in memory
+    return operatorFile.empty();
+}
+
+template <class Offset>
+void
+OsdMklKernelDispatcherT<Offset>::SetOperatorFile(const char* path, std::vector<unsigned int> const & signature) {
+    operatorFile = path ? path : "";
+    operatorSignature = signature;
+    operatorFileLookedUp = false;
+}
+
+template <class Offset>
+CpuCsrMatrixT<Offset>*
+OsdMklKernelDispatcherT<Offset>::cloneMatrix(Matrix const * A) {
+    Matrix* B = new Matrix(A->m, A->n, A->nnz, A->nve);
+    memcpy(B->rows, A->rows, (size_t) (A->m+1) * sizeof(Offset));
+    memcpy(B->cols, A->cols, (size_t) A->nnz * sizeof(int));
+    memcpy(B->vals, A->vals, (size_t) A->nnz * sizeof(float));
+    return B;
+}
+
+template <class Offset>
+bool
+OsdMklKernelDispatcherT<Offset>::SupportsOutputLevels() {
+    return true;
+}
+
+template <class Offset>
+CpuCsrMatrixT<Offset>*
+OsdMklKernelDispatcherT<Offset>::stackMatrices(std::vector<Matrix*> const & blocks) {
+    int m = 0;
+    Offset nnz = 0;
+    for (int b = 0; b < (int) blocks.size(); b++) {
+        m += blocks[b]->m;
+        nnz += blocks[b]->nnz;
+    }
+
+    // the blocks share the index base of the first one
+    Matrix* S = new Matrix(m, blocks[0]->n, nnz, blocks[0]->nve);
+    Offset base = blocks[0]->rows[0],
+           pos = 0;
+    int row = 0;
+    for (int b = 0; b < (int) blocks.size(); b++) {
+        Matrix const * A = blocks[b];
+        for (int i = 0; i < A->m; i++)
+            S->rows[row++] = base + pos + (A->rows[i] - A->rows[0]);
+        memcpy(S->cols + pos, A->cols, (size_t) A->nnz * sizeof(int));
+        memcpy(S->vals + pos, A->vals, (size_t) A->nnz * sizeof(float));
+        pos += A->nnz;
+    }
+    S->rows[m] = base + pos;
+    return S;
+}
+
+CpuHybridCsrMatrix::CpuHybridCsrMatrix(const CpuCsrMatrix* A) :
+    CpuCsrMatrix(A->m, A->n, A->nnz, A->nve, NULL, NULL, NULL) {
+
+    int maxLength = 0;
+    for (int i = 0; i < m; i++)
+        maxLength = std::max(maxLength, A->rows[i+1] - A->rows[i]);
+
+    // determine the width of the ELL table with Bell and Garland's rule:
+    // the widest k that at least a third of the rows fill. The 4096-row
+    // floor of the GPU version is about occupancy and is dropped here.
+    std::vector<int> cdf(maxLength+2, 0);
+    for (int i = 0; i < m; i++)
+        cdf[ A->rows[i+1] - A->rows[i] ] += 1;
+    for (int i = maxLength-1; i >= 0; i--)
+        cdf[i] += cdf[i+1];
+
+    int k = maxLength;
+    while (k > 0 and cdf[k] < std::max(1, m/3))
+        k--;
+
+    // pad to whole SIMD blocks, so that every slot is 16-byte aligned
+    ell_k = k;
+    ell_lda = (m + 3) & ~3;
+    size_t ellSize = (size_t) ell_lda * k;
+    ell_vals = (float*) _mm_malloc(std::max(ellSize, (size_t) 1) * sizeof(float), 16);
+    ell_cols = (int*) _mm_malloc(std::max(ellSize, (size_t) 1) * sizeof(int), 16);
+    std::fill(ell_vals, ell_vals + ellSize, 0.0f);
+    std::fill(ell_cols, ell_cols + ellSize, 0);
+
+    for (int i = 0; i < m; i++) {
+        int j = A->rows[i], z = 0;
+        // regular part
+        for ( ; j < A->rows[i+1] and z < k; j++, z++) {
+            ell_cols[ i + (size_t) z*ell_lda ] = A->cols[j];
+            ell_vals[ i + (size_t) z*ell_lda ] = A->vals[j];
+        }
+        // irregular part
+        for ( ; j < A->rows[i+1]; j++) {
+            coo_rowInds.push_back(i);
+            coo_colInds.push_back(A->cols[j]);
+            coo_vals.push_back(A->vals[j]);
+        }
+    }
+
+#if BENCHMARKING
+    printf(" irreg=%d m=%d k=%d", (int) coo_vals.size(), m, k);
+#endif
+
+    // split the COO entries evenly between threads, moving each cut
+    // forward to the next row so that no two threads share a row
+#ifdef OPENSUBDIV_HAS_OPENMP
+    int nThreads = omp_get_max_threads();
+#else
+    int nThreads = 1;
+#endif
+    int cooNnz = (int) coo_vals.size();
+    coo_schedule.resize(nThreads+1);
+    coo_schedule[0] = 0;
+    for (int t = 1; t < nThreads; t++) {
+        int cut = std::max(coo_schedule[t-1], (int) ((long long) t * cooNnz / nThreads));
+        while (cut > 0 and cut < cooNnz and coo_rowInds[cut-1] == coo_rowInds[cut])
+            cut++;
+        coo_schedule[t] = cut;
+    }
+    coo_schedule[nThreads] = cooNnz;
+}
+
+CpuHybridCsrMatrix::~CpuHybridCsrMatrix() {
+    _mm_free(ell_vals);
+    _mm_free(ell_cols);
+}
+
+bool
+CpuHybridCsrMatrix::spmm_strided(float* d_out, float* d_in, int ld, int width) {
+    SpMV_ell0_cpu(m, ell_lda, ell_k, ell_cols, ell_vals, ld, width, d_in, d_out);
+
+    if (not coo_vals.empty())
+        SpMV_coo0_add_cpu((int) coo_schedule.size()-1, &coo_schedule[0],
+                          &coo_rowInds[0], &coo_colInds[0], &coo_vals[0], ld, width, d_in, d_out);
+    return true;
+}
+
+void
+CpuHybridCsrMatrix::logical_spmv(float* d_out, float* d_in, float *h_in) {
+    spmv(d_out, d_in);
+}
+
+size_t
+CpuHybridCsrMatrix::NumBytes() {
+    return (size_t) ell_lda*ell_k*(sizeof(float)+sizeof(int)) +
+           coo_vals.size()*(2*sizeof(int) + sizeof(float));
+}
+
+void
+CpuHybridCsrMatrix::dump(std::string ofilename) {
+    assert(!"No support for dumping hybrid matrices to file. Use MKL kernel.");
+}
+
+// hashes the column set of a row
+static unsigned long long
+hashColumns(const int* cols, int n) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (int i = 0; i < n; i++)
+        h = (h ^ (unsigned int) cols[i]) * 1099511628211ULL;
+    return (h ^ (unsigned long long) n) * 1099511628211ULL;
+}
+
+struct RowKey {
+    unsigned long long hash;
+    int row;
+    bool operator<(RowKey const & other) const {
+        return hash < other.hash or (hash == other.hash and row < other.row);
+    }
+};
+
+CpuPanelCsrMatrix::CpuPanelCsrMatrix(const CpuCsrMatrix* A) :
+    CpuCsrMatrix(A->m, A->n, A->nnz, A->nve, NULL, NULL, NULL), maxPanelCols(0) {
+
+    // rows with equal hashes end up next to each other, in row order
+    std::vector<RowKey> keys(m);
+#pragma omp parallel for
+    for (int i = 0; i < m; i++) {
+        keys[i].hash = hashColumns(A->cols + A->rows[i], A->rows[i+1] - A->rows[i]);
+        keys[i].row = i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // group the rows of each run whose columns really match its first row;
+    // the others, with colliding hashes, start panels of their own
+    std::vector<int> panelOf(m, -1),
+                     firstRows,
+                     runPanels;
+    for (int i = 0; i < m; i++) {
+        if (i == 0 or keys[i].hash != keys[i-1].hash)
+            runPanels.clear();
+
+        int row = keys[i].row,
+            length = A->rows[row+1] - A->rows[row];
+        for (int j = 0; j < (int) runPanels.size(); j++) {
+            int first = firstRows[ runPanels[j] ];
+            if (length == A->rows[first+1] - A->rows[first] and
+                std::equal(A->cols + A->rows[row], A->cols + A->rows[row+1], A->cols + A->rows[first])) {
+                panelOf[row] = runPanels[j];
+                break;
+            }
+        }
+        if (panelOf[row] < 0) {
+            panelOf[row] = (int) firstRows.size();
+            runPanels.push_back(panelOf[row]);
+            firstRows.push_back(row);
+        }
+    }
+
+    // panels were numbered in hash order : renumber them by first row,
+    // keeping the output mostly in order
+    int nPanels = (int) firstRows.size();
+    std::vector<std::pair<int, int> > byFirstRow(nPanels);
+    for (int p = 0; p < nPanels; p++)
+        byFirstRow[p] = std::make_pair(firstRows[p], p);
+    std::sort(byFirstRow.begin(), byFirstRow.end());
+
+    std::vector<int> renumber(nPanels);
+    for (int p = 0; p < nPanels; p++) {
+        firstRows[p] = byFirstRow[p].first;
+        renumber[ byFirstRow[p].second ] = p;
+    }
+    for (int i = 0; i < m; i++)
+        panelOf[i] = renumber[ panelOf[i] ];
+
+    std::vector<int> numRows(nPanels, 0);
+    for (int i = 0; i < m; i++)
+        numRows[panelOf[i]]++;
+
+    panel_rowPtrs.resize(nPanels+1);
+    panel_colPtrs.resize(nPanels+1);
+    panel_valPtrs.resize(nPanels+1);
+    panel_rowPtrs[0] = panel_colPtrs[0] = panel_valPtrs[0] = 0;
+    for (int p = 0; p < nPanels; p++) {
+        int first = firstRows[p],
+            nCols = A->rows[first+1] - A->rows[first];
+        panel_rowPtrs[p+1] = panel_rowPtrs[p] + numRows[p];
+        panel_colPtrs[p+1] = panel_colPtrs[p] + nCols;
+        panel_valPtrs[p+1] = panel_valPtrs[p] + numRows[p]*nCols;
+        maxPanelCols = std::max(maxPanelCols, nCols);
+    }
+
+    panel_colInds.resize(panel_colPtrs[nPanels]);
+    for (int p = 0; p < nPanels; p++) {
+        int first = firstRows[p];
+        std::copy(A->cols + A->rows[first], A->cols + A->rows[first+1],
+                  panel_colInds.begin() + panel_colPtrs[p]);
+    }
+
+    panel_rowInds.resize(m);
+    panel_vals.resize(panel_valPtrs[nPanels]);
+    std::vector<int> filled(nPanels, 0);
+    for (int i = 0; i < m; i++) {
+        int p = panelOf[i],
+            r = filled[p]++,
+            nCols = panel_colPtrs[p+1] - panel_colPtrs[p];
+        panel_rowInds[ panel_rowPtrs[p] + r ] = i;
+        std::copy(A->vals + A->rows[i], A->vals + A->rows[i+1],
+                  panel_vals.begin() + panel_valPtrs[p] + r*nCols);
+    }
+
+#if BENCHMARKING
+    printf(" panels=%d m=%d maxcols=%d", nPanels, m, maxPanelCols);
+#endif
+}
+
+bool
+CpuPanelCsrMatrix::spmm_strided(float* d_out, float* d_in, int ld, int width) {
+    SpMM_panel0_cpu((int) panel_rowPtrs.size()-1, &panel_rowPtrs[0], &panel_colPtrs[0], &panel_valPtrs[0],
+                    &panel_rowInds[0], panel_colInds.empty() ? NULL : &panel_colInds[0],
+                    panel_vals.empty() ? NULL : &panel_vals[0], maxPanelCols, ld, width, d_in, d_out);
+    return true;
+}
+
+void
+CpuPanelCsrMatrix::logical_spmv(float* d_out, float* d_in, float *h_in) {
+    spmv(d_out, d_in);
+}
+
+size_t
+CpuPanelCsrMatrix::NumBytes() {
+    return panel_vals.size()*sizeof(float) +
+           (panel_rowInds.size() + panel_colInds.size() + 3*panel_rowPtrs.size())*sizeof(int);
+}
+
+void
+CpuPanelCsrMatrix::dump(std::string ofilename) {
+    assert(!"No support for dumping panel matrices to file. Use MKL kernel.");
+}
+
+#ifndef _WIN32
+// bytes of cols and vals streamed per block
+static const size_t kStreamBlockBytes = 32 << 20;
+
+template <class Offset>
+CpuMappedCsrMatrix<Offset>::CpuMappedCsrMatrix(void* mapping, size_t mappingSize,
+        int m, int n, Offset nnz, int nve, Offset* rows, int* cols, float* vals) :
+    super(m, n, nnz, nve, rows, cols, vals), mapping(mapping), mappingSize(mappingSize) {
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+}
+
+template <class Offset>
+CpuMappedCsrMatrix<Offset>::~CpuMappedCsrMatrix() {
+    munmap(mapping, mappingSize);
+}
+
+// first row past the block starting at begin, which holds at least one row
+template <class Offset>
+int
+CpuMappedCsrMatrix<Offset>::blockEnd(int begin) const {
+    if (begin >= m)
+        return m;
+    Offset limit = rows[begin] + (Offset) (kStreamBlockBytes / (sizeof(int) + sizeof(float)));
+    int end = (int) (std::upper_bound(rows+begin+1, rows+m+1, limit) - rows) - 1;
+    return std::max(end, begin+1);
+}
+
+// applies advice to the pages of cols and vals holding rows [begin,end):
+// all the pages they touch when reading ahead, only the ones they fill
+// when dropping pages, which may still be needed by the next block
+template <class Offset>
+void
+CpuMappedCsrMatrix<Offset>::advise(int begin, int end, int advice) {
+    if (begin >= end)
+        return;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    char* ranges[2][2] = {
+        { (char*) (cols + rows[begin]), (char*) (cols + rows[end]) },
+        { (char*) (vals + rows[begin]), (char*) (vals + rows[end]) } };
+
+    for (int i = 0; i < 2; i++) {
+        size_t first = (size_t) ranges[i][0],
+               last = (size_t) ranges[i][1];
+        if (advice == MADV_DONTNEED) {
+            first = (first + page-1) & ~(page-1);
+            last &= ~(page-1);
+        } else {
+            first &= ~(page-1);
+        }
+        if (first < last)
+            madvise((void*) first, last-first, advice);
+    }
+}
+
+/*
+ * Faults in the pages of a block of cols and vals from a helper thread,
+ * so that the storage reads overlap the product of the previous block.
+ * MADV_WILLNEED alone is only a hint, which the kernel may ignore or
+ * cut short.
+ */
+class StreamPrefetch {
+public:
+    StreamPrefetch() : running(false) { }
+
+    ~StreamPrefetch() { Join(); }
+
+    template <class Offset>
+    void Start(Offset* rows, int* cols, float* vals, int begin, int end) {
+        Join();
+        if (begin >= end)
+            return;
+        ranges[0][0] = (const char*) (cols + rows[begin]);
+        ranges[0][1] = (const char*) (cols + rows[end]);
+        ranges[1][0] = (const char*) (vals + rows[begin]);
+        ranges[1][1] = (const char*) (vals + rows[end]);
+        running = (pthread_create(&thread, NULL, Run, this) == 0);
+    }
+
+    void Join() {
+        if (running)
+            pthread_join(thread, NULL);
+        running = false;
+    }
+
+private:
+    static void* Run(void* arg) {
+        StreamPrefetch* prefetch = (StreamPrefetch*) arg;
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        char sum = 0;
+        for (int i = 0; i < 2; i++) {
+            const char* first = prefetch->ranges[i][0],
+                      * last = prefetch->ranges[i][1];
+            // one byte of every page, starting with the partial first one
+            for (const char* p = first; p < last; p += page - ((size_t) p & (page-1)))
+                sum += *(volatile const char*) p;
+        }
+        prefetch->touched = sum;
+        return NULL;
+    }
+
+    const char* ranges[2][2];
+    pthread_t thread;
+    bool running;
+    volatile char touched;
+};
+
+template <class Offset>
+bool
+CpuMappedCsrMatrix<Offset>::spmm_strided(float* d_out, float* d_in, int ld, int width) {
+    int begin = 0,
+        end = blockEnd(0);
+    advise(begin, end, MADV_WILLNEED);
+
+    StreamPrefetch prefetch;
+    while (begin < m) {
+        // the helper thread reads the next block while this one is multiplied
+        int next = blockEnd(end);
+        advise(end, next, MADV_WILLNEED);
+        prefetch.Start(rows, cols, vals, end, next);
+
+        this->spmm_rows(begin, end, d_out, d_in, ld, width);
+
+        // the next block is resident before it is multiplied
+        prefetch.Join();
+        advise(begin, end, MADV_DONTNEED);
+        begin = end;
+        end = next;
+    }
+    return true;
+}
+
+template <class Offset>
+void
+CpuMappedCsrMatrix<Offset>::logical_spmv(float* d_out, float* d_in, float *h_in) {
+    this->spmv(d_out, d_in);
+}
+#endif
+
+template <class Offset>
+void
+CpuCsrMatrixT<Offset>::dump(std::string ofilename) {
     FILE* ofile = fopen(ofilename.c_str(), "w");
     assert(ofile != NULL);
 
     fprintf(ofile, "%%%%MatrixMarket matrix coordinate real general\n");
-    fprintf(ofile, "%d %d %d\n", m, n, nnz);
+    fprintf(ofile, "%d %d %lld\n", m, n, (long long) nnz);
 
     for(int r = 0; r < m; r++) {
-        for(int i = rows[r]; i < rows[r+1]; i++) {
+        for(Offset i = rows[r]; i < rows[r+1]; i++) {
             int col = cols[i-1];
             float val = vals[i-1];
             fprintf(ofile, "%d %d %10.3g\n", r+1, col, val);
@@ -194,17 +1156,32 @@ CpuCsrMatrix::dump(std::string ofilename) {
     fclose(ofile);
 }
 
-CpuCsrMatrix::~CpuCsrMatrix() {
+template <class Offset>
+CpuCsrMatrixT<Offset>::~CpuCsrMatrixT() {
+    if (not ownsArrays)
+        return;
     free(rows);
     free(cols);
     free(vals);
 }
 
 
-OsdMklKernelDispatcher::OsdMklKernelDispatcher(int levels, bool logical) :
-    super(levels,logical)
+template <class Offset>
+OsdMklKernelDispatcherT<Offset>::OsdMklKernelDispatcherT(int levels, bool logical, bool hybrid, bool panels) :
+    super(levels,logical), hybrid(hybrid), panels(panels), sharedKey(0), sharedPublish(false), sharedLookedUp(false), attachedKey(0),
+    operatorFileLookedUp(false)
 { }
 
+template <class Offset>
+OsdMklKernelDispatcherT<Offset>::~OsdMklKernelDispatcherT() {
+#ifndef _WIN32
+    // the views are deleted by the base class once the segment is unmapped,
+    // which is fine since they don't touch their arrays
+    if (attachedKey != 0)
+        OsdSharedOperators::GetInstance()->Detach(attachedKey);
+#endif
+}
+
 static OsdMklKernelDispatcher::OsdKernelDispatcher *
 Create(int levels) {
     return new OsdMklKernelDispatcher(levels, false);
@@ -215,12 +1192,40 @@ CreateLogical(int levels) {
     return new OsdMklKernelDispatcher(levels, true);
 }
 
+static OsdMklKernelDispatcher::OsdKernelDispatcher *
+CreateHybrid(int levels) {
+    return new OsdMklKernelDispatcher(levels, false, true);
+}
+
+static OsdMklKernelDispatcher::OsdKernelDispatcher *
+CreatePanels(int levels) {
+    return new OsdMklKernelDispatcher(levels, false, false, true);
+}
+
+static OsdMklKernelDispatcher::OsdKernelDispatcher *
+CreateWide(int levels) {
+    return new OsdMklWideKernelDispatcher(levels);
+}
+
 void
 OsdMklKernelDispatcher::Register() {
     Factory::GetInstance().Register(Create, kMKL);
     Factory::GetInstance().Register(CreateLogical, kCCPU);
+    Factory::GetInstance().Register(CreateHybrid, kHCPU);
+    // plain product only, there are no logical, hybrid or panel 64-bit kernels
+    Factory::GetInstance().Register(CreateWide, kMKL64);
+    Factory::GetInstance().Register(CreatePanels, kPCPU);
 }
 
+template class CpuCsrMatrixT<int>;
+template class CpuCsrMatrixT<long long>;
+#ifndef _WIN32
+template class CpuMappedCsrMatrix<int>;
+template class CpuMappedCsrMatrix<long long>;
+#endif
+template class OsdMklKernelDispatcherT<int>;
+template class OsdMklKernelDispatcherT<long long>;
+
 } // end namespace OPENSUBDIV_VERSION
 
 } // end namespace OpenSubdiv
@@ -13,7 +13,9 @@ extern "C" {
 namespace OpenSubdiv {
 namespace OPENSUBDIV_VERSION {
 
-class CpuCsrMatrix;
+template <class Offset> class CpuCsrMatrixT;
+typedef CpuCsrMatrixT<int> CpuCsrMatrix;
+typedef CpuCsrMatrixT<long long> CpuWideCsrMatrix;
 
 class CpuCooMatrix : public CooMatrix {
 public:
@@ -27,33 +29,211 @@ public:
     std::vector<float> vals;
 };
 
-class CpuCsrMatrix : public CsrMatrix {
+/*
+ * CSR matrix of the host kernels. Offset is the type of the row
+ * offsets: int matrices are multiplied by MKL, long long ones, for
+ * operators past 2^31 nonzeroes, by a host kernel.
+ */
+template <class Offset>
+class CpuCsrMatrixT : public CsrMatrixT<Offset> {
 public:
-    int* rows;
+    typedef CsrMatrixT<Offset> super;
+    using super::m;
+    using super::n;
+    using super::nnz;
+    using super::nve;
+
+    Offset* rows;
     int* cols;
     float* vals;
 
-    CpuCsrMatrix(int m, int n, int nnz, int nve=1);
-    CpuCsrMatrix(const CpuCooMatrix* StagedOp, int nve=1);
-    virtual ~CpuCsrMatrix();
+    CpuCsrMatrixT(int m, int n, Offset nnz, int nve=1);
+    CpuCsrMatrixT(const CpuCooMatrix* StagedOp, int nve=1);
+    // wraps read-only arrays owned by someone else, e.g. a shared memory segment
+    CpuCsrMatrixT(int m, int n, Offset nnz, int nve, Offset* rows, int* cols, float* vals);
+    virtual ~CpuCsrMatrixT();
 
     virtual void spmv(float* d_out, float* d_in);
+    virtual bool spmm(float* d_out, float* d_in, int nrhs);
+    virtual bool spmm_strided(float* d_out, float* d_in, int ld, int width);
+    virtual bool supportsStrides() { return true; }
     virtual void logical_spmv(float* d_out, float* d_in, float *h_in);
-    virtual CpuCsrMatrix* gemm(CpuCsrMatrix* rhs);
+    virtual CpuCsrMatrixT* gemm(CpuCsrMatrixT* rhs);
+    virtual Offset truncate(float tolerance, float* achieved);
+    virtual void dump(std::string ofilename);
+
+protected:
+    // multiplies rows [begin,end) of the matrix
+    void spmm_rows(int begin, int end, float* d_out, float* d_in, int ld, int width);
+
+private:
+    bool ownsArrays;
+};
+
+
+/*
+ * Host port of the HybridCsrMatrix split: rows are cut at an ELL width
+ * picked from the row length histogram, the regular part is stored as
+ * column-major padded ELL and evaluated with SIMD across rows, and the
+ * overflow is kept as COO. Built from a finalized, zero-based matrix.
+ */
+class CpuHybridCsrMatrix : public CpuCsrMatrix {
+public:
+    CpuHybridCsrMatrix(const CpuCsrMatrix* A);
+    virtual ~CpuHybridCsrMatrix();
+
+    virtual bool spmm_strided(float* d_out, float* d_in, int ld, int width);
+    virtual void logical_spmv(float* d_out, float* d_in, float *h_in);
+    virtual size_t NumBytes();
     virtual void dump(std::string ofilename);
+
+    // ellpack data
+    float* ell_vals;
+    int* ell_cols;
+    int ell_k, ell_lda;
+
+    // COO data, split in row-aligned parts for the threads
+    std::vector<float> coo_vals;
+    std::vector<int>   coo_rowInds,
+                       coo_colInds,
+                       coo_schedule;
 };
 
 
-class OsdMklKernelDispatcher :
-    public OsdSpMVKernelDispatcher<CpuCooMatrix,CpuCsrMatrix,OsdCpuVertexBuffer>
+/*
+ * Rows with identical column sets, e.g. the refined vertices inside a
+ * coarse face, are grouped into dense panels: one column list shared by
+ * the rows of the panel, and a dense block of their weights. A panel is
+ * applied by gathering its inputs once and multiplying them with the
+ * block, which reads one column index per panel column instead of one
+ * per nonzero. Built from a finalized, zero-based matrix.
+ */
+class CpuPanelCsrMatrix : public CpuCsrMatrix {
+public:
+    CpuPanelCsrMatrix(const CpuCsrMatrix* A);
+    virtual ~CpuPanelCsrMatrix() { }
+
+    virtual bool spmm_strided(float* d_out, float* d_in, int ld, int width);
+    virtual void logical_spmv(float* d_out, float* d_in, float *h_in);
+    virtual size_t NumBytes();
+    virtual void dump(std::string ofilename);
+
+    // panel p holds the rows panel_rowInds[panel_rowPtrs[p]..panel_rowPtrs[p+1]),
+    // the columns panel_colInds[panel_colPtrs[p]..panel_colPtrs[p+1]), and a
+    // row-major block of weights starting at panel_vals[panel_valPtrs[p]]
+    std::vector<int> panel_rowPtrs,
+                     panel_colPtrs,
+                     panel_valPtrs,
+                     panel_rowInds,
+                     panel_colInds;
+    std::vector<float> panel_vals;
+    int maxPanelCols;
+};
+
+
+#ifndef _WIN32
+/*
+ * Finalized, zero-based matrix whose arrays live in a file mapped
+ * read-only, for operators larger than memory. Products stream the file
+ * in blocks of rows: a helper thread faults in the pages of the next
+ * block while the current one is multiplied, and the pages of the blocks
+ * done are dropped, so that only a few blocks are resident at a time.
+ */
+template <class Offset>
+class CpuMappedCsrMatrix : public CpuCsrMatrixT<Offset> {
+public:
+    typedef CpuCsrMatrixT<Offset> super;
+    using super::m;
+    using super::rows;
+    using super::cols;
+    using super::vals;
+
+    // takes ownership of the mapping the arrays point into
+    CpuMappedCsrMatrix(void* mapping, size_t mappingSize,
+                       int m, int n, Offset nnz, int nve, Offset* rows, int* cols, float* vals);
+    virtual ~CpuMappedCsrMatrix();
+
+    virtual bool spmm_strided(float* d_out, float* d_in, int ld, int width);
+    virtual void logical_spmv(float* d_out, float* d_in, float *h_in);
+
+private:
+    int blockEnd(int begin) const;
+    void advise(int begin, int end, int advice);
+
+    void* mapping;
+    size_t mappingSize;
+};
+#endif
+
+
+template <class Offset>
+class OsdMklKernelDispatcherT :
+    public OsdSpMVKernelDispatcher<CpuCooMatrix,CpuCsrMatrixT<Offset>,OsdCpuVertexBuffer>
 {
 public:
-    typedef OsdSpMVKernelDispatcher<CpuCooMatrix,CpuCsrMatrix,OsdCpuVertexBuffer> super;
-    OsdMklKernelDispatcher(int levels, bool logical=false);
+    typedef OsdSpMVKernelDispatcher<CpuCooMatrix,CpuCsrMatrixT<Offset>,OsdCpuVertexBuffer> super;
+    typedef CpuCsrMatrixT<Offset> Matrix;
+    using super::SubdivOp;
+    using super::VaryingOp;
+    using super::getStackOffset;
+    using super::setStackOffset;
+    using super::hasOutputGaps;
+
+    OsdMklKernelDispatcherT(int levels, bool logical=false, bool hybrid=false, bool panels=false);
+    virtual ~OsdMklKernelDispatcherT();
     virtual void FinalizeMatrix();
+    virtual bool MatrixReady();
+    virtual void SetSharedOperators(unsigned long long key, std::vector<unsigned int> const & signature, bool publish);
+    virtual bool SupportsConcurrentProducts();
+    virtual bool SupportsLevelCache();
+    virtual bool SupportsApproximation();
+    virtual Matrix* cloneMatrix(Matrix const * A);
+    virtual bool SupportsOutputLevels();
+    virtual Matrix* stackMatrices(std::vector<Matrix*> const & blocks);
+    virtual void SetOperatorFile(const char* path, std::vector<unsigned int> const & signature);
+
+private:
+    void attachSharedOperators();
+    bool mapOperatorFile();
+    void convertMatrices();
+
+    bool hybrid,                        // evaluate with CpuHybridCsrMatrix
+         panels;                        // evaluate with CpuPanelCsrMatrix
+
+    unsigned long long sharedKey;       // topology hash of the shared matrices, or 0
+    std::vector<unsigned int> sharedSignature;
+    bool sharedPublish,                 // publish the matrices if nobody else did
+         sharedLookedUp;
+    unsigned long long attachedKey;     // segment SubdivOp and VaryingOp point into, or 0
+
+    std::string operatorFile;           // file the matrices are streamed from, or empty
+    std::vector<unsigned int> operatorSignature;
+    bool operatorFileLookedUp;
+};
+
+/*
+ * The MKL dispatcher registers kMKL, kCCPU, kHCPU and kPCPU with 32-bit
+ * offsets, and kMKL64 with 64-bit ones for the largest operators.
+ */
+class OsdMklKernelDispatcher : public OsdMklKernelDispatcherT<int> {
+public:
+    OsdMklKernelDispatcher(int levels, bool logical=false, bool hybrid=false, bool panels=false) :
+        OsdMklKernelDispatcherT<int>(levels, logical, hybrid, panels) { }
+
     static void Register();
 };
 
+/*
+ * kMKL64 only does the plain product : the logical, hybrid and panel
+ * products are built for 32-bit offsets, so the wide dispatcher can't
+ * be asked for them.
+ */
+class OsdMklWideKernelDispatcher : public OsdMklKernelDispatcherT<long long> {
+public:
+    OsdMklWideKernelDispatcher(int levels) :
+        OsdMklKernelDispatcherT<long long>(levels) { }
+};
+
 } // end namespace OPENSUBDIV_VERSION
 using namespace OPENSUBDIV_VERSION;
 
@@ -152,3 +152,180 @@ void LogicalSpMV_coo0_cpu(int *schedule, int *offsets, int *rowInds, int *colInd
 #endif
 }
 
+
+/*
+ * Column-major padded ELL: slot z of row i is at i + z*lda, and padding
+ * slots hold a zero weight on column 0. Each SSE lane computes one row,
+ * so the weights of four consecutive rows are loaded at once and only
+ * the inputs are gathered. Computes width elements of vertices laid
+ * out ld elements apart, so a subset of interleaved primvars works too.
+ */
+void SpMV_ell0_cpu(int m, int lda, int k, int *cols, float *vals, int ld, int width, float *d_in, float *d_out) {
+
+    int nBlocks = m / 4;
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < nBlocks; b++) {
+        int i = 4*b;
+
+        for (int e = 0; e < width; e++) {
+            __m128 outv = _mm_setzero_ps();
+
+            for (int z = 0; z < k; z++) {
+                size_t slot = i + (size_t) z*lda;
+                const int *c = &cols[slot];
+                __m128
+                    weightv = _mm_load_ps( &vals[slot] ),
+                    inv = _mm_set_ps( d_in[(size_t) c[3]*ld+e], d_in[(size_t) c[2]*ld+e],
+                                      d_in[(size_t) c[1]*ld+e], d_in[(size_t) c[0]*ld+e] );
+                outv = _mm_add_ps(outv, _mm_mul_ps(weightv, inv));
+            }
+
+            float out[4];
+            _mm_storeu_ps( out, outv );
+            d_out[(size_t) (i+0)*ld+e] = out[0];
+            d_out[(size_t) (i+1)*ld+e] = out[1];
+            d_out[(size_t) (i+2)*ld+e] = out[2];
+            d_out[(size_t) (i+3)*ld+e] = out[3];
+        }
+    }
+
+    // rows left over from the last block
+    for (int i = 4*nBlocks; i < m; i++) {
+        for (int e = 0; e < width; e++) {
+            float out = 0.0f;
+            for (int z = 0; z < k; z++)
+                out += vals[i + (size_t) z*lda] * d_in[(size_t) cols[i + (size_t) z*lda]*ld+e];
+            d_out[(size_t) i*ld+e] = out;
+        }
+    }
+}
+
+/*
+ * Adds the COO remainder of a hybrid matrix into d_out. Part t of the
+ * schedule holds the entries between schedule[t] and schedule[t+1],
+ * which start on a row boundary, so the parts update d_out in place.
+ */
+void SpMV_coo0_add_cpu(int nParts, int *schedule, int *rowInds, int *colInds, float *vals, int ld, int width, float *d_in, float *d_out) {
+
+    #pragma omp parallel for schedule(static,1)
+    for (int t = 0; t < nParts; t++) {
+        for (int i = schedule[t]; i < schedule[t+1]; i++) {
+            float weight = vals[i];
+            float *in = &d_in[(size_t) colInds[i]*ld],
+                  *out = &d_out[(size_t) rowInds[i]*ld];
+            for (int e = 0; e < width; e++)
+                out[e] += weight * in[e];
+        }
+    }
+}
+
+/*
+ * Multiplies a matrix stored as dense panels: panel p holds the rows
+ * rowInds[rowPtrs[p]..rowPtrs[p+1]), which all depend on the columns
+ * colInds[colPtrs[p]..colPtrs[p+1]), with a row-major block of weights
+ * starting at vals[valPtrs[p]]. The inputs of a panel are gathered
+ * once into a dense block padded to whole SIMD vectors, which is then
+ * multiplied four rows by four elements at a time.
+ */
+void SpMM_panel0_cpu(int nPanels, int *rowPtrs, int *colPtrs, int *valPtrs, int *rowInds, int *colInds, float *vals, int maxCols, int ld, int width, float *d_in, float *d_out) {
+
+    int width4 = (width + 3) & ~3;
+
+    #pragma omp parallel
+    {
+        float *x = (float*) _mm_malloc(std::max(maxCols*width4, 4) * sizeof(float), 16);
+
+        #pragma omp for schedule(dynamic, 16)
+        for (int p = 0; p < nPanels; p++) {
+            int nRows = rowPtrs[p+1] - rowPtrs[p],
+                nCols = colPtrs[p+1] - colPtrs[p];
+            const int *rows = &rowInds[rowPtrs[p]],
+                      *cols = &colInds[colPtrs[p]];
+            const float *w = &vals[valPtrs[p]];
+
+            // gather the inputs, zero-filling the padding
+            for (int c = 0; c < nCols; c++) {
+                const float *in = &d_in[(size_t) cols[c]*ld];
+                float *xc = &x[c*width4];
+                for (int e = 0; e < width; e++)
+                    xc[e] = in[e];
+                for (int e = width; e < width4; e++)
+                    xc[e] = 0.0f;
+            }
+
+            int r = 0;
+            for ( ; r+4 <= nRows; r += 4) {
+                const float *w0 = &w[(r+0)*nCols], *w1 = &w[(r+1)*nCols],
+                            *w2 = &w[(r+2)*nCols], *w3 = &w[(r+3)*nCols];
+                float *out[4] = { &d_out[(size_t) rows[r+0]*ld], &d_out[(size_t) rows[r+1]*ld],
+                                  &d_out[(size_t) rows[r+2]*ld], &d_out[(size_t) rows[r+3]*ld] };
+
+                for (int e = 0; e < width4; e += 4) {
+                    __m128
+                        out0v = _mm_setzero_ps(), out1v = _mm_setzero_ps(),
+                        out2v = _mm_setzero_ps(), out3v = _mm_setzero_ps();
+
+                    for (int c = 0; c < nCols; c++) {
+                        __m128 inv = _mm_load_ps( &x[c*width4 + e] );
+                        out0v = _mm_add_ps(out0v, _mm_mul_ps(_mm_set1_ps(w0[c]), inv));
+                        out1v = _mm_add_ps(out1v, _mm_mul_ps(_mm_set1_ps(w1[c]), inv));
+                        out2v = _mm_add_ps(out2v, _mm_mul_ps(_mm_set1_ps(w2[c]), inv));
+                        out3v = _mm_add_ps(out3v, _mm_mul_ps(_mm_set1_ps(w3[c]), inv));
+                    }
+
+                    float block[4][4];
+                    _mm_storeu_ps( block[0], out0v );
+                    _mm_storeu_ps( block[1], out1v );
+                    _mm_storeu_ps( block[2], out2v );
+                    _mm_storeu_ps( block[3], out3v );
+                    int n = std::min(4, width-e);
+                    for (int k = 0; k < 4; k++)
+                        for (int i = 0; i < n; i++)
+                            out[k][e+i] = block[k][i];
+                }
+            }
+
+            // rows left over from the last block
+            for ( ; r < nRows; r++) {
+                const float *wr = &w[r*nCols];
+                float *out = &d_out[(size_t) rows[r]*ld];
+                for (int e = 0; e < width4; e += 4) {
+                    __m128 outv = _mm_setzero_ps();
+                    for (int c = 0; c < nCols; c++)
+                        outv = _mm_add_ps(outv, _mm_mul_ps(_mm_set1_ps(wr[c]), _mm_load_ps( &x[c*width4 + e] )));
+
+                    float block[4];
+                    _mm_storeu_ps( block, outv );
+                    int n = std::min(4, width-e);
+                    for (int i = 0; i < n; i++)
+                        out[e+i] = block[i];
+                }
+            }
+        }
+
+        _mm_free(x);
+    }
+}
+
+/*
+ * Multiplies rows [begin,end) of a zero-based CSR matrix with 64-bit
+ * row offsets, which MKL's LP64 interface can't take. Computes width
+ * elements of vertices laid out ld elements apart.
+ */
+void SpMM_csr0_wide_cpu(int begin, int end, long long *rowPtrs, int *colInds, float *vals, int ld, int width, float *d_in, float *d_out) {
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = begin; i < end; i++) {
+        float *out = &d_out[(size_t) i*ld];
+        for (int e = 0; e < width; e++)
+            out[e] = 0.0f;
+
+        for (long long k = rowPtrs[i]; k < rowPtrs[i+1]; k++) {
+            float weight = vals[k];
+            float *in = &d_in[(size_t) colInds[k]*ld];
+            for (int e = 0; e < width; e++)
+                out[e] += weight * in[e];
+        }
+    }
+}
@@ -4,5 +4,9 @@
 void LogicalSpMV_csr1_cpu(int m, int *rowPtrs, int *colInds, float *vals, float *d_in, float *d_out);
 void LogicalSpMV_csr0_cpu(int m, int *rowPtrs, int *colInds, float *vals, float *d_in, float *d_out);
 void LogicalSpMV_coo0_cpu(int *schedule, int *offsets, int *rowInds, int *colInds, float *vals, float *h_in, int *h_out_inds, float *h_out_vals);
+void SpMV_ell0_cpu(int m, int lda, int k, int *cols, float *vals, int ld, int width, float *d_in, float *d_out);
+void SpMV_coo0_add_cpu(int nParts, int *schedule, int *rowInds, int *colInds, float *vals, int ld, int width, float *d_in, float *d_out);
+void SpMM_panel0_cpu(int nPanels, int *rowPtrs, int *colPtrs, int *valPtrs, int *rowInds, int *colInds, float *vals, int maxCols, int ld, int width, float *d_in, float *d_out);
+void SpMM_csr0_wide_cpu(int begin, int end, long long *rowPtrs, int *colInds, float *vals, int ld, int width, float *d_in, float *d_out);
 
 #endif // define OSD_MKL_KERNEL_H
@@ -0,0 +1,516 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "../version.h"
+
+#include "../osd/sharedOperators.h"
+#include "../osd/local.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+static const char * kDirectoryName = "/osd_operators";
+
+static const int kNumSlots = 1024;
+
+static const unsigned int kMagic = 0x4f534431; // "OSD1"
+
+// a slot keeps its key once claimed, and cycles through these states each
+// time the segment of the key is published and removed
+enum SlotState { kEmpty, kBuilding, kReady };
+
+struct OsdSharedOperators::Slot {
+    volatile unsigned long long key;
+    volatile int state;
+    volatile int refCount;
+};
+
+struct SegmentHeader {
+    unsigned int magic;
+    int offset,
+        signatureLength,
+        hasVarying,
+        offsetSize;     // bytes of the row offsets of both matrices
+    long long dims[2][4]; // m, n, nnz, nve of the vertex and varying matrices
+};
+
+static void
+segmentName(unsigned long long key, char * name) {
+    sprintf(name, "/osd_op_%016llx", key);
+}
+
+// the signature is padded so that the row offsets stay aligned
+static size_t
+signatureSize(size_t length) {
+    return (length*sizeof(unsigned int) + 7) & ~(size_t) 7;
+}
+
+static size_t
+matrixSize(long long m, long long nnz, int offsetSize) {
+    return (size_t) (m+1)*offsetSize + (size_t) nnz*sizeof(int) + (size_t) nnz*sizeof(float);
+}
+
+// points a matrix at its arrays, stored at ptr, and returns the end of them
+static char *
+bindMatrix(char * ptr, long long const dims[4], int offsetSize, OsdSharedOperators::Matrix * A) {
+    A->m = (int) dims[0];
+    A->n = (int) dims[1];
+    A->nnz = dims[2];
+    A->nve = (int) dims[3];
+    A->offsetSize = offsetSize;
+    A->rows = ptr;
+    A->cols = (int *) (ptr + (size_t) (A->m+1)*offsetSize);
+    A->vals = (float *) (A->cols + A->nnz);
+    return (char *) (A->vals + A->nnz);
+}
+
+// fills in the header of a segment holding the given matrices, and returns
+// the size of the segment
+static size_t
+makeHeader(std::vector<unsigned int> const & signature, int offset,
+           OsdSharedOperators::Matrix const * matrices[2], SegmentHeader * header) {
+
+    header->magic = kMagic;
+    header->offset = offset;
+    header->signatureLength = (int) signature.size();
+    header->hasVarying = matrices[1] != NULL;
+    header->offsetSize = matrices[0]->offsetSize;
+
+    size_t size = sizeof(SegmentHeader) + signatureSize(signature.size());
+    for (int i=0; i<2; ++i) {
+        OsdSharedOperators::Matrix const * A = matrices[i];
+        header->dims[i][0] = A ? A->m : 0;
+        header->dims[i][1] = A ? A->n : 0;
+        header->dims[i][2] = A ? A->nnz : 0;
+        header->dims[i][3] = A ? A->nve : 0;
+        if (A)
+            size += matrixSize(A->m, A->nnz, A->offsetSize);
+    }
+    return size;
+}
+
+// points the matrices at a mapped segment, if it holds the matrices of signature
+static bool
+bindSegment(char * ptr, size_t size, std::vector<unsigned int> const & signature, int offsetSize,
+            int * offset, OsdSharedOperators::Matrix * vertex, OsdSharedOperators::Matrix * varying) {
+
+    if (size < sizeof(SegmentHeader))
+        return false;
+
+    SegmentHeader const * header = (SegmentHeader const *) ptr;
+    ptr += sizeof(SegmentHeader);
+
+    // different topologies with colliding hashes are told apart here
+    if (header->magic != kMagic or
+        header->offsetSize != offsetSize or
+        header->signatureLength != (int) signature.size() or
+        size < sizeof(SegmentHeader) + signatureSize(signature.size()) or
+        (not signature.empty() and
+         memcmp(ptr, &signature[0], signature.size()*sizeof(unsigned int)) != 0))
+        return false;
+    ptr += signatureSize(signature.size());
+
+    // files may have been cut short
+    size_t expected = sizeof(SegmentHeader) + signatureSize(signature.size()) +
+                      matrixSize(header->dims[0][0], header->dims[0][2], offsetSize);
+    if (header->hasVarying)
+        expected += matrixSize(header->dims[1][0], header->dims[1][2], offsetSize);
+    if (size < expected)
+        return false;
+
+    *offset = header->offset;
+    ptr = bindMatrix(ptr, header->dims[0], offsetSize, vertex);
+    if (header->hasVarying)
+        bindMatrix(ptr, header->dims[1], offsetSize, varying);
+    else
+        varying->nnz = -1;
+    return true;
+}
+
+static OsdSharedOperators * g_instance = NULL;
+
+static pthread_once_t g_instanceOnce = PTHREAD_ONCE_INIT;
+
+OsdSharedOperators *
+OsdSharedOperators::GetInstance() {
+
+    // meshes built in the background may get here from several threads
+    pthread_once(&g_instanceOnce, &OsdSharedOperators::createInstance);
+    return g_instance;
+}
+
+void
+OsdSharedOperators::createInstance() {
+
+    size_t size = kNumSlots * sizeof(Slot);
+
+    // the first process to get here creates the segment zero-filled, the others
+    // truncate it to the same size, which leaves it untouched
+    int fd = shm_open(kDirectoryName, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        OSD_ERROR("Cannot open shared operator directory %s\n", kDirectoryName);
+        return;
+    }
+    void * slots = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (slots == MAP_FAILED) {
+        OSD_ERROR("Cannot map shared operator directory %s\n", kDirectoryName);
+        return;
+    }
+
+    g_instance = new OsdSharedOperators((Slot *) slots);
+}
+
+OsdSharedOperators::OsdSharedOperators(Slot * slots) : _slots(slots) {
+
+    pthread_mutex_init(&_mappingsLock, NULL);
+}
+
+// drops a reference, and removes the segment with the last one. The slot is
+// only emptied once the segment is gone, so that it can't be published again
+// under the same name meanwhile.
+void
+OsdSharedOperators::releaseSlot(Slot * slot, unsigned long long key) {
+
+    if (__sync_sub_and_fetch(&slot->refCount, 1) == 0) {
+        char name[32];
+        segmentName(key, name);
+        shm_unlink(name);
+        __sync_synchronize();
+        slot->state = kEmpty;
+    }
+}
+
+OsdSharedOperators::Slot *
+OsdSharedOperators::findSlot(unsigned long long key) const {
+
+    for (int i=0; i<kNumSlots; ++i) {
+        Slot * slot = _slots + (key+i) % kNumSlots;
+        unsigned long long k = slot->key;
+        if (k == key)
+            return slot;
+        if (k == 0)
+            break;
+    }
+    return NULL;
+}
+
+// returns the slot of key, claiming the first unused one on its probe
+// sequence if there is none. Keys are only ever written into unused slots
+// with a compare-and-swap, so two processes can't claim a key twice.
+OsdSharedOperators::Slot *
+OsdSharedOperators::claimSlot(unsigned long long key) {
+
+    for (int i=0; i<kNumSlots; ++i) {
+        Slot * slot = _slots + (key+i) % kNumSlots;
+        if (slot->key == 0)
+            __sync_bool_compare_and_swap(&slot->key, 0ULL, key);
+        if (slot->key == key)
+            return slot;
+    }
+    return NULL;
+}
+
+bool
+OsdSharedOperators::Publish(unsigned long long key, std::vector<unsigned int> const & signature,
+                            int offset, Matrix * vertex, Matrix * varying) {
+
+    if (key == 0)
+        return false;
+
+    Slot * slot = claimSlot(key);
+    if (not slot) {
+        OSD_ERROR("Shared operator directory %s is full\n", kDirectoryName);
+        return false;
+    }
+
+    // somebody else published the key, or is publishing it
+    if (not __sync_bool_compare_and_swap(&slot->state, kEmpty, kBuilding))
+        return false;
+
+    SegmentHeader header;
+    Matrix const * matrices[2] = { vertex, varying };
+    size_t size = makeHeader(signature, offset, matrices, &header);
+
+    char name[32];
+    segmentName(key, name);
+
+    // the segment of an empty slot can only be left over by a process that
+    // died while publishing or removing it, which is left to the user
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0444);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            OSD_ERROR("Shared operator segment %s is stale, remove it by hand\n", name);
+        } else {
+            OSD_ERROR("Cannot create shared operator segment %s\n", name);
+        }
+        slot->state = kEmpty;
+        return false;
+    }
+
+    void * data = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        OSD_ERROR("Cannot map shared operator segment %s\n", name);
+        shm_unlink(name);
+        __sync_synchronize();
+        slot->state = kEmpty;
+        return false;
+    }
+
+    char * ptr = (char *) data;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+    if (not signature.empty())
+        memcpy(ptr, &signature[0], signature.size()*sizeof(unsigned int));
+    ptr += signatureSize(signature.size());
+
+    for (int i=0; i<2; ++i) {
+        Matrix const * A = matrices[i];
+        if (not A)
+            continue;
+        Matrix B;
+        ptr = bindMatrix(ptr, header.dims[i], header.offsetSize, &B);
+        memcpy(B.rows, A->rows, (size_t) (A->m+1)*A->offsetSize);
+        memcpy(B.cols, A->cols, (size_t) A->nnz*sizeof(int));
+        memcpy(B.vals, A->vals, (size_t) A->nnz*sizeof(float));
+    }
+
+    // the publisher holds the first reference, through a read-only mapping
+    munmap(data, size);
+    slot->refCount = 1;
+    __sync_synchronize();
+    slot->state = kReady;
+
+    int attachedOffset;
+    Matrix noVarying;
+    if (not mapSegment(key, signature, header.offsetSize, &attachedOffset,
+                       vertex, varying ? varying : &noVarying)) {
+        releaseSlot(slot, key);
+        return false;
+    }
+    return true;
+}
+
+bool
+OsdSharedOperators::Attach(unsigned long long key, std::vector<unsigned int> const & signature,
+                           int offsetSize, int * offset, Matrix * vertex, Matrix * varying) {
+
+    if (isMapped(key))
+        return false;
+
+    Slot * slot = findSlot(key);
+    if (not slot or slot->state != kReady)
+        return false;
+
+    // only take a reference while someone else still holds one, so that a
+    // segment being removed is never brought back. Slots keep their key, so
+    // the reference is to this topology, if maybe to a later publication.
+    for (;;) {
+        int refCount = slot->refCount;
+        if (refCount <= 0)
+            return false;
+        if (__sync_bool_compare_and_swap(&slot->refCount, refCount, refCount+1))
+            break;
+    }
+
+    if (not mapSegment(key, signature, offsetSize, offset, vertex, varying)) {
+        releaseSlot(slot, key);
+        return false;
+    }
+    return true;
+}
+
+bool
+OsdSharedOperators::mapSegment(unsigned long long key, std::vector<unsigned int> const & signature,
+                               int offsetSize, int * offset, Matrix * vertex, Matrix * varying) {
+
+    char name[32];
+    segmentName(key, name);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void * data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 and st.st_size >= (off_t) sizeof(SegmentHeader))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    if (not bindSegment((char *) data, st.st_size, signature, offsetSize, offset, vertex, varying)) {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    pthread_mutex_lock(&_mappingsLock);
+    _mappings[key] = std::make_pair(data, (size_t) st.st_size);
+    pthread_mutex_unlock(&_mappingsLock);
+    return true;
+}
+
+bool
+OsdSharedOperators::isMapped(unsigned long long key) {
+
+    pthread_mutex_lock(&_mappingsLock);
+    bool mapped = _mappings.find(key) != _mappings.end();
+    pthread_mutex_unlock(&_mappingsLock);
+    return mapped;
+}
+
+void
+OsdSharedOperators::Detach(unsigned long long key) {
+
+    pthread_mutex_lock(&_mappingsLock);
+    std::map<unsigned long long, std::pair<void *, size_t> >::iterator it = _mappings.find(key);
+    if (it == _mappings.end()) {
+        pthread_mutex_unlock(&_mappingsLock);
+        return;
+    }
+    munmap(it->second.first, it->second.second);
+    _mappings.erase(it);
+    pthread_mutex_unlock(&_mappingsLock);
+
+    if (Slot * slot = findSlot(key))
+        releaseSlot(slot, key);
+}
+
+bool
+OsdSharedOperators::WriteFile(const char * path, std::vector<unsigned int> const & signature,
+                              int offset, Matrix const * vertex, Matrix const * varying) {
+
+    SegmentHeader header;
+    Matrix const * matrices[2] = { vertex, varying };
+    makeHeader(signature, offset, matrices, &header);
+
+    // readers never see a partial file
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE * file = fopen(tmpPath.c_str(), "wb");
+    if (not file) {
+        OSD_ERROR("Cannot create operator file %s\n", tmpPath.c_str());
+        return false;
+    }
+
+    static const char padding[8] = { 0 };
+    size_t padSize = signatureSize(signature.size()) - signature.size()*sizeof(unsigned int);
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 and
+        (signature.empty() or
+         fwrite(&signature[0], sizeof(unsigned int), signature.size(), file) == signature.size()) and
+        fwrite(padding, 1, padSize, file) == padSize;
+    for (int i=0; i<2 and success; ++i) {
+        Matrix const * A = matrices[i];
+        if (not A)
+            continue;
+        success = fwrite(A->rows, A->offsetSize, A->m+1, file) == (size_t) A->m+1 and
+                  fwrite(A->cols, sizeof(int), A->nnz, file) == (size_t) A->nnz and
+                  fwrite(A->vals, sizeof(float), A->nnz, file) == (size_t) A->nnz;
+    }
+    success = (fclose(file) == 0) and success;
+
+    if (not success or rename(tmpPath.c_str(), path) != 0) {
+        OSD_ERROR("Cannot write operator file %s\n", path);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void *
+OsdSharedOperators::MapFile(const char * path, std::vector<unsigned int> const & signature,
+                            int offsetSize, int * offset, Matrix * vertex, Matrix * varying,
+                            size_t * size) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void * data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 and st.st_size >= (off_t) sizeof(SegmentHeader))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    if (not bindSegment((char *) data, st.st_size, signature, offsetSize, offset, vertex, varying)) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return data;
+}
+
+} // end namespace OPENSUBDIV_VERSION
+} // end namespace OpenSubdiv
@@ -0,0 +1,163 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#ifndef OSD_SHARED_OPERATORS_H
+#define OSD_SHARED_OPERATORS_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <map>
+#include <vector>
+
+#include "../version.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+// Node-wide directory of finalized subdivision matrices in POSIX shared
+// memory. One process publishes the matrices of a topology under its
+// registry hash (see OsdTopologyRegistry), and the other processes of the
+// node map them read-only instead of building their own copy.
+//
+// The directory is a fixed table of slots in its own segment, claimed and
+// reference counted with atomic operations only. A slot keeps the hash it is
+// claimed for, so the directory holds up to 1024 topologies until it is
+// removed by hand. Each published topology lives in a segment named after its
+// hash, which is unlinked when the last process detaches from it, and may be
+// published again later. Processes that die while attached leak their
+// reference until the segment is removed by hand.
+//
+// The same layout is written to regular files for matrices too large for
+// memory, which are then streamed from storage (see CpuMappedCsrMatrix).
+class OsdSharedOperators {
+
+public:
+    // A CSR matrix with zero-based indices. Its row offsets are int or
+    // long long, as told by offsetSize.
+    struct Matrix {
+        int m, n, nve;
+        long long nnz;
+        int offsetSize;
+        void * rows;
+        int * cols;
+        float * vals;
+    };
+
+    // Maps the node directory, creating it on first use. Returns NULL if
+    // shared memory is not available.
+    static OsdSharedOperators * GetInstance();
+
+    // Copies the matrices into a new segment published under key, and maps it
+    // back read-only in place of the given matrices. Returns false if the key
+    // is already published or being published, or if the segment could not
+    // be created.
+    bool Publish(unsigned long long key, std::vector<unsigned int> const & signature,
+                 int offset, Matrix * vertex, Matrix * varying);
+
+    // Maps the matrices published under key for this signature read-only.
+    // varying->nnz is set to -1 if no varying matrix was published. Returns
+    // false if there is no such topology, or if its row offsets are not
+    // offsetSize bytes wide.
+    bool Attach(unsigned long long key, std::vector<unsigned int> const & signature,
+                int offsetSize, int * offset, Matrix * vertex, Matrix * varying);
+
+    // Unmaps the segment of key, and removes it with the last reference.
+    void Detach(unsigned long long key);
+
+    // Writes the matrices to a regular file, laid out like a segment, for
+    // operators too large to be kept in memory. Returns false on I/O errors.
+    static bool WriteFile(const char * path, std::vector<unsigned int> const & signature,
+                          int offset, Matrix const * vertex, Matrix const * varying);
+
+    // Maps a file written by WriteFile read-only, if it holds the matrices of
+    // this signature with offsetSize-byte row offsets. Returns the mapping, to
+    // be released with munmap() after the matrices, and its size in *size, or
+    // NULL.
+    static void * MapFile(const char * path, std::vector<unsigned int> const & signature,
+                          int offsetSize, int * offset, Matrix * vertex, Matrix * varying,
+                          size_t * size);
+
+private:
+    struct Slot;
+
+    OsdSharedOperators(Slot * slots);
+
+    static void createInstance();
+
+    Slot * findSlot(unsigned long long key) const;
+
+    Slot * claimSlot(unsigned long long key);
+
+    bool isMapped(unsigned long long key);
+
+    void releaseSlot(Slot * slot, unsigned long long key);
+
+    bool mapSegment(unsigned long long key, std::vector<unsigned int> const & signature,
+                    int offsetSize, int * offset, Matrix * vertex, Matrix * varying);
+
+    Slot * _slots;
+
+    // segments mapped by this process
+    std::map<unsigned long long, std::pair<void *, size_t> > _mappings;
+    pthread_mutex_t _mappingsLock;
+};
+
+} // end namespace OPENSUBDIV_VERSION
+using namespace OPENSUBDIV_VERSION;
+
+} // end namespace OpenSubdiv
+
+#endif /* OSD_SHARED_OPERATORS_H */
@@ -4,11 +4,22 @@
 #include "../version.h"
 #include "../osd/cpuDispatcher.h"
 #include "../osd/spmvKernel.h"
+#include "../osd/local.h"
 #include "../../examples/common/stopwatch.h"
 
+#ifdef OPENSUBDIV_HAS_OPENMP
+    #include <omp.h>
+#endif
+
+#include <assert.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 extern char* osdSpMVKernel_DumpSpy_FileName;
 extern Stopwatch g_matrixTimer;
@@ -23,18 +34,129 @@ extern Stopwatch g_matrixTimer;
 namespace OpenSubdiv {
 namespace OPENSUBDIV_VERSION {
 
+/**
+ * Host copy of a staged matrix whose copy rows, which take a single
+ * input with weight one, are kept implicit: row r copies input
+ * copyOf[r] if that is not negative, and otherwise holds the
+ * zero-based entries [rowPtr[r], rowPtr[r+1]).
+ */
+struct SpMVStage {
+    int m, n;
+    std::vector<int> copyOf, rowPtr, cols;
+    std::vector<float> vals;
+
+    SpMVStage(int m, int n) : m(m), n(n), copyOf(m, -1), rowPtr(m+1, 0) { }
+
+    bool HasCopies() const {
+        for (int r = 0; r < m; r++)
+            if (copyOf[r] >= 0)
+                return true;
+        return false;
+    }
+
+    /**
+     * Multiplies this stage by rhs. Copy rows on either side only
+     * forward indices or rows, so no flops are spent on them.
+     * Repeated columns of a row are merged. In pseudocode:
+     * C = this * rhs
+     */
+    SpMVStage* Multiply(SpMVStage const & rhs) const {
+        SpMVStage* C = new SpMVStage(m, rhs.n);
+
+        /* count the entries of each row, then fill them in */
+        for (int pass = 0; pass < 2; pass++) {
+#pragma omp parallel
+            {
+                std::vector<int> marker(rhs.n, -1), touched;
+                std::vector<float> acc(rhs.n, 0.0f);
+#pragma omp for schedule(dynamic, 256)
+                for (int r = 0; r < m; r++) {
+                    touched.clear();
+                    if (copyOf[r] >= 0 and rhs.copyOf[copyOf[r]] >= 0) {
+                        C->copyOf[r] = rhs.copyOf[copyOf[r]];
+                        continue;
+                    }
+                    if (copyOf[r] >= 0) {
+                        int c = copyOf[r];
+                        for (int q = rhs.rowPtr[c]; q < rhs.rowPtr[c+1]; q++)
+                            accumulate(rhs.cols[q], rhs.vals[q], marker, acc, touched);
+                    } else {
+                        for (int p = rowPtr[r]; p < rowPtr[r+1]; p++) {
+                            int j = cols[p];
+                            float w = vals[p];
+                            if (rhs.copyOf[j] >= 0)
+                                accumulate(rhs.copyOf[j], w, marker, acc, touched);
+                            else
+                                for (int q = rhs.rowPtr[j]; q < rhs.rowPtr[j+1]; q++)
+                                    accumulate(rhs.cols[q], w * rhs.vals[q], marker, acc, touched);
+                        }
+                    }
+
+                    if (pass == 0) {
+                        C->rowPtr[r+1] = (int) touched.size();
+                    } else {
+                        std::sort(touched.begin(), touched.end());
+                        for (int i = 0; i < (int) touched.size(); i++) {
+                            C->cols[C->rowPtr[r]+i] = touched[i];
+                            C->vals[C->rowPtr[r]+i] = acc[touched[i]];
+                        }
+                    }
+                    for (int i = 0; i < (int) touched.size(); i++)
+                        marker[touched[i]] = -1;
+                }
+            }
+
+            if (pass == 0) {
+                for (int r = 0; r < m; r++)
+                    C->rowPtr[r+1] += C->rowPtr[r];
+                C->cols.resize(C->rowPtr[m]);
+                C->vals.resize(C->rowPtr[m]);
+            }
+        }
+        return C;
+    }
+
+private:
+    static void accumulate(int col, float val, std::vector<int> & marker,
+                           std::vector<float> & acc, std::vector<int> & touched) {
+        if (marker[col] < 0) {
+            marker[col] = 1;
+            acc[col] = val;
+            touched.push_back(col);
+        } else {
+            acc[col] += val;
+        }
+    }
+};
+
 template <class CooMatrix_t, class CsrMatrix_t, class VertexBuffer_t>
 class OsdSpMVKernelDispatcher : public OsdCpuKernelDispatcher
 {
 public:
     OsdSpMVKernelDispatcher( int levels, bool logical=false )
-        : OsdCpuKernelDispatcher(levels), logical(logical), StagedOp(NULL), SubdivOp(NULL)
+        : OsdCpuKernelDispatcher(levels), StagedOp(NULL), SubdivOp(NULL),
+          StagedVaryingOp(NULL), VaryingOp(NULL), logical(logical), maxApproxError(0.0f), approxError(0.0f), approxNnzSaved(0),
+          outputLevelMask(0), stackOffset(-1), pendingOutput(false),
+          levelOffset(-1), lastRows(0), lastCols(0), stagedVaryingElems(0), heldStage(NULL), heldVaryingStage(NULL),
+          elementOffset(0), elementWidth(0), stridedRange(false), selectedLevel(-1), levelOpsNve(0), levelOpsNvv(0),
+          checkedOp(NULL), checkedVaryingOp(NULL), rangeReportedOp(NULL), checkedNve(0), checkedNvv(0),
+          vertexLayoutOk(false), varyingLayoutOk(false)
     { }
 
     virtual ~OsdSpMVKernelDispatcher() {
         if (_vdesc)           delete _vdesc;
         if (StagedOp != NULL) delete StagedOp;
         if (SubdivOp != NULL)  delete SubdivOp;
+        if (StagedVaryingOp != NULL) delete StagedVaryingOp;
+        if (VaryingOp != NULL) delete VaryingOp;
+        for (int i = 0; i < (int) StagedChain.size(); i++)
+            delete StagedChain[i];
+        for (int i = 0; i < (int) VaryingChain.size(); i++)
+            delete VaryingChain[i];
+        if (heldStage != NULL) delete heldStage;
+        if (heldVaryingStage != NULL) delete heldVaryingStage;
+        clearLevelOps();
+        clearOutputOps();
     }
 
     virtual void BindVertexBuffer(OsdVertexBuffer *vertex, OsdVertexBuffer *varying) {
@@ -65,9 +187,15 @@ public:
         return _currentVaryingBuffer ? _currentVaryingBuffer->GetNumElements() : 0;
     }
 
+    /**
+     * Copies vertices through the staged matrix. The copy rows are
+     * kept implicit (see PushMatrix) and never hold elements.
+     */
     int CopyNVerts(int nVerts, int index) {
         for (int i = 0; i < nVerts; i++)
-            _vdesc->AddWithWeight(NULL, index+i, index+i, 1.0);
+            stagedCopies.push_back(std::make_pair(index+i - dstOffset, index+i - srcOffset));
+        if (StagedVaryingOp != NULL)
+            stagedVaryingElems += nVerts;
         return nVerts;
     }
 
@@ -75,11 +203,25 @@ public:
     /**
      * Stage an i-by-j matrix with the dispatcher. The matrix will
      * be populated by StageElem calls executed later by the
-     * subdivision driver. In pseudocode:
+     * subdivision driver. A varying matrix of the same size is
+     * staged alongside when a varying buffer is bound. In pseudocode:
      * S = new matrix(i,j)
      */
     virtual void StageMatrix(int i, int j) {
-        StagedOp = new CooMatrix_t(i,j);
+        if (levelOffset < 0)
+            levelOffset = j;
+
+        StagedOp = new CooMatrix_t(i, j);
+
+        if (_currentVaryingBuffer)
+            StagedVaryingOp = new CooMatrix_t(i, j);
+
+        stagedCopies.clear();
+        lastRows = i;
+        lastCols = j;
+        stagedVaryingElems = 0;
+        stagedLinks.Reset(i);
+        stagedVaryingLinks.Reset(StagedVaryingOp != NULL ? i : 0);
 
         // NICK you could allocate storage here for the staged_subdiv_operator, or do it on-demand when the first StageEditAdd is called.
         // int nve = _currentVertexBuffer->GetNumElements();
@@ -92,7 +234,159 @@ public:
      * S[i,j] = value
      */
     virtual void StageElem(int i, int j, float value) {
-        StagedOp->append_element(i, j, value);
+        stageElem(StagedOp, stagedLinks, i, j, value);
+    }
+
+    /**
+     * Insert an element in the staged varying matrix. Varying data
+     * is interpolated bilinearly, so this matrix is much sparser
+     * than the vertex one. In pseudocode:
+     * V[i,j] = value
+     */
+    virtual void StageVaryingElem(int i, int j, float value) {
+        stageElem(StagedVaryingOp, stagedVaryingLinks, i, j, value);
+        stagedVaryingElems++;
+    }
+
+    /**
+     * Elements may reference rows of the staged matrix itself, which
+     * are substituted by their elements (see stageElem), so Catmark
+     * levels are staged as a single matrix.
+     */
+    virtual bool SupportsSingleStageLevels() {
+        return true;
+    }
+
+    /**
+     * Selects intermediate levels to output along with the finest
+     * one: bit l of levelMask writes level l at its usual offset in
+     * the vertex buffer. The operators of the selected levels are
+     * stacked on top of the subdivision matrix, so a single SpMV
+     * reads the coarse vertices once and writes every selected level.
+     * Levels in between are left untouched. Must be called before
+     * the first Subdivide(). Returns false if the matrix type can't
+     * stack levels and levelMask != 0.
+     */
+    virtual bool SetOutputLevels(int levelMask) {
+        if (levelMask != 0 and not this->SupportsOutputLevels())
+            return false;
+        outputLevelMask = levelMask;
+        return true;
+    }
+
+    /**
+     * True if the operators of intermediate levels may be stacked
+     * (see SetOutputLevels), which requires cloneMatrix and
+     * stackMatrices.
+     */
+    virtual bool SupportsOutputLevels() {
+        return false;
+    }
+
+    /**
+     * Called by the subdivision driver once all the matrices of an
+     * intermediate level have been pushed. If the level is output,
+     * EndLevel multiplies out its operator, and its rows are placed
+     * after those of the levels already output.
+     */
+    virtual void MarkLevel(int level) {
+        int offset = levelOffset;
+        levelOffset += lastRows;
+
+        if ((outputLevelMask >> level) & 1) {
+            outputBlocks.push_back(std::make_pair(offset, lastRows));
+            pendingOutput = true;
+        }
+    }
+
+    /**
+     * Called by the subdivision driver before it checks MatrixReady,
+     * with the level the matrix should subdivide to. If the matrix was
+     * built for another level, it is dropped along with the placement
+     * of its stacked levels, and the operator of the deepest cached
+     * level not past the requested one is pushed as the first matrix
+     * of the chain. Returns the first level the driver still has to
+     * stage. In pseudocode:
+     * M = P_k
+     */
+    virtual int SelectLevel(int level) {
+        if (SubdivOp != NULL and level == selectedLevel)
+            return 1;
+
+        if (SubdivOp != NULL) {
+            delete SubdivOp;
+            SubdivOp = NULL;
+        }
+        if (VaryingOp != NULL) {
+            delete VaryingOp;
+            VaryingOp = NULL;
+        }
+        stackOffset = -1;
+        clearOutputOps();
+        selectedLevel = level;
+
+        if (not this->SupportsLevelCache() or outputLevelMask != 0)
+            return 1;
+
+        /* the cached operators only fit buffers of the same layout */
+        int nve = _currentVertexBuffer->GetNumElements(),
+            nvv = _currentVaryingBuffer ? _currentVaryingBuffer->GetNumElements() : 0;
+        if (nve != levelOpsNve or (nvv != 0 and nvv != levelOpsNvv))
+            clearLevelOps();
+
+        int k = std::min(level, (int) levelOps.size()-1);
+        if (k < 1)
+            return 1;
+
+        DEBUG_PRINTF("SelectLevel %d from cached level %d\n", level, k);
+        StagedChain.insert(StagedChain.begin(), this->cloneMatrix(levelOps[k]));
+        if (nvv != 0)
+            VaryingChain.insert(VaryingChain.begin(), this->cloneMatrix(varyingLevelOps[k]));
+        return k+1;
+    }
+
+    /**
+     * Called by the subdivision driver once all the matrices of a
+     * level have been pushed. The chain is multiplied out into the
+     * operator of that level, which is cached for SelectLevel, or
+     * kept for ComposeMatrix if the level is output, and stays in
+     * the chain. In pseudocode:
+     * P_level = S_level * ... * S_1
+     */
+    virtual void EndLevel(int level) {
+        flushStages();
+
+        if (StagedChain.empty())
+            return;
+
+        if (outputLevelMask != 0) {
+            if (pendingOutput)
+                keepOutputLevel();
+            return;
+        }
+
+        if (not this->SupportsLevelCache())
+            return;
+
+        if (level == 1)
+            clearLevelOps();
+        if ((int) levelOps.size() != level)
+            return;
+
+        CsrMatrix_t* op = composeChain(StagedChain);
+        StagedChain.push_back(op);
+        levelOps.push_back(this->cloneMatrix(op));
+        levelOpsNve = _currentVertexBuffer->GetNumElements();
+
+        if (_currentVaryingBuffer and not VaryingChain.empty()) {
+            op = composeChain(VaryingChain);
+            VaryingChain.push_back(op);
+            varyingLevelOps.push_back(this->cloneMatrix(op));
+            levelOpsNvv = _currentVaryingBuffer->GetNumElements();
+        } else {
+            varyingLevelOps.push_back(NULL);
+            levelOpsNvv = 0;
+        }
     }
 
     // NICK add methods for staging vector and inserting additive edits
@@ -103,11 +397,18 @@ public:
     //    staged_vec[vert_num*numVertElements + elem_num] += weight;
 
     /**
-     * Multiplies the current subdivision matrix by the staged
-     * matrix, and unstages it. If there is no current subdivision
-     * matrix, the staged matrix becomes the subdivision matrix.
-     * In pseudocode:
+     * Converts the staged matrix and appends it to the chain of
+     * matrices that make up the subdivision matrix, and unstages
+     * it. The chain is multiplied out by ComposeMatrix. In
+     * pseudocode:
      * M = S * M
+     *
+     * A staged matrix with copy rows, e.g. S_1 = [ I ; F ] for the
+     * face points of a Catmark level, is held back and multiplied on
+     * the host into the next stage of its level, where its copies only
+     * forward indices. The identity blocks never reach the products
+     * of the chain. In pseudocode:
+     * M = (S_2 * [ I ; F ]) * M
      */
     virtual void PushMatrix() {
         // NICK at end of one level, express edits at next level via mat-vec product
@@ -142,24 +443,92 @@ public:
         //
         // At the end of this routine, global_edit_vector will contain edits from the current and previous levels, expressed at the current level.
 
-        /* if no SubdivOp exists, create one from A */
-        if (SubdivOp == NULL) {
-            DEBUG_PRINTF("PushMatrix set %d-%d\n", StagedOp->m, StagedOp->n);
-            int nve = _currentVertexBuffer->GetNumElements();
-            SubdivOp = new CsrMatrix_t(StagedOp, nve);
-        } else {
-            DEBUG_PRINTF("PushMatrix mul %d-%d = %d-%d * %d-%d\n",
-                    (int) StagedOp->m, (int) SubdivOp->n,
-                    (int) StagedOp->m, (int) StagedOp->n,
-                    (int) SubdivOp->m, (int) SubdivOp->n);
-            CsrMatrix_t* new_SubdivOp = StagedOp->gemm(SubdivOp);
-            delete SubdivOp;
-            SubdivOp = new_SubdivOp;
+        /* the chain is kept in product order, most recent push first */
+        DEBUG_PRINTF("PushMatrix %d-%d\n", StagedOp->m, StagedOp->n);
+        int nve = _currentVertexBuffer->GetNumElements();
+        pushStage(makeStage(StagedOp), heldStage, StagedChain, nve);
+
+        /* stages without varying weights (the limit stage) leave
+         * varying data where it is and need no matrix */
+        if (StagedVaryingOp != NULL and stagedVaryingElems > 0) {
+            int nvv = _currentVaryingBuffer->GetNumElements();
+            pushStage(makeStage(StagedVaryingOp), heldVaryingStage, VaryingChain, nvv);
         }
 
-        /* remove staged matrix */
+        /* remove staged matrices */
+        stagedCopies.clear();
         delete StagedOp;
         StagedOp = NULL;
+        if (StagedVaryingOp != NULL) {
+            delete StagedVaryingOp;
+            StagedVaryingOp = NULL;
+        }
+    }
+
+    /**
+     * Multiplies the pushed matrices into the subdivision matrix,
+     * and the varying ones into the varying matrix. The
+     * multiplication order is picked by a matrix-chain search
+     * over estimated flop counts, and the products of the resulting
+     * tree are evaluated bottom-up, each product being parallel over
+     * its rows. Sibling subtrees are reduced concurrently by teams
+     * splitting the threads in proportion to their estimated cost, if
+     * the matrix type allows it. The operators of the output levels
+     * are stacked on top of it. In pseudocode:
+     * M = S_k * ... * S_2 * S_1
+     * M = [ P_a ; P_b ; ... ; M ]
+     */
+    virtual void ComposeMatrix() {
+        flushStages();
+        stackOffset = -1;
+
+        if (not StagedChain.empty()) {
+            if (SubdivOp != NULL)
+                delete SubdivOp;
+            SubdivOp = composeChain(StagedChain);
+        }
+
+        if (not VaryingChain.empty()) {
+            if (VaryingOp != NULL)
+                delete VaryingOp;
+            VaryingOp = composeChain(VaryingChain);
+        }
+
+        if (not outputOps.empty() and SubdivOp != NULL)
+            stackOutputLevels(levelOffset);
+        levelOffset = -1;
+    }
+
+    /**
+     * True if independent products of the matrix chain may be
+     * computed concurrently, from nested thread teams.
+     */
+    virtual bool SupportsConcurrentProducts() {
+        return false;
+    }
+
+    /**
+     * True if the operators of each level may be cached (see
+     * SelectLevel), which requires cloneMatrix.
+     */
+    virtual bool SupportsLevelCache() {
+        return false;
+    }
+
+    /**
+     * Returns a deep copy of the given matrix.
+     */
+    virtual CsrMatrix_t* cloneMatrix(CsrMatrix_t const * A) {
+        return NULL;
+    }
+
+    /**
+     * Returns a new matrix holding the rows of the given ones, which
+     * have the same columns, one after the other. In pseudocode:
+     * M = [ A_0 ; A_1 ; ... ]
+     */
+    virtual CsrMatrix_t* stackMatrices(std::vector<CsrMatrix_t*> const & blocks) {
+        return NULL;
     }
 
     /**
@@ -167,27 +536,190 @@ public:
      * the matrix is applied to the vertices (ApplyMatrix).
      */
     virtual void FinalizeMatrix() {
+        /* staging runs on the dispatcher's thread count, but the
+         * matrix products should use the whole machine */
+#ifdef OPENSUBDIV_HAS_OPENMP
+        int numThreads = omp_get_max_threads();
+        omp_set_num_threads(omp_get_num_procs());
+#endif
+
+        this->ComposeMatrix();
+
+        if (maxApproxError > 0.0f)
+            this->ApproximateMatrix();
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+        omp_set_num_threads(numThreads);
+#endif
+
         if (osdSpMVKernel_DumpSpy_FileName != NULL)
             SubdivOp->dump(osdSpMVKernel_DumpSpy_FileName);
 
         this->PrintReport();
+
+        /* a new matrix may reuse the address of the one checked last */
+        checkedOp = checkedVaryingOp = rangeReportedOp = NULL;
+    }
+
+    /**
+     * Sets the largest distance a refined vertex may move when small
+     * weights are dropped from the subdivision matrix. Zero keeps the
+     * matrix exact. The bound is computed from the coarse vertices
+     * bound at FinalizeMatrix (see ApproximateMatrix) : poses moving
+     * further from their centroid may exceed it. Returns false if the
+     * matrix type can't drop weights and maxError > 0.
+     */
+    virtual bool SetMaxApproximationError(float maxError) {
+        if (maxError > 0.0f and not this->SupportsApproximation())
+            return false;
+        maxApproxError = maxError;
+        return true;
+    }
+
+    /**
+     * True if the matrix type implements truncate, so that
+     * SetMaxApproximationError has an effect.
+     */
+    virtual bool SupportsApproximation() {
+        return false;
+    }
+
+    virtual float GetApproximationError() const {
+        return approxError;
+    }
+
+    virtual long long GetApproximationSavings() const {
+        return approxNnzSaved;
+    }
+
+    /**
+     * Nonzeroes of the finalized subdivision matrix, or 0 before
+     * it is built.
+     */
+    virtual long long GetNumNonzeros() const {
+        return SubdivOp ? (long long) SubdivOp->nnz : 0;
+    }
+
+    /**
+     * Restricts ApplyMatrix to width elements of each vertex starting
+     * at offset, or lifts the restriction if width <= 0. Matrices that
+     * can't refine a subset refine every element, which is reported
+     * once per matrix.
+     */
+    virtual void SetElementRange(int offset, int width) {
+        elementOffset = offset;
+        elementWidth = width;
+        checkElementRange();
+    }
+
+    /**
+     * Drops the smallest weights of each row of the subdivision
+     * matrix and renormalizes the rest, so rows still sum to one.
+     * Moving a row from weights w to w' moves its vertex by at most
+     * R * sum|w-w'|, where R is the radius of the coarse vertices
+     * around their centroid, so the weight budget of each row is
+     * maxApproxError / R. The bound holds for any pose that stays
+     * within that radius.
+     */
+    virtual void ApproximateMatrix() {
+        int numElems = _currentVertexBuffer->GetNumElements();
+        float* coarse = _currentVertexBuffer->GetCpuBuffer();
+        if (coarse == NULL and not _currentVertexBuffer->h_data.empty())
+            coarse = &_currentVertexBuffer->h_data[0];
+        if (coarse == NULL) {
+            DEBUG_PRINTF("ApproximateMatrix: coarse vertices not on host, keeping exact matrix\n");
+            return;
+        }
+
+        int numCoarse = SubdivOp->n,
+            dims = std::min(numElems, 3);
+        double center[3] = { 0.0, 0.0, 0.0 };
+        for (int i = 0; i < numCoarse; i++)
+            for (int k = 0; k < dims; k++)
+                center[k] += coarse[i*numElems+k] / numCoarse;
+
+        double radius = 0.0;
+        for (int i = 0; i < numCoarse; i++) {
+            double d = 0.0;
+            for (int k = 0; k < dims; k++) {
+                double x = coarse[i*numElems+k] - center[k];
+                d += x*x;
+            }
+            radius = std::max(radius, sqrt(d));
+        }
+        if (radius == 0.0)
+            return;
+
+        float weightError = 0.0f;
+        approxNnzSaved = SubdivOp->truncate((float) (maxApproxError / radius), &weightError);
+        approxError = (float) (weightError * radius);
     }
 
     /**
      * Apply the subdivison matrix on the vertices at index 0,
-     * and store the result at the given offset. In pseudocode:
+     * and store the result at the given offset, or at the first
+     * stacked level if intermediate levels are output. In pseudocode:
      * v[offset:...] = M * v[0:...]
+     *
+     * Output levels with gaps in between are refined into a scratch
+     * buffer, and their rows copied to their offsets.
      */
     virtual void ApplyMatrix(int offset) {
+        if (stackOffset >= 0)
+            offset = stackOffset;
+
+        // matrices that can't refine the bound buffers leave them as
+        // they are : the check is only redone when the layout changes
+        checkBufferLayout();
+
         int numElems = _currentVertexBuffer->GetNumElements();
         float* V_in = (float*) _currentVertexBuffer->Map();
         float* V_out = (float*) V_in + offset * numElems;
 
-        if (logical)
-            SubdivOp->logical_spmv(V_out, V_in, &_currentVertexBuffer->h_data[0]);
+        // a subset of the elements can be refined in place, with the
+        // others left as they are, if the matrix type supports it
+        bool subset = stridedRange and elementWidth < numElems;
+
+        if (not outputBlocks.empty()) {
+            outputScratch.resize((size_t) SubdivOp->m * numElems);
+            V_out = &outputScratch[0];
+            if (subset)
+                copyOutputBlocks(V_out, V_in, numElems, false);
+        }
+        if (subset)
+            SubdivOp->spmm_strided(V_out + elementOffset, V_in + elementOffset, numElems, elementWidth);
+
+        // buffers wider than the matrix was built for hold a batch of
+        // instances, which are refined in a single multi-column product
+        if (subset or not vertexLayoutOk) {
+            // refined above, or not at all
+        } else if (numElems != SubdivOp->nve) {
+            SubdivOp->spmm(V_out, V_in, numElems);
+        } else if (logical)
+                SubdivOp->logical_spmv(V_out, V_in, &_currentVertexBuffer->h_data[0]);
         else
             SubdivOp->spmv(V_out, V_in);
 
+        if (not outputBlocks.empty())
+            copyOutputBlocks(V_out, V_in, numElems, true);
+
+        if (VaryingOp != NULL and _currentVaryingBuffer and varyingLayoutOk) {
+            int numVaryingElems = _currentVaryingBuffer->GetNumElements();
+            float* Var_in = (float*) _currentVaryingBuffer->Map();
+            float* Var_out = Var_in + offset * numVaryingElems;
+            if (not outputBlocks.empty()) {
+                varyingScratch.resize((size_t) VaryingOp->m * numVaryingElems);
+                Var_out = &varyingScratch[0];
+            }
+            if (numVaryingElems != VaryingOp->nve)
+                VaryingOp->spmm(Var_out, Var_in, numVaryingElems);
+            else
+                VaryingOp->spmv(Var_out, Var_in);
+            if (not outputBlocks.empty())
+                copyOutputBlocks(Var_out, Var_in, numVaryingElems, true);
+            _currentVaryingBuffer->Unmap();
+        }
+
         // NICK this is the routine that is called every frame
         // V_out += global_edit_vector // vector-vector add (write own or use cblas_saxpy in MKL)
         //
@@ -210,17 +742,24 @@ public:
      * matrix dimensions, number of nonzeroes, memory usage, etc.
      */
     virtual void PrintReport() {
-        int size_in_bytes = SubdivOp->NumBytes();
+        size_t size_in_bytes = SubdivOp->NumBytes();
         double sparsity_factor = 100.0 * SubdivOp->SparsityFactor();
 
         #if BENCHMARKING
-            printf(" nnz=%d", SubdivOp->nnz);
-            printf(" mem=%d", size_in_bytes);
+            printf(" nnz=%lld", (long long) SubdivOp->nnz);
+            printf(" mem=%lu", (unsigned long) size_in_bytes);
             printf(" sparsity=%f", sparsity_factor);
+            if (maxApproxError > 0.0f)
+                printf(" approxerr=%g nnzsaved=%lld", approxError, approxNnzSaved);
+            if (VaryingOp != NULL)
+                printf(" varyingnnz=%lld", (long long) VaryingOp->nnz);
         #endif
 
-	DEBUG_PRINTF("Subdiv matrix is %d-by-%d with %f%% nonzeroes, takes %d MB.\n",
-            SubdivOp->m, SubdivOp->n, sparsity_factor, size_in_bytes / 1024 / 1024);
+	DEBUG_PRINTF("Subdiv matrix is %d-by-%d with %f%% nonzeroes, takes %lu MB.\n",
+            SubdivOp->m, SubdivOp->n, sparsity_factor, (unsigned long) (size_in_bytes / 1024 / 1024));
+        if (maxApproxError > 0.0f)
+            DEBUG_PRINTF("Approximation dropped %lld nonzeroes, vertices move by at most %g.\n",
+                approxNnzSaved, approxError);
     }
 
     /**
@@ -233,35 +772,563 @@ public:
 
     CooMatrix_t* StagedOp;
     CsrMatrix_t* SubdivOp;
+    std::vector<CsrMatrix_t*> StagedChain;
+    CooMatrix_t* StagedVaryingOp;
+    CsrMatrix_t* VaryingOp;
+    std::vector<CsrMatrix_t*> VaryingChain;
     bool logical;
-};
 
+protected:
+    /* elements of each staged row, linked through their position in the
+     * staged arrays, for the substitution of references to staged rows */
+    struct StagedRowLinks {
+        std::vector<int> last, prev;
+        void Reset(int m) { last.assign(m, -1); prev.clear(); }
+        void Add(int row) { prev.push_back(last[row]); last[row] = (int) prev.size()-1; }
+    };
+
+    /* vertex offset of the first stacked row, or -1 */
+    int getStackOffset() const { return stackOffset; }
+    void setStackOffset(int offset) { stackOffset = offset; }
+
+    /* true if the stacked levels are not contiguous in the vertex buffer,
+     * which a single offset can't describe */
+    bool hasOutputGaps() const { return not outputBlocks.empty(); }
+
+    /* a column past the staged ones reads a vertex written by the staged
+     * matrix itself, e.g. a face point read by an edge point, and is
+     * replaced by the elements of its row, which only read staged columns.
+     * In pseudocode:
+     * S[i,:] += value * S[j',:] */
+    void stageElem(CooMatrix_t* A, StagedRowLinks & links, int i, int j, float value) {
+        int row = i;
+        if (j < lastCols) {
+            A->append_element(row, j, value);
+            links.Add(row);
+            return;
+        }
+
+        int ref = j + srcOffset - dstOffset;
+        for (int p = links.last[ref]; p >= 0; p = links.prev[p]) {
+            A->append_element(row, A->cols[p]-1, value * A->vals[p]);
+            links.Add(row);
+        }
+    }
+
+    /* gathers the staged elements by row, along with the copy rows */
+    SpMVStage* makeStage(CooMatrix_t const * A) {
+        SpMVStage* S = new SpMVStage(A->m, A->n);
+        for (int i = 0; i < (int) stagedCopies.size(); i++)
+            S->copyOf[stagedCopies[i].first] = stagedCopies[i].second;
+
+        /* the staged elements are one-based */
+        int nnz = (int) A->vals.size();
+        for (int p = 0; p < nnz; p++)
+            S->rowPtr[A->rows[p]]++;
+
+        /* a copy row that also got elements is stored explicitly */
+        for (int r = 0; r < S->m; r++)
+            if (S->copyOf[r] >= 0 and S->rowPtr[r+1] > 0)
+                S->rowPtr[r+1]++;
+
+        for (int r = 0; r < S->m; r++)
+            S->rowPtr[r+1] += S->rowPtr[r];
+        S->cols.resize(S->rowPtr[S->m]);
+        S->vals.resize(S->rowPtr[S->m]);
+
+        std::vector<int> fill(S->rowPtr.begin(), S->rowPtr.end()-1);
+        for (int r = 0; r < S->m; r++) {
+            if (S->copyOf[r] >= 0 and S->rowPtr[r+1] > S->rowPtr[r]) {
+                S->cols[fill[r]] = S->copyOf[r];
+                S->vals[fill[r]++] = 1.0f;
+                S->copyOf[r] = -1;
+            }
+        }
+        for (int p = 0; p < nnz; p++) {
+            int r = A->rows[p]-1;
+            S->cols[fill[r]] = A->cols[p]-1;
+            S->vals[fill[r]++] = A->vals[p];
+        }
+
+        /* merge repeated columns, e.g. the corners of a substituted face
+         * point that an edge point also reads directly */
+        std::vector<int> length(S->m);
+#pragma omp parallel
+        {
+            std::vector<std::pair<int,float> > row;
+#pragma omp for schedule(dynamic, 256)
+            for (int r = 0; r < S->m; r++) {
+                int begin = S->rowPtr[r], end = S->rowPtr[r+1];
+                row.clear();
+                for (int p = begin; p < end; p++)
+                    row.push_back(std::make_pair(S->cols[p], S->vals[p]));
+                std::sort(row.begin(), row.end(), ColumnLess());
+
+                int n = 0;
+                for (int k = 0; k < (int) row.size(); k++) {
+                    if (n > 0 and S->cols[begin+n-1] == row[k].first) {
+                        S->vals[begin+n-1] += row[k].second;
+                    } else {
+                        S->cols[begin+n] = row[k].first;
+                        S->vals[begin+n] = row[k].second;
+                        n++;
+                    }
+                }
+                length[r] = n;
+            }
+        }
+
+        int out = 0;
+        for (int r = 0; r < S->m; r++) {
+            int begin = S->rowPtr[r];
+            S->rowPtr[r] = out;
+            for (int k = 0; k < length[r]; k++, out++) {
+                S->cols[out] = S->cols[begin+k];
+                S->vals[out] = S->vals[begin+k];
+            }
+        }
+        S->rowPtr[S->m] = out;
+        S->cols.resize(out);
+        S->vals.resize(out);
+        return S;
+    }
+
+    struct ColumnLess {
+        bool operator()(std::pair<int,float> const & a, std::pair<int,float> const & b) const {
+            return a.first < b.first;
+        }
+    };
+
+    /* converts a stage, with its copy rows made explicit */
+    CsrMatrix_t* materializeStage(SpMVStage const & S, int nelems) {
+        CooMatrix_t* A = new CooMatrix_t(S.m, S.n);
+        for (int r = 0; r < S.m; r++) {
+            if (S.copyOf[r] >= 0)
+                A->append_element(r, S.copyOf[r], 1.0f);
+            for (int p = S.rowPtr[r]; p < S.rowPtr[r+1]; p++)
+                A->append_element(r, S.cols[p], S.vals[p]);
+        }
+        CsrMatrix_t* B = new CsrMatrix_t(A, nelems);
+        delete A;
+        return B;
+    }
+
+    /* folds the held stage into this one, and holds the result while it
+     * still has copy rows */
+    void pushStage(SpMVStage* stage, SpMVStage* & held, std::vector<CsrMatrix_t*> & chain, int nelems) {
+        if (held != NULL) {
+            SpMVStage* product = stage->Multiply(*held);
+            delete stage;
+            delete held;
+            held = NULL;
+            stage = product;
+        }
+
+        if (stage->HasCopies()) {
+            held = stage;
+        } else {
+            chain.insert(chain.begin(), materializeStage(*stage, nelems));
+            delete stage;
+        }
+    }
+
+    /* pushes the stages still held at the end of a level, copy rows
+     * included */
+    void flushStages() {
+        if (heldStage != NULL) {
+            StagedChain.insert(StagedChain.begin(),
+                materializeStage(*heldStage, _currentVertexBuffer->GetNumElements()));
+            delete heldStage;
+            heldStage = NULL;
+        }
+        if (heldVaryingStage != NULL) {
+            VaryingChain.insert(VaryingChain.begin(),
+                materializeStage(*heldVaryingStage, _currentVaryingBuffer->GetNumElements()));
+            delete heldVaryingStage;
+            heldVaryingStage = NULL;
+        }
+    }
+
+    void clearLevelOps() {
+        for (int i = 0; i < (int) levelOps.size(); i++) {
+            delete levelOps[i];
+            delete varyingLevelOps[i];
+        }
+        /* level 0 has no operator */
+        levelOps.assign(1, NULL);
+        varyingLevelOps.assign(1, NULL);
+        levelOpsNve = levelOpsNvv = 0;
+    }
+
+    void clearOutputOps() {
+        for (int i = 0; i < (int) outputOps.size(); i++)
+            delete outputOps[i];
+        for (int i = 0; i < (int) varyingOutputOps.size(); i++)
+            delete varyingOutputOps[i];
+        outputOps.clear();
+        varyingOutputOps.clear();
+        outputBlocks.clear();
+        pendingOutput = false;
+    }
+
+    /* multiplies out the chain into the operator of the level marked for
+     * output, which starts the chain of the next levels. Every level stages
+     * its varying matrix along with the vertex one when a varying buffer is
+     * bound (see PushMatrix), so the varying operators of the output levels
+     * are kept in step with the vertex ones */
+    void keepOutputLevel() {
+        CsrMatrix_t* op = composeChain(StagedChain);
+        StagedChain.push_back(op);
+        outputOps.push_back(this->cloneMatrix(op));
+
+        if (not VaryingChain.empty()) {
+            op = composeChain(VaryingChain);
+            VaryingChain.push_back(op);
+            varyingOutputOps.push_back(this->cloneMatrix(op));
+        }
+        pendingOutput = false;
+    }
+
+    /* stacks the operators of the output levels on top of the subdivision
+     * matrix, whose rows go at the given offset. Contiguous levels are
+     * written from the offset of the first one, others through outputBlocks */
+    void stackOutputLevels(int offset) {
+        outputBlocks.push_back(std::make_pair(offset, SubdivOp->m));
+
+        outputOps.push_back(SubdivOp);
+        SubdivOp = this->stackMatrices(outputOps);
+
+        /* the varying rows are stacked the same way, and written through
+         * the same offset or blocks by ApplyMatrix */
+        if (VaryingOp != NULL) {
+            varyingOutputOps.push_back(VaryingOp);
+            assert(varyingOutputOps.size() == outputOps.size());
+            VaryingOp = this->stackMatrices(varyingOutputOps);
+        }
+
+        bool contiguous = true;
+        for (int i = 0; i+1 < (int) outputBlocks.size(); i++)
+            if (outputBlocks[i].first + outputBlocks[i].second != outputBlocks[i+1].first)
+                contiguous = false;
+
+        /* the blocks are deleted along with the stacked operators */
+        std::vector<std::pair<int,int> > blocks;
+        blocks.swap(outputBlocks);
+        clearOutputOps();
+        if (contiguous)
+            stackOffset = blocks[0].first;
+        else
+            outputBlocks.swap(blocks);
+    }
+
+    /* checks that the matrices can refine the bound buffers, once per
+     * matrix and buffer layout rather than every frame */
+    void checkBufferLayout() {
+        int nve = _currentVertexBuffer->GetNumElements(),
+            nvv = _currentVaryingBuffer ? _currentVaryingBuffer->GetNumElements() : 0;
+        if (SubdivOp == checkedOp and VaryingOp == checkedVaryingOp and
+            nve == checkedNve and nvv == checkedNvv)
+            return;
+        checkedOp = SubdivOp;
+        checkedVaryingOp = VaryingOp;
+        checkedNve = nve;
+        checkedNvv = nvv;
+
+        vertexLayoutOk = (nve == SubdivOp->nve or SubdivOp->supportsStrides());
+        if (not vertexLayoutOk)
+            OSD_ERROR("Error: %d elements not supported by a %d-wide subdivision matrix\n",
+                      nve, SubdivOp->nve);
+
+        varyingLayoutOk = (VaryingOp == NULL or nvv == 0 or nvv == VaryingOp->nve or
+                           VaryingOp->supportsStrides());
+        if (not varyingLayoutOk)
+            OSD_ERROR("Error: %d varying elements not supported by a %d-wide varying matrix\n",
+                      nvv, VaryingOp->nve);
+
+        checkElementRange();
+    }
+
+    /* decides whether the element range is refined alone, which the
+     * matrix type may not support, and reports it once per matrix */
+    void checkElementRange() {
+        stridedRange = elementWidth > 0;
+        if (not stridedRange or SubdivOp == NULL or SubdivOp->supportsStrides())
+            return;
+
+        stridedRange = false;
+        if (rangeReportedOp != SubdivOp)
+            OSD_ERROR("Error: the subdivision matrix can't refine %d elements alone, "
+                      "refining them all\n", elementWidth);
+        rangeReportedOp = SubdivOp;
+    }
+
+    /* copies the rows of the stacked levels from the product, which holds
+     * them one after the other, to their offsets in the buffer, or back */
+    void copyOutputBlocks(float* product, float* buffer, int numElems, bool toBuffer) {
+        for (int i = 0; i < (int) outputBlocks.size(); i++) {
+            float* rows = buffer + (size_t) outputBlocks[i].first * numElems;
+            size_t size = (size_t) outputBlocks[i].second * numElems * sizeof(float);
+            if (toBuffer)
+                memcpy(rows, product, size);
+            else
+                memcpy(product, rows, size);
+            product += (size_t) outputBlocks[i].second * numElems;
+        }
+    }
+
+    /* multiplies out the chain (in product order) and empties it */
+    CsrMatrix_t* composeChain(std::vector<CsrMatrix_t*> & chain) {
+        int k = (int) chain.size();
+
+        /* cost[i*k+j] estimates the multiply-adds needed to form
+         * A_i * ... * A_j and nnz[i*k+j] the nonzeroes of the result.
+         * Multiplying L by R touches nnz(L) rows of R, each holding
+         * nnz(R)/m(R) nonzeroes on average. */
+        std::vector<double> cost(k*k, 0.0), nnz(k*k, 0.0);
+        std::vector<int> split(k*k, 0);
+
+        for (int i = 0; i < k; i++)
+            nnz[i*k+i] = chain[i]->nnz;
+
+        for (int len = 2; len <= k; len++) {
+            for (int i = 0; i+len-1 < k; i++) {
+                int j = i+len-1;
+                cost[i*k+j] = -1.0;
+                for (int s = i; s < j; s++) {
+                    double flops = nnz[i*k+s] * nnz[(s+1)*k+j] /
+                        std::max(chain[s+1]->m, 1);
+                    double c = cost[i*k+s] + cost[(s+1)*k+j] + flops;
+                    if (cost[i*k+j] < 0.0 or c < cost[i*k+j]) {
+                        cost[i*k+j] = c;
+                        split[i*k+j] = s;
+                        nnz[i*k+j] = std::min(flops,
+                            (double) chain[i]->m * (double) chain[j]->n);
+                    }
+                }
+            }
+        }
+
+        std::vector<ChainNode> nodes;
+        int root = buildChainTree(chain, split, cost, 0, k-1, nodes);
+
+        /* the teams of sibling subtrees share the threads of the caller
+         * (all processors in FinalizeMatrix), and each product runs on
+         * the threads of its team */
+        int numThreads = 1;
+#ifdef OPENSUBDIV_HAS_OPENMP
+        int nested = omp_get_nested();
+        if (this->SupportsConcurrentProducts()) {
+            numThreads = omp_get_max_threads();
+            omp_set_nested(1);
+        }
+#endif
+
+        multiplyChainTree(nodes, root, numThreads);
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+        omp_set_nested(nested);
+#endif
+
+        chain.clear();
+        return nodes[root].product;
+    }
+
+    struct ChainNode {
+        int left, right; // children, or -1 for a matrix of the chain
+        double cost;     // estimated multiply-adds of the subtree
+        CsrMatrix_t* product;
+    };
+
+    int buildChainTree(std::vector<CsrMatrix_t*> const & chain,
+                       std::vector<int> const & split, std::vector<double> const & cost,
+                       int i, int j, std::vector<ChainNode> & nodes) {
+        int k = (int) chain.size();
+        ChainNode node;
+        node.cost = cost[i*k+j];
+        if (i == j) {
+            node.left = node.right = -1;
+            node.product = chain[i];
+        } else {
+            int s = split[i*k+j];
+            node.left = buildChainTree(chain, split, cost, i, s, nodes);
+            node.right = buildChainTree(chain, split, cost, s+1, j, nodes);
+            node.product = NULL;
+        }
+        nodes.push_back(node);
+        return (int) nodes.size()-1;
+    }
+
+    /* multiplies out the subtree of index with numThreads threads : two
+     * subtrees holding products run side by side, each on a team of
+     * threads sized after its cost */
+    void multiplyChainTree(std::vector<ChainNode> & nodes, int index, int numThreads) {
+        int left = nodes[index].left,
+            right = nodes[index].right;
+        if (left < 0)
+            return;
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+        if (numThreads > 1 and nodes[left].left >= 0 and nodes[right].left >= 0) {
+            double total = nodes[left].cost + nodes[right].cost;
+            int leftThreads = total > 0.0 ?
+                (int) (numThreads * nodes[left].cost / total + 0.5) : numThreads/2;
+            leftThreads = std::max(1, std::min(numThreads-1, leftThreads));
+
+            int subtrees[2] = { left, right },
+                teams[2] = { leftThreads, numThreads-leftThreads };
+
+            /* the products of the teams overlap : they are timed as a whole */
+            bool outermost = not omp_in_parallel();
+            if (outermost)
+                g_matrixTimer.Start();
+#pragma omp parallel for num_threads(2) schedule(static, 1)
+            for (int t = 0; t < 2; t++) {
+                omp_set_num_threads(teams[t]);
+                multiplyChainTree(nodes, subtrees[t], teams[t]);
+            }
+            if (outermost)
+                g_matrixTimer.Stop();
+        } else
+#endif
+        {
+            multiplyChainTree(nodes, left, numThreads);
+            multiplyChainTree(nodes, right, numThreads);
+        }
+
+        multiplyChainNode(nodes, index);
+    }
+
+    void multiplyChainNode(std::vector<ChainNode> & nodes, int index) {
+        ChainNode & node = nodes[index];
+        CsrMatrix_t *lhs = nodes[node.left].product,
+                    *rhs = nodes[node.right].product;
+
+        DEBUG_PRINTF("ComposeMatrix mul %d-%d = %d-%d * %d-%d\n",
+                lhs->m, rhs->n, lhs->m, lhs->n, rhs->m, rhs->n);
+
+        node.product = lhs->gemm(rhs);
+        delete lhs;
+        delete rhs;
+        nodes[node.left].product = NULL;
+        nodes[node.right].product = NULL;
+    }
+
+private:
+    float maxApproxError, approxError;
+    long long approxNnzSaved;
+
+    /* stacked output of intermediate levels */
+    int outputLevelMask;
+    int stackOffset;                                  // vertex offset of the first stacked row, or -1
+    bool pendingOutput;                               // the level marked last is output
+    std::vector<CsrMatrix_t*> outputOps, varyingOutputOps;  // operators of the output levels
+    std::vector<std::pair<int,int> > outputBlocks;    // vertex offset and rows of each stacked
+                                                      // level, if they are not contiguous
+    std::vector<float> outputScratch, varyingScratch; // products of stacked levels with gaps
+    int levelOffset, lastRows, lastCols;
+    int stagedVaryingElems;
+
+    /* elements of each staged row, linked through their position in the
+     * staged arrays, for the substitution of references to staged rows */
+    StagedRowLinks stagedLinks, stagedVaryingLinks;
+
+    /* implicit copy rows of the staged matrices, as (row, column) */
+    std::vector<std::pair<int,int> > stagedCopies;
+    SpMVStage *heldStage, *heldVaryingStage;          // stages waiting for the next one, or NULL
+
+    /* element range refined by ApplyMatrix, all of them if elementWidth <= 0 */
+    int elementOffset, elementWidth;
+    bool stridedRange;                                // the range is refined alone
+
+    /* operators from the coarse vertices to each level, indexed by level */
+    std::vector<CsrMatrix_t*> levelOps, varyingLevelOps;
+    int selectedLevel;                                // level SubdivOp subdivides to
+    int levelOpsNve, levelOpsNvv;                     // buffer layout of the cached operators
+
+    /* matrices and buffer layout last checked by checkBufferLayout */
+    CsrMatrix_t *checkedOp, *checkedVaryingOp, *rangeReportedOp;
+    int checkedNve, checkedNvv;
+    bool vertexLayoutOk, varyingLayoutOk;
+};
 
-class CsrMatrix;
 
 class CooMatrix {
 public:
     int m, n, nnz;
     CooMatrix(int m, int n, int nnz=0) : m(m), n(n), nnz(nnz) { };
+    virtual ~CooMatrix() { }
 
     virtual void append_element(int i, int j, float val) = 0;
 };
 
-class CsrMatrix {
+/**
+ * Offset is the type of the row offsets and of the number of
+ * nonzeroes. Operators of the finest levels of large meshes pass
+ * 2^31 nonzeroes, and need a 64-bit type. Column indices stay int,
+ * since they index the vertices of a single level.
+ */
+template <class Offset>
+class CsrMatrixT {
 public:
-    int m, n, nve, nnz;
+    int m, n, nve;
+    Offset nnz;
 
-    CsrMatrix(int m, int n, int nnz=1, int nve=1) :
-        m(m), n(n), nnz(nnz), nve(nve) { };
-    CsrMatrix(const CooMatrix* StagedOp, int nve=1) :
-        m(StagedOp->m), n(StagedOp->n), nnz(StagedOp->nnz), nve(nve) { }
+    CsrMatrixT(int m, int n, Offset nnz=1, int nve=1) :
+        m(m), n(n), nve(nve), nnz(nnz) { };
+    CsrMatrixT(const CooMatrix* StagedOp, int nve=1) :
+        m(StagedOp->m), n(StagedOp->n), nve(nve), nnz(StagedOp->nnz) { }
+
+    virtual ~CsrMatrixT() { }
 
     virtual void spmv(float* d_out, float* d_in) = 0;
     virtual void logical_spmv(float* d_out, float* d_in, float* h_in) = 0;
     virtual void dump(std::string ofilename) = 0;
 
-    virtual int NumBytes() {
-        return nnz*sizeof(float) + nnz*sizeof(int) + (m+1)*sizeof(int);
+    /**
+     * Multiplies the matrix with nrhs interleaved columns instead of
+     * nve, e.g. the vertices of a batch of instances sharing this
+     * topology. Returns false if only nve columns are supported.
+     */
+    virtual bool spmm(float* d_out, float* d_in, int nrhs) {
+        if (nrhs != nve)
+            return false;
+        spmv(d_out, d_in);
+        return true;
+    }
+
+    /**
+     * Multiplies the matrix with width columns of an interleaved
+     * buffer holding ld elements per vertex, starting at d_in and
+     * d_out. The other elements are left untouched. Returns false
+     * if only whole vertices are supported.
+     */
+    virtual bool spmm_strided(float* d_out, float* d_in, int ld, int width) {
+        if (ld != width)
+            return false;
+        return spmm(d_out, d_in, width);
+    }
+
+    /**
+     * True if spmm takes any number of columns and spmm_strided any
+     * width and stride, rather than whole nve-wide vertices only.
+     */
+    virtual bool supportsStrides() {
+        return false;
+    }
+
+    /**
+     * Drops small entries from each row and rescales the rest to
+     * keep the row sum, as long as the absolute weight change of the
+     * row stays within tolerance. Stores the largest change in
+     * *achieved and returns the number of entries dropped.
+     */
+    virtual Offset truncate(float tolerance, float* achieved) {
+        *achieved = 0.0f;
+        return 0;
+    }
+
+    virtual size_t NumBytes() {
+        return (size_t) nnz * (sizeof(float) + sizeof(int)) + (size_t) (m+1) * sizeof(Offset);
     }
 
     virtual inline double SparsityFactor() {
@@ -269,6 +1336,8 @@ public:
     }
 };
 
+typedef CsrMatrixT<int> CsrMatrix;
+
 } // end namespace OPENSUBDIV_VERSION
 using namespace OPENSUBDIV_VERSION;
 
@@ -25,7 +25,11 @@ public:
     }
 
     virtual void AddVaryingWithWeight(float *varying, int dstIndex, int srcIndex, float weight) const {
-        assert(numVaryingElements == 0);
+        if (numVaryingElements == 0)
+            return;
+        int d = dstIndex - _dispatcher->dstOffset;
+        int s = srcIndex - _dispatcher->srcOffset;
+        _dispatcher->StageVaryingElem(d,s,weight);
     }
 
     virtual void ApplyVertexEditAdd(float *vertex, int primVarOffset, int primVarWidth, int editIndex, const float *editValues) const {
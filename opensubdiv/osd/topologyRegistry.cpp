@@ -0,0 +1,244 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#include <string.h>
+
+#include "../version.h"
+
+#include "../osd/mutex.h"
+
+#include "../hbr/mesh.h"
+#include "../hbr/vertex.h"
+#include "../hbr/face.h"
+#include "../hbr/halfedge.h"
+#include "../hbr/bilinear.h"
+#include "../hbr/catmark.h"
+#include "../hbr/loop.h"
+
+#include "../far/mesh.h"
+
+#include "../osd/topologyRegistry.h"
+#include "../osd/kernelDispatcher.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+// Bumped whenever FarMeshFactory changes the order of the refined vertices,
+// so that the operators saved by older builds are not mapped.
+static const unsigned int kVertexOrderVersion = 1;
+
+static unsigned int
+floatBits(float f) {
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+OsdTopologyRegistry &
+OsdTopologyRegistry::GetInstance() {
+
+    static OsdTopologyRegistry registry;
+    return registry;
+}
+
+bool
+OsdTopologyRegistry::GetSignature(HbrMesh<OsdVertex> * hbrMesh, int level, int kernel, int exact,
+                                  std::vector<unsigned int> & signature) {
+
+    if (hbrMesh->HasVertexEdits() or not hbrMesh->GetHierarchicalEdits().empty())
+        return false;
+
+    unsigned int scheme;
+    HbrSubdivision<OsdVertex> * subdivision = hbrMesh->GetSubdivision();
+    if (HbrCatmarkSubdivision<OsdVertex> * catmark = dynamic_cast<HbrCatmarkSubdivision<OsdVertex> *>(subdivision))
+        scheme = 0x10 | catmark->GetTriangleSubdivisionMethod();
+    else if (dynamic_cast<HbrLoopSubdivision<OsdVertex> *>(subdivision))
+        scheme = 0x20;
+    else if (dynamic_cast<HbrBilinearSubdivision<OsdVertex> *>(subdivision))
+        scheme = 0x30;
+    else
+        return false;
+
+    int nverts = hbrMesh->GetNumVertices(),
+        nfaces = hbrMesh->GetNumCoarseFaces();
+
+    signature.clear();
+    signature.push_back(kVertexOrderVersion);
+    signature.push_back(scheme);
+    signature.push_back(subdivision->GetCreaseSubdivisionMethod());
+    signature.push_back(hbrMesh->GetInterpolateBoundaryMethod());
+    signature.push_back(level);
+    signature.push_back(kernel);
+    signature.push_back(exact);
+    signature.push_back(nverts);
+    signature.push_back(nfaces);
+
+    // the face-varying operators depend on the layout of the data, and on
+    // the edges across which it is discontinuous
+    int fvarcount = hbrMesh->GetFVarCount();
+    signature.push_back(hbrMesh->GetFVarInterpolateBoundaryMethod());
+    signature.push_back(hbrMesh->GetFVarPropagateCorners());
+    signature.push_back(fvarcount);
+    for (int i=0; i<fvarcount; ++i)
+        signature.push_back(hbrMesh->GetFVarWidths()[i]);
+
+    for (int i=0; i<nfaces; ++i) {
+        HbrFace<OsdVertex> * f = hbrMesh->GetFace(i);
+        int nv = f->GetNumVertices();
+        signature.push_back(nv | (f->IsHole() ? 0x80000000u : 0));
+        for (int j=0; j<nv; ++j) {
+            signature.push_back(f->GetVertex(j)->GetID());
+            signature.push_back(floatBits(f->GetEdge(j)->GetSharpness()));
+            for (int k=0; k<fvarcount; k+=32) {
+                unsigned int fvarsharp = 0;
+                for (int datum=k; datum<fvarcount and datum<k+32; ++datum)
+                    if (f->GetEdge(j)->GetFVarInfiniteSharp(datum))
+                        fvarsharp |= 1u << (datum-k);
+                signature.push_back(fvarsharp);
+            }
+        }
+    }
+
+    for (int i=0; i<nverts; ++i) {
+        HbrVertex<OsdVertex> * v = hbrMesh->GetVertex(i);
+        signature.push_back(v ? floatBits(v->GetSharpness()) : 0xFFFFFFFFu);
+    }
+    return true;
+}
+
+// 64-bit FNV-1a
+unsigned long long
+OsdTopologyRegistry::hashSignature(std::vector<unsigned int> const & signature) {
+
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i=0; i<(int)signature.size(); ++i) {
+        for (int k=0; k<4; ++k) {
+            hash ^= (signature[i] >> (8*k)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+OsdTopology *
+OsdTopologyRegistry::Acquire(std::vector<unsigned int> const & signature) {
+
+    unsigned long long hash = hashSignature(signature);
+
+    OsdTopology * result = NULL;
+
+    _mutex.Lock();
+    std::pair<TopologyMap::iterator, TopologyMap::iterator> range = _topologies.equal_range(hash);
+    for (TopologyMap::iterator it=range.first; it!=range.second; ++it) {
+        if (it->second->signature == signature) {
+            result = it->second;
+            ++result->refCount;
+            break;
+        }
+    }
+    _mutex.Unlock();
+
+    return result;
+}
+
+OsdTopology *
+OsdTopologyRegistry::Insert(std::vector<unsigned int> const & signature,
+                            FarMesh<OsdVertex> * farMesh, OsdKernelDispatcher * dispatcher,
+                            int level, int exact) {
+
+    OsdTopology * topology = new OsdTopology;
+    topology->farMesh = farMesh;
+    topology->dispatcher = dispatcher;
+    topology->level = level;
+    topology->exact = exact;
+    topology->refCount = 1;
+    topology->hash = hashSignature(signature);
+    topology->signature = signature;
+
+    _mutex.Lock();
+    _topologies.insert(std::make_pair(topology->hash, topology));
+    ++_numTopologies;
+    _mutex.Unlock();
+
+    return topology;
+}
+
+void
+OsdTopologyRegistry::Release(OsdTopology * topology) {
+
+    _mutex.Lock();
+    bool last = (--topology->refCount == 0);
+    if (last) {
+        std::pair<TopologyMap::iterator, TopologyMap::iterator> range = _topologies.equal_range(topology->hash);
+        for (TopologyMap::iterator it=range.first; it!=range.second; ++it) {
+            if (it->second == topology) {
+                _topologies.erase(it);
+                break;
+            }
+        }
+        --_numTopologies;
+    }
+    _mutex.Unlock();
+
+    if (last) {
+        delete topology->dispatcher;
+        delete topology->farMesh;
+        delete topology;
+    }
+}
+
+} // end namespace OPENSUBDIV_VERSION
+} // end namespace OpenSubdiv
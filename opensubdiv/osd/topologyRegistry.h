@@ -0,0 +1,139 @@
+//
+//     Copyright (C) Pixar. All rights reserved.
+//
+//     This license governs use of the accompanying software. If you
+//     use the software, you accept this license. If you do not accept
+//     the license, do not use the software.
+//
+//     1. Definitions
+//     The terms "reproduce," "reproduction," "derivative works," and
+//     "distribution" have the same meaning here as under U.S.
+//     copyright law.  A "contribution" is the original software, or
+//     any additions or changes to the software.
+//     A "contributor" is any person or entity that distributes its
+//     contribution under this license.
+//     "Licensed patents" are a contributor's patent claims that read
+//     directly on its contribution.
+//
+//     2. Grant of Rights
+//     (A) Copyright Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free copyright license to reproduce its contribution,
+//     prepare derivative works of its contribution, and distribute
+//     its contribution or any derivative works that you create.
+//     (B) Patent Grant- Subject to the terms of this license,
+//     including the license conditions and limitations in section 3,
+//     each contributor grants you a non-exclusive, worldwide,
+//     royalty-free license under its licensed patents to make, have
+//     made, use, sell, offer for sale, import, and/or otherwise
+//     dispose of its contribution in the software or derivative works
+//     of the contribution in the software.
+//
+//     3. Conditions and Limitations
+//     (A) No Trademark License- This license does not grant you
+//     rights to use any contributor's name, logo, or trademarks.
+//     (B) If you bring a patent claim against any contributor over
+//     patents that you claim are infringed by the software, your
+//     patent license from such contributor to the software ends
+//     automatically.
+//     (C) If you distribute any portion of the software, you must
+//     retain all copyright, patent, trademark, and attribution
+//     notices that are present in the software.
+//     (D) If you distribute any portion of the software in source
+//     code form, you may do so only under this license by including a
+//     complete copy of this license with your distribution. If you
+//     distribute any portion of the software in compiled or object
+//     code form, you may only do so under a license that complies
+//     with this license.
+//     (E) The software is licensed "as-is." You bear the risk of
+//     using it. The contributors give no express warranties,
+//     guarantees or conditions. You may have additional consumer
+//     rights under your local laws which this license cannot change.
+//     To the extent permitted under your local laws, the contributors
+//     exclude the implied warranties of merchantability, fitness for
+//     a particular purpose and non-infringement.
+//
+#ifndef OSD_TOPOLOGY_REGISTRY_H
+#define OSD_TOPOLOGY_REGISTRY_H
+
+#include <map>
+#include <vector>
+
+#include "../version.h"
+
+#include "../osd/mutex.h"
+#include "../osd/vertex.h"
+
+namespace OpenSubdiv {
+namespace OPENSUBDIV_VERSION {
+
+template <class T> class HbrMesh;
+template <class U> class FarMesh;
+
+class OsdKernelDispatcher;
+
+// A refined topology shared by all the OsdMesh instances created from
+// identical coarse meshes : the Far tables, and the dispatcher holding the
+// device tables or the finalized subdivision matrix.
+struct OsdTopology {
+    FarMesh<OsdVertex>  * farMesh;
+    OsdKernelDispatcher * dispatcher;
+
+    int level,
+        exact,
+        refCount;
+
+    unsigned long long        hash;
+    std::vector<unsigned int> signature;
+};
+
+// Registry of the shared topologies, keyed by a canonical description of the
+// coarse mesh : scheme, boundary interpolation, face-vertex indices, holes,
+// edge and vertex sharpness, and the refinement level, kernel and exact mode.
+// Meshes with hierarchical edits are never shared, since the edit values are
+// baked into their tables.
+class OsdTopologyRegistry {
+
+public:
+    static OsdTopologyRegistry & GetInstance();
+
+    // Computes the canonical description of hbrMesh. Returns false if the mesh
+    // cannot be shared.
+    static bool GetSignature(HbrMesh<OsdVertex> * hbrMesh, int level, int kernel, int exact,
+                             std::vector<unsigned int> & signature);
+
+    // Returns the topology registered with this signature and adds a reference
+    // to it, or NULL if there is none.
+    OsdTopology * Acquire(std::vector<unsigned int> const & signature);
+
+    // Registers a new topology with a single reference. The registry takes
+    // ownership of farMesh and dispatcher.
+    OsdTopology * Insert(std::vector<unsigned int> const & signature,
+                         FarMesh<OsdVertex> * farMesh, OsdKernelDispatcher * dispatcher,
+                         int level, int exact);
+
+    // Drops a reference, and deletes the topology with the last one.
+    void Release(OsdTopology * topology);
+
+    // Number of distinct topologies currently registered
+    int GetNumTopologies() const { return _numTopologies; }
+
+private:
+    OsdTopologyRegistry() : _numTopologies(0) { }
+
+    static unsigned long long hashSignature(std::vector<unsigned int> const & signature);
+
+    typedef std::multimap<unsigned long long, OsdTopology *> TopologyMap;
+
+    TopologyMap _topologies;
+    int         _numTopologies;
+    Mutex       _mutex;
+};
+
+} // end namespace OPENSUBDIV_VERSION
+using namespace OPENSUBDIV_VERSION;
+
+} // end namespace OpenSubdiv
+
+#endif /* OSD_TOPOLOGY_REGISTRY_H */
@@ -56,6 +56,7 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 
 #include <osd/mutex.h>
 
@@ -66,6 +67,8 @@
 #include <hbr/catmark.h>
 
 #include <far/meshFactory.h>
+#include <far/topologyRefiner.h>
+#include <far/meshPredictor.h>
 
 #include "../common/shape_utils.h"
 
@@ -78,7 +81,15 @@
 // - results cannot be bitwise identical as some vertex interpolations
 //   are not happening in the same order.
 //
-// - only vertex interpolation is being tested at the moment.
+// - only vertex and face-varying interpolation are being tested at the moment.
+//
+// - the meshes built by FarTopologyRefiner must be bitwise identical to the
+//   ones built by FarMeshFactory.
+//
+// - FarMeshPredictor must predict the vertex counts and table sizes exactly.
+//
+// - the limit positions of the exact evaluation must match vertices refined
+//   deeply in Hbr (precision 1e-4).
 //
 #define PRECISION 1e-6
 
@@ -417,7 +428,513 @@ int checkMesh( char const * msg, xyzmesh * hmesh, int levels, Scheme scheme=kCat
             printf("  success !\n");
     }
 
+    // the far mesh owns the hbr mesh
+    delete m;
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Face-varying data : the vertex position, and a 2-wide channel offset on
+// every third face, which is discontinuous across some of the edges
+static int g_fvarIndices[2] = { 0, 3 },
+           g_fvarWidths[2] = { 3, 2 };
+
+static xyzmesh * fvarHbr( char const * shapestr, Scheme scheme,
+                          xyzmesh::InterpolateBoundaryMethod fvarInterpolation ) {
+
+    static OpenSubdiv::HbrBilinearSubdivision<xyzVV> _bilinear;
+    static OpenSubdiv::HbrLoopSubdivision<xyzVV>     _loop;
+    static OpenSubdiv::HbrCatmarkSubdivision<xyzVV>  _catmark;
+
+    OpenSubdiv::HbrSubdivision<xyzVV> * subdivision = &_catmark;
+    if (scheme==kBilinear)
+        subdivision = &_bilinear;
+    else if (scheme==kLoop)
+        subdivision = &_loop;
+
+    xyzmesh * mesh = new xyzmesh( subdivision, 2, g_fvarIndices, g_fvarWidths, 5 );
+
+    shape * sh = shape::parseShape( shapestr );
+
+    createVertices<xyzVV>( sh, mesh, (std::vector<float> *)0 );
+
+    const int * fv=&(sh->faceverts[0]);
+    for (int f=0; f<sh->getNfaces(); ++f) {
+
+        int nv = sh->nvertsPerFace[f];
+
+        xyzface * face = mesh->NewFace(nv, (int *)fv, 0);
+
+        for (int j=0; j<nv; ++j) {
+
+            float const * pos = &sh->verts[fv[j]*3];
+            float data[5] = { pos[0], pos[1], pos[2], pos[0] + 0.1f*(f%3), pos[1] };
+
+            xyzvertex * v = face->GetVertex(j);
+            OpenSubdiv::HbrFVarData<xyzVV> & fvt = v->GetFVarData(face);
+            if (not fvt.IsInitialized())
+                fvt.SetAllData(5, data);
+            else if (not fvt.CompareAll(5, data))
+                v->NewFVarData(face).SetAllData(5, data);
+        }
+        fv+=nv;
+    }
+
+    mesh->SetInterpolateBoundaryMethod( xyzmesh::k_InterpolateBoundaryEdgeOnly );
+
+    mesh->SetFVarInterpolateBoundaryMethod( fvarInterpolation );
+
+    applyTags<xyzVV>( mesh, sh );
+
+    mesh->Finish();
+
+    delete sh;
+
+    return mesh;
+}
+
+//------------------------------------------------------------------------------
+// Writes the mesh to a temporary file and reads it back, then matches the
+// face-varying tables read to the original ones, and the data they refine
+static int checkFVarSerialization( fMesh const * m, std::vector<float> const & coarse,
+                                                    std::vector<float> const & refined ) {
+
+    FILE * file = tmpfile();
+    if (not file or not m->Write(file)) {
+        printf("// fvar serialization : the mesh could not be written\n");
+        if (file)
+            fclose(file);
+        return 1;
+    }
+
+    // Read uses the data in place, which must be 8-byte aligned
+    size_t size = (size_t)ftell(file);
+    std::vector<long long> data((size+7)/8);
+    rewind(file);
+    bool success = fread(&data[0], 1, size, file) == size;
+    fclose(file);
+
+    fMesh * r = success ? fMesh::Read((char *)&data[0], size) : 0;
+    OpenSubdiv::FarFVarTables<xyzVV> const * tables = m->GetFVarTables(),
+                                           * result = r ? r->GetFVarTables() : 0;
+    if (not result) {
+        printf("// fvar serialization : the face-varying tables could not be read\n");
+        delete r;
+        return 1;
+    }
+
+    int count=0;
+    if (result->GetMaxLevel()!=tables->GetMaxLevel() or
+        result->GetTotalWidth()!=tables->GetTotalWidth() or
+        result->GetNumCoarseValues()!=tables->GetNumCoarseValues() or
+        result->GetNumRefinedValues()!=tables->GetNumRefinedValues() or
+        result->GetNumChannels()!=tables->GetNumChannels()) {
+        printf("// fvar serialization : the sizes of the tables differ\n");
+        delete r;
+        return 1;
+    }
+
+    for (int c=0; c<tables->GetNumChannels(); ++c)
+        if (result->GetChannelWidth(c)!=tables->GetChannelWidth(c) or
+            result->GetChannelOffset(c)!=tables->GetChannelOffset(c) or
+            result->GetRowOffsets(c)!=tables->GetRowOffsets(c) or
+            result->GetColumns(c)!=tables->GetColumns(c) or
+            result->GetWeights(c)!=tables->GetWeights(c)) {
+            printf("// fvar serialization : channel %d differs\n", c);
+            count++;
+        }
+
+    std::vector<float> values(refined.size());
+    result->Apply(&coarse[0], &values[0]);
+    if (values!=refined) {
+        printf("// fvar serialization : the refined data differs\n");
+        count++;
+    }
+
+    delete r;
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Matches the face-varying data refined with the FarFVarTables operators to
+// the data refined by Hbr, for each face-varying boundary interpolation method,
+// and checks that the tables survive a round trip through FarMesh::Write/Read
+int checkFVar( char const * msg, char const * shapestr, int levels, Scheme scheme=kCatmark ) {
+
+    assert(msg);
+
+    if (not g_debugmode)
+        printf("- %s (scheme=%d)\n", msg, scheme);
+
+    int count=0;
+    for (int method=0; method<4; ++method) {
+
+        xyzmesh * hmesh = fvarHbr( shapestr, scheme, (xyzmesh::InterpolateBoundaryMethod)method );
+
+        fMeshFactory fact( hmesh, levels );
+        fMesh * m = fact.Create( );
+
+        OpenSubdiv::FarFVarTables<xyzVV> const * tables = m->GetFVarTables();
+
+        // the Loop face-varying rules are not serialized
+        if (scheme==kLoop or not tables) {
+            if ((scheme==kLoop) != (tables==NULL)) {
+                printf("// face-varying tables %s\n", tables ? "built for a Loop mesh" : "missing");
+                count++;
+            }
+            delete m;
+            continue;
+        }
+
+        int width = tables->GetTotalWidth();
+
+        std::vector<float> coarse,
+                           refined(tables->GetNumRefinedValues()*width);
+
+        for (int i=0; i<hmesh->GetNumCoarseFaces(); ++i) {
+            xyzface * f = hmesh->GetFace(i);
+            for (int j=0; j<f->GetNumVertices(); ++j) {
+                float const * data = f->GetFVarData(j).GetData(0);
+                coarse.insert(coarse.end(), data, data+width);
+            }
+        }
+
+        tables->Apply(&coarse[0], &refined[0]);
+
+        // the refined face corners follow the faces of the last level
+        for (int i=0, corner=0; i<hmesh->GetNumFaces(); ++i) {
+
+            xyzface * f = hmesh->GetFace(i);
+            if (f->GetDepth()!=levels)
+                continue;
+
+            for (int j=0; j<f->GetNumVertices(); ++j, ++corner) {
+
+                float const * data = f->GetFVarData(j).GetData(0),
+                            * value = &refined[corner*width];
+
+                for (int k=0; k<width; ++k)
+                    if ( fabsf(data[k]-value[k]) > PRECISION ) {
+                        if (not g_debugmode)
+                            printf("// fvar method %d face %d corner %d fails : %.10f instead of %.10f\n",
+                                   method, i, j, value[k], data[k]);
+                        count++;
+                        break;
+                    }
+            }
+        }
+
+        count += checkFVarSerialization( m, coarse, refined );
+
+        delete m;
+    }
+
+    if (not g_debugmode and count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Describes a shape to FarTopologyRefiner, with the tags of applyTags()
+static OpenSubdiv::FarTopologyDescriptor refinerDescriptor( shape const * sh, Scheme scheme ) {
+
+    typedef OpenSubdiv::FarTopologyDescriptor Descriptor;
+
+    Descriptor desc;
+
+    desc.scheme = scheme==kLoop ? Descriptor::k_Loop :
+                  scheme==kBilinear ? Descriptor::k_Bilinear : Descriptor::k_Catmark;
+
+    // createTopology() defaults to "edge only" boundaries
+    desc.interpolateBoundary = Descriptor::k_InterpolateBoundaryEdgeOnly;
+
+    desc.numVertices = sh->getNverts();
+    desc.numVertsPerFace = sh->nvertsPerFace;
+    desc.vertIndices = sh->faceverts;
+
+    for (int i=0; i<(int)sh->tags.size(); ++i) {
+        shape::tag * t = sh->tags[i];
+
+        int nfloat = (int)t->floatargs.size();
+        if (t->name=="crease") {
+            for (int j=0; j<(int)t->intargs.size()-1; j += 2) {
+                desc.creaseIndices.push_back(t->intargs[j]);
+                desc.creaseIndices.push_back(t->intargs[j+1]);
+                desc.creaseSharpness.push_back(nfloat > 1 ? t->floatargs[j] : t->floatargs[0]);
+            }
+        } else if (t->name=="corner") {
+            for (int j=0; j<(int)t->intargs.size(); ++j) {
+                desc.cornerIndices.push_back(t->intargs[j]);
+                desc.cornerSharpness.push_back(nfloat > 1 ? t->floatargs[j] : t->floatargs[0]);
+            }
+        } else if (t->name=="interpolateboundary") {
+            switch (t->intargs[0]) {
+                case 0 : desc.interpolateBoundary = Descriptor::k_InterpolateBoundaryNone; break;
+                case 1 : desc.interpolateBoundary = Descriptor::k_InterpolateBoundaryEdgeAndCorner; break;
+                case 2 : desc.interpolateBoundary = Descriptor::k_InterpolateBoundaryEdgeOnly; break;
+            }
+        } else if (t->name=="creasemethod") {
+            desc.triangleSubdivision = t->stringargs[0]=="chaikin" ? Descriptor::k_TriangleNew :
+                                                                     Descriptor::k_TriangleOld;
+        }
+    }
+    return desc;
+}
+
+//------------------------------------------------------------------------------
+template <class T> static int
+compareTables( char const * name, OpenSubdiv::FarTable<T> const & a,
+                                  OpenSubdiv::FarTable<T> const & b, int levels ) {
+
+    if (a.GetMemoryUsed()!=b.GetMemoryUsed() or
+        (a.GetMemoryUsed() and memcmp(a[0], b[0], a.GetMemoryUsed()))) {
+        printf("// table %s differs\n", name);
+        return 1;
+    }
+    for (int i=0; i<levels; ++i)
+        if (a.GetNumElements(i)!=b.GetNumElements(i)) {
+            printf("// table %s differs at level %d\n", name, i);
+            return 1;
+        }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Matches the mesh built by FarTopologyRefiner with the one FarMeshFactory
+// builds from Hbr : the tables and the refined vertices must be identical.
+// The refiner rejects the non-manifold meshes Hbr splits vertices of.
+int checkRefiner( char const * msg, char const * shapestr, int levels, Scheme scheme=kCatmark ) {
+
+    assert(msg);
+
+    if (not g_debugmode)
+        printf("- %s (scheme=%d)\n", msg, scheme);
+
+    shape * sh = shape::parseShape( shapestr );
+
+    fMeshFactory fact( simpleHbr<xyzVV>(shapestr, scheme, 0), levels );
+    fMesh * m = fact.Create( );
+
+    OpenSubdiv::FarTopologyRefiner<xyzVV> refiner( refinerDescriptor(sh, scheme), levels );
+    fMesh * r = refiner.Create( );
+
+    int count=0;
+    if (not r) {
+        if (m->GetNumCoarseVertices()==sh->getNverts()) {
+            printf("// the refiner rejected a manifold mesh\n");
+            count++;
+        }
+    } else if (m->GetNumCoarseVertices()!=r->GetNumCoarseVertices() or
+               m->GetNumVertices()!=r->GetNumVertices()) {
+        printf("// %d coarse / %d vertices instead of %d / %d\n",
+               r->GetNumCoarseVertices(), r->GetNumVertices(),
+               m->GetNumCoarseVertices(), m->GetNumVertices());
+        count++;
+    } else {
+
+        if (fact.GetRemappingTable()!=refiner.GetRemappingTable() or
+            fact.GetUnmappingTable()!=refiner.GetUnmappingTable()) {
+            printf("// remapping tables differ\n");
+            count++;
+        }
+
+        fMeshSubdivision const * ta = m->GetSubdivision(),
+                               * tb = r->GetSubdivision();
+
+        count += compareTables("E_IT", ta->Get_E_IT(), tb->Get_E_IT(), levels);
+        count += compareTables("E_W", ta->Get_E_W(), tb->Get_E_W(), levels);
+        count += compareTables("V_ITa", ta->Get_V_ITa(), tb->Get_V_ITa(), levels);
+        count += compareTables("V_IT", ta->Get_V_IT(), tb->Get_V_IT(), levels);
+        count += compareTables("V_W", ta->Get_V_W(), tb->Get_V_W(), levels);
+
+        if (scheme==kCatmark) {
+            OpenSubdiv::FarCatmarkSubdivisionTables<xyzVV> const
+                * ca = dynamic_cast<OpenSubdiv::FarCatmarkSubdivisionTables<xyzVV> const *>(ta),
+                * cb = dynamic_cast<OpenSubdiv::FarCatmarkSubdivisionTables<xyzVV> const *>(tb);
+            count += compareTables("F_IT", ca->Get_F_IT(), cb->Get_F_IT(), levels);
+            count += compareTables("F_ITa", ca->Get_F_ITa(), cb->Get_F_ITa(), levels);
+        } else if (scheme==kBilinear) {
+            OpenSubdiv::FarBilinearSubdivisionTables<xyzVV> const
+                * ba = dynamic_cast<OpenSubdiv::FarBilinearSubdivisionTables<xyzVV> const *>(ta),
+                * bb = dynamic_cast<OpenSubdiv::FarBilinearSubdivisionTables<xyzVV> const *>(tb);
+            count += compareTables("F_IT", ba->Get_F_IT(), bb->Get_F_IT(), levels);
+            count += compareTables("F_ITa", ba->Get_F_ITa(), bb->Get_F_ITa(), levels);
+        }
+
+        for (int i=0; i<=levels; ++i) {
+            if (ta->GetFirstVertexOffset(i)!=tb->GetFirstVertexOffset(i) or
+                m->GetFaceVertices(i)!=r->GetFaceVertices(i) or
+                m->GetPtexCoordinates(i)!=r->GetPtexCoordinates(i)) {
+                printf("// level %d differs\n", i);
+                count++;
+            }
+        }
+
+        // the refiner leaves the coarse vertices to the client
+        for (int i=0; i<r->GetNumCoarseVertices(); ++i)
+            r->GetVertex(i).SetPosition( sh->verts[i*3], sh->verts[i*3+1], sh->verts[i*3+2] );
+
+        m->Subdivide( );
+        r->Subdivide( );
+
+        for (int i=0; i<m->GetNumVertices(); ++i)
+            if (memcmp(m->GetVertex(i).GetPos(), r->GetVertex(i).GetPos(), 3*sizeof(float))) {
+                if (not g_debugmode)
+                    printf("// vertex %d differs\n", i);
+                count++;
+            }
+        delete r;
+    }
+
+    if (not g_debugmode and count==0)
+        printf("  success !\n");
+
+    delete m;
+    delete sh;
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Matches the vertex counts and table sizes predicted from the coarse mesh with
+// the ones of the meshes FarMeshFactory builds for each level
+int checkPredictor( char const * msg, char const * shapestr, int levels, Scheme scheme=kCatmark ) {
+
+    assert(msg);
+
+    if (not g_debugmode)
+        printf("- %s (scheme=%d)\n", msg, scheme);
+
+    xyzmesh * hmesh = simpleHbr<xyzVV>(shapestr, scheme, 0);
+
+    std::vector<OpenSubdiv::FarLevelPrediction> predictions;
+    OpenSubdiv::FarMeshPredictor<xyzVV>(hmesh).Predict(levels, predictions);
+
+    int count=0;
+    for (int level=1; level<=levels; ++level) {
+
+        // each factory refines the HbrMesh further
+        fMeshFactory fact( hmesh, level );
+        fMesh * m = fact.Create( );
+
+        OpenSubdiv::FarLevelPrediction const & p = predictions[level-1];
+
+        int nverts = m->GetSubdivision()->GetNumVertices(level);
+        size_t tableBytes = m->GetSubdivision()->GetMemoryUsed();
+
+        if (p.numVertices!=nverts or p.numTotalVertices!=m->GetNumVertices() or
+            p.tableBytes!=tableBytes) {
+            printf("// level %d : predicted %d / %d vertices and %lu table bytes"
+                   " instead of %d / %d and %lu\n", level,
+                   p.numVertices, p.numTotalVertices, (unsigned long)p.tableBytes,
+                   nverts, m->GetNumVertices(), (unsigned long)tableBytes);
+            count++;
+        }
+
+        hmesh = m->ReleaseHbrMesh();
+        delete m;
+    }
+
     delete hmesh;
+
+    if (not g_debugmode and count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Records the limit matrix pushed by the subdivision tables, and refines the
+// levels with the default table kernels
+class LimitRecorder : public OpenSubdiv::FarDispatcher<xyzVV> {
+public:
+    virtual int SupportsExactEvaluation() { return 1; }
+
+    virtual void StageMatrix(int i, int /* j */) { _staged.assign(i, Row()); }
+
+    virtual void StageElem(int i, int j, float value) { _staged[i].push_back(std::make_pair(j, value)); }
+
+    virtual void PushMatrix() { rows.swap(_staged); }
+
+    typedef std::vector<std::pair<int, float> > Row;
+
+    std::vector<Row> rows;
+
+private:
+    std::vector<Row> _staged;
+};
+
+// Compares the limit positions of the vertices of the first level with the
+// positions of their descendants, refined locally in the HbrMesh
+int checkLimit( char const * msg, char const * shapestr, Scheme scheme=kCatmark ) {
+
+    assert(msg);
+
+    static const int limitLevels = 20;
+    static const float limitPrecision = 1e-4f;
+
+    if (not g_debugmode)
+        printf("- %s (scheme=%d)\n", msg, scheme);
+
+    xyzmesh * hmesh = simpleHbr<xyzVV>(shapestr, scheme, 0);
+
+    LimitRecorder recorder;
+    fMeshFactory fact( hmesh, 1 );
+    fMesh * m = fact.Create( &recorder );
+
+    // refines the first level, and pushes its vertices to the limit
+    m->Subdivide( 2, 1 );
+
+    int nverts = m->GetSubdivision()->GetNumVertices(1),
+        offset = m->GetSubdivision()->GetFirstVertexOffset(1);
+
+    std::vector<int> const & remap = fact.GetRemappingTable();
+    std::vector<int> unmap(m->GetNumVertices(), -1);
+    for (int i=0; i<(int)remap.size(); ++i)
+        unmap[remap[i]] = i;
+
+    int count=0;
+    if ((int)recorder.rows.size()!=nverts) {
+        printf("// limit matrix has %d rows instead of %d\n", (int)recorder.rows.size(), nverts);
+        count++;
+    }
+
+    for (int i=0; i<(int)recorder.rows.size(); ++i) {
+
+        xyzvertex * hv = hmesh->GetVertex(unmap[offset+i]);
+
+        if ( hmesh->GetInterpolateBoundaryMethod()==xyzmesh::k_InterpolateBoundaryNone and
+             VertexOnBoundary(hv) )
+             continue;
+
+        xyzVV limit(0.0f, 0.0f, 0.0f);
+        for (int j=0; j<(int)recorder.rows[i].size(); ++j)
+            limit.AddWithWeight(m->GetVertex(offset+recorder.rows[i][j].first), recorder.rows[i][j].second);
+
+        for (int level=0; level<limitLevels; ++level) {
+            hv->Refine();
+            hv = hv->Subdivide();
+        }
+
+        float const * a = limit.GetPos(),
+                    * b = hv->GetData().GetPos();
+        float delta[3] = { a[0]-b[0], a[1]-b[1], a[2]-b[2] };
+
+        float dist = sqrtf( delta[0]*delta[0]+delta[1]*delta[1]+delta[2]*delta[2]);
+        if ( dist > limitPrecision ) {
+            if (not g_debugmode)
+                printf("// limit of vertex %d fails : dist=%.10f (%.10f %.10f %.10f)"
+                       " (%.10f %.10f %.10f)\n", offset+i, dist, a[0], a[1], a[2], b[0], b[1], b[2] );
+            count++;
+        }
+    }
+
+    if (not g_debugmode and count==0)
+        printf("  success !\n");
+
+    // the far mesh owns the hbr mesh
     delete m;
 
     return count;
@@ -479,6 +996,8 @@ int main(int argc, char ** argv) {
 
 #define test_bilinear_cube
 
+#define test_refiner_large_shapes
+
   if (g_debugmode)
       printf("[ ");
   else
@@ -643,6 +1162,226 @@ int main(int argc, char ** argv) {
     total += checkMesh( "test_bilinear_cube", simpleHbr<xyzVV>(bilinear_cube, kBilinear, 0), levels, kBilinear );
 #endif
 
+#ifdef test_catmark_edgecorner
+    total += checkFVar( "test_fvar_catmark_edgecorner", catmark_edgecorner, levels );
+#endif
+
+#ifdef test_catmark_pyramid_creases1
+    total += checkFVar( "test_fvar_catmark_pyramid_creases1", catmark_pyramid_creases1, levels );
+#endif
+
+#ifdef test_catmark_cube_creases0
+    total += checkFVar( "test_fvar_catmark_cube_creases0", catmark_cube_creases0, levels );
+#endif
+
+#ifdef test_catmark_cube_creases1
+    total += checkFVar( "test_fvar_catmark_cube_creases1", catmark_cube_creases1, levels );
+#endif
+
+#ifdef test_catmark_dart_edgeonly
+    total += checkFVar( "test_fvar_catmark_dart_edgeonly", catmark_dart_edgeonly, levels );
+#endif
+
+#ifdef test_catmark_tent_creases1
+    total += checkFVar( "test_fvar_catmark_tent_creases1", catmark_tent_creases1, levels );
+#endif
+
+#ifdef test_loop_cube_creases1
+    total += checkFVar( "test_fvar_loop_cube_creases1", loop_cube_creases1, levels, kLoop );
+#endif
+
+#ifdef test_bilinear_cube
+    total += checkFVar( "test_fvar_bilinear_cube", bilinear_cube, levels, kBilinear );
+#endif
+
+    // FarTopologyRefiner doesn't support hierarchical edits : the hedit
+    // shapes are left out
+#ifdef test_catmark_edgeonly
+    total += checkRefiner( "test_refiner_catmark_edgeonly", catmark_edgeonly, levels );
+    total += checkPredictor( "test_predictor_catmark_edgeonly", catmark_edgeonly, levels );
+#endif
+#ifdef test_catmark_edgecorner
+    total += checkRefiner( "test_refiner_catmark_edgecorner", catmark_edgecorner, levels );
+    total += checkPredictor( "test_predictor_catmark_edgecorner", catmark_edgecorner, levels );
+#endif
+#ifdef test_catmark_pyramid
+    total += checkRefiner( "test_refiner_catmark_pyramid", catmark_pyramid, levels );
+    total += checkPredictor( "test_predictor_catmark_pyramid", catmark_pyramid, levels );
+#endif
+#ifdef test_catmark_pyramid_creases0
+    total += checkRefiner( "test_refiner_catmark_pyramid_creases0", catmark_pyramid_creases0, levels );
+    total += checkPredictor( "test_predictor_catmark_pyramid_creases0", catmark_pyramid_creases0, levels );
+#endif
+#ifdef test_catmark_pyramid_creases1
+    total += checkRefiner( "test_refiner_catmark_pyramid_creases1", catmark_pyramid_creases1, levels );
+    total += checkPredictor( "test_predictor_catmark_pyramid_creases1", catmark_pyramid_creases1, levels );
+#endif
+#ifdef test_catmark_cube
+    total += checkRefiner( "test_refiner_catmark_cube", catmark_cube, levels );
+    total += checkPredictor( "test_predictor_catmark_cube", catmark_cube, levels );
+#endif
+#ifdef test_catmark_cube_creases0
+    total += checkRefiner( "test_refiner_catmark_cube_creases0", catmark_cube_creases0, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_creases0", catmark_cube_creases0, levels );
+#endif
+#ifdef test_catmark_cube_creases1
+    total += checkRefiner( "test_refiner_catmark_cube_creases1", catmark_cube_creases1, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_creases1", catmark_cube_creases1, levels );
+#endif
+#ifdef test_catmark_cube_corner0
+    total += checkRefiner( "test_refiner_catmark_cube_corner0", catmark_cube_corner0, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_corner0", catmark_cube_corner0, levels );
+#endif
+#ifdef test_catmark_cube_corner1
+    total += checkRefiner( "test_refiner_catmark_cube_corner1", catmark_cube_corner1, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_corner1", catmark_cube_corner1, levels );
+#endif
+#ifdef test_catmark_cube_corner2
+    total += checkRefiner( "test_refiner_catmark_cube_corner2", catmark_cube_corner2, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_corner2", catmark_cube_corner2, levels );
+#endif
+#ifdef test_catmark_cube_corner3
+    total += checkRefiner( "test_refiner_catmark_cube_corner3", catmark_cube_corner3, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_corner3", catmark_cube_corner3, levels );
+#endif
+#ifdef test_catmark_cube_corner4
+    total += checkRefiner( "test_refiner_catmark_cube_corner4", catmark_cube_corner4, levels );
+    total += checkPredictor( "test_predictor_catmark_cube_corner4", catmark_cube_corner4, levels );
+#endif
+#ifdef test_catmark_dart_edgeonly
+    total += checkRefiner( "test_refiner_catmark_dart_edgeonly", catmark_dart_edgeonly, levels );
+    total += checkPredictor( "test_predictor_catmark_dart_edgeonly", catmark_dart_edgeonly, levels );
+#endif
+#ifdef test_catmark_dart_edgecorner
+    total += checkRefiner( "test_refiner_catmark_dart_edgecorner", catmark_dart_edgecorner, levels );
+    total += checkPredictor( "test_predictor_catmark_dart_edgecorner", catmark_dart_edgecorner, levels );
+#endif
+#ifdef test_catmark_tent
+    total += checkRefiner( "test_refiner_catmark_tent", catmark_tent, levels );
+    total += checkPredictor( "test_predictor_catmark_tent", catmark_tent, levels );
+#endif
+#ifdef test_catmark_tent_creases0
+    total += checkRefiner( "test_refiner_catmark_tent_creases0", catmark_tent_creases0, levels );
+    total += checkPredictor( "test_predictor_catmark_tent_creases0", catmark_tent_creases0, levels );
+#endif
+#ifdef test_catmark_tent_creases1
+    total += checkRefiner( "test_refiner_catmark_tent_creases1", catmark_tent_creases1, levels );
+    total += checkPredictor( "test_predictor_catmark_tent_creases1", catmark_tent_creases1, levels );
+#endif
+#ifdef test_loop_triangle_edgeonly
+    total += checkRefiner( "test_refiner_loop_triangle_edgeonly", loop_triangle_edgeonly, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_triangle_edgeonly", loop_triangle_edgeonly, levels, kLoop );
+#endif
+#ifdef test_loop_triangle_edgecorner
+    total += checkRefiner( "test_refiner_loop_triangle_edgecorner", loop_triangle_edgecorner, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_triangle_edgecorner", loop_triangle_edgecorner, levels, kLoop );
+#endif
+#ifdef test_loop_icosahedron
+    total += checkRefiner( "test_refiner_loop_icosahedron", loop_icosahedron, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_icosahedron", loop_icosahedron, levels, kLoop );
+#endif
+#ifdef test_loop_cube
+    total += checkRefiner( "test_refiner_loop_cube", loop_cube, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_cube", loop_cube, levels, kLoop );
+#endif
+#ifdef test_loop_cube_creases0
+    total += checkRefiner( "test_refiner_loop_cube_creases0", loop_cube_creases0, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_cube_creases0", loop_cube_creases0, levels, kLoop );
+#endif
+#ifdef test_loop_cube_creases1
+    total += checkRefiner( "test_refiner_loop_cube_creases1", loop_cube_creases1, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_cube_creases1", loop_cube_creases1, levels, kLoop );
+#endif
+#ifdef test_bilinear_cube
+    total += checkRefiner( "test_refiner_bilinear_cube", bilinear_cube, levels, kBilinear );
+    total += checkPredictor( "test_predictor_bilinear_cube", bilinear_cube, levels, kBilinear );
+#endif
+#ifndef test_loop_saddle_edgeonly
+#include "../shapes/loop_saddle_edgeonly.h"
+#endif
+    total += checkRefiner( "test_refiner_loop_saddle_edgeonly", loop_saddle_edgeonly, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_saddle_edgeonly", loop_saddle_edgeonly, levels, kLoop );
+#ifndef test_loop_saddle_edgecorner
+#include "../shapes/loop_saddle_edgecorner.h"
+#endif
+    total += checkRefiner( "test_refiner_loop_saddle_edgecorner", loop_saddle_edgecorner, levels, kLoop );
+    total += checkPredictor( "test_predictor_loop_saddle_edgecorner", loop_saddle_edgecorner, levels, kLoop );
+
+    // FarMesh::Subdivide with exact evaluation : the semi-sharp creases and the
+    // darts are solved on local refinements
+#ifdef test_catmark_cube
+    total += checkLimit( "test_limit_catmark_cube", catmark_cube );
+#endif
+#ifdef test_catmark_cube_creases0
+    total += checkLimit( "test_limit_catmark_cube_creases0", catmark_cube_creases0 );
+#endif
+#ifdef test_catmark_cube_creases1
+    total += checkLimit( "test_limit_catmark_cube_creases1", catmark_cube_creases1 );
+#endif
+#ifdef test_catmark_cube_corner0
+    total += checkLimit( "test_limit_catmark_cube_corner0", catmark_cube_corner0 );
+#endif
+#ifdef test_catmark_cube_corner2
+    total += checkLimit( "test_limit_catmark_cube_corner2", catmark_cube_corner2 );
+#endif
+#ifdef test_catmark_cube_corner4
+    total += checkLimit( "test_limit_catmark_cube_corner4", catmark_cube_corner4 );
+#endif
+#ifdef test_catmark_pyramid_creases1
+    total += checkLimit( "test_limit_catmark_pyramid_creases1", catmark_pyramid_creases1 );
+#endif
+#ifdef test_catmark_tent_creases1
+    total += checkLimit( "test_limit_catmark_tent_creases1", catmark_tent_creases1 );
+#endif
+#ifdef test_catmark_dart_edgeonly
+    total += checkLimit( "test_limit_catmark_dart_edgeonly", catmark_dart_edgeonly );
+#endif
+#ifdef test_catmark_dart_edgecorner
+    total += checkLimit( "test_limit_catmark_dart_edgecorner", catmark_dart_edgecorner );
+#endif
+#ifdef test_loop_icosahedron
+    total += checkLimit( "test_limit_loop_icosahedron", loop_icosahedron, kLoop );
+#endif
+#ifdef test_loop_cube_creases0
+    total += checkLimit( "test_limit_loop_cube_creases0", loop_cube_creases0, kLoop );
+#endif
+#ifdef test_loop_cube_creases1
+    total += checkLimit( "test_limit_loop_cube_creases1", loop_cube_creases1, kLoop );
+#endif
+
+#ifdef test_refiner_large_shapes
+#include "../shapes/al.h"
+#include "../shapes/bigguy.h"
+#include "../shapes/bunny.h"
+#include "../shapes/cupid.h"
+#include "../shapes/head.h"
+#include "../shapes/monsterfrog.h"
+#include "../shapes/teapot.h"
+#include "../shapes/torii.h"
+#include "../shapes/twist.h"
+#include "../shapes/venus.h"
+    total += checkRefiner( "test_refiner_al", al, 2 );
+    total += checkPredictor( "test_predictor_al", al, 3 );
+    total += checkRefiner( "test_refiner_bigguy", bigguy, 2 );
+    total += checkPredictor( "test_predictor_bigguy", bigguy, 3 );
+    total += checkRefiner( "test_refiner_bunny", bunny, 2, kLoop );
+    total += checkPredictor( "test_predictor_bunny", bunny, 3, kLoop );
+    total += checkRefiner( "test_refiner_cupid", cupid, 1 );
+    total += checkPredictor( "test_predictor_cupid", cupid, 2 );
+    total += checkRefiner( "test_refiner_head", head, 2 );
+    total += checkPredictor( "test_predictor_head", head, 3 );
+    total += checkRefiner( "test_refiner_monsterfrog", monsterfrog, 2 );
+    total += checkPredictor( "test_predictor_monsterfrog", monsterfrog, 3 );
+    total += checkRefiner( "test_refiner_teapot", teapot, 2 );
+    total += checkPredictor( "test_predictor_teapot", teapot, 3 );
+    total += checkRefiner( "test_refiner_torii", torii, 2 );
+    total += checkPredictor( "test_predictor_torii", torii, 3 );
+    total += checkRefiner( "test_refiner_twist", twist, 2 );
+    total += checkPredictor( "test_predictor_twist", twist, 3 );
+    total += checkRefiner( "test_refiner_venus", venus, 2 );
+    total += checkPredictor( "test_predictor_venus", venus, 3 );
+#endif
+
 
     if (g_debugmode)
         printf("]\n");
@@ -66,6 +66,18 @@
 
 #include <stdio.h>
 #include <cassert>
+#include <algorithm>
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    #include <omp.h>
+#endif
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+#endif
 
 #include <osd/mutex.h>
 
@@ -77,6 +89,7 @@
 
 #include <osd/vertex.h>
 #include <osd/mesh.h>
+#include <osd/topologyRegistry.h>
 #include <osd/cpuDispatcher.h>
 #include <osd/glslDispatcher.h>
 
@@ -84,6 +97,13 @@
     #include <osd/cudaDispatcher.h>
 #endif
 
+#ifdef OPENSUBDIV_HAS_MKL
+    #include <osd/mklDispatcher.h>
+    #ifndef _WIN32
+        #include <osd/sharedOperators.h>
+    #endif
+#endif
+
 #ifdef OPENSUBDIV_HAS_OPENCL
     #include <osd/clDispatcher.h>
 #endif
@@ -342,209 +362,1941 @@ int checkMesh( char const * msg, char const * shape, int levels, Scheme scheme=k
     return result;
 }
 
+#ifdef OPENSUBDIV_HAS_MKL
 //------------------------------------------------------------------------------
-int main(int argc, char ** argv) {
+// Refines the coarse vertices with omesh, and returns the vertices of the
+// given level
+static std::vector<float> refineLevel( OpenSubdiv::OsdMesh * omesh,
+                                       std::vector<float> const & coarseverts,
+                                       int level ) {
 
-    // Make sure we have an OpenGL context.
-    glutInit(&argc, argv);
-    glutCreateWindow("osd_regression");
-    glewInit();
+    OpenSubdiv::OsdCpuVertexBuffer * vb =
+        dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3));
 
-    int levels=5, total=0;
+    vb->UpdateData( & coarseverts[0], (int)coarseverts.size()/3 );
 
-    // Register Osd compute kernels
-    OpenSubdiv::OsdCpuKernelDispatcher::Register();
+    omesh->Subdivide( vb, NULL );
 
-#define test_catmark_edgeonly
-#define test_catmark_edgecorner
-#define test_catmark_pyramid
-#define test_catmark_pyramid_creases0
-#define test_catmark_pyramid_creases1
-#define test_catmark_cube
-#define test_catmark_cube_creases0
-#define test_catmark_cube_creases1
-#define test_catmark_cube_corner0
-#define test_catmark_cube_corner1
-#define test_catmark_cube_corner2
-#define test_catmark_cube_corner3
-#define test_catmark_cube_corner4
-#define test_catmark_dart_edgeonly
-#define test_catmark_dart_edgecorner
-#define test_catmark_tent
-#define test_catmark_tent_creases0
-#define test_catmark_tent_creases1
-#define test_catmark_square_hedit0
-#define test_catmark_square_hedit1
-#define test_catmark_square_hedit2
-#define test_catmark_square_hedit3
+    omesh->Synchronize();
 
-#define test_loop_triangle_edgeonly
-#define test_loop_triangle_edgecorner
-#define test_loop_icosahedron
-#define test_loop_cube
-#define test_loop_cube_creases0
-#define test_loop_cube_creases1
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
 
-#define test_bilinear_cube
+    int first = tables->GetFirstVertexOffset(level),
+        last = first + tables->GetNumVertices(level);
 
-    printf("precision : %f\n",PRECISION);
+    std::vector<float> result( vb->GetCpuBuffer() + first*3, vb->GetCpuBuffer() + last*3 );
 
-#ifdef test_catmark_edgeonly
-#include "../shapes/catmark_edgeonly.h"
-    total += checkMesh( "test_catmark_edgeonly", catmark_edgeonly, levels, kCatmark );
-#endif
+    delete vb;
 
-#ifdef test_catmark_edgecorner
-#include "../shapes/catmark_edgecorner.h"
-    total += checkMesh( "test_catmark_edgeonly", catmark_edgecorner, levels, kCatmark );
-#endif
+    return result;
+}
 
-#ifdef test_catmark_pyramid
-#include "../shapes/catmark_pyramid.h"
-    total += checkMesh( "test_catmark_pyramid", catmark_pyramid, levels, kCatmark );
-#endif
+//------------------------------------------------------------------------------
+// Returns the number of vertices of a level that differ between a and b
+static int compareLevel( std::vector<float> const & a, std::vector<float> const & b, int level ) {
 
-#ifdef test_catmark_pyramid_creases0
-#include "../shapes/catmark_pyramid_creases0.h"
-    total += checkMesh( "test_catmark_pyramid_creases0", catmark_pyramid_creases0, levels, kCatmark );
-#endif
+    if (a.size()!=b.size()) {
+        printf("// level %d has %d vertices instead of %d\n", level,
+               (int)b.size()/3, (int)a.size()/3);
+        return 1;
+    }
 
-#ifdef test_catmark_pyramid_creases1
-#include "../shapes/catmark_pyramid_creases1.h"
-    total += checkMesh( "test_catmark_pyramid_creases1", catmark_pyramid_creases1, levels, kCatmark );
-#endif
+    int count=0;
+    for (int i=0; i<(int)a.size(); i+=3) {
+        float delta[3] = { a[i]-b[i], a[i+1]-b[i+1], a[i+2]-b[i+2] };
+        float dist = sqrtf( delta[0]*delta[0]+delta[1]*delta[1]+delta[2]*delta[2]);
+        if ( dist > PRECISION ) {
+            printf("// level %d vertex %d fails : dist=%.10f\n", level, i/3, dist);
+            count++;
+        }
+    }
+    return count;
+}
 
-#ifdef test_catmark_cube
-#include "../shapes/catmark_cube.h"
-    total += checkMesh( "test_catmark_cube", catmark_cube, levels, kCatmark );
-#endif
+//------------------------------------------------------------------------------
+// Switches a matrix kernel mesh back and forth between levels, and matches
+// each level to a mesh created at that level
+int checkSetLevel( char const * msg, char const * shape, int outputLevels, Scheme scheme=kCatmark ) {
 
-#ifdef test_catmark_cube_creases0
-#include "../shapes/catmark_cube_creases0.h"
-    total += checkMesh( "test_catmark_cube_creases0", catmark_cube_creases0, levels, kCatmark );
-#endif
+    static int const levels[] = { 2, 1, 3, 2, 4, 1 };
 
-#ifdef test_catmark_cube_creases1
-#include "../shapes/catmark_cube_creases1.h"
-    total += checkMesh( "test_catmark_cube_creases1", catmark_cube_creases1, levels, kCatmark );
-#endif
+    printf("- %s (scheme=%d, outputLevels=%d)\n", msg, scheme, outputLevels);
 
-#ifdef test_catmark_cube_corner0
-#include "../shapes/catmark_cube_corner0.h"
-    total += checkMesh( "test_catmark_cube_corner0", catmark_cube_corner0, levels, kCatmark );
-#endif
+    std::vector<float> coarseverts;
 
-#ifdef test_catmark_cube_corner1
-#include "../shapes/catmark_cube_corner1.h"
-    total += checkMesh( "test_catmark_cube_corner1", catmark_cube_corner1, levels, kCatmark );
-#endif
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh();
 
-#ifdef test_catmark_cube_corner2
-#include "../shapes/catmark_cube_corner2.h"
-    total += checkMesh( "test_catmark_cube_corner2", catmark_cube_corner2, levels, kCatmark );
-#endif
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels[0],
+                  (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
 
-#ifdef test_catmark_cube_corner3
-#include "../shapes/catmark_cube_corner3.h"
-    total += checkMesh( "test_catmark_cube_corner3", catmark_cube_corner3, levels, kCatmark );
-#endif
+    omesh->SetOutputLevels(outputLevels);
 
-#ifdef test_catmark_cube_corner4
-#include "../shapes/catmark_cube_corner4.h"
-    total += checkMesh( "test_catmark_cube_corner4", catmark_cube_corner4, levels, kCatmark );
-#endif
+    int count=0;
+    for (int i=0; i<(int)(sizeof(levels)/sizeof(levels[0])); ++i) {
 
-#ifdef test_catmark_dart_edgecorner
-#include "../shapes/catmark_dart_edgecorner.h"
-    total += checkMesh( "test_catmark_dart_edgecorner", catmark_dart_edgecorner, levels, kCatmark );
-#endif
+        omesh->SetLevel(levels[i]);
 
-#ifdef test_catmark_dart_edgeonly
-#include "../shapes/catmark_dart_edgeonly.h"
-    total += checkMesh( "test_catmark_dart_edgeonly", catmark_dart_edgeonly, levels, kCatmark );
-#endif
+        std::vector<float> freshverts;
 
-#ifdef test_catmark_tent
-#include "../shapes/catmark_tent.h"
-    total += checkMesh( "test_catmark_tent", catmark_tent, levels, kCatmark );
-#endif
+        OpenSubdiv::OsdMesh * fresh = new OpenSubdiv::OsdMesh();
 
-#ifdef test_catmark_tent_creases0
-#include "../shapes/catmark_tent_creases0.h"
-    total += checkMesh( "test_catmark_tent_creases0", catmark_tent_creases0, levels );
-#endif
+        fresh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, freshverts), levels[i],
+                      (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
 
-#ifdef test_catmark_tent_creases1
-#include "../shapes/catmark_tent_creases1.h"
-    total += checkMesh( "test_catmark_tent_creases1", catmark_tent_creases1, levels );
-#endif
+        count += compareLevel( refineLevel(fresh, freshverts, levels[i]),
+                               refineLevel(omesh, coarseverts, levels[i]), levels[i] );
 
-#ifdef test_catmark_square_hedit0
-#include "../shapes/catmark_square_hedit0.h"
-    total += checkMesh( "test_catmark_square_hedit0", catmark_square_hedit0, levels );
-#endif
+        delete fresh;
+    }
 
-#ifdef test_catmark_square_hedit1
-#include "../shapes/catmark_square_hedit1.h"
-    total += checkMesh( "test_catmark_square_hedit1", catmark_square_hedit1, levels );
-#endif
+    delete omesh;
 
-#ifdef test_catmark_square_hedit2
-#include "../shapes/catmark_square_hedit2.h"
-    total += checkMesh( "test_catmark_square_hedit2", catmark_square_hedit2, levels );
-#endif
+    if (count==0)
+        printf("  success !\n");
 
-#ifdef test_catmark_square_hedit3
-#include "../shapes/catmark_square_hedit3.h"
-    total += checkMesh( "test_catmark_square_hedit3", catmark_square_hedit3, levels );
-#endif
+    return count;
+}
 
+//------------------------------------------------------------------------------
+// Refines a matrix kernel mesh stacking the intermediate levels of
+// outputLevels, matches each of them to a mesh created at that level, and
+// checks the levels in between are left untouched
+int checkOutputLevels( char const * msg, char const * shape, int levels, int outputLevels,
+                       Scheme scheme=kCatmark ) {
 
-#ifdef test_loop_triangle_edgeonly
-#include "../shapes/loop_triangle_edgeonly.h"
-    total += checkMesh( "test_loop_triangle_edgeonly", loop_triangle_edgeonly, levels, kLoop );
-#endif
+    static float const untouched = 1e6f;
 
-#ifdef test_loop_triangle_edgecorner
-#include "../shapes/loop_triangle_edgecorner.h"
-    total += checkMesh( "test_loop_triangle_edgecorner", loop_triangle_edgecorner, levels, kLoop );
-#endif
+    printf("- %s (scheme=%d, outputLevels=%d)\n", msg, scheme, outputLevels);
 
-#ifdef test_loop_saddle_edgeonly
-#include "../shapes/loop_saddle_edgeonly.h"
-    total += checkMesh( "test_loop_saddle_edgeonly", loop_saddle_edgeonly, levels, kLoop );
-#endif
+    std::vector<float> coarseverts;
 
-#ifdef test_loop_saddle_edgecorner
-#include "../shapes/loop_saddle_edgecorner.h"
-    total += checkMesh( "test_loop_saddle_edgecorner", loop_saddle_edgecorner, levels, kLoop );
-#endif
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh();
 
-#ifdef test_loop_icosahedron
-#include "../shapes/loop_icosahedron.h"
-    total += checkMesh( "test_loop_icosahedron", loop_icosahedron, levels, kLoop );
-#endif
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
 
-#ifdef test_loop_cube
-#include "../shapes/loop_cube.h"
-    total += checkMesh( "test_loop_cube", loop_cube, levels, kLoop );
-#endif
+    if (not omesh->SetOutputLevels(outputLevels)) {
+        printf("// the kernel can't output levels %d\n", outputLevels);
+        delete omesh;
+        return 1;
+    }
 
-#ifdef test_loop_cube_creases0
-#include "../shapes/loop_cube_creases0.h"
-    total += checkMesh( "test_loop_cube_creases0", loop_cube_creases0,levels, kLoop );
-#endif
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
 
-#ifdef test_loop_cube_creases1
-#include "../shapes/loop_cube_creases1.h"
-    total += checkMesh( "test_loop_cube_creases1", loop_cube_creases1, levels, kLoop );
-#endif
+    int numVertices = omesh->GetFarMesh()->GetNumVertices();
 
+    std::vector<float> verts(numVertices*3, untouched);
+    for (int i=0; i<(int)coarseverts.size(); ++i)
+        verts[i] = coarseverts[i];
 
+    OpenSubdiv::OsdCpuVertexBuffer * vb =
+        dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3));
 
-#ifdef test_bilinear_cube
-#include "../shapes/bilinear_cube.h"
-    total += checkMesh( "test_bilinear_cube", bilinear_cube, levels, kBilinear );
+    vb->UpdateData( & verts[0], numVertices );
+
+    omesh->Subdivide( vb, NULL );
+
+    omesh->Synchronize();
+
+    int count=0;
+    for (int level=1; level<=levels; ++level) {
+
+        int first = tables->GetFirstVertexOffset(level),
+            last = first + tables->GetNumVertices(level);
+
+        std::vector<float> stacked( vb->GetCpuBuffer() + first*3, vb->GetCpuBuffer() + last*3 );
+
+        if (level==levels or ((outputLevels >> level) & 1)) {
+
+            std::vector<float> freshverts;
+
+            OpenSubdiv::OsdMesh * fresh = new OpenSubdiv::OsdMesh();
+
+            fresh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, freshverts), level,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+            count += compareLevel( refineLevel(fresh, freshverts, level), stacked, level );
+
+            delete fresh;
+
+        } else {
+
+            for (int i=0; i<(int)stacked.size(); ++i)
+                if (stacked[i]!=untouched) {
+                    printf("// level %d is not output but vertex %d was written\n", level, i/3);
+                    count++;
+                    break;
+                }
+        }
+    }
+
+    delete vb;
+
+    delete omesh;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Refines the vertex and varying data of a matrix kernel mesh stacking the
+// intermediate levels of outputLevels, and matches the output levels of both
+// to the table kernels
+int checkOutputVarying( char const * msg, char const * shape, int levels, int outputLevels,
+                        Scheme scheme=kCatmark ) {
+
+    printf("- %s (scheme=%d, outputLevels=%d)\n", msg, scheme, outputLevels);
+
+    int const kernels[2] = { (int)OpenSubdiv::OsdKernelDispatcher::kCPU,
+                             (int)OpenSubdiv::OsdKernelDispatcher::kMKL };
+
+    std::vector<float> results[2][2];
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables = 0;
+
+    int count=0;
+    for (int k=0; k<2; ++k) {
+
+        std::vector<float> coarseverts;
+
+        OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh();
+
+        omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                      kernels[k], /* exact= */ 0);
+
+        if (k==1 and not omesh->SetOutputLevels(outputLevels)) {
+            printf("// the kernel can't output levels %d\n", outputLevels);
+            delete omesh;
+            return 1;
+        }
+
+        // the varying data is the coarse position, swizzled
+        int numCoarse = (int)coarseverts.size()/3;
+        std::vector<float> varying(numCoarse*3);
+        for (int i=0; i<numCoarse; ++i) {
+            varying[i*3  ] = coarseverts[i*3+2];
+            varying[i*3+1] = coarseverts[i*3  ];
+            varying[i*3+2] = coarseverts[i*3+1];
+        }
+
+        OpenSubdiv::OsdCpuVertexBuffer * vb =
+            dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3));
+        OpenSubdiv::OsdCpuVertexBuffer * vvb =
+            dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3));
+
+        vb->UpdateData( & coarseverts[0], numCoarse );
+        vvb->UpdateData( & varying[0], numCoarse );
+
+        omesh->Subdivide( vb, vvb );
+
+        omesh->Synchronize();
+
+        tables = omesh->GetFarMesh()->GetSubdivision();
+
+        int numVertices = omesh->GetFarMesh()->GetNumVertices();
+        results[k][0].assign( vb->GetCpuBuffer(), vb->GetCpuBuffer() + numVertices*3 );
+        results[k][1].assign( vvb->GetCpuBuffer(), vvb->GetCpuBuffer() + numVertices*3 );
+
+        delete vb;
+        delete vvb;
+
+        if (k==0) {
+            delete omesh;
+            continue;
+        }
+
+        for (int level=1; level<=levels; ++level) {
+            if (level!=levels and not ((outputLevels >> level) & 1))
+                continue;
+
+            int first = tables->GetFirstVertexOffset(level)*3,
+                last = first + tables->GetNumVertices(level)*3;
+
+            for (int j=0; j<2; ++j) {
+                std::vector<float> a( results[0][j].begin()+first, results[0][j].begin()+last ),
+                                   b( results[1][j].begin()+first, results[1][j].begin()+last );
+                int failures = compareLevel( a, b, level );
+                if (failures)
+                    printf("// %s data of level %d differs\n", j ? "varying" : "vertex", level);
+                count += failures;
+            }
+        }
+
+        delete omesh;
+    }
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Refines a shape with one of the host matrix kernels, and matches the finest
+// level to the kMKL product
+int checkKernel( char const * msg, char const * shape, int levels, int kernel, Scheme scheme=kCatmark ) {
+
+    printf("- %s (scheme=%d, kernel=%d)\n", msg, scheme, kernel);
+
+    std::vector<float> coarseverts, refverts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh(),
+                        * reference = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  kernel, /* exact= */ 0);
+
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, refverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    int count = compareLevel( refineLevel(reference, refverts, levels),
+                              refineLevel(omesh, coarseverts, levels), levels );
+
+    delete omesh;
+    delete reference;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Matrix kernel staging each Catmark level as the face point stage and the
+// stage of the vertices reading it, like the dispatchers that can't
+// substitute the face points
+class TwoStageDispatcher : public OpenSubdiv::OsdMklKernelDispatcher {
+public:
+    TwoStageDispatcher(int levels) : OpenSubdiv::OsdMklKernelDispatcher(levels) { }
+
+    virtual bool SupportsSingleStageLevels() {
+        return false;
+    }
+
+    // registers the dispatcher on first use, and returns its kernel type
+    static int Kernel() {
+        static int kernel = Factory::GetInstance().Register(Create);
+        return kernel;
+    }
+
+private:
+    static OpenSubdiv::OsdKernelDispatcher * Create(int levels) {
+        return new TwoStageDispatcher(levels);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Refines a Catmark shape to each level with the face points substituted into
+// a single stage, and matches the level to the two stage matrix
+int checkSingleStage( char const * msg, char const * shape, int levels ) {
+
+    printf("- %s (levels=%d)\n", msg, levels);
+
+    int count=0;
+    for (int level=1; level<=levels; ++level) {
+
+        std::vector<float> coarseverts, refverts;
+
+        OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh(),
+                            * reference = new OpenSubdiv::OsdMesh();
+
+        omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, kCatmark, coarseverts), level,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+        reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, kCatmark, refverts), level,
+                          TwoStageDispatcher::Kernel(), /* exact= */ 0);
+
+        count += compareLevel( refineLevel(reference, refverts, level),
+                               refineLevel(omesh, coarseverts, level), level );
+
+        delete omesh;
+        delete reference;
+    }
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Refines a shape with a matrix truncated to maxError, and matches the finest
+// level to the exact matrix on the coarse pose and on its reflection through
+// the centroid, which keeps the radius the bound is computed for. A fourth
+// element of ones checks that the truncated rows still sum to one.
+int checkApproximation( char const * msg, char const * shape, int levels, float maxError,
+                        Scheme scheme=kCatmark ) {
+
+    static int const numElems = 4;
+
+    printf("- %s (scheme=%d, maxError=%g)\n", msg, scheme, maxError);
+
+    std::vector<float> coarseverts, refverts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh(),
+                        * reference = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, refverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    int count=0;
+    if (not omesh->SetMaxApproximationError(maxError)) {
+        printf("// the kernel can't approximate\n");
+        count++;
+    }
+
+    int numCoarse = (int)coarseverts.size()/3;
+
+    float center[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i=0; i<numCoarse; ++i)
+        for (int j=0; j<3; ++j)
+            center[j] += coarseverts[i*3+j] / (float)numCoarse;
+
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels);
+
+    OpenSubdiv::OsdCpuVertexBuffer
+        * vb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(numElems)),
+        * rvb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(reference->InitializeVertexBuffer(numElems));
+
+    float maxDistance = 0.0f, maxSumError = 0.0f;
+    for (int pose=0; pose<2; ++pose) {
+
+        std::vector<float> coarse(numCoarse*numElems, 1.0f);
+        for (int i=0; i<numCoarse; ++i)
+            for (int j=0; j<3; ++j)
+                coarse[i*numElems+j] = pose==0 ? coarseverts[i*3+j] : 2.0f*center[j] - coarseverts[i*3+j];
+
+        vb->UpdateData( & coarse[0], numCoarse );
+        omesh->Subdivide( vb, NULL );
+        omesh->Synchronize();
+
+        rvb->UpdateData( & coarse[0], numCoarse );
+        reference->Subdivide( rvb, NULL );
+        reference->Synchronize();
+
+        for (int i=first; i<last; ++i) {
+            float const * a = vb->GetCpuBuffer() + i*numElems,
+                        * b = rvb->GetCpuBuffer() + i*numElems;
+            float d = sqrtf( (a[0]-b[0])*(a[0]-b[0]) + (a[1]-b[1])*(a[1]-b[1]) + (a[2]-b[2])*(a[2]-b[2]) );
+            maxDistance = std::max(maxDistance, d);
+            maxSumError = std::max(maxSumError, fabsf(a[3]-1.0f));
+        }
+    }
+
+    if (omesh->GetApproximationSavings()==0) {
+        printf("// no nonzero was dropped\n");
+        count++;
+    }
+    if (omesh->GetApproximationError() > maxError) {
+        printf("// the approximation reports an error of %g\n", omesh->GetApproximationError());
+        count++;
+    }
+    if (maxDistance > maxError*(1.0f+PRECISION)) {
+        printf("// a vertex moved by %g\n", maxDistance);
+        count++;
+    }
+    if (maxSumError > PRECISION) {
+        printf("// a row sums to 1 +/- %g\n", maxSumError);
+        count++;
+    }
+
+    delete vb;
+    delete rvb;
+    delete omesh;
+    delete reference;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Refines a matrix kernel mesh building its matrix in the background, a new
+// pose each frame, while the table kernel stands in for it and once it has
+// swapped in the matrix, and matches the finest level of every frame to the
+// table kernel
+int checkBackgroundBuild( char const * msg, char const * shape, int levels, Scheme scheme=kCatmark ) {
+
+    static int const maxFrames = 10000;
+
+    printf("- %s (scheme=%d)\n", msg, scheme);
+
+    std::vector<float> coarseverts, refverts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh(),
+                        * reference = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, refverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kCPU, /* exact= */ 0);
+
+    int count=0;
+    if (not omesh->SetBackgroundBuild(true)) {
+        printf("// the mesh can't build its matrix in the background\n");
+        count++;
+    }
+
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels),
+        numCoarse = (int)coarseverts.size()/3;
+
+    OpenSubdiv::OsdCpuVertexBuffer
+        * vb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3)),
+        * rvb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(reference->InitializeVertexBuffer(3));
+
+    // frames run until two of them used the matrix
+    int framesDuring = 0, framesAfter = 0;
+    for (int frame=0; frame<maxFrames and framesAfter<2 and count==0; ++frame) {
+
+        std::vector<float> pose(coarseverts);
+        for (int i=0; i<(int)pose.size(); ++i)
+            pose[i] *= 1.0f + 0.01f*(float)(frame % 100);
+
+        bool pending = omesh->IsBuildPending();
+
+        vb->UpdateData( & pose[0], numCoarse );
+        omesh->Subdivide( vb, NULL );
+        omesh->Synchronize();
+
+        rvb->UpdateData( & pose[0], numCoarse );
+        reference->Subdivide( rvb, NULL );
+        reference->Synchronize();
+
+        std::vector<float> a( rvb->GetCpuBuffer() + first*3, rvb->GetCpuBuffer() + last*3 ),
+                           b( vb->GetCpuBuffer() + first*3, vb->GetCpuBuffer() + last*3 );
+        int failures = compareLevel( a, b, levels );
+        if (failures)
+            printf("// frame %d fails %s the build\n", frame, omesh->IsBuildPending() ? "during" : "after");
+        count += failures;
+
+        // the first frame starts the build
+        if (omesh->IsBuildPending())
+            framesDuring++;
+        else if (pending or framesAfter>0)
+            framesAfter++;
+
+#ifndef _WIN32
+        if (omesh->IsBuildPending())
+            usleep(1000);
+#endif
+    }
+
+    if (count==0 and (framesDuring==0 or framesAfter<2)) {
+        printf("// %d frames during the build and %d after it\n", framesDuring, framesAfter);
+        count++;
+    }
+
+    delete vb;
+    delete rvb;
+    delete omesh;
+    delete reference;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Returns the finest level of a mesh created without sharing, refined from the
+// given coarse vertices
+static std::vector<float> refineUnshared( char const * shape, int levels, int kernel, Scheme scheme,
+                                          std::vector<float> const & coarseverts ) {
+
+    std::vector<float> verts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, verts), levels, kernel, /* exact= */ 0);
+
+    std::vector<float> result = refineLevel(omesh, coarseverts, levels);
+
+    delete omesh;
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// Creates two shared meshes of a shape, which must share their tables and
+// dispatcher, and the matrix the first one builds. Each mesh refines
+// numInstances poses of an instance buffer, and every instance must match a
+// mesh of its own created without sharing.
+int checkSharedMesh( char const * msg, char const * shape, int levels, int kernel, int numInstances,
+                     Scheme scheme=kCatmark ) {
+
+    printf("- %s (scheme=%d, kernel=%d, instances=%d)\n", msg, scheme, kernel, numInstances);
+
+    OpenSubdiv::OsdTopologyRegistry & registry = OpenSubdiv::OsdTopologyRegistry::GetInstance();
+
+    int numTopologies = registry.GetNumTopologies();
+
+    std::vector<float> coarseverts, otherverts;
+
+    OpenSubdiv::OsdMesh * meshes[2] = { new OpenSubdiv::OsdMesh(), new OpenSubdiv::OsdMesh() };
+
+    meshes[0]->CreateShared(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels, kernel, /* exact= */ 0);
+    meshes[1]->CreateShared(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, otherverts), levels, kernel, /* exact= */ 0);
+
+    int count=0;
+    if (not meshes[0]->IsShared() or not meshes[1]->IsShared() or
+        meshes[0]->GetFarMesh()!=meshes[1]->GetFarMesh() or
+        meshes[0]->GetFarMesh()->GetDispatcher()!=meshes[1]->GetFarMesh()->GetDispatcher()) {
+        printf("// the meshes don't share their tables and dispatcher\n");
+        count++;
+    }
+    if (registry.GetNumTopologies()!=numTopologies+1) {
+        printf("// %d topologies registered instead of %d\n", registry.GetNumTopologies(), numTopologies+1);
+        count++;
+    }
+
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        meshes[0]->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels),
+        numCoarse = (int)coarseverts.size()/3,
+        numElems = 3*numInstances;
+
+    for (int i=0; i<2 and count==0; ++i) {
+
+        // the first mesh builds the matrix, the second one finds it
+        bool ready = meshes[i]->GetFarMesh()->GetDispatcher()->MatrixReady();
+        if (kernel==(int)OpenSubdiv::OsdKernelDispatcher::kMKL and ready!=(i==1)) {
+            printf("// mesh %d %s a matrix\n", i, ready ? "finds" : "does not find");
+            count++;
+        }
+
+        std::vector<std::vector<float> > poses(numInstances);
+        std::vector<float> coarse(numCoarse*numElems);
+        for (int k=0; k<numInstances; ++k) {
+            poses[k] = coarseverts;
+            for (int j=0; j<(int)poses[k].size(); ++j)
+                poses[k][j] *= 1.0f + 0.25f*(float)(i*numInstances+k);
+            for (int v=0; v<numCoarse; ++v)
+                for (int j=0; j<3; ++j)
+                    coarse[v*numElems+k*3+j] = poses[k][v*3+j];
+        }
+
+        OpenSubdiv::OsdCpuVertexBuffer * vb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(
+            meshes[i]->InitializeInstanceBuffer(3, numInstances));
+
+        vb->UpdateData( & coarse[0], numCoarse );
+        meshes[i]->Subdivide( vb, NULL );
+        meshes[i]->Synchronize();
+
+        for (int k=0; k<numInstances; ++k) {
+            std::vector<float> instance;
+            for (int v=first; v<last; ++v)
+                instance.insert(instance.end(), vb->GetCpuBuffer() + v*numElems + k*3,
+                                                vb->GetCpuBuffer() + v*numElems + k*3 + 3);
+
+            int failures = compareLevel( refineUnshared(shape, levels, kernel, scheme, poses[k]), instance, levels );
+            if (failures)
+                printf("// instance %d of mesh %d fails\n", k, i);
+            count += failures;
+        }
+
+        delete vb;
+    }
+
+    delete meshes[0];
+    delete meshes[1];
+
+    if (registry.GetNumTopologies()!=numTopologies) {
+        printf("// the topology is still registered\n");
+        count++;
+    }
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Applies blendshape weights through the precomputed refined deltas, first in
+// full and then only where the weights changed, and matches the finest level
+// to the refinement of the coarse base plus the weighted coarse deltas
+int checkBlendShapes( char const * msg, char const * shape, int levels, int kernel, Scheme scheme=kCatmark ) {
+
+    static int const numShapes = 3,
+                     numFrames = 6;
+
+    // weights of each frame, repeated, changed one at a time, and zeroed
+    static float const weights[numFrames][numShapes] = { { 0.5f,  0.0f,  1.0f },
+                                                         { 0.5f,  0.0f,  1.0f },
+                                                         { 0.5f,  0.25f, 1.0f },
+                                                         { 0.0f,  0.25f, -1.0f },
+                                                         { 0.0f,  0.0f,  0.0f },
+                                                         { 0.75f, 0.5f,  0.25f } };
+
+    printf("- %s (scheme=%d, kernel=%d)\n", msg, scheme, kernel);
+
+    std::vector<float> coarseverts, refverts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh(),
+                        * reference = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  kernel, /* exact= */ 0);
+
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, refverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kCPU, /* exact= */ 0);
+
+    int numCoarse = (int)coarseverts.size()/3;
+
+    // each blendshape moves a few neighboring coarse vertices, overlapping the next one
+    std::vector<int> vertices[numShapes];
+    std::vector<float> deltas[numShapes];
+    unsigned int seed = 1;
+    for (int i=0; i<numShapes; ++i) {
+        for (int j=0; j<3; ++j) {
+            vertices[i].push_back((2*i+j) % numCoarse);
+            for (int k=0; k<3; ++k) {
+                seed = seed*1103515245u + 12345u;
+                deltas[i].push_back((float)((seed>>16) & 0x7fff) / 32767.0f - 0.5f);
+            }
+        }
+        omesh->AddBlendShape(3, (int)vertices[i].size(), &vertices[i][0], &deltas[i][0]);
+    }
+
+    // the precomputation refines outside of the frames kAUTO accounts for
+    omesh->SetExpectedFrames(1000000);
+    int startKernel = omesh->GetKernel();
+
+    int count=0;
+    if (not omesh->PrepareBlendShapes(&coarseverts[0], 3)) {
+        printf("// the blendshapes can't be prepared\n");
+        count++;
+    }
+
+    if (omesh->GetKernel() != startKernel) {
+        printf("// preparing the blendshapes switched to kernel %d\n", omesh->GetKernel());
+        count++;
+    }
+
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels);
+
+    OpenSubdiv::OsdCpuVertexBuffer * vb =
+        dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3));
+
+    // the last frame follows a refinement of the buffer, and rewrites it whole
+    for (int frame=0; frame<numFrames and count==0; ++frame) {
+
+        if (frame == numFrames-1) {
+            vb->UpdateData( & coarseverts[0], numCoarse );
+            omesh->Subdivide( vb, NULL );
+            omesh->Synchronize();
+            omesh->InvalidateBlendShapes();
+        }
+
+        omesh->ApplyBlendShapes( vb, weights[frame] );
+
+        std::vector<float> pose(refverts);
+        for (int i=0; i<numShapes; ++i)
+            for (int j=0; j<(int)vertices[i].size(); ++j)
+                for (int k=0; k<3; ++k)
+                    pose[vertices[i][j]*3+k] += weights[frame][i] * deltas[i][j*3+k];
+
+        std::vector<float> b( vb->GetCpuBuffer() + first*3, vb->GetCpuBuffer() + last*3 );
+        int failures = compareLevel( refineLevel(reference, pose, levels), b, levels );
+        if (failures)
+            printf("// frame %d fails\n", frame);
+        count += failures;
+    }
+
+    delete vb;
+    delete omesh;
+    delete reference;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Poses a skinning rig with the refined bone contributions precomputed, and
+// with whichever path the mesh picks, and matches the finest level to the
+// refinement of the coarse vertices skinned by the test
+int checkSkinning( char const * msg, char const * shape, int levels, int kernel, Scheme scheme=kCatmark ) {
+
+    static int const numBones = 3,
+                     numFrames = 3;
+
+    printf("- %s (scheme=%d, kernel=%d)\n", msg, scheme, kernel);
+
+    std::vector<float> coarseverts, restverts, refverts;
+
+    OpenSubdiv::OsdMesh * precomputed = new OpenSubdiv::OsdMesh(),
+                        * picked = new OpenSubdiv::OsdMesh(),
+                        * reference = new OpenSubdiv::OsdMesh();
+
+    precomputed->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                        kernel, /* exact= */ 0);
+
+    picked->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, restverts), levels,
+                   kernel, /* exact= */ 0);
+
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, refverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kCPU, /* exact= */ 0);
+
+    int numCoarse = (int)coarseverts.size()/3;
+
+    // each coarse vertex follows two bones, or one for every third vertex
+    std::vector<int> offsets(1, 0), bones;
+    std::vector<float> weights;
+    for (int v=0; v<numCoarse; ++v) {
+        bones.push_back(v % numBones);
+        if (v % 3 == 0) {
+            weights.push_back(1.0f);
+        } else {
+            bones.push_back((v+1) % numBones);
+            weights.push_back(0.7f);
+            weights.push_back(0.3f);
+        }
+        offsets.push_back((int)bones.size());
+    }
+
+    int count=0;
+    if (not precomputed->PrepareSkinning(numBones, &coarseverts[0], &offsets[0], &bones[0],
+                                         &weights[0], /* force= */ true)) {
+        printf("// the forced precomputation isn't kept\n");
+        count++;
+    }
+
+    // the precomputation refines outside of the frames kAUTO accounts for
+    picked->SetExpectedFrames(1000000);
+    int startKernel = picked->GetKernel();
+
+    picked->PrepareSkinning(numBones, &restverts[0], &offsets[0], &bones[0], &weights[0]);
+
+    if (picked->GetKernel() != startKernel) {
+        printf("// preparing the skinning switched to kernel %d\n", picked->GetKernel());
+        count++;
+    }
+
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        precomputed->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels);
+
+    OpenSubdiv::OsdCpuVertexBuffer
+        * vb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(precomputed->InitializeVertexBuffer(3)),
+        * pvb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(picked->InitializeVertexBuffer(3));
+
+    for (int frame=0; frame<numFrames and count==0; ++frame) {
+
+        // bone b rotates about z by an angle growing with the frame, and translates
+        float boneMatrices[numBones*12];
+        for (int b=0; b<numBones; ++b) {
+            float angle = 0.3f * (float)((frame+1)*(b+1)),
+                  c = cosf(angle), s = sinf(angle),
+                  T[12] = { c,   -s,   0.0f, 0.1f*(float)b,
+                            s,    c,   0.0f, -0.2f*(float)frame,
+                            0.0f, 0.0f, 1.0f, 0.05f*(float)(b+frame) };
+            std::copy(T, T+12, &boneMatrices[12*b]);
+        }
+
+        std::vector<float> pose(refverts.size(), 0.0f);
+        for (int v=0; v<numCoarse; ++v) {
+            const float * x = &refverts[3*v];
+            for (int j=offsets[v]; j<offsets[v+1]; ++j) {
+                const float * T = &boneMatrices[12*bones[j]];
+                for (int k=0; k<3; ++k)
+                    pose[3*v+k] += weights[j] * (T[4*k]*x[0] + T[4*k+1]*x[1] + T[4*k+2]*x[2] + T[4*k+3]);
+            }
+        }
+        std::vector<float> a = refineLevel(reference, pose, levels);
+
+        precomputed->Skin( vb, boneMatrices );
+        precomputed->Synchronize();
+
+        picked->Skin( pvb, boneMatrices );
+        picked->Synchronize();
+
+        std::vector<float> b( vb->GetCpuBuffer() + first*3, vb->GetCpuBuffer() + last*3 ),
+                           p( pvb->GetCpuBuffer() + first*3, pvb->GetCpuBuffer() + last*3 );
+
+        int failures = compareLevel( a, b, levels );
+        if (failures)
+            printf("// frame %d fails with the precomputation\n", frame);
+        count += failures;
+
+        failures = compareLevel( a, p, levels );
+        if (failures)
+            printf("// frame %d fails %s the precomputation\n", frame,
+                   picked->IsSkinningPrecomputed() ? "with" : "without");
+        count += failures;
+    }
+
+    delete vb;
+    delete pvb;
+    delete precomputed;
+    delete picked;
+    delete reference;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Refines frames with a kAUTO mesh told to expect the given number of frames,
+// matches each one to the table kernel, and checks whether the mesh moved to
+// the matrix kernel. The decision only depends on the predicted matrix size
+// relative to the tables, not on the measured times.
+int checkAutoKernel( char const * msg, char const * shape, int levels, int expectedFrames,
+                     bool expectMatrix, Scheme scheme=kCatmark ) {
+
+    static int const numFrames = 10;
+
+    printf("- %s (scheme=%d, frames=%d)\n", msg, scheme, expectedFrames);
+
+    std::vector<float> coarseverts, refverts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh(),
+                        * reference = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  (int)OpenSubdiv::OsdKernelDispatcher::kAUTO, /* exact= */ 0);
+
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, refverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kCPU, /* exact= */ 0);
+
+    omesh->SetExpectedFrames(expectedFrames);
+
+    int count=0;
+    if (omesh->GetKernel() == (int)OpenSubdiv::OsdKernelDispatcher::kMKL) {
+        printf("// the mesh starts on the matrix kernel\n");
+        count++;
+    }
+
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels),
+        numCoarse = (int)coarseverts.size()/3;
+
+    OpenSubdiv::OsdCpuVertexBuffer
+        * vb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(3)),
+        * rvb = dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(reference->InitializeVertexBuffer(3));
+
+    // frames keep going past the expected ones, as a caller may
+    int switchFrame = -1;
+    for (int frame=0; frame<numFrames and count==0; ++frame) {
+
+        std::vector<float> pose(coarseverts);
+        for (int i=0; i<(int)pose.size(); ++i)
+            pose[i] *= 1.0f + 0.1f*(float)frame;
+
+        vb->UpdateData( & pose[0], numCoarse );
+        omesh->Subdivide( vb, NULL );
+        omesh->Synchronize();
+
+        rvb->UpdateData( & pose[0], numCoarse );
+        reference->Subdivide( rvb, NULL );
+        reference->Synchronize();
+
+        std::vector<float> a( rvb->GetCpuBuffer() + first*3, rvb->GetCpuBuffer() + last*3 ),
+                           b( vb->GetCpuBuffer() + first*3, vb->GetCpuBuffer() + last*3 );
+        int failures = compareLevel( a, b, levels );
+        if (failures)
+            printf("// frame %d fails on kernel %d\n", frame, omesh->GetKernel());
+        count += failures;
+
+        if (switchFrame < 0 and omesh->GetKernel() == (int)OpenSubdiv::OsdKernelDispatcher::kMKL)
+            switchFrame = frame;
+    }
+
+    if (count==0 and (switchFrame >= 0) != expectMatrix) {
+        if (expectMatrix)
+            printf("// the mesh stayed on kernel %d\n", omesh->GetKernel());
+        else
+            printf("// the mesh moved to the matrix kernel at frame %d\n", switchFrame);
+        count++;
+    }
+
+    delete vb;
+    delete rvb;
+    delete omesh;
+    delete reference;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Refines a range of the elements of each vertex after a full refinement, and
+// matches the finest level to a full refinement of the same data : the other
+// elements must be left as the first Subdivide() wrote them
+int checkElementRange( char const * msg, char const * shape, int levels, int firstElement,
+                       int numElements, Scheme scheme=kCatmark ) {
+
+    static int const numElems = 6;
+
+    printf("- %s (scheme=%d, elements=%d..%d)\n", msg, scheme, firstElement, firstElement+numElements-1);
+
+    std::vector<float> coarseverts;
+
+    OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh();
+
+    omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                  (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    int numCoarse = (int)coarseverts.size()/3;
+
+    // the elements are the position and its square
+    std::vector<float> coarse(numCoarse*numElems);
+    for (int i=0; i<numCoarse; ++i)
+        for (int j=0; j<3; ++j) {
+            coarse[i*numElems+j] = coarseverts[i*3+j];
+            coarse[i*numElems+3+j] = coarseverts[i*3+j]*coarseverts[i*3+j];
+        }
+
+    OpenSubdiv::OsdCpuVertexBuffer * vb =
+        dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(omesh->InitializeVertexBuffer(numElems));
+
+    vb->UpdateData( & coarse[0], numCoarse );
+    omesh->Subdivide( vb, NULL );
+    omesh->Synchronize();
+
+    // the range moves, and the other elements are scrambled in the buffer
+    // only : refining them too would show in the result
+    std::vector<float> scrambled(coarse.size());
+    for (int i=0; i<numCoarse; ++i)
+        for (int j=0; j<numElems; ++j) {
+            if (j>=firstElement and j<firstElement+numElements) {
+                coarse[i*numElems+j] += 0.5f + 0.25f*(float)j;
+                scrambled[i*numElems+j] = coarse[i*numElems+j];
+            } else
+                scrambled[i*numElems+j] = -2.0f*coarse[i*numElems+j] + (float)i;
+        }
+
+    vb->UpdateData( & scrambled[0], numCoarse );
+    omesh->Subdivide( vb, firstElement, numElements );
+    omesh->Synchronize();
+
+    OpenSubdiv::OsdMesh * full = new OpenSubdiv::OsdMesh();
+
+    std::vector<float> freshverts;
+    full->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, freshverts), levels,
+                 (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    OpenSubdiv::OsdCpuVertexBuffer * fvb =
+        dynamic_cast<OpenSubdiv::OsdCpuVertexBuffer *>(full->InitializeVertexBuffer(numElems));
+
+    fvb->UpdateData( & coarse[0], numCoarse );
+    full->Subdivide( fvb, NULL );
+    full->Synchronize();
+
+    // the matrix kernels only write the finest level
+    OpenSubdiv::FarSubdivisionTables<OpenSubdiv::OsdVertex> const * tables =
+        omesh->GetFarMesh()->GetSubdivision();
+
+    int first = tables->GetFirstVertexOffset(levels),
+        last = first + tables->GetNumVertices(levels);
+
+    int count=0;
+    for (int i=first*numElems; i<last*numElems; ++i) {
+        if (fabsf(vb->GetCpuBuffer()[i] - fvb->GetCpuBuffer()[i]) > PRECISION) {
+            printf("// vertex %d element %d fails : %.10f instead of %.10f\n", i/numElems, i%numElems,
+                   vb->GetCpuBuffer()[i], fvb->GetCpuBuffer()[i]);
+            count++;
+            break;
+        }
+    }
+
+    delete vb;
+    delete fvb;
+    delete omesh;
+    delete full;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Returns a one-based m x n CSR matrix with up to maxRowNnz random columns per
+// row, and rows summing to 1 like subdivision weights
+static OpenSubdiv::CpuCsrMatrix * randomMatrix( int m, int n, int maxRowNnz, unsigned int & seed ) {
+
+    std::vector<int> rows(1, 1), cols;
+    std::vector<float> vals;
+
+    for (int i=0; i<m; ++i) {
+        seed = seed*1103515245u + 12345u;
+        int rowNnz = 1 + (int)((seed >> 16) % (unsigned int)maxRowNnz);
+
+        std::vector<int> row;
+        for (int j=0; j<rowNnz; ++j) {
+            seed = seed*1103515245u + 12345u;
+            int col = (int)((seed >> 16) % (unsigned int)n);
+            if (std::find(row.begin(), row.end(), col)==row.end())
+                row.push_back(col);
+        }
+        std::sort(row.begin(), row.end());
+
+        float sum = 0.0f;
+        for (int j=0; j<(int)row.size(); ++j) {
+            seed = seed*1103515245u + 12345u;
+            vals.push_back( 0.1f + (float)((seed >> 16) % 1000) / 1000.0f );
+            sum += vals.back();
+            cols.push_back(row[j]+1);
+        }
+        for (int j=(int)vals.size()-(int)row.size(); j<(int)vals.size(); ++j)
+            vals[j] /= sum;
+        rows.push_back((int)cols.size()+1);
+    }
+
+    OpenSubdiv::CpuCsrMatrix * A = new OpenSubdiv::CpuCsrMatrix(m, n, (int)cols.size());
+    std::copy(rows.begin(), rows.end(), A->rows);
+    std::copy(cols.begin(), cols.end(), A->cols);
+    std::copy(vals.begin(), vals.end(), A->vals);
+    return A;
+}
+
+//------------------------------------------------------------------------------
+// Returns the number of rows of two one-based CSR matrices that differ by
+// more than tolerance in any column
+static int compareMatrices( char const * what, OpenSubdiv::CpuCsrMatrix const * a,
+                            OpenSubdiv::CpuCsrMatrix const * b, float tolerance=PRECISION ) {
+
+    if (a->m!=b->m or a->n!=b->n) {
+        printf("// %s : %dx%d matrix instead of %dx%d\n", what, b->m, b->n, a->m, a->n);
+        return 1;
+    }
+
+    int count=0;
+    std::vector<float> row(a->n, 0.0f);
+    for (int i=0; i<a->m; ++i) {
+        for (int p=a->rows[i]-1; p<a->rows[i+1]-1; ++p)
+            row[a->cols[p]-1] += a->vals[p];
+        for (int p=b->rows[i]-1; p<b->rows[i+1]-1; ++p)
+            row[b->cols[p]-1] -= b->vals[p];
+
+        bool differs = false;
+        for (int p=a->rows[i]-1; p<a->rows[i+1]-1; ++p)
+            differs |= fabsf(row[a->cols[p]-1]) > tolerance;
+        for (int p=b->rows[i]-1; p<b->rows[i+1]-1; ++p) {
+            differs |= fabsf(row[b->cols[p]-1]) > tolerance;
+            row[b->cols[p]-1] = 0.0f;
+        }
+        for (int p=a->rows[i]-1; p<a->rows[i+1]-1; ++p)
+            row[a->cols[p]-1] = 0.0f;
+
+        if (differs) {
+            if (count==0)
+                printf("// %s : row %d differs\n", what, i);
+            count++;
+        }
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Returns an m x n stage with the rows of a random matrix, a third of which
+// are turned into copy rows of a random input
+static OpenSubdiv::SpMVStage * randomStage( int m, int n, int maxRowNnz, unsigned int & seed ) {
+
+    OpenSubdiv::CpuCsrMatrix * A = randomMatrix(m, n, maxRowNnz, seed);
+
+    OpenSubdiv::SpMVStage * S = new OpenSubdiv::SpMVStage(m, n);
+    for (int i=0; i<m; ++i) {
+        seed = seed*1103515245u + 12345u;
+        if ((seed >> 16) % 3 == 0) {
+            seed = seed*1103515245u + 12345u;
+            S->copyOf[i] = (int)((seed >> 16) % (unsigned int)n);
+        } else {
+            for (int p=A->rows[i]-1; p<A->rows[i+1]-1; ++p) {
+                S->cols.push_back(A->cols[p]-1);
+                S->vals.push_back(A->vals[p]);
+            }
+        }
+        S->rowPtr[i+1] = (int)S->cols.size();
+    }
+
+    delete A;
+    return S;
+}
+
+//------------------------------------------------------------------------------
+// Returns a stage as a one-based CSR matrix, with its copy rows made explicit
+static OpenSubdiv::CpuCsrMatrix * explicitStage( OpenSubdiv::SpMVStage const & S ) {
+
+    std::vector<int> rows(1, 1), cols;
+    std::vector<float> vals;
+
+    for (int i=0; i<S.m; ++i) {
+        if (S.copyOf[i]>=0) {
+            cols.push_back(S.copyOf[i]+1);
+            vals.push_back(1.0f);
+        }
+        for (int p=S.rowPtr[i]; p<S.rowPtr[i+1]; ++p) {
+            cols.push_back(S.cols[p]+1);
+            vals.push_back(S.vals[p]);
+        }
+        rows.push_back((int)cols.size()+1);
+    }
+
+    OpenSubdiv::CpuCsrMatrix * A = new OpenSubdiv::CpuCsrMatrix(S.m, S.n, (int)cols.size());
+    std::copy(rows.begin(), rows.end(), A->rows);
+    std::copy(cols.begin(), cols.end(), A->cols);
+    std::copy(vals.begin(), vals.end(), A->vals);
+    return A;
+}
+
+//------------------------------------------------------------------------------
+// Multiplies a chain of three stages with implicit copy rows, and matches the
+// products to the products of the same matrices with the copy rows made
+// explicit. A row copying a copy row must stay a copy row.
+int checkStageProducts( char const * msg, int numThreads ) {
+
+    printf("- %s (threads=%d)\n", msg, numThreads);
+
+    unsigned int seed = 1;
+    OpenSubdiv::SpMVStage * a = randomStage(3000, 2000, 6, seed),
+                          * b = randomStage(2000, 1500, 6, seed),
+                          * c = randomStage(1500, 800, 6, seed);
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(numThreads);
+#endif
+
+    OpenSubdiv::SpMVStage * ab = a->Multiply(*b),
+                          * abc = ab->Multiply(*c);
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+    int count=0;
+    for (int i=0; i<a->m; ++i) {
+        bool copies = a->copyOf[i]>=0 and b->copyOf[a->copyOf[i]]>=0;
+        if (copies != (ab->copyOf[i]>=0)) {
+            if (count==0)
+                printf("// row %d of the product %s a copy row\n", i, copies ? "is not" : "is");
+            count++;
+        }
+    }
+
+    OpenSubdiv::CpuCsrMatrix * ea = explicitStage(*a),
+                             * eb = explicitStage(*b),
+                             * ec = explicitStage(*c),
+                             * eab = ea->gemm(eb),
+                             * eabc = eab->gemm(ec),
+                             * sab = explicitStage(*ab),
+                             * sabc = explicitStage(*abc);
+
+    count += compareMatrices("product of two stages", eab, sab);
+    count += compareMatrices("product of three stages", eabc, sabc);
+
+    delete a; delete b; delete c; delete ab; delete abc;
+    delete ea; delete eb; delete ec; delete eab; delete eabc; delete sab; delete sabc;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Exposes the reduction of a matrix chain of the matrix kernel
+class ChainDispatcher : public OpenSubdiv::OsdMklKernelDispatcher {
+public:
+    ChainDispatcher() : OpenSubdiv::OsdMklKernelDispatcher(1) { }
+
+    using OpenSubdiv::OsdMklKernelDispatcher::composeChain;
+};
+
+//------------------------------------------------------------------------------
+// Reduces a chain of random matrices as a tree, with the sibling subtrees
+// running on concurrent thread teams, and matches the result to the product
+// of the chain taken from left to right
+int checkComposeChain( char const * msg, int numThreads ) {
+
+    // dims[i] x dims[i+1] matrices, shrinking and growing so that the chain
+    // search does not pick a plain left or right fold
+    static int const dims[] = { 3000, 800, 1200, 300, 900, 200, 250, 60 };
+    static int const k = (int)(sizeof(dims)/sizeof(dims[0]))-1;
+
+    printf("- %s (threads=%d)\n", msg, numThreads);
+
+    unsigned int seed = 1;
+    std::vector<OpenSubdiv::CpuCsrMatrix *> chain, reference;
+    for (int i=0; i<k; ++i)
+        chain.push_back( randomMatrix(dims[i], dims[i+1], 6, seed) );
+
+    seed = 1;
+    for (int i=0; i<k; ++i)
+        reference.push_back( randomMatrix(dims[i], dims[i+1], 6, seed) );
+
+    OpenSubdiv::CpuCsrMatrix * product = reference[0];
+    for (int i=1; i<k; ++i) {
+        OpenSubdiv::CpuCsrMatrix * next = product->gemm(reference[i]);
+        delete product;
+        delete reference[i];
+        product = next;
+    }
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(numThreads);
+#endif
+
+    ChainDispatcher dispatcher;
+    OpenSubdiv::CpuCsrMatrix * composed = dispatcher.composeChain(chain);
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+    int count = compareMatrices("composed chain", product, composed);
+    if (not chain.empty()) {
+        printf("// the chain was not emptied\n");
+        count++;
+    }
+
+    delete product;
+    delete composed;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+#ifndef _WIN32
+//------------------------------------------------------------------------------
+// Streams the matrix of a mesh from an operator file, once as written by the
+// first Subdivide() and once as found by a second mesh, and matches both to
+// the matrix held in memory
+int checkStreamOperators( char const * msg, char const * shape, int levels, Scheme scheme=kCatmark ) {
+
+    printf("- %s (scheme=%d)\n", msg, scheme);
+
+    char path[] = "/tmp/osd_regression_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("// can't create an operator file\n");
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    std::vector<float> coarseverts;
+
+    OpenSubdiv::OsdMesh * reference = new OpenSubdiv::OsdMesh();
+    reference->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+    std::vector<float> expected = refineLevel(reference, coarseverts, levels);
+    delete reference;
+
+    int count=0;
+    for (int pass=0; pass<2; ++pass) {
+
+        OpenSubdiv::OsdMesh * omesh = new OpenSubdiv::OsdMesh();
+        omesh->Create(simpleHbr<OpenSubdiv::OsdVertex>(shape, scheme, coarseverts), levels,
+                      (int)OpenSubdiv::OsdKernelDispatcher::kMKL, /* exact= */ 0);
+
+        if (not omesh->StreamOperators(path)) {
+            printf("// StreamOperators fails\n");
+            count++;
+        } else {
+            count += compareLevel( expected, refineLevel(omesh, coarseverts, levels), levels );
+
+            if (access(path, R_OK)!=0) {
+                printf("// the operator file was not written\n");
+                count++;
+            }
+        }
+
+        delete omesh;
+    }
+
+    unlink(path);
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Returns a view of a one-based CSR matrix as a shared matrix
+static OpenSubdiv::OsdSharedOperators::Matrix sharedView( OpenSubdiv::CpuCsrMatrix const * A ) {
+
+    OpenSubdiv::OsdSharedOperators::Matrix B;
+    B.m = A->m;
+    B.n = A->n;
+    B.nve = A->nve;
+    B.nnz = A->nnz;
+    B.offsetSize = sizeof(int);
+    B.rows = A->rows;
+    B.cols = A->cols;
+    B.vals = A->vals;
+    return B;
+}
+
+//------------------------------------------------------------------------------
+// True if a shared matrix holds the arrays of A
+static bool sameMatrix( OpenSubdiv::OsdSharedOperators::Matrix const & B, OpenSubdiv::CpuCsrMatrix const * A ) {
+
+    return B.m==A->m and B.n==A->n and B.nnz==A->nnz and B.offsetSize==(int)sizeof(int) and
+           memcmp(B.rows, A->rows, (A->m+1)*sizeof(int))==0 and
+           memcmp(B.cols, A->cols, A->nnz*sizeof(int))==0 and
+           memcmp(B.vals, A->vals, A->nnz*sizeof(float))==0;
+}
+
+//------------------------------------------------------------------------------
+// True if the shared memory segment of key exists
+static bool sharedSegmentExists( unsigned long long key ) {
+
+    char name[32];
+    sprintf(name, "/osd_op_%016llx", key);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    close(fd);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Publishes a pair of matrices, attaches to them from a second process and
+// detaches both. The segment must outlive the first detach only, and its slot
+// must take the key again, which the second pass checks. Meshes of a process
+// share the dispatcher of their topology, so the second mesh of a topology is
+// always in another process. The process is forked before the publication, as
+// it would inherit the mapping otherwise, and runs no OpenMP code, which
+// libgomp does not support after a fork.
+int checkSharedOperators( char const * msg ) {
+
+    printf("- %s\n", msg);
+
+    OpenSubdiv::OsdSharedOperators * shared = OpenSubdiv::OsdSharedOperators::GetInstance();
+    if (not shared) {
+        printf("// shared memory is not available\n");
+        return 1;
+    }
+
+    // a key of this process, so that concurrent runs don't collide
+    unsigned long long key = 0x05d0000000000000ULL + (unsigned long long)getpid();
+
+    std::vector<unsigned int> signature;
+    signature.push_back(3);
+    signature.push_back(14);
+
+    unsigned int seed = 5;
+    OpenSubdiv::CpuCsrMatrix * A = randomMatrix(500, 200, 6, seed),
+                             * V = randomMatrix(500, 200, 3, seed);
+
+    int count=0;
+    for (int pass=0; pass<2 and count==0; ++pass) {
+
+        int ready[2];
+        if (pipe(ready) != 0) {
+            printf("// cannot create a pipe\n");
+            count++;
+            break;
+        }
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            // the second process waits for the publication
+            char c;
+            close(ready[1]);
+            if (read(ready[0], &c, 1) != 1)
+                _exit(1);
+
+            int offset = 0;
+            OpenSubdiv::OsdSharedOperators::Matrix vertex, varying;
+            if (not shared->Attach(key, signature, sizeof(int), &offset, &vertex, &varying))
+                _exit(2);
+            bool same = offset==42 and sameMatrix(vertex, A) and sameMatrix(varying, V);
+            shared->Detach(key);
+            _exit(same ? 0 : 3);
+        }
+        close(ready[0]);
+
+        OpenSubdiv::OsdSharedOperators::Matrix vertex = sharedView(A),
+                                               varying = sharedView(V);
+
+        if (not shared->Publish(key, signature, 42, &vertex, &varying)) {
+            printf("// pass %d fails to publish\n", pass);
+            count++;
+        } else if (vertex.rows==A->rows or not sameMatrix(vertex, A) or not sameMatrix(varying, V)) {
+            printf("// pass %d does not map the published matrices back\n", pass);
+            count++;
+        }
+
+        OpenSubdiv::OsdSharedOperators::Matrix again = sharedView(A);
+        if (shared->Publish(key, signature, 42, &again, NULL)) {
+            printf("// pass %d publishes the key twice\n", pass);
+            count++;
+        }
+
+        if (write(ready[1], "p", 1) != 1)
+            count++;
+        close(ready[1]);
+
+        int status = -1;
+        waitpid(pid, &status, 0);
+        if (not WIFEXITED(status) or WEXITSTATUS(status)!=0) {
+            printf("// pass %d fails in the second process (status %d)\n", pass, status);
+            count++;
+        }
+
+        if (not sharedSegmentExists(key)) {
+            printf("// pass %d removes the segment while it is attached\n", pass);
+            count++;
+        }
+
+        shared->Detach(key);
+
+        if (sharedSegmentExists(key)) {
+            printf("// pass %d does not unlink the segment\n", pass);
+            count++;
+        }
+    }
+
+    delete A;
+    delete V;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Multiplies two random matrices and matches the product to MKL's. Wide
+// products with short rows go through the hashed row accumulator, narrow
+// ones through the dense one. With BENCHMARKING, prints the time of both.
+int checkGemm( char const * msg, int m, int k, int n, int maxRowNnz, int numThreads ) {
+
+    printf("- %s (%dx%d * %dx%d, threads=%d)\n", msg, m, k, k, n, numThreads);
+
+    unsigned int seed = 7;
+    OpenSubdiv::CpuCsrMatrix * A = randomMatrix(m, k, maxRowNnz, seed),
+                             * B = randomMatrix(k, n, maxRowNnz, seed);
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(numThreads);
+#endif
+
+    Stopwatch s;
+    s.Start();
+    OpenSubdiv::CpuCsrMatrix * C = A->gemm(B);
+    s.Stop();
+    double gemmTime = s.GetElapsed();
+
+    // two passes : the row offsets, then the columns and values
+    char trans = 'N';
+    int request = 1, sort = 0, nzmax = 0, info = 0;
+    OpenSubdiv::CpuCsrMatrix * R = new OpenSubdiv::CpuCsrMatrix(m, n, 1);
+    s.Start();
+    mkl_scsrmultcsr(&trans, &request, &sort, &m, &k, &n, A->vals, A->cols, A->rows,
+                    B->vals, B->cols, B->rows, R->vals, R->cols, R->rows, &nzmax, &info);
+    R->nnz = R->rows[m]-1;
+    R->cols = (int*) realloc(R->cols, std::max(R->nnz, 1) * sizeof(int));
+    R->vals = (float*) realloc(R->vals, std::max(R->nnz, 1) * sizeof(float));
+    request = 2;
+    nzmax = R->nnz;
+    mkl_scsrmultcsr(&trans, &request, &sort, &m, &k, &n, A->vals, A->cols, A->rows,
+                    B->vals, B->cols, B->rows, R->vals, R->cols, R->rows, &nzmax, &info);
+    s.Stop();
+    double mklTime = s.GetElapsed();
+
+#ifdef OPENSUBDIV_HAS_OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+#if BENCHMARKING
+    printf("  gemm %.3f ms, mkl_scsrmultcsr %.3f ms\n", gemmTime*1000.0, mklTime*1000.0);
+#else
+    (void) gemmTime;
+    (void) mklTime;
+#endif
+
+    int count = 0;
+    if (info!=0) {
+        printf("// mkl_scsrmultcsr fails : info=%d\n", info);
+        count++;
+    } else {
+        if (C->nnz!=R->nnz) {
+            printf("// product has %d nonzeroes instead of %d\n", C->nnz, R->nnz);
+            count++;
+        }
+        count += compareMatrices("product", R, C);
+    }
+
+    delete A;
+    delete B;
+    delete C;
+    delete R;
+
+    if (count==0)
+        printf("  success !\n");
+
+    return count;
+}
+#endif
+
+//------------------------------------------------------------------------------
+int main(int argc, char ** argv) {
+
+    // Make sure we have an OpenGL context.
+    glutInit(&argc, argv);
+    glutCreateWindow("osd_regression");
+    glewInit();
+
+    int levels=5, total=0;
+
+    // Register Osd compute kernels
+    OpenSubdiv::OsdCpuKernelDispatcher::Register();
+#ifdef OPENSUBDIV_HAS_MKL
+    OpenSubdiv::OsdMklKernelDispatcher::Register();
+#endif
+
+#define test_catmark_edgeonly
+#define test_catmark_edgecorner
+#define test_catmark_pyramid
+#define test_catmark_pyramid_creases0
+#define test_catmark_pyramid_creases1
+#define test_catmark_cube
+#define test_catmark_cube_creases0
+#define test_catmark_cube_creases1
+#define test_catmark_cube_corner0
+#define test_catmark_cube_corner1
+#define test_catmark_cube_corner2
+#define test_catmark_cube_corner3
+#define test_catmark_cube_corner4
+#define test_catmark_dart_edgeonly
+#define test_catmark_dart_edgecorner
+#define test_catmark_tent
+#define test_catmark_tent_creases0
+#define test_catmark_tent_creases1
+#define test_catmark_square_hedit0
+#define test_catmark_square_hedit1
+#define test_catmark_square_hedit2
+#define test_catmark_square_hedit3
+
+#define test_loop_triangle_edgeonly
+#define test_loop_triangle_edgecorner
+#define test_loop_icosahedron
+#define test_loop_cube
+#define test_loop_cube_creases0
+#define test_loop_cube_creases1
+
+#define test_bilinear_cube
+
+    printf("precision : %f\n",PRECISION);
+
+#ifdef test_catmark_edgeonly
+#include "../shapes/catmark_edgeonly.h"
+    total += checkMesh( "test_catmark_edgeonly", catmark_edgeonly, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_edgecorner
+#include "../shapes/catmark_edgecorner.h"
+    total += checkMesh( "test_catmark_edgeonly", catmark_edgecorner, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_pyramid
+#include "../shapes/catmark_pyramid.h"
+    total += checkMesh( "test_catmark_pyramid", catmark_pyramid, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_pyramid_creases0
+#include "../shapes/catmark_pyramid_creases0.h"
+    total += checkMesh( "test_catmark_pyramid_creases0", catmark_pyramid_creases0, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_pyramid_creases1
+#include "../shapes/catmark_pyramid_creases1.h"
+    total += checkMesh( "test_catmark_pyramid_creases1", catmark_pyramid_creases1, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube
+#include "../shapes/catmark_cube.h"
+    total += checkMesh( "test_catmark_cube", catmark_cube, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_creases0
+#include "../shapes/catmark_cube_creases0.h"
+    total += checkMesh( "test_catmark_cube_creases0", catmark_cube_creases0, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_creases1
+#include "../shapes/catmark_cube_creases1.h"
+    total += checkMesh( "test_catmark_cube_creases1", catmark_cube_creases1, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_corner0
+#include "../shapes/catmark_cube_corner0.h"
+    total += checkMesh( "test_catmark_cube_corner0", catmark_cube_corner0, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_corner1
+#include "../shapes/catmark_cube_corner1.h"
+    total += checkMesh( "test_catmark_cube_corner1", catmark_cube_corner1, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_corner2
+#include "../shapes/catmark_cube_corner2.h"
+    total += checkMesh( "test_catmark_cube_corner2", catmark_cube_corner2, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_corner3
+#include "../shapes/catmark_cube_corner3.h"
+    total += checkMesh( "test_catmark_cube_corner3", catmark_cube_corner3, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_cube_corner4
+#include "../shapes/catmark_cube_corner4.h"
+    total += checkMesh( "test_catmark_cube_corner4", catmark_cube_corner4, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_dart_edgecorner
+#include "../shapes/catmark_dart_edgecorner.h"
+    total += checkMesh( "test_catmark_dart_edgecorner", catmark_dart_edgecorner, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_dart_edgeonly
+#include "../shapes/catmark_dart_edgeonly.h"
+    total += checkMesh( "test_catmark_dart_edgeonly", catmark_dart_edgeonly, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_tent
+#include "../shapes/catmark_tent.h"
+    total += checkMesh( "test_catmark_tent", catmark_tent, levels, kCatmark );
+#endif
+
+#ifdef test_catmark_tent_creases0
+#include "../shapes/catmark_tent_creases0.h"
+    total += checkMesh( "test_catmark_tent_creases0", catmark_tent_creases0, levels );
+#endif
+
+#ifdef test_catmark_tent_creases1
+#include "../shapes/catmark_tent_creases1.h"
+    total += checkMesh( "test_catmark_tent_creases1", catmark_tent_creases1, levels );
+#endif
+
+#ifdef test_catmark_square_hedit0
+#include "../shapes/catmark_square_hedit0.h"
+    total += checkMesh( "test_catmark_square_hedit0", catmark_square_hedit0, levels );
+#endif
+
+#ifdef test_catmark_square_hedit1
+#include "../shapes/catmark_square_hedit1.h"
+    total += checkMesh( "test_catmark_square_hedit1", catmark_square_hedit1, levels );
+#endif
+
+#ifdef test_catmark_square_hedit2
+#include "../shapes/catmark_square_hedit2.h"
+    total += checkMesh( "test_catmark_square_hedit2", catmark_square_hedit2, levels );
+#endif
+
+#ifdef test_catmark_square_hedit3
+#include "../shapes/catmark_square_hedit3.h"
+    total += checkMesh( "test_catmark_square_hedit3", catmark_square_hedit3, levels );
+#endif
+
+
+#ifdef test_loop_triangle_edgeonly
+#include "../shapes/loop_triangle_edgeonly.h"
+    total += checkMesh( "test_loop_triangle_edgeonly", loop_triangle_edgeonly, levels, kLoop );
+#endif
+
+#ifdef test_loop_triangle_edgecorner
+#include "../shapes/loop_triangle_edgecorner.h"
+    total += checkMesh( "test_loop_triangle_edgecorner", loop_triangle_edgecorner, levels, kLoop );
+#endif
+
+#ifdef test_loop_saddle_edgeonly
+#include "../shapes/loop_saddle_edgeonly.h"
+    total += checkMesh( "test_loop_saddle_edgeonly", loop_saddle_edgeonly, levels, kLoop );
+#endif
+
+#ifdef test_loop_saddle_edgecorner
+#include "../shapes/loop_saddle_edgecorner.h"
+    total += checkMesh( "test_loop_saddle_edgecorner", loop_saddle_edgecorner, levels, kLoop );
+#endif
+
+#ifdef test_loop_icosahedron
+#include "../shapes/loop_icosahedron.h"
+    total += checkMesh( "test_loop_icosahedron", loop_icosahedron, levels, kLoop );
+#endif
+
+#ifdef test_loop_cube
+#include "../shapes/loop_cube.h"
+    total += checkMesh( "test_loop_cube", loop_cube, levels, kLoop );
+#endif
+
+#ifdef test_loop_cube_creases0
+#include "../shapes/loop_cube_creases0.h"
+    total += checkMesh( "test_loop_cube_creases0", loop_cube_creases0,levels, kLoop );
+#endif
+
+#ifdef test_loop_cube_creases1
+#include "../shapes/loop_cube_creases1.h"
+    total += checkMesh( "test_loop_cube_creases1", loop_cube_creases1, levels, kLoop );
+#endif
+
+
+
+#ifdef test_bilinear_cube
+#include "../shapes/bilinear_cube.h"
+    total += checkMesh( "test_bilinear_cube", bilinear_cube, levels, kBilinear );
+#endif
+
+#ifdef OPENSUBDIV_HAS_MKL
+    // the matrix kernels cache the operators of the levels they switch between
+    total += checkSetLevel( "test_setlevel_catmark_dart_edgecorner", catmark_dart_edgecorner, 0, kCatmark );
+    total += checkSetLevel( "test_setlevel_catmark_cube_creases0", catmark_cube_creases0, 1<<1, kCatmark );
+    total += checkSetLevel( "test_setlevel_loop_cube_creases1", loop_cube_creases1, 1<<1, kLoop );
+
+    // the matrix kernels stack the output levels, contiguous or not
+    total += checkOutputLevels( "test_outputlevels_catmark_cube_creases0", catmark_cube_creases0, 4, (1<<1)|(1<<2) );
+    total += checkOutputLevels( "test_outputlevels_catmark_dart_edgecorner", catmark_dart_edgecorner, 4, 1<<1 );
+    total += checkOutputLevels( "test_outputlevels_loop_cube_creases1", loop_cube_creases1, 4, (1<<1)|(1<<3), kLoop );
+    total += checkOutputVarying( "test_outputvarying_catmark_cube_creases0", catmark_cube_creases0, 4, (1<<1)|(1<<2) );
+    total += checkOutputVarying( "test_outputvarying_catmark_dart_edgecorner", catmark_dart_edgecorner, 3, 1<<1 );
+    total += checkOutputVarying( "test_outputvarying_loop_cube_creases1", loop_cube_creases1, 4, (1<<1)|(1<<3), kLoop );
+
+    // the host matrix kernels match the kMKL product
+    total += checkKernel( "test_hybrid_catmark_dart_edgecorner", catmark_dart_edgecorner, 4,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kHCPU );
+    total += checkKernel( "test_hybrid_catmark_cube_creases1", catmark_cube_creases1, 4,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kHCPU );
+    total += checkKernel( "test_hybrid_loop_cube_creases0", loop_cube_creases0, 3,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kHCPU, kLoop );
+    total += checkKernel( "test_panel_catmark_dart_edgecorner", catmark_dart_edgecorner, 4,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kPCPU );
+    total += checkKernel( "test_panel_catmark_cube_creases1", catmark_cube_creases1, 4,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kPCPU );
+    total += checkKernel( "test_panel_loop_cube_creases0", loop_cube_creases0, 3,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kPCPU, kLoop );
+    total += checkKernel( "test_wide_catmark_cube_creases1", catmark_cube_creases1, 3,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kMKL64 );
+    total += checkKernel( "test_wide_loop_cube_creases0", loop_cube_creases0, 3,
+                          (int)OpenSubdiv::OsdKernelDispatcher::kMKL64, kLoop );
+
+    // Catmark levels staged as a single matrix match the two stage ones, on
+    // creases, darts, corners and boundaries
+    total += checkSingleStage( "test_singlestage_catmark_cube_creases1", catmark_cube_creases1, 3 );
+    total += checkSingleStage( "test_singlestage_catmark_dart_edgecorner", catmark_dart_edgecorner, 3 );
+    total += checkSingleStage( "test_singlestage_catmark_tent_creases1", catmark_tent_creases1, 3 );
+    total += checkSingleStage( "test_singlestage_catmark_cube_corner4", catmark_cube_corner4, 3 );
+    total += checkSingleStage( "test_singlestage_catmark_edgeonly", catmark_edgeonly, 3 );
+
+    // truncated matrices stay within the error bound, and their rows sum to one
+    total += checkApproximation( "test_approximation_catmark_cube_creases1", catmark_cube_creases1, 4, 1e-3f );
+    total += checkApproximation( "test_approximation_catmark_cube_creases1", catmark_cube_creases1, 4, 1e-2f );
+    total += checkApproximation( "test_approximation_catmark_dart_edgecorner", catmark_dart_edgecorner, 3, 1e-2f );
+    total += checkApproximation( "test_approximation_loop_cube_creases0", loop_cube_creases0, 3, 1e-2f, kLoop );
+
+    // frames refined during and after a background build match the table kernel
+    total += checkBackgroundBuild( "test_backgroundbuild_catmark_cube_creases1", catmark_cube_creases1, 4 );
+    total += checkBackgroundBuild( "test_backgroundbuild_catmark_dart_edgecorner", catmark_dart_edgecorner, 3 );
+    total += checkBackgroundBuild( "test_backgroundbuild_loop_cube_creases0", loop_cube_creases0, 3, kLoop );
+
+    // shared meshes share their tables and matrix, and refine their instances
+    // like separate meshes
+    total += checkSharedMesh( "test_sharedmesh_catmark_cube_creases1", catmark_cube_creases1, 3,
+                              (int)OpenSubdiv::OsdKernelDispatcher::kMKL, 1 );
+    total += checkSharedMesh( "test_sharedmesh_catmark_dart_edgecorner", catmark_dart_edgecorner, 3,
+                              (int)OpenSubdiv::OsdKernelDispatcher::kMKL, 4 );
+    total += checkSharedMesh( "test_sharedmesh_loop_cube_creases0", loop_cube_creases0, 3,
+                              (int)OpenSubdiv::OsdKernelDispatcher::kMKL, 3, kLoop );
+    total += checkSharedMesh( "test_sharedmesh_catmark_cube_creases1", catmark_cube_creases1, 3,
+                              (int)OpenSubdiv::OsdKernelDispatcher::kCPU, 2 );
+
+    // blendshapes applied in full and where their weights changed match the
+    // refinement of the blended coarse vertices
+    total += checkBlendShapes( "test_blendshapes_catmark_cube_creases1", catmark_cube_creases1, 3,
+                               (int)OpenSubdiv::OsdKernelDispatcher::kMKL );
+    total += checkBlendShapes( "test_blendshapes_catmark_dart_edgecorner", catmark_dart_edgecorner, 3,
+                               (int)OpenSubdiv::OsdKernelDispatcher::kCPU );
+    total += checkBlendShapes( "test_blendshapes_loop_cube_creases0", loop_cube_creases0, 3,
+                               (int)OpenSubdiv::OsdKernelDispatcher::kAUTO, kLoop );
+
+    // skinning with the precomputed bone contributions, or with the path the
+    // mesh picks, matches skinning the coarse vertices and subdividing them
+    total += checkSkinning( "test_skinning_catmark_cube_creases1", catmark_cube_creases1, 3,
+                            (int)OpenSubdiv::OsdKernelDispatcher::kMKL );
+    total += checkSkinning( "test_skinning_catmark_dart_edgecorner", catmark_dart_edgecorner, 3,
+                            (int)OpenSubdiv::OsdKernelDispatcher::kCPU );
+    total += checkSkinning( "test_skinning_loop_cube_creases0", loop_cube_creases0, 3,
+                            (int)OpenSubdiv::OsdKernelDispatcher::kAUTO, kLoop );
+
+    // kAUTO stays on the table kernel for a single frame, and moves to the
+    // matrix kernel when many are expected
+    total += checkAutoKernel( "test_autokernel_catmark_cube_creases1", catmark_cube_creases1, 4, 1, false );
+    total += checkAutoKernel( "test_autokernel_catmark_cube_creases1", catmark_cube_creases1, 4, 1000000, true );
+    total += checkAutoKernel( "test_autokernel_loop_cube_creases0", loop_cube_creases0, 3, 1, false, kLoop );
+    total += checkAutoKernel( "test_autokernel_loop_cube_creases0", loop_cube_creases0, 3, 1000000, true, kLoop );
+
+    // a range of the elements is refined alone, the others are left untouched
+    total += checkElementRange( "test_elementrange_catmark_cube_creases1", catmark_cube_creases1, 3, 0, 3 );
+    total += checkElementRange( "test_elementrange_catmark_dart_edgecorner", catmark_dart_edgecorner, 3, 2, 3 );
+    total += checkElementRange( "test_elementrange_loop_cube_creases0", loop_cube_creases0, 3, 5, 1, kLoop );
+
+    // the matrix chain is reduced as a tree, on one thread and on teams
+    total += checkComposeChain( "test_composechain", 1 );
+    total += checkComposeChain( "test_composechain", 4 );
+    total += checkComposeChain( "test_composechain", 7 );
+
+    // stages with implicit copy rows multiply like the explicit matrices
+    total += checkStageProducts( "test_stageproducts", 1 );
+    total += checkStageProducts( "test_stageproducts", 4 );
+
+    // the sparse product matches MKL's, on the dense and hashed accumulators
+    total += checkGemm( "test_gemm_dense", 3000, 800, 1200, 6, 1 );
+    total += checkGemm( "test_gemm_dense", 3000, 800, 1200, 6, 4 );
+    total += checkGemm( "test_gemm_hashed", 2000, 1500, 100000, 4, 1 );
+    total += checkGemm( "test_gemm_hashed", 2000, 1500, 100000, 4, 4 );
+
+#ifndef _WIN32
+    // the matrix streamed from an operator file matches the one in memory
+    total += checkStreamOperators( "test_streamoperators_catmark_cube_creases1", catmark_cube_creases1, 4 );
+    total += checkStreamOperators( "test_streamoperators_loop_cube_creases0", loop_cube_creases0, 3, kLoop );
+
+    // published matrices are attached from another process, and removed
+    // with the last reference
+    total += checkSharedOperators( "test_sharedoperators" );
+#endif
 #endif
 
     if (total==0)